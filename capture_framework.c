@@ -34,6 +34,9 @@
 #include <sys/wait.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <sys/time.h>
+
+#include <zlib.h>
 
 #ifdef HAVE_CAPABILITY
 #include <sys/capability.h>
@@ -321,6 +324,8 @@ size_t cf_append_unique_chans(char **in_list1, size_t in_list1_sz,
     return offt;
 }
 
+static void cf_mux_free_streams(kis_capture_handler_t *caph);
+
 kis_capture_handler_t *cf_handler_init(const char *in_type) {
     kis_capture_handler_t *ch;
     pthread_mutexattr_t mutexattr;
@@ -343,6 +348,12 @@ kis_capture_handler_t *cf_handler_init(const char *in_type) {
     ch->reverse_server = 0;
 
     ch->cli_sourcedef = NULL;
+    ch->cli_sourcedef_list = NULL;
+    ch->cli_sourcedef_list_sz = 0;
+
+    ch->mux_streams = NULL;
+    ch->mux_streams_sz = 0;
+    ch->mux_buf = NULL;
 
     ch->in_fd = -1;
     ch->out_fd = -1;
@@ -371,8 +382,9 @@ kis_capture_handler_t *cf_handler_init(const char *in_type) {
     }
 
     /* Allocate a much more generous outbound buffer since this is where 
-     * packets get queued */
+     * packets get queued; --lockfree-output replaces it with a spsc buffer */
     ch->out_ringbuf = kis_simple_ringbuf_create(1024 * 256);
+    ch->out_spsc = 0;
 
     if (ch->out_ringbuf == NULL) {
         kis_simple_ringbuf_free(ch->in_ringbuf);
@@ -403,6 +415,10 @@ kis_capture_handler_t *cf_handler_init(const char *in_type) {
 
     ch->spectrumconfig_cb = NULL;
 
+    ch->filter_cb = NULL;
+
+    ch->truncate_data = 0;
+
     ch->capture_cb = NULL;
 
     ch->userdata = NULL;
@@ -413,12 +429,25 @@ kis_capture_handler_t *cf_handler_init(const char *in_type) {
     ch->channel = NULL;
     ch->channel_hop_list = NULL;
     ch->custom_channel_hop_list = NULL;
+    ch->channel_hop_dwell = NULL;
     ch->channel_hop_list_sz = 0;
     ch->channel_hop_shuffle = 0;
     ch->channel_hop_shuffle_spacing = 1;
     ch->channel_hop_failure_list = NULL;
     ch->channel_hop_failure_list_sz = 0;
 
+    ch->transport_offer = 1;
+    ch->transport_compress = 0;
+    ch->transport_level = 1;
+    ch->transport_block_max = 0;
+    ch->transport_flush_ms = 0;
+    ch->transport_pending_ts.tv_sec = 0;
+    ch->transport_pending_ts.tv_usec = 0;
+    ch->transport_raw = NULL;
+    ch->transport_block = NULL;
+    ch->transport_block_len = 0;
+    ch->transport_block_pos = 0;
+
     return ch;
 }
 
@@ -450,6 +479,14 @@ void cf_handler_free(kis_capture_handler_t *caph) {
     if (caph->cli_sourcedef)
         free(caph->cli_sourcedef);
 
+    for (szi = 0; szi < caph->cli_sourcedef_list_sz; szi++)
+        free(caph->cli_sourcedef_list[szi]);
+
+    if (caph->cli_sourcedef_list != NULL)
+        free(caph->cli_sourcedef_list);
+
+    cf_mux_free_streams(caph);
+
     if (caph->tcp_fd >= 0)
         close(caph->tcp_fd);
 
@@ -459,6 +496,12 @@ void cf_handler_free(kis_capture_handler_t *caph) {
     if (caph->out_ringbuf != NULL)
         kis_simple_ringbuf_free(caph->out_ringbuf);
 
+    if (caph->transport_raw != NULL)
+        free(caph->transport_raw);
+
+    if (caph->transport_block != NULL)
+        free(caph->transport_block);
+
     for (szi = 0; szi < caph->channel_hop_list_sz; szi++) {
         if (caph->channel_hop_list[szi] != NULL)
             free(caph->channel_hop_list[szi]);
@@ -476,6 +519,9 @@ void cf_handler_free(kis_capture_handler_t *caph) {
     if (caph->custom_channel_hop_list != NULL)
         free(caph->custom_channel_hop_list);
 
+    if (caph->channel_hop_dwell != NULL)
+        free(caph->channel_hop_dwell);
+
     if (caph->capture_running) {
         pthread_cancel(caph->capturethread);
         caph->capture_running = 0;
@@ -487,6 +533,8 @@ void cf_handler_free(kis_capture_handler_t *caph) {
     }
 
     pthread_mutex_destroy(&(caph->out_ringbuf_lock));
+    pthread_cond_destroy(&(caph->out_ringbuf_flush_cond));
+    pthread_mutex_destroy(&(caph->out_ringbuf_flush_cond_mutex));
     pthread_mutex_destroy(&(caph->handler_lock));
 }
 
@@ -555,6 +603,13 @@ void cf_handler_spindown(kis_capture_handler_t *caph) {
 void cf_handler_assign_hop_channels(kis_capture_handler_t *caph, char **stringchans,
         void **privchans, size_t chan_sz, double rate, int shuffle, int shuffle_spacing, 
         int offset) {
+    cf_handler_assign_hop_channels_dwell(caph, stringchans, privchans, NULL, chan_sz,
+            rate, shuffle, shuffle_spacing, offset);
+}
+
+void cf_handler_assign_hop_channels_dwell(kis_capture_handler_t *caph, char **stringchans,
+        void **privchans, double *dwell, size_t chan_sz, double rate, int shuffle, 
+        int shuffle_spacing, int offset) {
     size_t szi;
 
     /*
@@ -582,9 +637,12 @@ void cf_handler_assign_hop_channels(kis_capture_handler_t *caph, char **stringch
         free(caph->channel_hop_list);
     if (caph->custom_channel_hop_list)
         free(caph->custom_channel_hop_list);
+    if (caph->channel_hop_dwell)
+        free(caph->channel_hop_dwell);
 
     caph->channel_hop_list = stringchans;
     caph->custom_channel_hop_list = privchans;
+    caph->channel_hop_dwell = dwell;
     caph->channel_hop_list_sz = chan_sz;
 
     if (caph->max_channel_hop_rate != 0 && rate < caph->max_channel_hop_rate)
@@ -727,6 +785,8 @@ int cf_handler_parse_opts(kis_capture_handler_t *caph, int argc, char *argv[]) {
         { "fixed-gps", required_argument, 0, 8},
         { "gps-name", required_argument, 0, 9},
         { "host", required_argument, 0, 10},
+        { "disable-compression", no_argument, 0, 11},
+        { "lockfree-output", no_argument, 0, 12},
         { "help", no_argument, 0, 'h'},
         { 0, 0, 0, 0 }
     };
@@ -762,7 +822,21 @@ int cf_handler_parse_opts(kis_capture_handler_t *caph, int argc, char *argv[]) {
             caph->remote_host = strdup(parse_hname);
             caph->remote_port = parse_port;
         } else if (r == 4) {
-            caph->cli_sourcedef = strdup(optarg);
+            char **sourcedef_list;
+
+            sourcedef_list = (char **) realloc(caph->cli_sourcedef_list, 
+                    sizeof(char *) * (caph->cli_sourcedef_list_sz + 1));
+
+            if (sourcedef_list == NULL) {
+                fprintf(stderr, "FATAL: Unable to allocate source list\n");
+                return -1;
+            }
+
+            caph->cli_sourcedef_list = sourcedef_list;
+            caph->cli_sourcedef_list[caph->cli_sourcedef_list_sz++] = strdup(optarg);
+
+            if (caph->cli_sourcedef == NULL)
+                caph->cli_sourcedef = strdup(optarg);
         } else if (r == 5) {
             fprintf(stderr, "INFO: Disabling automatic reconnection to remote servers\n");
             retry = 0;
@@ -786,6 +860,22 @@ int cf_handler_parse_opts(kis_capture_handler_t *caph, int argc, char *argv[]) {
             caph->remote_host = strdup(parse_hname);
             caph->remote_port = parse_port;
             caph->reverse_server = 1;
+        } else if (r == 11) {
+            caph->transport_offer = 0;
+        } else if (r == 12) {
+            if (!caph->out_spsc) {
+                kis_simple_ringbuf_t *spsc_ringbuf = 
+                    kis_simple_ringbuf_create_spsc(kis_simple_ringbuf_size(caph->out_ringbuf));
+
+                if (spsc_ringbuf == NULL) {
+                    fprintf(stderr, "FATAL: Unable to allocate lock-free write buffer\n");
+                    return -1;
+                }
+
+                kis_simple_ringbuf_free(caph->out_ringbuf);
+                caph->out_ringbuf = spsc_ringbuf;
+                caph->out_spsc = 1;
+            }
         }
     }
 
@@ -824,6 +914,13 @@ int cf_handler_parse_opts(kis_capture_handler_t *caph, int argc, char *argv[]) {
             return -1;
         }
 
+        /* Multiple sources share the connection we make */
+        if (caph->cli_sourcedef_list_sz > 1 && caph->reverse_server) {
+            fprintf(stderr,
+                    "FATAL: Multiple --source options are only supported with --connect\n");
+            return -1;
+        }
+
         /* Set retry only when we have a remote host */
         caph->remote_retry = retry;
 
@@ -858,12 +955,20 @@ void cf_print_help(kis_capture_handler_t *caph, const char *argv0) {
                 "                             port for each source you define.\n"
                 " --source [source def]       Specify a source to send to the remote \n"
                 "                             Kismet server; only used in conjunction with \n"
-                "                             remote capture.\n"
+                "                             remote capture.  With --connect, --source may\n"
+                "                             be given more than once to send several \n"
+                "                             sources over one connection.\n"
                 " --disable-retry             Do not attempt to reconnect to a remote server\n"
                 "                             if there is an error; exit immediately\n"
                 " --fixed-gps [lat,lon,alt]   Set a fixed location for this capture (remote only),\n"
                 "                             accepts lat,lon,alt or lat,lon\n"
                 " --gps-name [name]           Set an alternate GPS name for this source\n"
+                " --disable-compression       Do not offer to send compressed blocks of \n"
+                "                             packets to the remote Kismet server\n"
+                " --lockfree-output           Queue data to the Kismet server in a lock-free\n"
+                "                             buffer; lowers latency and helps batched\n"
+                "                             sources, but is slower for sources which send\n"
+                "                             one packet at a time\n"
                 " --daemonize                 Background the capture tool and enter daemon\n"
                 "                             mode.\n"
                 " --list                      List supported devices detected\n",
@@ -912,6 +1017,12 @@ void cf_handler_set_spectrumconfig_cb(kis_capture_handler_t *capf,
     pthread_mutex_unlock(&(capf->handler_lock));
 }
 
+void cf_handler_set_filter_cb(kis_capture_handler_t *capf, cf_callback_filter cb) {
+    pthread_mutex_lock(&(capf->handler_lock));
+    capf->filter_cb = cb;
+    pthread_mutex_unlock(&(capf->handler_lock));
+}
+
 void cf_handler_set_unknown_cb(kis_capture_handler_t *capf, cf_callback_unknown cb) {
     pthread_mutex_lock(&(capf->handler_lock));
     capf->unknown_cb = cb;
@@ -990,12 +1101,248 @@ int cf_handler_launch_capture_thread(kis_capture_handler_t *caph) {
     return 1;
 }
 
-void cf_handler_wait_ringbuffer(kis_capture_handler_t *caph) {
-    pthread_cond_wait(&(caph->out_ringbuf_flush_cond),
-            &(caph->out_ringbuf_flush_cond_mutex));
+/* Wait up to 100ms for size bytes to be free in the write buffer */
+static void cf_wait_out_space(kis_capture_handler_t *caph, size_t size) {
+    struct timeval now;
+    struct timespec deadline;
+
+    if (caph->out_spsc) {
+        kis_simple_ringbuf_wait_space(caph->out_ringbuf, size, 100);
+        return;
+    }
+
+    gettimeofday(&now, NULL);
+    deadline.tv_sec = now.tv_sec;
+    deadline.tv_nsec = (now.tv_usec + 100000) * 1000;
+
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&(caph->out_ringbuf_flush_cond_mutex));
+
+    pthread_mutex_lock(&(caph->out_ringbuf_lock));
+    if (kis_simple_ringbuf_available(caph->out_ringbuf) >= size) {
+        pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+        pthread_mutex_unlock(&(caph->out_ringbuf_flush_cond_mutex));
+        return;
+    }
+    pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+
+    pthread_cond_timedwait(&(caph->out_ringbuf_flush_cond),
+            &(caph->out_ringbuf_flush_cond_mutex), &deadline);
+    pthread_mutex_unlock(&(caph->out_ringbuf_flush_cond_mutex));
+}
+
+/* Signal to any waiting IO that the write buffer has some headroom; spsc buffers
+ * wake waiting writers themselves */
+static void cf_signal_out_space(kis_capture_handler_t *caph) {
+    if (caph->out_spsc)
+        return;
+
+    pthread_mutex_lock(&(caph->out_ringbuf_flush_cond_mutex));
+    pthread_cond_broadcast(&(caph->out_ringbuf_flush_cond));
     pthread_mutex_unlock(&(caph->out_ringbuf_flush_cond_mutex));
 }
 
+void cf_handler_wait_ringbuffer(kis_capture_handler_t *caph) {
+    cf_wait_out_space(caph, kis_simple_ringbuf_size(caph->out_ringbuf) / 2);
+}
+
+/* Return to sending plain frames, such as when a new connection is made */
+static void cf_transport_reset(kis_capture_handler_t *caph) {
+    pthread_mutex_lock(&(caph->out_ringbuf_lock));
+    caph->transport_compress = 0;
+    caph->transport_block_len = 0;
+    caph->transport_block_pos = 0;
+    caph->transport_pending_ts.tv_sec = 0;
+    caph->transport_pending_ts.tv_usec = 0;
+    pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+}
+
+/* Start sending compressed blocks with the parameters from the server */
+static int cf_transport_enable(kis_capture_handler_t *caph, 
+        KismetDatasource__Transport *transport) {
+    size_t rb_sz = kis_simple_ringbuf_size(caph->out_ringbuf);
+
+    if (!caph->transport_offer || strcasecmp(transport->compression, "zlib") != 0)
+        return 0;
+
+    pthread_mutex_lock(&(caph->out_ringbuf_lock));
+
+    /* Blocks are assembled from the write buffer, so they can never be larger than it,
+     * but may hold one frame which is larger than the block size */
+    if (caph->transport_raw == NULL)
+        caph->transport_raw = (uint8_t *) malloc(rb_sz);
+
+    if (caph->transport_block == NULL)
+        caph->transport_block = 
+            (uint8_t *) malloc(sizeof(kismet_external_block_t) + compressBound(rb_sz));
+
+    if (caph->transport_raw == NULL || caph->transport_block == NULL) {
+        pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+        return -1;
+    }
+
+    caph->transport_block_max = 64 * 1024;
+    caph->transport_flush_ms = 100;
+    caph->transport_level = 1;
+
+    if (transport->has_block_size && transport->block_size >= 1024)
+        caph->transport_block_max = transport->block_size;
+
+    if (caph->transport_block_max > rb_sz / 2)
+        caph->transport_block_max = rb_sz / 2;
+
+    if (transport->has_flush_ms)
+        caph->transport_flush_ms = transport->flush_ms;
+
+    if (transport->has_level && transport->level >= 1 && transport->level <= 9)
+        caph->transport_level = transport->level;
+
+    caph->transport_compress = 1;
+    caph->transport_block_len = 0;
+    caph->transport_block_pos = 0;
+
+    if (kis_simple_ringbuf_used(caph->out_ringbuf) != 0)
+        gettimeofday(&(caph->transport_pending_ts), NULL);
+
+    pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+
+    return 1;
+}
+
+/* Remember when the oldest frame was queued; must be called with the write buffer 
+ * locked, before the frame is written */
+static void cf_transport_mark_pending(kis_capture_handler_t *caph) {
+    if (caph->transport_compress && kis_simple_ringbuf_used(caph->out_ringbuf) == 0)
+        gettimeofday(&(caph->transport_pending_ts), NULL);
+}
+
+/* Build the next compressed block from the write buffer, if enough data is waiting 
+ * or the oldest frame has waited long enough; otherwise shorten the select timeout
+ * in tm to the time remaining.  force sends whatever is waiting immediately.
+ *
+ * Returns:
+ * -1   Error
+ *  0   No block is ready to send
+ *  1   A block is ready to send
+ */
+static int cf_transport_build_block(kis_capture_handler_t *caph, int force, 
+        struct timeval *tm) {
+    struct timeval now;
+    kismet_external_frame_t *frame;
+    kismet_external_block_t *block;
+    size_t used, peek_sz, raw_sz, frame_sz;
+    long age_ms, wait_us;
+    uint32_t latency_us;
+    uLongf data_sz;
+
+    pthread_mutex_lock(&(caph->out_ringbuf_lock));
+
+    used = kis_simple_ringbuf_used(caph->out_ringbuf);
+
+    if (used == 0) {
+        pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+        return 0;
+    }
+
+    gettimeofday(&now, NULL);
+
+    if (caph->transport_pending_ts.tv_sec == 0)
+        caph->transport_pending_ts = now;
+
+    age_ms = (now.tv_sec - caph->transport_pending_ts.tv_sec) * 1000 +
+        (now.tv_usec - caph->transport_pending_ts.tv_usec) / 1000;
+
+    if (!force && used < caph->transport_block_max && age_ms < caph->transport_flush_ms) {
+        wait_us = (caph->transport_flush_ms - age_ms) * 1000;
+
+        if (wait_us < tm->tv_sec * 1000000 + tm->tv_usec) {
+            tm->tv_sec = wait_us / 1000000;
+            tm->tv_usec = wait_us % 1000000;
+        }
+
+        pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+        return 0;
+    }
+
+    /* Take whole frames up to the block size, and always at least one frame */
+    peek_sz = used < caph->transport_block_max ? used : caph->transport_block_max;
+
+    if (peek_sz < sizeof(kismet_external_frame_t))
+        peek_sz = used;
+
+    kis_simple_ringbuf_peek(caph->out_ringbuf, caph->transport_raw, peek_sz);
+
+    frame = (kismet_external_frame_t *) caph->transport_raw;
+    frame_sz = ntohl(frame->data_sz) + sizeof(kismet_external_frame_t);
+
+    if (frame_sz > peek_sz) {
+        if (frame_sz > used) {
+            fprintf(stderr, "FATAL: Incomplete frame in the write buffer\n");
+            pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+            return -1;
+        }
+
+        peek_sz = frame_sz;
+        kis_simple_ringbuf_peek(caph->out_ringbuf, caph->transport_raw, peek_sz);
+    }
+
+    raw_sz = 0;
+
+    while (peek_sz - raw_sz >= sizeof(kismet_external_frame_t)) {
+        frame = (kismet_external_frame_t *) (caph->transport_raw + raw_sz);
+        frame_sz = ntohl(frame->data_sz) + sizeof(kismet_external_frame_t);
+
+        if (raw_sz + frame_sz > peek_sz)
+            break;
+
+        raw_sz += frame_sz;
+    }
+
+    kis_simple_ringbuf_read(caph->out_ringbuf, NULL, raw_sz);
+
+    latency_us = (now.tv_sec - caph->transport_pending_ts.tv_sec) * 1000000 +
+        (now.tv_usec - caph->transport_pending_ts.tv_usec);
+
+    /* Whatever is left has been waiting at most since now */
+    if (kis_simple_ringbuf_used(caph->out_ringbuf) != 0) {
+        caph->transport_pending_ts = now;
+    } else {
+        caph->transport_pending_ts.tv_sec = 0;
+        caph->transport_pending_ts.tv_usec = 0;
+    }
+
+    pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+
+    /* The frames are out of the write buffer; let any waiting capture continue while
+     * we compress */
+    cf_signal_out_space(caph);
+
+    block = (kismet_external_block_t *) caph->transport_block;
+
+    data_sz = compressBound(raw_sz);
+
+    if (compress2(block->data, &data_sz, caph->transport_raw, raw_sz, 
+                caph->transport_level) != Z_OK) {
+        fprintf(stderr, "FATAL: Unable to compress block\n");
+        return -1;
+    }
+
+    block->signature = htonl(KIS_EXTERNAL_BLOCK_SIG);
+    block->data_sz = htonl(data_sz);
+    block->raw_sz = htonl(raw_sz);
+    block->latency_us = htonl(latency_us);
+    block->data_checksum = htonl(adler32_csum(block->data, data_sz));
+
+    caph->transport_block_len = sizeof(kismet_external_block_t) + data_sz;
+    caph->transport_block_pos = 0;
+
+    return 1;
+}
+
 /* Internal capture thread which drives channel hopping
  */
 void *cf_int_chanhop_thread(void *arg) {
@@ -1011,6 +1358,11 @@ void *cf_int_chanhop_thread(void *arg) {
     unsigned int wait_sec = 0;
     unsigned int wait_usec = 0;
 
+    /* Dwell multiplier of the current channel, and the last hop step */
+    double dwell;
+    size_t hopstep = 0;
+    int hopped = 0;
+
     char errstr[STATUS_MAX];
     
     int r = 0;
@@ -1033,7 +1385,15 @@ void *cf_int_chanhop_thread(void *arg) {
             return NULL;
         }
        
-        wait_usec = 1000000L / caph->channel_hop_rate;
+        /* Hold the current channel for its share of the hop cycle; the sleep happens
+         * after tuning, so this is the dwell of the channel we tuned last */
+        dwell = 1.0;
+        if (caph->channel_hop_dwell != NULL && caph->channel_hop_list_sz != 0 &&
+                hopped)
+            dwell = caph->channel_hop_dwell[(hoppos - hopstep) % caph->channel_hop_list_sz];
+
+        wait_sec = 0;
+        wait_usec = (1000000L * dwell) / caph->channel_hop_rate;
 
         if (wait_usec < 50000) {
             wait_sec = 0;
@@ -1096,9 +1456,12 @@ void *cf_int_chanhop_thread(void *arg) {
 
         /* Increment by the shuffle amount */
         if (caph->channel_hop_shuffle)
-            hoppos += caph->channel_hop_shuffle_spacing;
+            hopstep = caph->channel_hop_shuffle_spacing;
         else
-            hoppos++;
+            hopstep = 1;
+
+        hoppos += hopstep;
+        hopped = 1;
 
         /* If we've gotten back to 0, look at the failed channel list.  This is super
          * inefficient because it has to do multiple crawls of a linked list, but
@@ -1107,6 +1470,7 @@ void *cf_int_chanhop_thread(void *arg) {
                 caph->channel_hop_failure_list_sz != 0) {
             char **channel_hop_list_new;
             void **custom_channel_hop_list_new;
+            double *channel_hop_dwell_new;
             size_t new_sz;
             size_t i, ni;
             struct cf_channel_error *err, *errnext;
@@ -1144,6 +1508,11 @@ void *cf_int_chanhop_thread(void *arg) {
             channel_hop_list_new = (char **) malloc(sizeof(char *) * new_sz);
             custom_channel_hop_list_new = (void **) malloc(sizeof(void *) * new_sz);
 
+            if (caph->channel_hop_dwell != NULL)
+                channel_hop_dwell_new = (double *) malloc(sizeof(double) * new_sz);
+            else
+                channel_hop_dwell_new = NULL;
+
             // fprintf(stderr, "debug - allocating new channel list %lu\n", new_sz);
 
             for (i = 0, ni = 0; i < caph->channel_hop_list_sz && ni < new_sz; i++) {
@@ -1171,6 +1540,8 @@ void *cf_int_chanhop_thread(void *arg) {
                 /* Otherwise move the pointer to our new list */
                 channel_hop_list_new[ni] = caph->channel_hop_list[i];
                 custom_channel_hop_list_new[ni] = caph->custom_channel_hop_list[i];
+                if (channel_hop_dwell_new != NULL)
+                    channel_hop_dwell_new[ni] = caph->channel_hop_dwell[i];
                 ni++;
             }
 
@@ -1178,11 +1549,18 @@ void *cf_int_chanhop_thread(void *arg) {
             /* Remove the old lists and swap in the new ones */
             free(caph->channel_hop_list);
             free(caph->custom_channel_hop_list);
+            if (caph->channel_hop_dwell != NULL)
+                free(caph->channel_hop_dwell);
 
             caph->channel_hop_list = channel_hop_list_new;
             caph->custom_channel_hop_list = custom_channel_hop_list_new;
+            caph->channel_hop_dwell = channel_hop_dwell_new;
             caph->channel_hop_list_sz = new_sz;
 
+            /* The list was rebuilt; don't look up the dwell of a channel by its old 
+             * position */
+            hopped = 0;
+
             /* Spam a configresp which should trigger a reconfigure */
             snprintf(errstr, STATUS_MAX, "Removed %lu channels from the channel list "
                     "because the source could not tune to them", 
@@ -1233,117 +1611,467 @@ int cf_handler_launch_hopping_thread(kis_capture_handler_t *caph) {
     return 1;
 }
 
-int cf_handle_rx_data(kis_capture_handler_t *caph) {
-    size_t rb_available;
+/* Frames from Kismet waiting to be written to each multiplexed source */
+#define CF_MUX_TX_BUF_SZ        (64 * 1024)
 
-    kismet_external_frame_t *external_frame;
+/* Frames from a source are gathered into multiplexed frames of up to this size */
+#define CF_MUX_FRAME_MAX        (64 * 1024)
 
-    /* Buffer of entire frame, dynamic */
-    uint8_t *frame_buf;
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL            0
+#endif
 
-    /* Incoming size */
-    uint32_t packet_sz;
-    uint32_t total_sz = 0;
+static void cf_mux_free_streams(kis_capture_handler_t *caph) {
+    size_t i;
 
-    /* Incoming checksum */
-    uint32_t data_checksum;
+    for (i = 0; i < caph->mux_streams_sz; i++) {
+        if (caph->mux_streams[i].fd >= 0)
+            close(caph->mux_streams[i].fd);
 
-    /* Calculated checksum */
-    uint32_t calc_checksum;
+        if (caph->mux_streams[i].rx_ringbuf != NULL)
+            kis_simple_ringbuf_free(caph->mux_streams[i].rx_ringbuf);
 
-    /* Callback ret */
-    int cbret = -1;
+        if (caph->mux_streams[i].tx_ringbuf != NULL)
+            kis_simple_ringbuf_free(caph->mux_streams[i].tx_ringbuf);
+    }
 
-    /* Status buffer */
-    char msgstr[STATUS_MAX];
+    if (caph->mux_streams != NULL)
+        free(caph->mux_streams);
 
-    /* Kismet command */
-    KismetExternal__Command *kds_cmd;
+    if (caph->mux_buf != NULL)
+        free(caph->mux_buf);
+
+    caph->mux_streams = NULL;
+    caph->mux_streams_sz = 0;
+    caph->mux_buf = NULL;
+}
+
+/* Close the socket to a source process, which makes it shut down, and optionally 
+ * tell Kismet the source is gone */
+static void cf_mux_close_stream(kis_capture_handler_t *caph, uint32_t stream, int notify) {
+    cf_mux_stream_t *s = &(caph->mux_streams[stream]);
+    kismet_external_mux_frame_t mux_frame;
+
+    if (s->fd < 0)
+        return;
+
+    close(s->fd);
+    s->fd = -1;
+
+    if (s->pid > 0 && waitpid(s->pid, NULL, WNOHANG) == s->pid)
+        s->pid = 0;
+
+    if (!notify)
+        return;
+
+    mux_frame.signature = htonl(KIS_EXTERNAL_MUX_SIG);
+    mux_frame.stream = htonl(stream);
+    mux_frame.data_sz = 0;
+
+    if (cf_send_raw_bytes(caph, (uint8_t *) &mux_frame, sizeof(mux_frame)) < 1)
+        fprintf(stderr, "WARNING - Could not tell Kismet source %u closed\n", stream);
+}
 
+/* Close all the sources and wait for their processes to exit */
+static void cf_mux_stop_streams(kis_capture_handler_t *caph) {
     size_t i;
 
-    rb_available = kis_simple_ringbuf_used(caph->in_ringbuf);
+    for (i = 0; i < caph->mux_streams_sz; i++)
+        cf_mux_close_stream(caph, i, 0);
 
-    if (rb_available < sizeof(kismet_external_frame_t)) {
-        /* fprintf(stderr, "DEBUG - insufficient data to represent a frame\n"); */
-        return 0;
+    for (i = 0; i < caph->mux_streams_sz; i++) {
+        if (caph->mux_streams[i].pid > 0) {
+            waitpid(caph->mux_streams[i].pid, NULL, 0);
+            caph->mux_streams[i].pid = 0;
+        }
     }
+}
 
-    if (kis_simple_ringbuf_peek_zc(caph->in_ringbuf, (void **) &frame_buf, 
-                sizeof(kismet_external_frame_t)) != sizeof(kismet_external_frame_t)) {
-        return 0;
-    }
+/* Move the multiplexed frames at the head of the read buffer to the sources they
+ * belong to.  Frames for sources which are gone are discarded.
+ *
+ * Returns:
+ * -1   Error
+ *  0   Waiting for more data, or for room in a source buffer
+ */
+static int cf_mux_route_rx(kis_capture_handler_t *caph) {
+    kismet_external_mux_frame_t mux_frame;
+    cf_mux_stream_t *s;
+    uint32_t stream, data_sz;
+    size_t total_sz;
+    void *data;
+
+    while (kis_simple_ringbuf_peek(caph->in_ringbuf, &mux_frame, 
+                sizeof(mux_frame)) == sizeof(mux_frame)) {
+        if (ntohl(mux_frame.signature) != KIS_EXTERNAL_MUX_SIG)
+            return 0;
 
-    external_frame = (kismet_external_frame_t *) frame_buf;
+        stream = ntohl(mux_frame.stream);
+        data_sz = ntohl(mux_frame.data_sz);
+        total_sz = sizeof(mux_frame) + data_sz;
 
-    /* Check the signature */
-    if (ntohl(external_frame->signature) != KIS_EXTERNAL_PROTO_SIG) {
-        kis_simple_ringbuf_peek_free(caph->in_ringbuf, frame_buf);
-        fprintf(stderr, "FATAL: Invalid frame header received\n");
-        return -1;
-    }
+        if (total_sz >= kis_simple_ringbuf_size(caph->in_ringbuf)) {
+            fprintf(stderr, "FATAL: Incoming multiplexed frame too large for ringbuf\n");
+            return -1;
+        }
 
-    /* If the signature passes, see if we can read the whole frame */
-    packet_sz = ntohl(external_frame->data_sz);
-    total_sz = packet_sz + sizeof(kismet_external_frame_t);
+        if (kis_simple_ringbuf_used(caph->in_ringbuf) < total_sz)
+            return 0;
 
-    if (total_sz >= kis_simple_ringbuf_size(caph->in_ringbuf)) {
-        kis_simple_ringbuf_peek_free(caph->in_ringbuf, frame_buf);
-        fprintf(stderr, "FATAL: Incoming packet too large for ringbuf\n");
-        return -1;
-    }
+        s = NULL;
 
-    if (rb_available < total_sz) {
-        kis_simple_ringbuf_peek_free(caph->in_ringbuf, frame_buf);
-        return 0;
-    }
+        if (stream < caph->mux_streams_sz && caph->mux_streams[stream].fd >= 0)
+            s = &(caph->mux_streams[stream]);
 
-    /* Free the peek of the frame header */
-    kis_simple_ringbuf_peek_free(caph->in_ringbuf, frame_buf);
+        /* Leave it until the source has caught up */
+        if (s != NULL && kis_simple_ringbuf_available(s->tx_ringbuf) < data_sz)
+            return 0;
 
-    /* We've got enough to read it all; try to zc the buffer */
+        if (s == NULL || data_sz == 0) {
+            /* An empty frame means Kismet closed the source */
+            if (s != NULL)
+                cf_mux_close_stream(caph, stream, 0);
 
-    /* Peek our ring buffer */
-    if (kis_simple_ringbuf_peek_zc(caph->in_ringbuf, (void **) &frame_buf, total_sz) != total_sz) {
-        fprintf(stderr, "FATAL: Failed to read packet from ringbuf\n");
-        free(frame_buf);
-        return -1;
+            kis_simple_ringbuf_read(caph->in_ringbuf, NULL, total_sz);
+            continue;
+        }
+
+        kis_simple_ringbuf_read(caph->in_ringbuf, NULL, sizeof(mux_frame));
+
+        if (kis_simple_ringbuf_reserve(s->tx_ringbuf, &data, data_sz) < data_sz) {
+            fprintf(stderr, "FATAL: Failed to reserve source buffer space\n");
+            return -1;
+        }
+
+        kis_simple_ringbuf_read(caph->in_ringbuf, data, data_sz);
+        kis_simple_ringbuf_commit(s->tx_ringbuf, data, data_sz);
     }
 
-    external_frame = (kismet_external_frame_t *) frame_buf;
+    return 0;
+}
 
-    /* Checksum it */
-    calc_checksum = adler32_csum(external_frame->data, packet_sz);
+/* Move the complete frames a source has written to the write buffer, gathering 
+ * them into multiplexed frames.
+ *
+ * Returns:
+ * -1   The source sent something which isn't a frame
+ *  0   Waiting for more data, or for room in the write buffer
+ */
+static int cf_mux_relay_stream(kis_capture_handler_t *caph, uint32_t stream) {
+    cf_mux_stream_t *s = &(caph->mux_streams[stream]);
+    kismet_external_mux_frame_t *mux_frame = (kismet_external_mux_frame_t *) caph->mux_buf;
+    kismet_external_frame_t frame;
+    size_t frame_sz, len, room;
 
-    data_checksum = ntohl(external_frame->data_checksum);
+    while (1) {
+        len = 0;
 
-    if (calc_checksum != data_checksum) {
-        // fprintf(stderr, "DEBUG - C - Checksum %x calced %x len %u\n", calc_checksum, data_checksum, packet_sz);
-        fprintf(stderr, "FATAL:  Invalid frame received, checksum does not match\n");
-        kis_simple_ringbuf_peek_free(caph->in_ringbuf, frame_buf);
-        return -1;
-    }
+        pthread_mutex_lock(&(caph->out_ringbuf_lock));
 
-    /* Unpack the protbuf */
-    kds_cmd = kismet_external__command__unpack(NULL, packet_sz, external_frame->data);
+        room = kis_simple_ringbuf_available(caph->out_ringbuf);
 
-    if (kds_cmd == NULL) {
-        fprintf(stderr, "FATAL:  Invalid frame received, unable to unpack command\n");
-        kis_simple_ringbuf_peek_free(caph->in_ringbuf, frame_buf);
-        return -1;
-    }
+        if (room <= sizeof(kismet_external_mux_frame_t)) {
+            pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+            return 0;
+        }
 
-    /* Lock so we can look at callbacks */
-    pthread_mutex_lock(&(caph->handler_lock));
+        room -= sizeof(kismet_external_mux_frame_t);
 
-    /* Split into commands and handle them */
-    if (strcasecmp(kds_cmd->command, "PING") == 0) {
-        caph->last_ping = time(NULL);
+        while (kis_simple_ringbuf_peek(s->rx_ringbuf, &frame, sizeof(frame)) == sizeof(frame)) {
+            if (ntohl(frame.signature) != KIS_EXTERNAL_PROTO_SIG) {
+                fprintf(stderr, "FATAL: Invalid frame header received from source %u\n",
+                        stream);
+                pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+                return -1;
+            }
+
+            frame_sz = sizeof(frame) + ntohl(frame.data_sz);
+
+            if (frame_sz + sizeof(kismet_external_mux_frame_t) >= 
+                    kis_simple_ringbuf_size(caph->out_ringbuf)) {
+                fprintf(stderr, "FATAL: Frame from source %u too large for ringbuf\n",
+                        stream);
+                pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+                return -1;
+            }
+
+            if (kis_simple_ringbuf_used(s->rx_ringbuf) < frame_sz)
+                break;
+
+            if (len + frame_sz > room)
+                break;
+
+            /* A single large frame is sent on its own */
+            if (len != 0 && len + frame_sz > CF_MUX_FRAME_MAX)
+                break;
+
+            kis_simple_ringbuf_read(s->rx_ringbuf, 
+                    caph->mux_buf + sizeof(kismet_external_mux_frame_t) + len, frame_sz);
+            len += frame_sz;
+        }
+
+        if (len == 0) {
+            pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+            return 0;
+        }
+
+        mux_frame->signature = htonl(KIS_EXTERNAL_MUX_SIG);
+        mux_frame->stream = htonl(stream);
+        mux_frame->data_sz = htonl(len);
+
+        cf_transport_mark_pending(caph);
+
+        kis_simple_ringbuf_write(caph->out_ringbuf, caph->mux_buf, 
+                sizeof(kismet_external_mux_frame_t) + len);
+
+        pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+    }
+}
+
+/* Add the source sockets to the select sets */
+static int cf_mux_set_fds(kis_capture_handler_t *caph, fd_set *rset, fd_set *wset, 
+        int max_fd) {
+    size_t i;
+
+    for (i = 0; i < caph->mux_streams_sz; i++) {
+        cf_mux_stream_t *s = &(caph->mux_streams[i]);
+
+        if (s->fd < 0)
+            continue;
+
+        if (kis_simple_ringbuf_available(s->rx_ringbuf) != 0)
+            FD_SET(s->fd, rset);
+
+        if (kis_simple_ringbuf_used(s->tx_ringbuf) != 0)
+            FD_SET(s->fd, wset);
+
+        if (max_fd < s->fd)
+            max_fd = s->fd;
+    }
+
+    return max_fd;
+}
+
+/* Service the source sockets after select, and relay what we can in both directions
+ *
+ * Returns:
+ * -1   Error, or all the sources have closed
+ *  1   Success
+ */
+static int cf_mux_poll(kis_capture_handler_t *caph, fd_set *rset, fd_set *wset) {
+    size_t i;
+    size_t sz;
+    ssize_t amt;
+    void *buf;
+    int num_open = 0;
+
+    for (i = 0; i < caph->mux_streams_sz; i++) {
+        cf_mux_stream_t *s = &(caph->mux_streams[i]);
+
+        if (s->fd >= 0 && FD_ISSET(s->fd, wset)) {
+            sz = kis_simple_ringbuf_peek_zc(s->tx_ringbuf, &buf, 
+                    kis_simple_ringbuf_used(s->tx_ringbuf));
+
+            amt = send(s->fd, buf, sz, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+            kis_simple_ringbuf_peek_free(s->tx_ringbuf, buf);
+
+            if (amt > 0) {
+                kis_simple_ringbuf_read(s->tx_ringbuf, NULL, (size_t) amt);
+            } else if (amt < 0 && errno != EINTR && errno != EAGAIN && 
+                    errno != EWOULDBLOCK) {
+                fprintf(stderr, "INFO - Source %lu closed: %s\n", (unsigned long) i,
+                        strerror(errno));
+                cf_mux_close_stream(caph, i, 1);
+            }
+        }
+
+        if (s->fd >= 0 && FD_ISSET(s->fd, rset)) {
+            sz = kis_simple_ringbuf_reserve(s->rx_ringbuf, &buf, 
+                    kis_simple_ringbuf_available(s->rx_ringbuf));
+
+            if (sz != 0) {
+                amt = recv(s->fd, buf, sz, MSG_DONTWAIT);
+
+                if (amt > 0)
+                    kis_simple_ringbuf_commit(s->rx_ringbuf, buf, (size_t) amt);
+                else
+                    kis_simple_ringbuf_reserve_free(s->rx_ringbuf, buf);
+
+                if (amt == 0 || (amt < 0 && errno != EINTR && errno != EAGAIN && 
+                            errno != EWOULDBLOCK)) {
+                    /* Pass on whatever the source managed to send before it closed */
+                    cf_mux_relay_stream(caph, i);
+
+                    fprintf(stderr, "INFO - Source %lu closed\n", (unsigned long) i);
+                    cf_mux_close_stream(caph, i, 1);
+                }
+            }
+        }
+
+        if (s->fd >= 0 && cf_mux_relay_stream(caph, i) < 0)
+            cf_mux_close_stream(caph, i, 1);
+
+        if (s->fd >= 0)
+            num_open++;
+    }
+
+    if (num_open == 0) {
+        fprintf(stderr, "FATAL - All multiplexed sources have closed\n");
+        return -1;
+    }
+
+    /* Frames from Kismet may have been waiting for room in a source buffer */
+    if (cf_mux_route_rx(caph) < 0)
+        return -1;
+
+    return 1;
+}
+
+int cf_handle_rx_data(kis_capture_handler_t *caph) {
+    size_t rb_available;
+
+    kismet_external_frame_t *external_frame;
+
+    /* Buffer of entire frame, dynamic */
+    uint8_t *frame_buf;
+
+    /* Incoming size */
+    uint32_t packet_sz;
+    uint32_t total_sz = 0;
+
+    /* Incoming checksum */
+    uint32_t data_checksum;
+
+    /* Calculated checksum */
+    uint32_t calc_checksum;
+
+    /* Callback ret */
+    int cbret = -1;
+
+    /* Status buffer */
+    char msgstr[STATUS_MAX];
+
+    /* Kismet command */
+    KismetExternal__Command *kds_cmd;
+
+    size_t i;
+
+    rb_available = kis_simple_ringbuf_used(caph->in_ringbuf);
+
+    if (rb_available < sizeof(kismet_external_frame_t)) {
+        /* fprintf(stderr, "DEBUG - insufficient data to represent a frame\n"); */
+        return 0;
+    }
+
+    if (kis_simple_ringbuf_peek_zc(caph->in_ringbuf, (void **) &frame_buf, 
+                sizeof(kismet_external_frame_t)) != sizeof(kismet_external_frame_t)) {
+        return 0;
+    }
+
+    external_frame = (kismet_external_frame_t *) frame_buf;
+
+    /* Frames for the sources of a multiplexed connection are passed along */
+    if (ntohl(external_frame->signature) == KIS_EXTERNAL_MUX_SIG && 
+            caph->mux_streams_sz > 0) {
+        kis_simple_ringbuf_peek_free(caph->in_ringbuf, frame_buf);
+        return cf_mux_route_rx(caph);
+    }
+
+    /* Check the signature */
+    if (ntohl(external_frame->signature) != KIS_EXTERNAL_PROTO_SIG) {
+        kis_simple_ringbuf_peek_free(caph->in_ringbuf, frame_buf);
+        fprintf(stderr, "FATAL: Invalid frame header received\n");
+        return -1;
+    }
+
+    /* If the signature passes, see if we can read the whole frame */
+    packet_sz = ntohl(external_frame->data_sz);
+    total_sz = packet_sz + sizeof(kismet_external_frame_t);
+
+    if (total_sz >= kis_simple_ringbuf_size(caph->in_ringbuf)) {
+        kis_simple_ringbuf_peek_free(caph->in_ringbuf, frame_buf);
+        fprintf(stderr, "FATAL: Incoming packet too large for ringbuf\n");
+        return -1;
+    }
+
+    if (rb_available < total_sz) {
+        kis_simple_ringbuf_peek_free(caph->in_ringbuf, frame_buf);
+        return 0;
+    }
+
+    /* Free the peek of the frame header */
+    kis_simple_ringbuf_peek_free(caph->in_ringbuf, frame_buf);
+
+    /* We've got enough to read it all; try to zc the buffer */
+
+    /* Peek our ring buffer */
+    if (kis_simple_ringbuf_peek_zc(caph->in_ringbuf, (void **) &frame_buf, total_sz) != total_sz) {
+        fprintf(stderr, "FATAL: Failed to read packet from ringbuf\n");
+        free(frame_buf);
+        return -1;
+    }
+
+    external_frame = (kismet_external_frame_t *) frame_buf;
+
+    /* Checksum it */
+    calc_checksum = adler32_csum(external_frame->data, packet_sz);
+
+    data_checksum = ntohl(external_frame->data_checksum);
+
+    if (calc_checksum != data_checksum) {
+        // fprintf(stderr, "DEBUG - C - Checksum %x calced %x len %u\n", calc_checksum, data_checksum, packet_sz);
+        fprintf(stderr, "FATAL:  Invalid frame received, checksum does not match\n");
+        kis_simple_ringbuf_peek_free(caph->in_ringbuf, frame_buf);
+        return -1;
+    }
+
+    /* Unpack the protbuf */
+    kds_cmd = kismet_external__command__unpack(NULL, packet_sz, external_frame->data);
+
+    if (kds_cmd == NULL) {
+        fprintf(stderr, "FATAL:  Invalid frame received, unable to unpack command\n");
+        kis_simple_ringbuf_peek_free(caph->in_ringbuf, frame_buf);
+        return -1;
+    }
+
+    /* Lock so we can look at callbacks */
+    pthread_mutex_lock(&(caph->handler_lock));
+
+    /* Split into commands and handle them */
+    if (strcasecmp(kds_cmd->command, "PING") == 0) {
+        caph->last_ping = time(NULL);
         cf_send_pong(caph, kds_cmd->seqno);
         cbret = 1;
         goto finish;
     } else if (strcasecmp(kds_cmd->command, "PONG") == 0) {
         cbret = 1;
+        goto finish;
+    } else if (strcasecmp(kds_cmd->command, "KDSTRANSPORT") == 0) {
+        KismetDatasource__Transport *transport_cmd;
+
+        transport_cmd = kismet_datasource__transport__unpack(NULL, kds_cmd->content.len,
+                kds_cmd->content.data);
+
+        if (transport_cmd == NULL) {
+            fprintf(stderr, "FATAL:  Invalid frame received, unable to unpack "
+                    "KDSTRANSPORT command\n");
+            cbret = -1;
+            goto finish;
+        }
+
+        cbret = cf_transport_enable(caph, transport_cmd);
+
+        if (cbret > 0 && caph->remote_host) {
+            fprintf(stderr, "INFO - %s:%u sending %s compressed blocks of up to %luKB\n",
+                    caph->remote_host, caph->remote_port, transport_cmd->compression,
+                    (unsigned long) caph->transport_block_max / 1024);
+        } else if (cbret < 0) {
+            fprintf(stderr, "FATAL:  Unable to allocate compression buffers\n");
+        }
+
+        kismet_datasource__transport__free_unpacked(transport_cmd, NULL);
+
         goto finish;
     } else if (strcasecmp(kds_cmd->command, "KDSLISTINTERFACES") == 0) {
         if (caph->listdevices_cb == NULL) {
@@ -1444,6 +2172,7 @@ int cf_handle_rx_data(kis_capture_handler_t *caph) {
             cf_params_spectrum_t *spectrumparams = NULL;
 
             char *uuid = NULL;
+            char *placeholder = NULL;
 
             /* Unpack the protbuf */
             open_cmd = kismet_datasource__open_source__unpack(NULL, kds_cmd->content.len, 
@@ -1456,6 +2185,13 @@ int cf_handle_rx_data(kis_capture_handler_t *caph) {
                 goto finish;
             }
             
+            /* Header-only capture of data frames applies to any source */
+            caph->truncate_data = 0;
+
+            if (cf_find_flag(&placeholder, "truncate_data", open_cmd->definition) > 0 &&
+                    strncasecmp(placeholder, "true", 4) == 0)
+                caph->truncate_data = 1;
+
             msgstr[0] = 0;
             cbret = (*(caph->open_cb))(caph,
                     kds_cmd->seqno, open_cmd->definition,
@@ -1495,6 +2231,7 @@ int cf_handle_rx_data(kis_capture_handler_t *caph) {
         char **chanhop_channels = NULL;
         void **chanhop_priv_channels = NULL;
         size_t chanhop_channels_sz, szi;
+        double *chanhop_dwell = NULL;
         int chanhop_shuffle = 0, chanhop_shuffle_spacing = 1, chanhop_offset = 0;
         void *translate_chan = NULL;
 
@@ -1601,6 +2338,19 @@ int cf_handle_rx_data(kis_capture_handler_t *caph) {
                 }
             }
 
+            /* Per-channel dwell is only used when it lines up with the channel list */
+            if (conf_cmd->hopping->n_dwell == chanhop_channels_sz && 
+                    chanhop_channels_sz != 0) {
+                chanhop_dwell = (double *) malloc(sizeof(double) * chanhop_channels_sz);
+
+                for (szi = 0; szi < chanhop_channels_sz; szi++) {
+                    chanhop_dwell[szi] = conf_cmd->hopping->dwell[szi];
+
+                    if (chanhop_dwell[szi] <= 0)
+                        chanhop_dwell[szi] = 1;
+                }
+            }
+
             /* Load any configure options or default to what we're already set for */
             if (conf_cmd->hopping->has_rate)
                 chanhop_rate = conf_cmd->hopping->rate;
@@ -1623,9 +2373,10 @@ int cf_handle_rx_data(kis_capture_handler_t *caph) {
                 chanhop_offset = caph->channel_hop_offset;
 
             /* Set the hop data, which will handle our thread */
-            cf_handler_assign_hop_channels(caph, chanhop_channels,
-                    chanhop_priv_channels, chanhop_channels_sz, chanhop_rate,
-                    chanhop_shuffle, chanhop_shuffle_spacing, chanhop_offset);
+            cf_handler_assign_hop_channels_dwell(caph, chanhop_channels,
+                    chanhop_priv_channels, chanhop_dwell, chanhop_channels_sz, 
+                    chanhop_rate, chanhop_shuffle, chanhop_shuffle_spacing, 
+                    chanhop_offset);
 
             /* Return a completion, and we do NOT free the channel lists we
              * dynamically allocated out of the buffer with cf_get_CHANHOP, as
@@ -1636,8 +2387,66 @@ int cf_handle_rx_data(kis_capture_handler_t *caph) {
 
             kismet_datasource__configure__free_unpacked(conf_cmd, NULL);
 
+            goto finish;
+        } else if (conf_cmd->filter != NULL) {
+            cf_bpf_insn_t *program = NULL;
+
+            /* A filter the source can't apply isn't fatal; the server filters
+             * the packets itself */
+            if (caph->filter_cb == NULL) {
+                cf_send_configresp(caph, kds_cmd->seqno, 0, 
+                        "Source does not support capture filters", NULL);
+                cbret = 0;
+
+                kismet_datasource__configure__free_unpacked(conf_cmd, NULL);
+
+                goto finish;
+            }
+
+            if (conf_cmd->filter->n_program > 0) {
+                program = (cf_bpf_insn_t *) 
+                    malloc(sizeof(cf_bpf_insn_t) * conf_cmd->filter->n_program);
+
+                if (program == NULL) {
+                    cf_send_configresp(caph, kds_cmd->seqno, 0, 
+                            "Unable to allocate capture filter", NULL);
+                    cbret = 0;
+
+                    kismet_datasource__configure__free_unpacked(conf_cmd, NULL);
+
+                    goto finish;
+                }
+
+                for (szi = 0; szi < conf_cmd->filter->n_program; szi++) {
+                    program[szi].code = conf_cmd->filter->program[szi]->code;
+                    program[szi].jt = conf_cmd->filter->program[szi]->jt;
+                    program[szi].jf = conf_cmd->filter->program[szi]->jf;
+                    program[szi].k = conf_cmd->filter->program[szi]->k;
+                }
+            }
+
+            msgstr[0] = 0;
+            cbret = (*(caph->filter_cb))(caph, kds_cmd->seqno, conf_cmd->filter->dlt,
+                    program, conf_cmd->filter->n_program, msgstr);
+
+            cf_send_configresp(caph, kds_cmd->seqno, cbret >= 0, msgstr, NULL);
+            cbret = 0;
+
+            free(program);
+
+            kismet_datasource__configure__free_unpacked(conf_cmd, NULL);
+
             goto finish;
         }
+
+        /* Nothing we know how to configure */
+        cf_send_configresp(caph, kds_cmd->seqno, 0, 
+                "Unsupported configuration", NULL);
+        cbret = 0;
+
+        kismet_datasource__configure__free_unpacked(conf_cmd, NULL);
+
+        goto finish;
     } else {
         /* fprintf(stderr, "DEBUG - got unhandled request - '%.16s'\n", cap_proto_frame->header.type); */
         cbret = -1;
@@ -1711,6 +2520,9 @@ int cf_handler_remote_server(kis_capture_handler_t *caph) {
     kis_simple_ringbuf_clear(caph->in_ringbuf);
     kis_simple_ringbuf_clear(caph->out_ringbuf);
 
+    /* New connections start with plain frames until the server asks for blocks */
+    cf_transport_reset(caph);
+
     /* Perform a local probe on the source to see if it's valid */
     msgstr[0] = 0;
 
@@ -1856,42 +2668,15 @@ int cf_handler_remote_server(kis_capture_handler_t *caph) {
     return 1;
 }
 
-int cf_handler_remote_connect(kis_capture_handler_t *caph) {
-    struct hostent *connect_host;
-    struct sockaddr_in client_sock, local_sock;
-    int client_fd;
-    int sock_flags;
-
+/* Perform a local probe on the source to see if it's valid before telling the
+ * remote server about it; uuid is allocated by the probe */
+static int cf_remote_probe(kis_capture_handler_t *caph, char **uuid) {
     char msgstr[STATUS_MAX];
-
-    char *uuid = NULL;
-
     int cbret;
 
     cf_params_interface_t *cpi;
     cf_params_spectrum_t *cps;
 
-    /* If we have nothing to connect to... */
-    if (caph->remote_host == NULL)
-        return 0;
-
-    /* close the fd if it's open */
-    if (caph->tcp_fd >= 0) {
-        close(caph->tcp_fd);
-        caph->tcp_fd = -1;
-    }
-
-    /* Reset the last ping */
-    caph->last_ping = time(0);
-
-    /* Reset spindown */
-    caph->spindown = 0;
-
-    /* Clear the buffers */
-    kis_simple_ringbuf_clear(caph->in_ringbuf);
-    kis_simple_ringbuf_clear(caph->out_ringbuf);
-
-    /* Perform a local probe on the source to see if it's valid */
     msgstr[0] = 0;
 
     cpi = NULL;
@@ -1903,7 +2688,7 @@ int cf_handler_remote_connect(kis_capture_handler_t *caph) {
         return -1;
     }
 
-    cbret = (*(caph->probe_cb))(caph, 0, caph->cli_sourcedef, msgstr, &uuid, 
+    cbret = (*(caph->probe_cb))(caph, 0, caph->cli_sourcedef, msgstr, uuid, 
             NULL, &cpi, &cps);
 
     if (cpi != NULL)
@@ -1916,19 +2701,27 @@ int cf_handler_remote_connect(kis_capture_handler_t *caph) {
         fprintf(stderr, "FATAL - Could not probe local source prior to connecting to the "
                 "remote host: %s\n", msgstr);
 
-        if (uuid)
-            free(uuid);
+        if (*uuid) {
+            free(*uuid);
+            *uuid = NULL;
+        }
     
         return -1;
     }
 
+    return 1;
+}
+
+/* Open the TCP connection to the remote server */
+static int cf_remote_tcp_connect(kis_capture_handler_t *caph) {
+    struct hostent *connect_host;
+    struct sockaddr_in client_sock, local_sock;
+    int client_fd;
+    int sock_flags;
+
     if ((connect_host = gethostbyname(caph->remote_host)) == NULL) {
         fprintf(stderr, "FATAL - Could not resolve hostname for remote connection to '%s'\n",
                 caph->remote_host);
-
-        if (uuid)
-            free(uuid);
-
         return -1;
     }
 
@@ -1941,10 +2734,6 @@ int cf_handler_remote_connect(kis_capture_handler_t *caph) {
     if ((client_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
         fprintf(stderr, "FATAL - Could not connect to remote host '%s:%u': %s\n",
                 caph->remote_host, caph->remote_port, strerror(errno));
-
-        if (uuid)
-            free(uuid);
-
         return -1;
     }
 
@@ -1957,10 +2746,6 @@ int cf_handler_remote_connect(kis_capture_handler_t *caph) {
         fprintf(stderr, "FATAL - Could not connect to remote host '%s:%u': %s\n",
                 caph->remote_host, caph->remote_port, strerror(errno));
         close(client_fd);
-
-        if (uuid)
-            free(uuid);
-
         return -1;
     }
 
@@ -1968,12 +2753,7 @@ int cf_handler_remote_connect(kis_capture_handler_t *caph) {
         if (errno != EINPROGRESS) {
             fprintf(stderr, "FATAL - Could not connect to remote host '%s:%u': %s\n",
                     caph->remote_host, caph->remote_port, strerror(errno));
-
             close(client_fd);
-
-            if (uuid)
-                free(uuid);
-
             return -1;
         }
     }
@@ -1983,13 +2763,164 @@ int cf_handler_remote_connect(kis_capture_handler_t *caph) {
 
     caph->tcp_fd = client_fd;
 
-    fprintf(stderr, "INFO - Connected to '%s:%u'...\n", caph->remote_host, caph->remote_port);
+    fprintf(stderr, "INFO - Connected to '%s:%u'...\n", caph->remote_host, caph->remote_port);
+
+    return 1;
+}
+
+/* Get ready for a new connection */
+static void cf_remote_reset(kis_capture_handler_t *caph) {
+    /* close the fd if it's open */
+    if (caph->tcp_fd >= 0) {
+        close(caph->tcp_fd);
+        caph->tcp_fd = -1;
+    }
+
+    /* Reset the last ping */
+    caph->last_ping = time(0);
+
+    /* Reset spindown */
+    caph->spindown = 0;
+
+    /* Clear the buffers */
+    kis_simple_ringbuf_clear(caph->in_ringbuf);
+    kis_simple_ringbuf_clear(caph->out_ringbuf);
+
+    /* New connections start with plain frames until the server asks for blocks */
+    cf_transport_reset(caph);
+}
+
+int cf_handler_remote_connect(kis_capture_handler_t *caph) {
+    char *uuid = NULL;
+
+    /* If we have nothing to connect to... */
+    if (caph->remote_host == NULL)
+        return 0;
+
+    cf_remote_reset(caph);
+
+    if (cf_remote_probe(caph, &uuid) < 0)
+        return -1;
+
+    if (cf_remote_tcp_connect(caph) < 0) {
+        if (uuid)
+            free(uuid);
+
+        return -1;
+    }
+
+    /* Send the NEWSOURCE command to the Kismet server */
+    cf_send_newsource(caph, uuid);
+
+    if (uuid)
+        free(uuid);
+
+    return 1;
+}
+
+int cf_handler_remote_mux(kis_capture_handler_t *caph) {
+    size_t i;
+    int sv[2];
+    pid_t pid;
+    size_t rb_sz;
+    char *uuid = NULL;
+
+    /* If we have nothing to connect to... */
+    if (caph->remote_host == NULL)
+        return 0;
+
+    cf_remote_reset(caph);
+
+    if (cf_remote_tcp_connect(caph) < 0)
+        return -1;
+
+    /* Sources are relayed in frames no larger than the write buffer, so the source 
+     * buffers match it */
+    rb_sz = kis_simple_ringbuf_size(caph->out_ringbuf);
+
+    caph->mux_buf = (uint8_t *) malloc(sizeof(kismet_external_mux_frame_t) + rb_sz);
+    caph->mux_streams = 
+        (cf_mux_stream_t *) calloc(caph->cli_sourcedef_list_sz, sizeof(cf_mux_stream_t));
+
+    if (caph->mux_buf == NULL || caph->mux_streams == NULL) {
+        fprintf(stderr, "FATAL - Could not allocate multiplexed source buffers\n");
+        return -1;
+    }
+
+    /* Announce the connection before any of the sources */
+    if (cf_send_mux(caph) < 1) {
+        fprintf(stderr, "FATAL - Could not send multiplex command\n");
+        return -1;
+    }
+
+    for (i = 0; i < caph->cli_sourcedef_list_sz; i++) {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+            fprintf(stderr, "FATAL - Could not create socket pair for source '%s': %s\n",
+                    caph->cli_sourcedef_list[i], strerror(errno));
+            return -1;
+        }
+
+        if ((pid = fork()) < 0) {
+            fprintf(stderr, "FATAL - Could not fork process for source '%s': %s\n",
+                    caph->cli_sourcedef_list[i], strerror(errno));
+            close(sv[0]);
+            close(sv[1]);
+            return -1;
+        } else if (pid == 0) {
+            /* This process is the source, and talks to the relay as if it were 
+             * the connection */
+            close(sv[0]);
+
+            close(caph->tcp_fd);
+            caph->tcp_fd = -1;
+
+            cf_mux_free_streams(caph);
+
+            caph->in_fd = sv[1];
+            caph->out_fd = sv[1];
+
+            if (caph->cli_sourcedef != NULL)
+                free(caph->cli_sourcedef);
+            caph->cli_sourcedef = strdup(caph->cli_sourcedef_list[i]);
+
+            /* The relay compresses the connection */
+            caph->transport_offer = 0;
+
+            caph->last_ping = time(0);
+
+            kis_simple_ringbuf_clear(caph->in_ringbuf);
+            kis_simple_ringbuf_clear(caph->out_ringbuf);
+
+            if (cf_remote_probe(caph, &uuid) < 0)
+                return -1;
+
+            cf_send_newsource(caph, uuid);
+
+            if (uuid)
+                free(uuid);
+
+            return 2;
+        }
+
+        close(sv[1]);
+
+        fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL, 0) | O_NONBLOCK | FD_CLOEXEC);
+
+        caph->mux_streams[i].fd = sv[0];
+        caph->mux_streams[i].pid = pid;
+        caph->mux_streams[i].rx_ringbuf = kis_simple_ringbuf_create(rb_sz);
+        caph->mux_streams[i].tx_ringbuf = kis_simple_ringbuf_create(CF_MUX_TX_BUF_SZ);
+        caph->mux_streams_sz = i + 1;
 
-    /* Send the NEWSOURCE command to the Kismet server */
-    cf_send_newsource(caph, uuid);
+        if (caph->mux_streams[i].rx_ringbuf == NULL || 
+                caph->mux_streams[i].tx_ringbuf == NULL) {
+            fprintf(stderr, "FATAL - Could not allocate multiplexed source buffers\n");
+            return -1;
+        }
+    }
 
-    if (uuid)
-        free(uuid);
+    fprintf(stderr, "INFO - Sending %lu sources over one connection\n", 
+            (unsigned long) caph->mux_streams_sz);
 
     return 1;
 }
@@ -2002,6 +2933,7 @@ int cf_handler_loop(kis_capture_handler_t *caph) {
     int spindown;
     int ret;
     int rv = 0;
+    size_t out_used;
 
     if (caph->tcp_fd >= 0) {
         read_fd = caph->tcp_fd;
@@ -2048,30 +2980,81 @@ int cf_handler_loop(kis_capture_handler_t *caph) {
 
         max_fd = 0;
 
-        /* Only set read sets if we're not spinning down */
-        if (spindown == 0) {
+        /* Only set read sets if we're not spinning down; a multiplexed connection
+         * stops reading while a source is too slow to take its frames */
+        if (spindown == 0 && (caph->mux_streams_sz == 0 || 
+                    kis_simple_ringbuf_available(caph->in_ringbuf) != 0)) {
             /* Only set rset if we're not spinning down */
             FD_SET(read_fd, &rset);
             max_fd = read_fd;
         }
 
-        /* Inspect the write buffer - do we have data? */
-        pthread_mutex_lock(&(caph->out_ringbuf_lock));
+        /* Relay the sources of a multiplexed connection */
+        if (caph->mux_streams_sz > 0)
+            max_fd = cf_mux_set_fds(caph, &rset, &wset, max_fd);
+
+        tm.tv_sec = 0;
+        tm.tv_usec = 500000;
+
+        /* Only the main loop changes the transport, so it's safe to check without
+         * holding the write buffer lock */
+        if (caph->transport_compress) {
+            /* Build the next block once the previous one has been sent, flushing 
+             * everything when we're spinning down */
+            if (caph->transport_block_len == 0) {
+                if (cf_transport_build_block(caph, spindown, &tm) < 0) {
+                    rv = -1;
+                    break;
+                }
+            }
+
+            /* Wake up often enough to honor the flush time for frames queued
+             * while we wait */
+            if (tm.tv_sec * 1000 + tm.tv_usec / 1000 > caph->transport_flush_ms) {
+                tm.tv_sec = caph->transport_flush_ms / 1000;
+                tm.tv_usec = (caph->transport_flush_ms % 1000) * 1000;
+            }
+
+            pthread_mutex_lock(&(caph->out_ringbuf_lock));
+
+            if (caph->transport_block_len != 0) {
+                FD_SET(write_fd, &wset);
+                if (max_fd < write_fd)
+                    max_fd = write_fd;
+            } else if (spindown != 0 && kis_simple_ringbuf_used(caph->out_ringbuf) == 0) {
+                pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+                rv = 0;
+                break;
+            }
 
-        if (kis_simple_ringbuf_used(caph->out_ringbuf) != 0) {
-            FD_SET(write_fd, &wset);
-            if (max_fd < write_fd)
-                max_fd = write_fd;
-        } else if (spindown != 0) {
             pthread_mutex_unlock(&(caph->out_ringbuf_lock));
-            rv = 0;
-            break;
-        }
+        } else {
+            /* Inspect the write buffer - do we have data?  The main loop is the only
+             * reader, so a spsc buffer doesn't need the lock */
+            if (!caph->out_spsc)
+                pthread_mutex_lock(&(caph->out_ringbuf_lock));
 
-        pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+            out_used = kis_simple_ringbuf_used(caph->out_ringbuf);
 
-        tm.tv_sec = 0;
-        tm.tv_usec = 500000;
+            if (!caph->out_spsc)
+                pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+
+            if (out_used != 0) {
+                FD_SET(write_fd, &wset);
+                if (max_fd < write_fd)
+                    max_fd = write_fd;
+            } else if (spindown != 0) {
+                rv = 0;
+                break;
+            }
+        }
+
+        /* Wake up as soon as anything is queued to an empty spsc write buffer */
+        if (caph->out_spsc) {
+            FD_SET(kis_simple_ringbuf_data_fd(caph->out_ringbuf), &rset);
+            if (max_fd < kis_simple_ringbuf_data_fd(caph->out_ringbuf))
+                max_fd = kis_simple_ringbuf_data_fd(caph->out_ringbuf);
+        }
 
         if ((ret = select(max_fd + 1, &rset, &wset, NULL, &tm)) < 0) {
             if (errno != EINTR && errno != EAGAIN) {
@@ -2081,9 +3064,19 @@ int cf_handler_loop(kis_capture_handler_t *caph) {
             }
         }
 
+        /* Sources are serviced even on timeout, so frames waiting for room in the 
+         * write buffer are moved as soon as it drains */
+        if (caph->mux_streams_sz > 0 && cf_mux_poll(caph, &rset, &wset) < 0) {
+            rv = -1;
+            break;
+        }
+
         if (ret == 0)
             continue;
 
+        if (caph->out_spsc && FD_ISSET(kis_simple_ringbuf_data_fd(caph->out_ringbuf), &rset))
+            kis_simple_ringbuf_data_clear(caph->out_ringbuf);
+
         if (FD_ISSET(read_fd, &rset)) {
             while (kis_simple_ringbuf_available(caph->in_ringbuf)) {
                 /* We use a fixed-length read buffer for simplicity, and we shouldn't
@@ -2145,29 +3138,56 @@ int cf_handler_loop(kis_capture_handler_t *caph) {
             }
         }
 
-        if (FD_ISSET(write_fd, &wset)) {
-            /* We can write data - lock the ring buffer mutex and write out
-             * whatever we can; we peek the ringbuffer and then flag off what
-             * we've successfully written out */
+        if (FD_ISSET(write_fd, &wset) && caph->transport_compress &&
+                caph->transport_block_len != 0) {
+            /* Write as much of the current compressed block as we can */
+            ssize_t written_sz;
+
+            written_sz = send(write_fd, 
+                    caph->transport_block + caph->transport_block_pos, 
+                    caph->transport_block_len - caph->transport_block_pos, MSG_DONTWAIT);
+
+            if (written_sz < 0) {
+                if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+                    fprintf(stderr,
+                            "FATAL:  Error during write(): %s\n", strerror(errno));
+                    rv = -1;
+                    break;
+                }
+            } else {
+                caph->transport_block_pos += written_sz;
+
+                if (caph->transport_block_pos >= caph->transport_block_len) {
+                    caph->transport_block_len = 0;
+                    caph->transport_block_pos = 0;
+                }
+            }
+        } else if (FD_ISSET(write_fd, &wset)) {
+            /* We can write data - write out whatever we can; we peek the 
+             * ringbuffer and then flag off what we've successfully written out.
+             * Writers only ever add to a spsc buffer, so it doesn't need the lock */
             ssize_t written_sz;
             size_t peek_sz;
             size_t peeked_sz;
             uint8_t *peek_buf;
 
-            pthread_mutex_lock(&(caph->out_ringbuf_lock));
+            if (!caph->out_spsc)
+                pthread_mutex_lock(&(caph->out_ringbuf_lock));
 
             peek_sz = kis_simple_ringbuf_used(caph->out_ringbuf);
 
             /* Don't know how we'd get here... */
             if (peek_sz == 0) {
-                pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+                if (!caph->out_spsc)
+                    pthread_mutex_unlock(&(caph->out_ringbuf_lock));
                 continue;
             }
 
             peek_buf = (uint8_t *) malloc(peek_sz);
 
             if (peek_buf == NULL) {
-                pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+                if (!caph->out_spsc)
+                    pthread_mutex_unlock(&(caph->out_ringbuf_lock));
                 fprintf(stderr,
                         "FATAL:  Error during write(): could not allocate write "
                         "buffer space\n");
@@ -2187,7 +3207,8 @@ int cf_handler_loop(kis_capture_handler_t *caph) {
 
             if (written_sz < 0) {
                 if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
-                    pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+                    if (!caph->out_spsc)
+                        pthread_mutex_unlock(&(caph->out_ringbuf_lock));
                     fprintf(stderr,
                             "FATAL:  Error during write(): %s\n", strerror(errno));
                     free(peek_buf);
@@ -2198,15 +3219,16 @@ int cf_handler_loop(kis_capture_handler_t *caph) {
 
             free(peek_buf);
 
-            /* Flag it as consumed */
-            kis_simple_ringbuf_read(caph->out_ringbuf, NULL, (size_t) written_sz);
+            /* Flag it as consumed; a spsc buffer wakes any writer waiting for 
+             * headroom itself */
+            if (written_sz > 0)
+                kis_simple_ringbuf_read(caph->out_ringbuf, NULL, (size_t) written_sz);
 
-            /* Unlock */
-            pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+            if (!caph->out_spsc)
+                pthread_mutex_unlock(&(caph->out_ringbuf_lock));
 
-            /* Signal to any waiting IO that the buffer has some
-             * headroom */
-            pthread_cond_signal(&(caph->out_ringbuf_flush_cond));
+            if (written_sz > 0)
+                cf_signal_out_space(caph);
         }
     }
 
@@ -2232,6 +3254,8 @@ int cf_send_raw_bytes(kis_capture_handler_t *caph, uint8_t *data, size_t len) {
         return 0;
     }
 
+    cf_transport_mark_pending(caph);
+
     if (kis_simple_ringbuf_write(caph->out_ringbuf, data, len) != len) {
         fprintf(stderr, "FATAL: Failed to write data to buffer\n");
         pthread_mutex_unlock(&(caph->out_ringbuf_lock));
@@ -2641,6 +3665,11 @@ int cf_send_openresp(kis_capture_handler_t *caph, uint32_t seq, unsigned int suc
             kechanhop.has_offset = true;
             kechanhop.offset = caph->channel_hop_offset;
 
+            if (caph->channel_hop_dwell != NULL) {
+                kechanhop.dwell = caph->channel_hop_dwell;
+                kechanhop.n_dwell = caph->channel_hop_list_sz;
+            }
+
             keopen.hop_config = &kechanhop;
         }
 
@@ -2707,11 +3736,106 @@ int cf_send_openresp(kis_capture_handler_t *caph, uint32_t seq, unsigned int suc
     return cf_send_packet(caph, "KDSOPENSOURCEREPORT", buf, buf_len);
 }
 
+/* Fill in the fixed GPS location of the capture, if there is one; the name and type
+ * must be freed by the caller */
+static int cf_fixed_gps(kis_capture_handler_t *caph, KismetDatasource__SubGps *kegps) {
+    struct timeval tv;
+
+    if (caph->gps_fixed_lat == 0)
+        return 0;
+
+    kegps->lat = caph->gps_fixed_lat;
+    kegps->lon = caph->gps_fixed_lon;
+    kegps->alt = caph->gps_fixed_alt;
+    kegps->fix = 3;
+
+    gettimeofday(&tv, NULL);
+    kegps->time_sec = tv.tv_sec;
+    kegps->time_usec = tv.tv_usec;
+
+    kegps->type = strdup("remote-fixed");
+
+    if (caph->gps_name != NULL)
+        kegps->name = strdup(caph->gps_name);
+    else
+        kegps->name = strdup("remote-fixed");
+
+    return 1;
+}
+
+uint32_t cf_dot11_data_snaplen(uint32_t dlt, const uint8_t *pack, uint32_t packet_sz) {
+    /* LLC/SNAP header for EAPOL */
+    const uint8_t eapol_llc[] = { 0xAA, 0xAA, 0x03, 0x00, 0x00, 0x00, 0x88, 0x8E };
+
+    uint32_t offt = 0, hdr_len;
+    uint8_t fc0, fc1;
+
+    if (dlt == 127 || dlt == 192) {
+        /* Radiotap and PPI both start with a little-endian header length */
+        if (packet_sz < 8)
+            return packet_sz;
+
+        /* PPI encapsulating something other than 802.11 */
+        if (dlt == 192 && (pack[4] != 105 || pack[5] != 0 || pack[6] != 0 || pack[7] != 0))
+            return packet_sz;
+
+        offt = pack[2] | (pack[3] << 8);
+    } else if (dlt != 105) {
+        return packet_sz;
+    }
+
+    if (offt + 2 > packet_sz)
+        return packet_sz;
+
+    fc0 = pack[offt];
+    fc1 = pack[offt + 1];
+
+    /* Only data frames with a body */
+    if ((fc0 & 0x0C) != 0x08 || (fc0 & 0x40))
+        return packet_sz;
+
+    hdr_len = 24;
+
+    /* 4-address frames */
+    if ((fc1 & 0x03) == 0x03)
+        hdr_len += 6;
+
+    /* QoS control, and the HT control field when the order bit is set */
+    if (fc0 & 0x80) {
+        hdr_len += 2;
+
+        if (fc1 & 0x80)
+            hdr_len += 4;
+    }
+
+    /* Keep the LLC/SNAP header, or the IV on protected frames */
+    hdr_len += 8;
+
+    if (offt + hdr_len >= packet_sz)
+        return packet_sz;
+
+    if (!(fc1 & 0x40) && 
+            memcmp(pack + offt + hdr_len - 8, eapol_llc, sizeof(eapol_llc)) == 0)
+        return packet_sz;
+
+    return offt + hdr_len;
+}
+
 int cf_send_data(kis_capture_handler_t *caph,
         KismetExternal__MsgbusMessage *kv_message,
         KismetDatasource__SubSignal *kv_signal,
         KismetDatasource__SubGps *kv_gps,
         struct timeval ts, uint32_t dlt, uint32_t packet_sz, uint8_t *pack) {
+    return cf_send_data_truncated(caph, kv_message, kv_signal, kv_gps, ts, dlt,
+            packet_sz, packet_sz, pack);
+}
+
+int cf_send_data_truncated(kis_capture_handler_t *caph,
+        KismetExternal__MsgbusMessage *kv_message,
+        KismetDatasource__SubSignal *kv_signal,
+        KismetDatasource__SubGps *kv_gps,
+        struct timeval ts, uint32_t dlt, uint32_t original_sz, 
+        uint32_t packet_sz, uint8_t *pack) {
 
     KismetDatasource__DataReport kedata;
     KismetDatasource__SubPacket kepkt;
@@ -2726,33 +3850,21 @@ int cf_send_data(kis_capture_handler_t *caph,
 
     if (kv_gps != NULL) {
         kedata.gps = kv_gps;
-    } else if (caph->gps_fixed_lat != 0) {
-        struct timeval tv;
-
-        kegps.lat = caph->gps_fixed_lat;
-        kegps.lon = caph->gps_fixed_lon;
-        kegps.alt = caph->gps_fixed_alt;
-        kegps.fix = 3;
-
-        gettimeofday(&tv, NULL);
-        kegps.time_sec = tv.tv_sec;
-        kegps.time_usec = tv.tv_usec;
-
-        kegps.type = strdup("remote-fixed");
-
-        if (caph->gps_name != NULL)
-            kegps.name = strdup(caph->gps_name);
-        else
-            kegps.name = strdup("remote-fixed");
-
+    } else if (cf_fixed_gps(caph, &kegps)) {
         kedata.gps = &kegps;
     }
 
     if (packet_sz > 0 && pack != NULL) {
+        if (original_sz < packet_sz)
+            original_sz = packet_sz;
+
+        if (caph->truncate_data)
+            packet_sz = cf_dot11_data_snaplen(dlt, pack, packet_sz);
+
         kepkt.time_sec = ts.tv_sec;
         kepkt.time_usec = ts.tv_usec;
         kepkt.dlt = dlt;
-        kepkt.size = packet_sz;
+        kepkt.size = original_sz;
         kepkt.data.len = packet_sz;
         kepkt.data.data = pack;
 
@@ -2779,6 +3891,230 @@ int cf_send_data(kis_capture_handler_t *caph,
     return cf_send_packet(caph, "KDSDATAREPORT", buf, buf_len);
 }
 
+int cf_send_data_batch(kis_capture_handler_t *caph, 
+        const cf_packet_t *packets, size_t num_packets) {
+
+    KismetDatasource__DataReport kedata;
+    KismetDatasource__SubPacket kepkt;
+    KismetDatasource__SubGps kegps;
+    KismetExternal__Command cmd;
+
+    kismet_external_frame_t *frame;
+
+    /* Serialized data reports, and the frames built from them */
+    uint8_t *report_buf = NULL;
+    size_t report_buf_sz = 0;
+    uint8_t *send_buf = NULL;
+    size_t send_buf_sz = 0;
+    size_t send_sz = 0;
+
+    /* End of each frame in the send buffer */
+    size_t *frame_end = NULL;
+
+    size_t report_sz, data_sz, frame_sz;
+    size_t i, end, pos, avail;
+    uint8_t *tmp;
+
+    int r = 1;
+
+    if (num_packets == 0)
+        return 1;
+
+    frame_end = (size_t *) malloc(sizeof(size_t) * num_packets);
+
+    if (frame_end == NULL)
+        return -1;
+
+    kismet_datasource__data_report__init(&kedata);
+    kismet_datasource__sub_packet__init(&kepkt);
+    kismet_datasource__sub_gps__init(&kegps);
+    kismet_external__command__init(&cmd);
+
+    if (cf_fixed_gps(caph, &kegps))
+        kedata.gps = &kegps;
+
+    kedata.packet = &kepkt;
+
+    cmd.command = (char *) "KDSDATAREPORT";
+
+    for (i = 0; i < num_packets; i++) {
+        kepkt.time_sec = packets[i].ts.tv_sec;
+        kepkt.time_usec = packets[i].ts.tv_usec;
+        kepkt.dlt = packets[i].dlt;
+        kepkt.size = packets[i].original_sz > packets[i].packet_sz ? 
+            packets[i].original_sz : packets[i].packet_sz;
+        kepkt.data.len = packets[i].packet_sz;
+        kepkt.data.data = packets[i].pack;
+
+        if (caph->truncate_data)
+            kepkt.data.len = cf_dot11_data_snaplen(packets[i].dlt, packets[i].pack, 
+                    packets[i].packet_sz);
+
+        report_sz = kismet_datasource__data_report__get_packed_size(&kedata);
+
+        if (report_sz > report_buf_sz) {
+            tmp = (uint8_t *) realloc(report_buf, report_sz);
+
+            if (tmp == NULL) {
+                r = -1;
+                goto batch_fail;
+            }
+
+            report_buf = tmp;
+            report_buf_sz = report_sz;
+        }
+
+        kismet_datasource__data_report__pack(&kedata, report_buf);
+
+        pthread_mutex_lock(&(caph->handler_lock));
+        if (++caph->seqno == 0)
+            caph->seqno = 1;
+        cmd.seqno = caph->seqno;
+        pthread_mutex_unlock(&(caph->handler_lock));
+
+        cmd.content.data = report_buf;
+        cmd.content.len = report_sz;
+
+        data_sz = kismet_external__command__get_packed_size(&cmd);
+        frame_sz = data_sz + sizeof(kismet_external_frame_t);
+
+        if (send_sz + frame_sz > send_buf_sz) {
+            size_t new_sz = send_buf_sz == 0 ? frame_sz * num_packets : send_buf_sz * 2;
+
+            if (new_sz < send_sz + frame_sz)
+                new_sz = send_sz + frame_sz;
+
+            tmp = (uint8_t *) realloc(send_buf, new_sz);
+
+            if (tmp == NULL) {
+                r = -1;
+                goto batch_fail;
+            }
+
+            send_buf = tmp;
+            send_buf_sz = new_sz;
+        }
+
+        frame = (kismet_external_frame_t *) (send_buf + send_sz);
+
+        frame->signature = htonl(KIS_EXTERNAL_PROTO_SIG);
+        frame->data_sz = htonl(data_sz);
+
+        kismet_external__command__pack(&cmd, frame->data);
+
+        frame->data_checksum = htonl(adler32_csum(frame->data, data_sz));
+
+        send_sz += frame_sz;
+        frame_end[i] = send_sz;
+    }
+
+    /* Queue as many whole frames as fit, waiting for the buffer to drain as needed */
+    i = 0;
+    pos = 0;
+
+    while (i < num_packets) {
+        pthread_mutex_lock(&(caph->out_ringbuf_lock));
+
+        avail = kis_simple_ringbuf_available(caph->out_ringbuf);
+
+        for (end = i; end < num_packets && frame_end[end] - pos <= avail; end++)
+            ;
+
+        if (end == i) {
+            if (frame_end[i] - pos > kis_simple_ringbuf_size(caph->out_ringbuf)) {
+                fprintf(stderr, "FATAL: Packet too large for the write buffer\n");
+                pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+                r = -1;
+                break;
+            }
+
+            pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+            cf_wait_out_space(caph, frame_end[i] - pos);
+            continue;
+        }
+
+        cf_transport_mark_pending(caph);
+
+        if (kis_simple_ringbuf_write(caph->out_ringbuf, send_buf + pos, 
+                    frame_end[end - 1] - pos) != frame_end[end - 1] - pos) {
+            fprintf(stderr, "FATAL: Failed to write data to buffer\n");
+            pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+            r = -1;
+            break;
+        }
+
+        pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+
+        pos = frame_end[end - 1];
+        i = end;
+    }
+
+batch_fail:
+    if (kegps.name != NULL)
+        free(kegps.name);
+    if (kegps.type != NULL)
+        free(kegps.type);
+
+    free(report_buf);
+    free(send_buf);
+    free(frame_end);
+
+    return r;
+}
+
+int cf_send_stats(kis_capture_handler_t *caph, uint64_t kernel_packets, uint64_t kernel_drops) {
+    KismetDatasource__StatsReport kestats;
+
+    kismet_datasource__stats_report__init(&kestats);
+
+    kestats.has_kernel_packets = true;
+    kestats.kernel_packets = kernel_packets;
+    kestats.has_kernel_drops = true;
+    kestats.kernel_drops = kernel_drops;
+
+    uint8_t *buf;
+    size_t len;
+
+    len = kismet_datasource__stats_report__get_packed_size(&kestats);
+    buf = (uint8_t *) malloc(len);
+
+    if (buf == NULL)
+        return -1;
+
+    kismet_datasource__stats_report__pack(&kestats, buf);
+
+    return cf_send_packet(caph, "KDSSTATSREPORT", buf, len);
+}
+
+int cf_send_replay_stats(kis_capture_handler_t *caph, double target_speed, double speed,
+        double target_pps, double pps) {
+    KismetDatasource__StatsReport kestats;
+
+    kismet_datasource__stats_report__init(&kestats);
+
+    kestats.has_replay_target_speed = true;
+    kestats.replay_target_speed = target_speed;
+    kestats.has_replay_speed = true;
+    kestats.replay_speed = speed;
+    kestats.has_replay_target_pps = true;
+    kestats.replay_target_pps = target_pps;
+    kestats.has_replay_pps = true;
+    kestats.replay_pps = pps;
+
+    uint8_t *buf;
+    size_t len;
+
+    len = kismet_datasource__stats_report__get_packed_size(&kestats);
+    buf = (uint8_t *) malloc(len);
+
+    if (buf == NULL)
+        return -1;
+
+    kismet_datasource__stats_report__pack(&kestats, buf);
+
+    return cf_send_packet(caph, "KDSSTATSREPORT", buf, len);
+}
+
 int cf_send_json(kis_capture_handler_t *caph,
         KismetExternal__MsgbusMessage *kv_message,
         KismetDatasource__SubSignal *kv_signal,
@@ -2899,6 +4235,11 @@ int cf_send_configresp(kis_capture_handler_t *caph, unsigned int seqno,
     kechanhop.has_offset = true;
     kechanhop.offset = caph->channel_hop_offset;
 
+    if (caph->channel_hop_dwell != NULL) {
+        kechanhop.dwell = caph->channel_hop_dwell;
+        kechanhop.n_dwell = caph->channel_hop_list_sz;
+    }
+
     keconf.hopping = &kechanhop;
 
     buf_len = kismet_datasource__configure_report__get_packed_size(&keconf);
@@ -2920,6 +4261,7 @@ int cf_send_configresp(kis_capture_handler_t *caph, unsigned int seqno,
 
 int cf_send_newsource(kis_capture_handler_t *caph, const char *uuid) {
     KismetDatasource__NewSource kesrc;
+    char *compression[] = { (char *) "zlib" };
 
     uint8_t *buf;
     size_t buf_len;
@@ -2929,6 +4271,11 @@ int cf_send_newsource(kis_capture_handler_t *caph, const char *uuid) {
 
     kesrc.definition = caph->cli_sourcedef;
     kesrc.sourcetype = caph->capsource_type;
+
+    if (caph->transport_offer) {
+        kesrc.n_compression = 1;
+        kesrc.compression = compression;
+    }
     if (uuid != NULL)
         kesrc.uuid = strdup(uuid);
 
@@ -2949,6 +4296,34 @@ int cf_send_newsource(kis_capture_handler_t *caph, const char *uuid) {
     return cf_send_packet(caph, "KDSNEWSOURCE", buf, buf_len);
 }
 
+int cf_send_mux(kis_capture_handler_t *caph) {
+    KismetDatasource__Multiplex kemux;
+    char *compression[] = { (char *) "zlib" };
+
+    uint8_t *buf;
+    size_t buf_len;
+
+    kismet_datasource__multiplex__init(&kemux);
+
+    if (caph->transport_offer) {
+        kemux.n_compression = 1;
+        kemux.compression = compression;
+    }
+
+    kemux.has_streams = 1;
+    kemux.streams = caph->cli_sourcedef_list_sz;
+
+    buf_len = kismet_datasource__multiplex__get_packed_size(&kemux);
+    buf = (uint8_t *) malloc(buf_len);
+
+    if (buf == NULL)
+        return -1;
+
+    kismet_datasource__multiplex__pack(&kemux, buf);
+
+    return cf_send_packet(caph, "KDSMUX", buf, buf_len);
+}
+
 int cf_send_pong(kis_capture_handler_t *caph, uint32_t in_seqno) {
     KismetExternal__Pong pong;
 
@@ -3109,6 +4484,7 @@ int cf_jail_filesystem(kis_capture_handler_t *caph) {
 void cf_handler_remote_capture(kis_capture_handler_t *caph) {
     pid_t chpid;
     int status;
+    int ret;
 
     /* If we're going into daemon mode, fork-exec and drop out here */
     if (caph->daemonize) {
@@ -3151,6 +4527,18 @@ void cf_handler_remote_capture(kis_capture_handler_t *caph) {
                 if (cf_handler_remote_server(caph) < 1) {
                     exit(1);
                 } 
+            } else if (caph->cli_sourcedef_list_sz > 1) {
+                /* Sources each get their own process, and this process relays 
+                 * them over one connection until they've all gone */
+                if ((ret = cf_handler_remote_mux(caph)) < 1)
+                    exit(1);
+
+                if (ret == 1) {
+                    ret = cf_handler_loop(caph);
+                    cf_mux_stop_streams(caph);
+                    cf_handler_free(caph);
+                    exit(ret < 0 ? 1 : 0);
+                }
             } else if (cf_handler_remote_connect(caph) < 1) {
                 exit(1);
             }
@@ -68,6 +68,17 @@ typedef struct cf_params_list_interface cf_params_list_interface_t;
 struct cf_params_spectrum;
 typedef struct cf_params_spectrum cf_params_spectrum_t;
 
+/* A captured packet, for sending a batch of packets with cf_send_data_batch; 
+ * original_sz is the length of the packet before it was truncated by the capture,
+ * or 0 if it wasn't */
+typedef struct {
+    struct timeval ts;
+    uint32_t dlt;
+    uint32_t packet_sz;
+    uint32_t original_sz;
+    uint8_t *pack;
+} cf_packet_t;
+
 
 /* List devices callback
  * Called to list devices available
@@ -230,6 +241,48 @@ typedef int (*cf_callback_spectrumconfig)(kis_capture_handler_t *, uint32_t seqn
     unsigned int amp, uint64_t if_amp, uint64_t baseband_amp, 
     KismetExternal__Command *command);
 
+/* Classic BPF instruction, in the layout of struct bpf_insn and struct sock_filter */
+typedef struct {
+    uint16_t code;
+    uint8_t jt;
+    uint8_t jf;
+    uint32_t k;
+} cf_bpf_insn_t;
+
+/* Capture filter callback
+ * Applies a classic BPF program to the capture, in response to a FILTER block in a
+ * CONFIGURE command.
+ *
+ * The program is written for captures with the given DLT; sources should refuse
+ * it if they're capturing with a different DLT.  An empty program removes the
+ * filter.  The program is only valid during the callback.
+ *
+ * msg is allocated by the framework and can hold up to STATUS_MAX characters.  It
+ * will be transmitted along with the success or failure value.
+ *
+ * Returns:
+ * -1   Error occurred, filter not applied
+ *  0   Success
+ */
+typedef int (*cf_callback_filter)(kis_capture_handler_t *, uint32_t seqno,
+        unsigned int dlt, const cf_bpf_insn_t *program, size_t program_len, char *msg);
+
+/* One source of a multiplexed remote capture connection.  Each source runs as its own
+ * capture process, talking to the process which owns the connection over a socket
+ * pair as if it were a connection of its own. */
+struct cf_mux_stream {
+    /* Socket to the source process, or -1 once the source has closed */
+    int fd;
+    pid_t pid;
+
+    /* Frames from the source, waiting to be relayed to Kismet */
+    kis_simple_ringbuf_t *rx_ringbuf;
+
+    /* Frames from Kismet, waiting to be written to the source */
+    kis_simple_ringbuf_t *tx_ringbuf;
+};
+typedef struct cf_mux_stream cf_mux_stream_t;
+
 struct kis_capture_handler {
     /* Capture source type */
     char *capsource_type;
@@ -258,6 +311,17 @@ struct kis_capture_handler {
     /* Specified commandline source, used for remote cap */
     char *cli_sourcedef;
 
+    /* All the --source options; when there is more than one, remote capture sends
+     * them all over one multiplexed connection */
+    char **cli_sourcedef_list;
+    size_t cli_sourcedef_list_sz;
+
+    /* Sources relayed by the process which owns a multiplexed connection, and the
+     * frame currently being relayed */
+    cf_mux_stream_t *mux_streams;
+    size_t mux_streams_sz;
+    uint8_t *mux_buf;
+
     /* Retry remote connections */
     int remote_retry;
 
@@ -277,10 +341,13 @@ struct kis_capture_handler {
     kis_simple_ringbuf_t *in_ringbuf;
     kis_simple_ringbuf_t *out_ringbuf;
 
-    /* Lock for output buffer */
+    /* Lock for output buffer; serializes the threads writing to it and the transport
+     * state.  With --lockfree-output the buffer is a spsc ring buffer and the main loop,
+     * the only reader, drains it without the lock. */
     pthread_mutex_t out_ringbuf_lock;
+    int out_spsc;
 
-    /* conditional waiter for ringbuf flushing data */
+    /* conditional waiter for ringbuf flushing data, when the buffer is not spsc */
     pthread_cond_t out_ringbuf_flush_cond;
     pthread_mutex_t out_ringbuf_flush_cond_mutex;
 
@@ -303,6 +370,7 @@ struct kis_capture_handler {
 
     cf_callback_spectrumconfig spectrumconfig_cb;
 
+    cf_callback_filter filter_cb;
 
     /* Arbitrary data blob */
     void *userdata;
@@ -326,6 +394,11 @@ struct kis_capture_handler {
     size_t channel_hop_list_sz;
     double channel_hop_rate;
 
+    /* Optional per-channel dwell multipliers, the same length as the channel hop
+     * list, or NULL to dwell equally on every channel; a channel with a dwell of 2
+     * is held twice as long as the hop rate alone would hold it */
+    double *channel_hop_dwell;
+
     /* Maximum hop rate; if 0, ignored, if not zero, hop commands are forced to this
      * rate.
      */
@@ -346,6 +419,30 @@ struct kis_capture_handler {
 
     /* Fixed GPS name */
     char *gps_name;
+
+    /* Send only the headers of 802.11 data frames; set by the truncate_data= source
+     * option */
+    int truncate_data;
+
+    /* Compressed block transport for remote capture; offered in the NEWSOURCE unless
+     * disabled, and enabled when the server answers with a KDSTRANSPORT.  Once enabled,
+     * the main loop copies whole frames out of the write buffer into zlib compressed
+     * blocks, sent when transport_block_max bytes are waiting or the oldest frame has
+     * waited transport_flush_ms */
+    int transport_offer;
+    int transport_compress;
+    int transport_level;
+    size_t transport_block_max;
+    unsigned int transport_flush_ms;
+
+    /* When the oldest frame in the write buffer was queued, if any */
+    struct timeval transport_pending_ts;
+
+    /* Frames copied out of the write buffer, and the compressed block being sent */
+    uint8_t *transport_raw;
+    uint8_t *transport_block;
+    size_t transport_block_len;
+    size_t transport_block_pos;
 };
 
 
@@ -540,6 +637,12 @@ void cf_handler_assign_hop_channels(kis_capture_handler_t *caph, char **stringch
         void **privchans, size_t chan_sz, double rate, int shuffle, int shuffle_spacing, 
         int offset);
 
+/* Assign a channel hopping list with per-channel dwell multipliers; the dwell
+ * list is owned by the caph once assigned, and may be NULL */
+void cf_handler_assign_hop_channels_dwell(kis_capture_handler_t *caph, char **stringchans,
+        void **privchans, double *dwell, size_t chan_sz, double rate, int shuffle, 
+        int shuffle_spacing, int offset);
+
 /* Set a channel hop shuffle spacing */
 void cf_handler_set_hop_shuffle_spacing(kis_capture_handler_t *capf, int spacing);
 
@@ -576,6 +679,8 @@ void cf_handler_set_chanfree_cb(kis_capture_handler_t *capf, cf_callback_chanfre
 void cf_handler_set_spectrumconfig_cb(kis_capture_handler_t *capf, 
         cf_callback_spectrumconfig cb);
 
+void cf_handler_set_filter_cb(kis_capture_handler_t *capf, cf_callback_filter cb);
+
 void cf_handler_set_unknown_cb(kis_capture_handler_t *capf, cf_callback_unknown cb);
 
 /* Set the capture function, which runs inside its own thread */
@@ -596,7 +701,7 @@ int cf_handler_launch_capture_thread(kis_capture_handler_t *caph);
 int cf_handler_launch_hopping_thread(kis_capture_handler_t *caph);
 
 
-/* Perform a blocking wait, waiting for the ringbuffer to free data */
+/* Perform a blocking wait, up to 100ms, for the write buffer to drain to half full */
 void cf_handler_wait_ringbuffer(kis_capture_handler_t *caph);
 
 
@@ -618,6 +723,18 @@ int cf_handle_rx_data(kis_capture_handler_t *caph);
  */
 int cf_handler_remote_connect(kis_capture_handler_t *caph);
 
+/* Connect to a network socket and carry several sources over it.  Each source is 
+ * forked into its own capture process, which talks to this process over a socket
+ * pair; this should not be needed by capture tools using the framework; the capture
+ * loop will be managed directly via cf_handler_remote_capture
+ *
+ * Returns:
+ * -1   Error, could not connect, process should exit
+ *  1   Successful remote connection, this process relays the sources
+ *  2   This process is one of the sources and should run the capture normally
+ */
+int cf_handler_remote_mux(kis_capture_handler_t *caph);
+
 /* Launch a network server and wait for a connection, if reverse connection is
  * specified; this should not be needed by capture tools using the framework; 
  * the capture loop will be managed directly via cf_handler_remote_capture
@@ -778,6 +895,74 @@ int cf_send_data(kis_capture_handler_t *caph,
         KismetDatasource__SubGps *kv_gps,
         struct timeval ts, uint32_t dlt, uint32_t packet_sz, uint8_t *pack);
 
+/* Send a DATA frame with packet data which was truncated by the capture
+ * Can be called from any thread
+ *
+ * The same as cf_send_data, but original_sz is the length of the packet before it 
+ * was truncated.
+ *
+ * Returns:
+ * -1   An error occurred 
+ *  0   Insufficient space in buffer
+ *  1   Success
+ */
+int cf_send_data_truncated(kis_capture_handler_t *caph,
+        KismetExternal__MsgbusMessage *kv_message,
+        KismetDatasource__SubSignal *kv_signal,
+        KismetDatasource__SubGps *kv_gps,
+        struct timeval ts, uint32_t dlt, uint32_t original_sz, 
+        uint32_t packet_sz, uint8_t *pack);
+
+/* Find how much of a packet to send when only the headers of 802.11 data frames
+ * are wanted
+ *
+ * Data frames are cut after the 802.11 header and the following 8 bytes, which hold
+ * the LLC/SNAP header or the encryption IV.  Management and control frames, EAPOL 
+ * frames, and packets which aren't 802.11, radiotap, or PPI are kept whole.
+ *
+ * Returns:
+ *      Number of bytes to send, no more than packet_sz
+ */
+uint32_t cf_dot11_data_snaplen(uint32_t dlt, const uint8_t *pack, uint32_t packet_sz);
+
+/* Send a batch of packets as DATA frames
+ * Can be called from any thread
+ *
+ * Each packet is serialized once and the packet data is copied, so the caller can
+ * reuse the packet buffers as soon as this returns.  If the write buffer is full, 
+ * this waits for it to be flushed and queues as many whole frames as fit each time,
+ * instead of re-serializing the packets.
+ *
+ * Returns:
+ * -1   An error occurred
+ *  1   Success
+ */
+int cf_send_data_batch(kis_capture_handler_t *caph, 
+        const cf_packet_t *packets, size_t num_packets);
+
+/* Send capture statistics, such as the number of packets dropped by the kernel; these
+ * are the totals since the source was opened.
+ * Can be called from any thread
+ *
+ * Returns:
+ * -1   An error occurred
+ *  0   Insufficient space in buffer, try again
+ *  1   Success
+ */
+int cf_send_stats(kis_capture_handler_t *caph, uint64_t kernel_packets, uint64_t kernel_drops);
+
+/* Send replay statistics for sources which replay saved captures; the speed is relative
+ * to the original capture, and a target of 0 is as fast as possible.
+ * Can be called from any thread
+ *
+ * Returns:
+ * -1   An error occurred
+ *  0   Insufficient space in buffer, try again
+ *  1   Success
+ */
+int cf_send_replay_stats(kis_capture_handler_t *caph, double target_speed, double speed,
+        double target_pps, double pps);
+
 /* Send a DATA frame with JSON non-packet data
  * Can be called from any thread
  *
@@ -831,6 +1016,15 @@ int cf_send_pong(kis_capture_handler_t *caph, uint32_t in_seqno);
  */
 int cf_send_newsource(kis_capture_handler_t *caph, const char *uuid);
 
+/* Send a MUX command to announce a multiplexed remote connection
+ *
+ * Returns:
+ * -1   An error occurred 
+ *  0   Insufficient space in buffer
+ *  1   Success
+ */
+int cf_send_mux(kis_capture_handler_t *caph);
+
 /* Simple frequency parser, returns the frequency in khz from multiple input 
  * formats, such as:
  * 123KHz
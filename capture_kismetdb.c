@@ -45,6 +45,7 @@
 #include "capture_framework.h"
 
 #include <sqlite3.h>
+#include <zlib.h>
 
 typedef struct {
     sqlite3 *db;
@@ -61,8 +62,151 @@ typedef struct {
     struct timeval last_ts;
 
     unsigned int pps_throttle;
+
+    /* Preset dictionary of logs written with kis_log_compress; see kismetdb_blob.h */
+    unsigned char *compression_dict;
+    unsigned int compression_dict_len;
 } local_pcap_t;
 
+/* Load the compression dictionary from the KISMET table; logs written before compression
+ * support don't have the column, and logs written without compression leave it empty */
+void kismetdb_load_dictionary(local_pcap_t *local_pcap) {
+    sqlite3_stmt *stmt = NULL;
+    const void *blob;
+    int len;
+
+    if (local_pcap->compression_dict != NULL) {
+        free(local_pcap->compression_dict);
+        local_pcap->compression_dict = NULL;
+    }
+
+    local_pcap->compression_dict_len = 0;
+
+    if (sqlite3_prepare_v2(local_pcap->db, "SELECT compression_dict FROM KISMET", 
+                -1, &stmt, NULL) != SQLITE_OK)
+        return;
+
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        blob = sqlite3_column_blob(stmt, 0);
+        len = sqlite3_column_bytes(stmt, 0);
+
+        if (blob != NULL && len > 0) {
+            local_pcap->compression_dict = (unsigned char *) malloc(len);
+
+            if (local_pcap->compression_dict != NULL) {
+                memcpy(local_pcap->compression_dict, blob, len);
+                local_pcap->compression_dict_len = len;
+            }
+        }
+    }
+
+    sqlite3_finalize(stmt);
+}
+
+/* Copy a JSON record out of the database as a NUL terminated string, decompressing it 
+ * if it was logged compressed; this follows kismetdb_blob::decompress.  Returns NULL and
+ * fills in errstr if the record can't be decoded. */
+char *kismetdb_record_json(local_pcap_t *local_pcap, const unsigned char *data, 
+        unsigned int len, char *errstr) {
+    z_stream zs;
+    unsigned char *out = NULL, *tmp;
+    size_t out_sz;
+    int r;
+
+    /* A zlib stream with the default window starts with 0x78 and a header which is a 
+     * multiple of 31; JSON never starts with 'x' */
+    if (len < 2 || data[0] != 0x78 || ((data[0] << 8) | data[1]) % 31 != 0) {
+        /* Storage msgpack records start with a 3-element array; only device records
+         * are logged that way, so they should never be in the data table */
+        if (len > 0 && data[0] == 0x93) {
+            snprintf(errstr, STATUS_MAX, "msgpack records can not be replayed");
+            return NULL;
+        }
+
+        out = (unsigned char *) malloc(len + 1);
+
+        if (out == NULL) {
+            snprintf(errstr, STATUS_MAX, "could not allocate record");
+            return NULL;
+        }
+
+        if (len > 0)
+            memcpy(out, data, len);
+        out[len] = 0;
+
+        return (char *) out;
+    }
+
+    memset(&zs, 0, sizeof(z_stream));
+
+    if (inflateInit(&zs) != Z_OK) {
+        snprintf(errstr, STATUS_MAX, "unable to initialize zlib decompression");
+        return NULL;
+    }
+
+    out_sz = (size_t) len * 4;
+
+    zs.next_in = (Bytef *) data;
+    zs.avail_in = len;
+
+    while (1) {
+        /* Always leave room for the terminating NUL */
+        if (out == NULL || zs.total_out + 1 >= out_sz) {
+            if (out != NULL)
+                out_sz *= 2;
+
+            if ((tmp = (unsigned char *) realloc(out, out_sz)) == NULL) {
+                snprintf(errstr, STATUS_MAX, "could not allocate record");
+                break;
+            }
+
+            out = tmp;
+        }
+
+        zs.next_out = out + zs.total_out;
+        zs.avail_out = out_sz - zs.total_out - 1;
+
+        r = inflate(&zs, Z_NO_FLUSH);
+
+        if (r == Z_NEED_DICT) {
+            if (local_pcap->compression_dict_len == 0 ||
+                    inflateSetDictionary(&zs, local_pcap->compression_dict,
+                        local_pcap->compression_dict_len) != Z_OK) {
+                snprintf(errstr, STATUS_MAX, "compressed record needs a dictionary "
+                        "which does not match the log");
+                break;
+            }
+
+            continue;
+        }
+
+        if (r == Z_STREAM_END) {
+            out[zs.total_out] = 0;
+            inflateEnd(&zs);
+            return (char *) out;
+        }
+
+        if (r == Z_BUF_ERROR || (r == Z_OK && zs.avail_out == 0)) {
+            if (zs.avail_in == 0 && zs.avail_out != 0) {
+                snprintf(errstr, STATUS_MAX, "truncated compressed record");
+                break;
+            }
+
+            continue;
+        }
+
+        if (r != Z_OK) {
+            snprintf(errstr, STATUS_MAX, "corrupt compressed record");
+            break;
+        }
+    }
+
+    inflateEnd(&zs);
+    free(out);
+
+    return NULL;
+}
+
 /* Version callback */
 int sqlite_version_cb(void *ver, int argc, char **data, char **colnames) {
     if (argc != 1) {
@@ -230,6 +374,8 @@ int open_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
         return -1;
     }
 
+    kismetdb_load_dictionary(local_pcap);
+
     if ((placeholder_len = cf_find_flag(&placeholder, "uuid", definition)) > 0) {
         *uuid = strdup(placeholder);
     } else {
@@ -500,6 +646,8 @@ void capture_thread(kis_capture_handler_t *caph) {
     /* Data... data... */
     char *data_type = NULL;
     char *data_json = NULL;
+    const unsigned char *data_raw;
+    unsigned int data_len;
 
     /* V4 didn't have speed, heading, etc, and used the normalized encoding */
     const char *basic_packet_sql_v4 = 
@@ -630,11 +778,23 @@ void capture_thread(kis_capture_handler_t *caph) {
             }
 
             data_type = strdup((const char *) sqlite3_column_text(data_stmt, colno++));
-            data_json = strdup((const char *) sqlite3_column_text(data_stmt, colno++));
 
-            kismetdb_dispatch_data_cb((u_char *) caph, packet_ts_sec, packet_ts_usec, 
-                    data_type, data_json,
-                    lat, lon, alt, speed, heading);
+            /* Records may be compressed binary, so they can't be read as text */
+            data_len = sqlite3_column_bytes(data_stmt, colno);
+            data_raw = (const unsigned char *) sqlite3_column_blob(data_stmt, colno++);
+
+            data_json = kismetdb_record_json(local_pcap, data_raw, data_len, errstr);
+
+            if (data_json == NULL) {
+                char msgstr[STATUS_MAX];
+                snprintf(msgstr, STATUS_MAX, "KismetDB '%s' skipping %s record: %s",
+                        local_pcap->dbname, data_type, errstr);
+                cf_send_message(caph, msgstr, MSGFLAG_ERROR);
+            } else {
+                kismetdb_dispatch_data_cb((u_char *) caph, packet_ts_sec, packet_ts_usec, 
+                        data_type, data_json,
+                        lat, lon, alt, speed, heading);
+            }
 
             free(data_type);
             free(data_json);
@@ -665,6 +825,8 @@ int main(int argc, char *argv[]) {
         .last_ts.tv_sec = 0,
         .last_ts.tv_usec = 0,
         .pps_throttle = 0,
+        .compression_dict = NULL,
+        .compression_dict_len = 0,
     };
 
 #if 0
@@ -90,11 +90,17 @@
 #include "linux_netlink_control.h"
 #include "linux_wireless_rfkill.h"
 #include "linux_nexmon_control.h"
+#include "linux_tpacket.h"
 
 #include "../wifi_ht_channels.h"
 
 #define MAX_PACKET_LEN  8192
 
+/* Default TPACKET_V3 ring: 32 blocks of 256KB, handed over at least every 100ms */
+#define TPACKET_BLOCK_KB        256
+#define TPACKET_BLOCKS          32
+#define TPACKET_TIMEOUT_MS      100
+
 /* State tracking, put in userdata */
 typedef struct {
     pcap_t *pd;
@@ -147,6 +153,26 @@ typedef struct {
     unsigned long channel_set_ns_avg;
     unsigned int channel_set_ns_count;
 
+    /* Capture with a TPACKET_V3 ring instead of libpcap, when enabled with the 
+     * tpacket=true source option and the kernel supports it; libpcap is still used to
+     * find the link type and compile filters, and is used to capture if the ring can't
+     * be set up */
+    int use_tpacket;
+    unsigned int tpacket_block_kb;
+    unsigned int tpacket_blocks;
+    unsigned int tpacket_timeout_ms;
+    int tpacket_open;
+#ifdef HAVE_LINUX_TPACKET_V3
+    linux_tpacket_t tpacket;
+#endif
+
+    /* Last time capture statistics were sent */
+    time_t last_stats;
+
+    /* We installed our own filter at open to ignore local interfaces or addresses;
+     * a capture filter from the server would replace it */
+    int local_filter;
+
 } local_wifi_t;
 
 /* Linux Wi-Fi Channels:
@@ -832,6 +858,115 @@ int chancontrol_callback(kis_capture_handler_t *caph, uint32_t seqno, void *priv
 }
 
 
+/* Capture filter callback; the server compiles the filter for our link type, and 
+ * we hand it to libpcap or attach it to the TPACKET socket */
+int filter_callback(kis_capture_handler_t *caph, uint32_t seqno, unsigned int dlt,
+        const cf_bpf_insn_t *program, size_t program_len, char *msg) {
+    local_wifi_t *local_wifi = (local_wifi_t *) caph->userdata;
+    struct bpf_program bpf;
+    size_t i;
+
+    if (local_wifi->local_filter) {
+        snprintf(msg, STATUS_MAX, "%s already filtering local interfaces or addresses",
+                local_wifi->name);
+        return -1;
+    }
+
+    if ((int) dlt != local_wifi->datalink_type) {
+        snprintf(msg, STATUS_MAX, "%s capture filter is for link type %u, capturing "
+                "with link type %d", local_wifi->name, dlt, local_wifi->datalink_type);
+        return -1;
+    }
+
+#ifdef HAVE_LINUX_TPACKET_V3
+    if (local_wifi->tpacket_open) {
+        struct sock_fprog fprog;
+        struct sock_filter *filter;
+
+        if (program_len == 0) {
+            if (setsockopt(local_wifi->tpacket.fd, SOL_SOCKET, SO_DETACH_FILTER, 
+                        NULL, 0) < 0 && errno != ENOENT) {
+                snprintf(msg, STATUS_MAX, "%s could not remove capture filter: %s",
+                        local_wifi->name, strerror(errno));
+                return -1;
+            }
+
+            return 0;
+        }
+
+        filter = (struct sock_filter *) malloc(sizeof(struct sock_filter) * program_len);
+
+        if (filter == NULL) {
+            snprintf(msg, STATUS_MAX, "%s could not allocate capture filter", 
+                    local_wifi->name);
+            return -1;
+        }
+
+        for (i = 0; i < program_len; i++) {
+            filter[i].code = program[i].code;
+            filter[i].jt = program[i].jt;
+            filter[i].jf = program[i].jf;
+            filter[i].k = program[i].k;
+        }
+
+        fprog.len = program_len;
+        fprog.filter = filter;
+
+        if (setsockopt(local_wifi->tpacket.fd, SOL_SOCKET, SO_ATTACH_FILTER, 
+                    &fprog, sizeof(fprog)) < 0) {
+            snprintf(msg, STATUS_MAX, "%s could not attach capture filter: %s",
+                    local_wifi->name, strerror(errno));
+            free(filter);
+            return -1;
+        }
+
+        free(filter);
+
+        return 0;
+    }
+#endif
+
+    if (local_wifi->pd == NULL) {
+        snprintf(msg, STATUS_MAX, "%s is not capturing", local_wifi->name);
+        return -1;
+    }
+
+    /* libpcap can't remove a filter, so an empty program becomes one that accepts 
+     * everything */
+    bpf.bf_len = program_len > 0 ? program_len : 1;
+    bpf.bf_insns = (struct bpf_insn *) malloc(sizeof(struct bpf_insn) * bpf.bf_len);
+
+    if (bpf.bf_insns == NULL) {
+        snprintf(msg, STATUS_MAX, "%s could not allocate capture filter", local_wifi->name);
+        return -1;
+    }
+
+    if (program_len == 0) {
+        bpf.bf_insns[0].code = BPF_RET | BPF_K;
+        bpf.bf_insns[0].jt = 0;
+        bpf.bf_insns[0].jf = 0;
+        bpf.bf_insns[0].k = MAX_PACKET_LEN;
+    }
+
+    for (i = 0; i < program_len; i++) {
+        bpf.bf_insns[i].code = program[i].code;
+        bpf.bf_insns[i].jt = program[i].jt;
+        bpf.bf_insns[i].jf = program[i].jf;
+        bpf.bf_insns[i].k = program[i].k;
+    }
+
+    if (pcap_setfilter(local_wifi->pd, &bpf) < 0) {
+        snprintf(msg, STATUS_MAX, "%s could not set capture filter: %s", 
+                local_wifi->name, pcap_geterr(local_wifi->pd));
+        free(bpf.bf_insns);
+        return -1;
+    }
+
+    free(bpf.bf_insns);
+
+    return 0;
+}
+
 int probe_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
         char *msg, char **uuid, KismetExternal__Command *frame,
         cf_params_interface_t **ret_interface,
@@ -1242,6 +1377,10 @@ int open_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
     int filter_locals = 0;
     char *ignore_filter = NULL;
     struct bpf_program bpf;
+    int filter_set = 0;
+#ifdef HAVE_LINUX_TPACKET_V3
+    struct sock_fprog fprog;
+#endif
 
     int i;
 
@@ -1285,6 +1424,13 @@ int open_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
         local_wifi->pd = NULL;
     }
 
+#ifdef HAVE_LINUX_TPACKET_V3
+    if (local_wifi->tpacket_open) {
+        linux_tpacket_close(&local_wifi->tpacket);
+        local_wifi->tpacket_open = 0;
+    }
+#endif
+
     /* Start processing the open */
 
     if ((placeholder_len = cf_parse_interface(&placeholder, definition)) <= 0) {
@@ -1321,6 +1467,46 @@ int open_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
         }
     }
 
+    /* Do we capture with a TPACKET_V3 ring? */
+    if ((placeholder_len = 
+                cf_find_flag(&placeholder, "tpacket", definition)) > 0) {
+        if (strncasecmp(placeholder, "false", placeholder_len) == 0) {
+            local_wifi->use_tpacket = 0;
+        } else if (strncasecmp(placeholder, "true", placeholder_len) == 0) {
+            local_wifi->use_tpacket = 1;
+        }
+    }
+
+    if ((placeholder_len = 
+                cf_find_flag(&placeholder, "tpacket_block_kb", definition)) > 0) {
+        if (sscanf(placeholder, "%u", &local_wifi->tpacket_block_kb) != 1 ||
+                local_wifi->tpacket_block_kb == 0) {
+            snprintf(msg, STATUS_MAX, "%s could not parse tpacket_block_kb= option", 
+                    local_wifi->name);
+            return -1;
+        }
+    }
+
+    if ((placeholder_len = 
+                cf_find_flag(&placeholder, "tpacket_blocks", definition)) > 0) {
+        if (sscanf(placeholder, "%u", &local_wifi->tpacket_blocks) != 1 ||
+                local_wifi->tpacket_blocks == 0) {
+            snprintf(msg, STATUS_MAX, "%s could not parse tpacket_blocks= option", 
+                    local_wifi->name);
+            return -1;
+        }
+    }
+
+    if ((placeholder_len = 
+                cf_find_flag(&placeholder, "tpacket_timeout_ms", definition)) > 0) {
+        if (sscanf(placeholder, "%u", &local_wifi->tpacket_timeout_ms) != 1 ||
+                local_wifi->tpacket_timeout_ms == 0) {
+            snprintf(msg, STATUS_MAX, "%s could not parse tpacket_timeout_ms= option", 
+                    local_wifi->name);
+            return -1;
+        }
+    }
+
     /* Do we ignore any other interfaces on this device? */
     if ((placeholder_len = 
                 cf_find_flag(&placeholder, "filter_locals", definition)) > 0) {
@@ -2372,6 +2558,8 @@ int open_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
                             "local interfaces: %s",
                             local_wifi->name, pcap_geterr(local_wifi->pd));
                     cf_send_message(caph, errstr, MSGFLAG_INFO);
+                } else {
+                    filter_set = 1;
                 }
             }
 
@@ -2390,6 +2578,8 @@ int open_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
                             "local interfaces: %s",
                             local_wifi->name, pcap_geterr(local_wifi->pd));
                     cf_send_message(caph, errstr, MSGFLAG_INFO);
+                } else {
+                    filter_set = 1;
                 }
             }
 
@@ -2415,6 +2605,8 @@ int open_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
                             "specific addresses: %s",
                             local_wifi->name, pcap_geterr(local_wifi->pd));
                     cf_send_message(caph, errstr, MSGFLAG_INFO);
+                } else {
+                    filter_set = 1;
                 }
             }
 
@@ -2431,6 +2623,48 @@ int open_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
 
     local_wifi->datalink_type = pcap_datalink(local_wifi->pd);
     *dlt = local_wifi->datalink_type;
+    local_wifi->local_filter = filter_set;
+
+    /* libpcap hands us the frames exactly as the kernel captured them for the Wi-Fi link
+     * types, so the TPACKET ring can replace it; the pcap handle is closed so the 
+     * kernel doesn't queue every packet twice */
+#ifdef HAVE_LINUX_TPACKET_V3
+    if (local_wifi->use_tpacket) {
+        if (local_wifi->datalink_type != DLT_IEEE802_11 &&
+                local_wifi->datalink_type != DLT_IEEE802_11_RADIO &&
+                local_wifi->datalink_type != DLT_IEEE802_11_RADIO_AVS &&
+                local_wifi->datalink_type != DLT_PRISM_HEADER) {
+            snprintf(errstr, STATUS_MAX, "%s interface '%s' has link type %d, capturing "
+                    "with libpcap instead of a TPACKET ring", local_wifi->name, 
+                    local_wifi->cap_interface, local_wifi->datalink_type);
+            cf_send_message(caph, errstr, MSGFLAG_INFO);
+        } else {
+            if (filter_set) {
+                fprog.len = bpf.bf_len;
+                fprog.filter = (struct sock_filter *) bpf.bf_insns;
+            }
+
+            if (linux_tpacket_open(&local_wifi->tpacket, local_wifi->cap_interface,
+                        local_wifi->tpacket_block_kb * 1024, local_wifi->tpacket_blocks,
+                        local_wifi->tpacket_timeout_ms, filter_set ? &fprog : NULL, 
+                        errstr2) < 0) {
+                snprintf(errstr, STATUS_MAX, "%s could not open a TPACKET capture ring on "
+                        "'%s', capturing with libpcap instead: %s", local_wifi->name, 
+                        local_wifi->cap_interface, errstr2);
+                cf_send_message(caph, errstr, MSGFLAG_INFO);
+            } else {
+                local_wifi->tpacket_open = 1;
+                pcap_close(local_wifi->pd);
+                local_wifi->pd = NULL;
+            }
+        }
+    }
+#endif
+
+    if (filter_set)
+        pcap_freecode(&bpf);
+
+    local_wifi->last_stats = 0;
 
     if (strcmp(local_wifi->interface, local_wifi->cap_interface) != 0) {
         snprintf(msg, STATUS_MAX, "%s Linux Wi-Fi capturing from monitor vif '%s' on "
@@ -2592,18 +2826,27 @@ void pcap_dispatch_cb(u_char *user, const struct pcap_pkthdr *header,
     kis_capture_handler_t *caph = (kis_capture_handler_t *) user;
     local_wifi_t *local_wifi = (local_wifi_t *) caph->userdata;
     int ret;
+    struct pcap_stat ps;
 
     /* fprintf(stderr, "debug - pcap_dispatch - got packet %u\n", header->caplen); */
 
+    /* Report the kernel drop counters about once a second */
+    if (header->ts.tv_sec != local_wifi->last_stats) {
+        local_wifi->last_stats = header->ts.tv_sec;
+
+        if (pcap_stats(local_wifi->pd, &ps) == 0)
+            cf_send_stats(caph, ps.ps_recv, ps.ps_drop);
+    }
+
     /* Try repeatedly to send the packet; go into a thread wait state if
      * the write buffer is full & we'll be woken up as soon as it flushes
      * data out in the main select() loop */
     while (1) {
-        if ((ret = cf_send_data(caph, 
+        if ((ret = cf_send_data_truncated(caph, 
                         NULL, NULL, NULL,
                         header->ts, 
                         local_wifi->datalink_type,
-                        header->caplen, (uint8_t *) data)) < 0) {
+                        header->len, header->caplen, (uint8_t *) data)) < 0) {
             pcap_breakloop(local_wifi->pd);
             cf_send_error(caph, 0, "unable to send DATA frame");
             cf_handler_spindown(caph);
@@ -2617,6 +2860,82 @@ void pcap_dispatch_cb(u_char *user, const struct pcap_pkthdr *header,
     }
 }
 
+#ifdef HAVE_LINUX_TPACKET_V3
+/* Capture from the TPACKET ring until it fails; every packet in a block is sent as 
+ * one batch, and the block is returned to the kernel as soon as the batch is queued.
+ * errstr is set to the reason the capture stopped, and must hold STATUS_MAX characters */
+void tpacket_capture_loop(kis_capture_handler_t *caph, char *errstr) {
+    local_wifi_t *local_wifi = (local_wifi_t *) caph->userdata;
+    struct tpacket_block_desc *block;
+    struct tpacket3_hdr *hdr;
+    cf_packet_t *packets = NULL;
+    size_t packets_sz = 0;
+    uint32_t num_pkts, i;
+    time_t now;
+    int ret;
+
+    errstr[0] = 0;
+
+    while (1) {
+        ret = linux_tpacket_next_block(&local_wifi->tpacket, 1000, &block, errstr);
+
+        if (ret < 0)
+            break;
+
+        /* Report the kernel drop counters about once a second */
+        now = time(NULL);
+        if (now != local_wifi->last_stats) {
+            local_wifi->last_stats = now;
+
+            if (linux_tpacket_update_stats(&local_wifi->tpacket) > 0)
+                cf_send_stats(caph, local_wifi->tpacket.total_packets, 
+                        local_wifi->tpacket.total_drops);
+        }
+
+        if (ret == 0)
+            continue;
+
+        num_pkts = block->hdr.bh1.num_pkts;
+
+        if (num_pkts > packets_sz) {
+            free(packets);
+            packets_sz = num_pkts;
+
+            if ((packets = (cf_packet_t *) malloc(sizeof(cf_packet_t) * packets_sz)) == NULL) {
+                linux_tpacket_release_block(&local_wifi->tpacket, block);
+                snprintf(errstr, STATUS_MAX, "unable to allocate packet batch");
+                break;
+            }
+        }
+
+        hdr = (struct tpacket3_hdr *) ((uint8_t *) block + block->hdr.bh1.offset_to_first_pkt);
+
+        for (i = 0; i < num_pkts; i++) {
+            packets[i].ts.tv_sec = hdr->tp_sec;
+            packets[i].ts.tv_usec = hdr->tp_nsec / 1000;
+            packets[i].dlt = local_wifi->datalink_type;
+            packets[i].packet_sz = hdr->tp_snaplen;
+            packets[i].original_sz = hdr->tp_len;
+            packets[i].pack = (uint8_t *) hdr + hdr->tp_mac;
+
+            hdr = (struct tpacket3_hdr *) ((uint8_t *) hdr + hdr->tp_next_offset);
+        }
+
+        ret = cf_send_data_batch(caph, packets, num_pkts);
+
+        linux_tpacket_release_block(&local_wifi->tpacket, block);
+
+        if (ret < 0) {
+            cf_send_error(caph, 0, "unable to send DATA frame");
+            snprintf(errstr, STATUS_MAX, "unable to send DATA frame");
+            break;
+        }
+    }
+
+    free(packets);
+}
+#endif
+
 void capture_thread(kis_capture_handler_t *caph) {
     local_wifi_t *local_wifi = (local_wifi_t *) caph->userdata;
     char errstr[PCAP_ERRBUF_SIZE];
@@ -2624,6 +2943,16 @@ void capture_thread(kis_capture_handler_t *caph) {
     char iferrstr[STATUS_MAX];
     int ifflags = 0, ifret;
 
+#ifdef HAVE_LINUX_TPACKET_V3
+    if (local_wifi->tpacket_open) {
+        tpacket_capture_loop(caph, iferrstr);
+
+        snprintf(errstr, PCAP_ERRBUF_SIZE, "%s interface '%s' closed: %s", 
+                local_wifi->name, local_wifi->cap_interface, 
+                strlen(iferrstr) == 0 ? "interface closed" : iferrstr);
+    } else {
+#endif
+
     /* Simple capture thread: since we don't care about blocking and 
      * channel control is managed by the channel hopping thread, all we have
      * to do is enter a blocking pcap loop */
@@ -2636,6 +2965,10 @@ void capture_thread(kis_capture_handler_t *caph) {
             local_wifi->name, local_wifi->cap_interface, 
             strlen(pcap_errstr) == 0 ? "interface closed" : pcap_errstr );
 
+#ifdef HAVE_LINUX_TPACKET_V3
+    }
+#endif
+
     cf_send_error(caph, 0, errstr);
 
     ifret = ifconfig_get_flags(local_wifi->cap_interface, iferrstr, &ifflags);
@@ -2740,6 +3073,13 @@ int main(int argc, char *argv[]) {
         .interface_sem = NULL,
         .datalink_type = -1,
         .override_dlt = -1,
+        .use_tpacket = 0,
+        .tpacket_block_kb = TPACKET_BLOCK_KB,
+        .tpacket_blocks = TPACKET_BLOCKS,
+        .tpacket_timeout_ms = TPACKET_TIMEOUT_MS,
+        .tpacket_open = 0,
+        .last_stats = 0,
+        .local_filter = 0,
         .use_mac80211_vif = 1,
         .use_mac80211_channels = 1,
         .use_mac80211_mode = 0,
@@ -2795,6 +3135,9 @@ int main(int argc, char *argv[]) {
     /* Set the control cb */
     cf_handler_set_chancontrol_cb(caph, chancontrol_callback);
 
+    /* Set the capture filter cb */
+    cf_handler_set_filter_cb(caph, filter_callback);
+
     /* Set the capture thread */
     cf_handler_set_capture_cb(caph, capture_thread);
 
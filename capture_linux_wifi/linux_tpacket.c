@@ -0,0 +1,210 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "../config.h"
+#include "linux_tpacket.h"
+
+#ifdef HAVE_LINUX_TPACKET_V3
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include <linux/if_ether.h>
+
+#include "../capture_framework.h"
+
+int linux_tpacket_open(linux_tpacket_t *tp, const char *interface, 
+        unsigned int block_sz, unsigned int num_blocks, unsigned int block_timeout_ms,
+        struct sock_fprog *filter, char *errstr) {
+    struct tpacket_req3 req;
+    struct sockaddr_ll sll;
+    int version = TPACKET_V3;
+    long page_sz;
+    unsigned int ifindex;
+
+    memset(tp, 0, sizeof(linux_tpacket_t));
+    tp->fd = -1;
+
+    if ((ifindex = if_nametoindex(interface)) == 0) {
+        snprintf(errstr, STATUS_MAX, "could not find interface index: %s", strerror(errno));
+        return -1;
+    }
+
+    /* Blocks must be a multiple of the page size */
+    page_sz = sysconf(_SC_PAGESIZE);
+    if (page_sz <= 0)
+        page_sz = 4096;
+
+    block_sz = ((block_sz + page_sz - 1) / page_sz) * page_sz;
+
+    if (num_blocks == 0)
+        num_blocks = 1;
+
+    /* Don't get any packets until the ring and filter are in place; the socket is bound
+     * to the interface last */
+    if ((tp->fd = socket(AF_PACKET, SOCK_RAW, 0)) < 0) {
+        snprintf(errstr, STATUS_MAX, "could not open packet socket: %s", strerror(errno));
+        return -1;
+    }
+
+    if (setsockopt(tp->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+        snprintf(errstr, STATUS_MAX, "kernel does not support TPACKET_V3: %s", strerror(errno));
+        linux_tpacket_close(tp);
+        return -1;
+    }
+
+    if (filter != NULL && 
+            setsockopt(tp->fd, SOL_SOCKET, SO_ATTACH_FILTER, filter, sizeof(struct sock_fprog)) < 0) {
+        snprintf(errstr, STATUS_MAX, "could not attach packet filter: %s", strerror(errno));
+        linux_tpacket_close(tp);
+        return -1;
+    }
+
+    /* Frames are variable length in V3; the frame size only has to be consistent with
+     * the block size */
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = block_sz;
+    req.tp_block_nr = num_blocks;
+    req.tp_frame_size = TPACKET_ALIGNMENT << 7;
+    req.tp_frame_nr = (block_sz / req.tp_frame_size) * num_blocks;
+    req.tp_retire_blk_tov = block_timeout_ms;
+    req.tp_feature_req_word = 0;
+
+    if (setsockopt(tp->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+        snprintf(errstr, STATUS_MAX, "could not allocate a %u x %u byte capture ring: %s", 
+                num_blocks, block_sz, strerror(errno));
+        linux_tpacket_close(tp);
+        return -1;
+    }
+
+    tp->ring_sz = (size_t) block_sz * num_blocks;
+    tp->ring = (uint8_t *) mmap(NULL, tp->ring_sz, PROT_READ | PROT_WRITE, 
+            MAP_SHARED, tp->fd, 0);
+
+    if (tp->ring == MAP_FAILED) {
+        tp->ring = NULL;
+        snprintf(errstr, STATUS_MAX, "could not map the capture ring: %s", strerror(errno));
+        linux_tpacket_close(tp);
+        return -1;
+    }
+
+    tp->block_sz = block_sz;
+    tp->num_blocks = num_blocks;
+    tp->block_pos = 0;
+
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = ifindex;
+
+    if (bind(tp->fd, (struct sockaddr *) &sll, sizeof(sll)) < 0) {
+        snprintf(errstr, STATUS_MAX, "could not bind to interface: %s", strerror(errno));
+        linux_tpacket_close(tp);
+        return -1;
+    }
+
+    return 1;
+}
+
+int linux_tpacket_next_block(linux_tpacket_t *tp, int timeout_ms, 
+        struct tpacket_block_desc **block, char *errstr) {
+    struct tpacket_block_desc *b;
+    struct pollfd pfd;
+    int err;
+    socklen_t errlen;
+
+    b = (struct tpacket_block_desc *) (tp->ring + ((size_t) tp->block_pos * tp->block_sz));
+
+    if ((b->hdr.bh1.block_status & TP_STATUS_USER) == 0) {
+        pfd.fd = tp->fd;
+        pfd.events = POLLIN | POLLERR;
+        pfd.revents = 0;
+
+        if (poll(&pfd, 1, timeout_ms) < 0) {
+            if (errno == EINTR)
+                return 0;
+
+            snprintf(errstr, STATUS_MAX, "error waiting for packets: %s", strerror(errno));
+            return -1;
+        }
+
+        if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+            err = 0;
+            errlen = sizeof(err);
+            getsockopt(tp->fd, SOL_SOCKET, SO_ERROR, &err, &errlen);
+
+            snprintf(errstr, STATUS_MAX, "capture socket closed: %s", 
+                    err != 0 ? strerror(err) : "interface closed");
+            return -1;
+        }
+
+        if ((b->hdr.bh1.block_status & TP_STATUS_USER) == 0)
+            return 0;
+    }
+
+    /* Make sure we see the packets the kernel wrote before it flagged the block */
+    __sync_synchronize();
+
+    *block = b;
+
+    tp->block_pos = (tp->block_pos + 1) % tp->num_blocks;
+
+    return 1;
+}
+
+void linux_tpacket_release_block(linux_tpacket_t *tp, struct tpacket_block_desc *block) {
+    __sync_synchronize();
+    block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+}
+
+int linux_tpacket_update_stats(linux_tpacket_t *tp) {
+    struct tpacket_stats_v3 stats;
+    socklen_t len = sizeof(stats);
+
+    if (getsockopt(tp->fd, SOL_PACKET, PACKET_STATISTICS, &stats, &len) < 0)
+        return -1;
+
+    /* The kernel packet count already includes the drops */
+    tp->total_packets += stats.tp_packets;
+    tp->total_drops += stats.tp_drops;
+
+    return 1;
+}
+
+void linux_tpacket_close(linux_tpacket_t *tp) {
+    if (tp->ring != NULL) {
+        munmap(tp->ring, tp->ring_sz);
+        tp->ring = NULL;
+    }
+
+    if (tp->fd >= 0) {
+        close(tp->fd);
+        tp->fd = -1;
+    }
+}
+
+#endif
+
@@ -0,0 +1,112 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __LINUX_TPACKET_H__
+#define __LINUX_TPACKET_H__
+
+#include "../config.h"
+
+#ifdef SYS_LINUX
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <linux/filter.h>
+#include <linux/if_packet.h>
+
+/* TPACKET_V3 was added in Linux 3.2; older headers can only use libpcap */
+#ifdef TPACKET3_HDRLEN
+#define HAVE_LINUX_TPACKET_V3 1
+#endif
+
+#endif
+
+#ifdef HAVE_LINUX_TPACKET_V3
+
+/* Memory-mapped AF_PACKET capture with a TPACKET_V3 block ring
+ *
+ * The kernel fills whole blocks of packets in a ring shared with the capture tool, and
+ * hands a block over once it is full or once it has been open for the block timeout.
+ * The capture tool processes every packet in a block and then returns the whole block
+ * to the kernel, so there is one wakeup per block instead of one copy and one
+ * syscall per packet.  When every block is waiting on the capture tool, the kernel
+ * drops packets and counts them.
+ */
+typedef struct {
+    int fd;
+
+    uint8_t *ring;
+    size_t ring_sz;
+
+    unsigned int block_sz;
+    unsigned int num_blocks;
+
+    /* Next block to be handed to us by the kernel */
+    unsigned int block_pos;
+
+    /* Kernel packet and drop totals since the ring was opened; the kernel resets its
+     * counters each time they are read */
+    uint64_t total_packets;
+    uint64_t total_drops;
+} linux_tpacket_t;
+
+/* Open a TPACKET_V3 capture ring on an interface, capturing the complete link layer
+ * frame of every packet.
+ *
+ * block_sz is rounded up to a multiple of the page size.  If filter is not NULL, it
+ * is attached to the socket before any packets are captured.
+ *
+ * errstr must hold STATUS_MAX characters.
+ *
+ * Returns:
+ * -1   Error, the ring could not be opened
+ *  1   Success
+ */
+int linux_tpacket_open(linux_tpacket_t *tp, const char *interface, 
+        unsigned int block_sz, unsigned int num_blocks, unsigned int block_timeout_ms,
+        struct sock_fprog *filter, char *errstr);
+
+/* Wait up to timeout_ms for the kernel to hand over the next block.
+ *
+ * Returns:
+ * -1   Error, such as the interface going away
+ *  0   No block is ready yet
+ *  1   *block is the next block of packets, which must be returned with
+ *      linux_tpacket_release_block before waiting for another
+ */
+int linux_tpacket_next_block(linux_tpacket_t *tp, int timeout_ms, 
+        struct tpacket_block_desc **block, char *errstr);
+
+/* Return a block to the kernel once all of its packets have been processed */
+void linux_tpacket_release_block(linux_tpacket_t *tp, struct tpacket_block_desc *block);
+
+/* Add the kernel packet and drop counters to the totals
+ *
+ * Returns:
+ * -1   Error
+ *  1   Success
+ */
+int linux_tpacket_update_stats(linux_tpacket_t *tp);
+
+/* Unmap the ring and close the socket */
+void linux_tpacket_close(linux_tpacket_t *tp);
+
+#endif
+
+#endif
+
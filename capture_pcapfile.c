@@ -43,7 +43,17 @@
  * line arguments, --in-fd= and --out-fd=
  *
  * We parse additional options from the source definition itself, such as a DLT
- * override, once we open the protocol
+ * override, once we open the protocol:
+ *
+ *  realtime=true   Replay with the original timing between packets
+ *  speed=N         Replay at N times the original speed
+ *  pps=N           Replay at N packets per second
+ *  files="a,b"     Merge additional files with the first, in timestamp order
+ *
+ * Otherwise packets are replayed as fast as Kismet can take them.  Classic pcap
+ * files are memory mapped and packets are sent in batches; pacing is measured from
+ * the start of the replay, so sleep overhead doesn't accumulate, and the achieved 
+ * rate is reported with the source statistics.
  *
  */
 
@@ -59,7 +69,9 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 
+#include <time.h>
 #include <unistd.h>
 #include <errno.h>
 
@@ -68,18 +80,211 @@
 #include "config.h"
 #include "capture_framework.h"
 
+/* Packets are sent to Kismet in batches of up to this many packets or bytes */
+#define REPLAY_BATCH_PACKETS    64
+#define REPLAY_BATCH_BYTES      (128 * 1024)
+
+/* Classic pcap file header magic, for microsecond and nanosecond timestamps */
+#define PCAP_MAGIC_USEC         0xa1b2c3d4
+#define PCAP_MAGIC_NSEC         0xa1b23c4d
+
+#define PCAP_FILE_HEADER_SZ     24
+#define PCAP_RECORD_HEADER_SZ   16
+
+/* A pcap file being replayed.  Classic pcap files are memory mapped and packets are
+ * sent straight from the map; pcapng files, and anything which can't be mapped such
+ * as a fifo, are read with libpcap. */
 typedef struct {
+    char *fname;
+    int dlt;
+
     pcap_t *pd;
+
+    uint8_t *map;
+    size_t map_sz;
+    size_t map_pos;
+    int swapped;
+    int nsec;
+
+    /* Next packet in the file, if valid */
+    int valid;
+    struct timeval ts;
+    uint32_t caplen;
+    uint32_t len;
+    const uint8_t *data;
+
+    /* Why the file ended, if it wasn't the end of the file */
+    char errstr[PCAP_ERRBUF_SIZE];
+} pcap_reader_t;
+
+typedef struct {
+    /* Files in the source, replayed together in timestamp order */
+    pcap_reader_t *readers;
+    size_t num_readers;
+
     char *pcapfname;
     int datalink_type;
     int override_dlt;
 
-    int realtime;
-    struct timeval last_ts;
+    /* Multiple of the original capture speed, or 0 for as fast as possible */
+    double speed;
 
     unsigned int pps_throttle;
 } local_pcap_t;
 
+static uint32_t pcap_reader_u32(pcap_reader_t *reader, size_t pos) {
+    uint32_t v;
+
+    memcpy(&v, reader->map + pos, sizeof(uint32_t));
+
+    if (reader->swapped)
+        v = ((v & 0xFF) << 24) | ((v & 0xFF00) << 8) | 
+            ((v & 0xFF0000) >> 8) | ((v & 0xFF000000) >> 24);
+
+    return v;
+}
+
+/* Advance to the next packet; returns 1 if there is one, 0 at the end of the file */
+static int pcap_reader_next(pcap_reader_t *reader) {
+    struct pcap_pkthdr *header;
+    const u_char *data;
+    uint32_t ts_frac;
+    int r;
+
+    reader->valid = 0;
+
+    if (reader->map != NULL) {
+        if (reader->map_sz - reader->map_pos < PCAP_RECORD_HEADER_SZ) {
+            if (reader->map_pos != reader->map_sz)
+                snprintf(reader->errstr, PCAP_ERRBUF_SIZE, "truncated dump file");
+            return 0;
+        }
+
+        reader->caplen = pcap_reader_u32(reader, reader->map_pos + 8);
+        reader->len = pcap_reader_u32(reader, reader->map_pos + 12);
+
+        if (reader->caplen > reader->map_sz - reader->map_pos - PCAP_RECORD_HEADER_SZ) {
+            snprintf(reader->errstr, PCAP_ERRBUF_SIZE, "truncated dump file");
+            return 0;
+        }
+
+        reader->ts.tv_sec = pcap_reader_u32(reader, reader->map_pos);
+        ts_frac = pcap_reader_u32(reader, reader->map_pos + 4);
+        reader->ts.tv_usec = reader->nsec ? ts_frac / 1000 : ts_frac;
+
+        reader->data = reader->map + reader->map_pos + PCAP_RECORD_HEADER_SZ;
+        reader->map_pos += PCAP_RECORD_HEADER_SZ + reader->caplen;
+
+        reader->valid = 1;
+        return 1;
+    }
+
+    while ((r = pcap_next_ex(reader->pd, &header, &data)) == 0)
+        ;
+
+    if (r < 0) {
+        if (r == -1)
+            snprintf(reader->errstr, PCAP_ERRBUF_SIZE, "%s", pcap_geterr(reader->pd));
+        return 0;
+    }
+
+    reader->ts = header->ts;
+    reader->caplen = header->caplen;
+    reader->len = header->len;
+    reader->data = data;
+
+    reader->valid = 1;
+    return 1;
+}
+
+static void pcap_reader_close(pcap_reader_t *reader) {
+    if (reader->pd != NULL)
+        pcap_close(reader->pd);
+
+    if (reader->map != NULL)
+        munmap(reader->map, reader->map_sz);
+
+    free(reader->fname);
+
+    memset(reader, 0, sizeof(pcap_reader_t));
+}
+
+/* Open a pcap file and read the first packet; returns -1 and fills in errstr if the
+ * file can't be opened */
+static int pcap_reader_open(pcap_reader_t *reader, const char *fname, char *errstr) {
+    struct stat sbuf;
+    uint32_t magic;
+    void *map;
+    int fd;
+
+    memset(reader, 0, sizeof(pcap_reader_t));
+
+    reader->fname = strdup(fname);
+
+    /* Let libpcap validate the file and translate the link type, even if we map it */
+    reader->pd = pcap_open_offline(fname, errstr);
+
+    if (reader->pd == NULL)
+        return -1;
+
+    reader->dlt = pcap_datalink(reader->pd);
+
+    if (stat(fname, &sbuf) == 0 && S_ISREG(sbuf.st_mode) && 
+            (uint64_t) sbuf.st_size >= PCAP_FILE_HEADER_SZ &&
+            (uint64_t) sbuf.st_size <= (size_t) -1 &&
+            (fd = open(fname, O_RDONLY)) >= 0) {
+        map = mmap(NULL, sbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+
+        if (map != MAP_FAILED) {
+            reader->map = (uint8_t *) map;
+            reader->map_sz = sbuf.st_size;
+
+            memcpy(&magic, reader->map, sizeof(uint32_t));
+
+            if (magic == PCAP_MAGIC_USEC || magic == PCAP_MAGIC_NSEC) {
+                reader->swapped = 0;
+            } else {
+                reader->swapped = 1;
+                magic = pcap_reader_u32(reader, 0);
+            }
+
+            if (magic == PCAP_MAGIC_USEC || magic == PCAP_MAGIC_NSEC) {
+                reader->nsec = (magic == PCAP_MAGIC_NSEC);
+                reader->map_pos = PCAP_FILE_HEADER_SZ;
+
+#ifdef MADV_SEQUENTIAL
+                madvise(reader->map, reader->map_sz, MADV_SEQUENTIAL);
+#endif
+
+                pcap_close(reader->pd);
+                reader->pd = NULL;
+            } else {
+                /* Not a classic pcap, such as pcapng; leave it to libpcap */
+                munmap(reader->map, reader->map_sz);
+                reader->map = NULL;
+                reader->map_sz = 0;
+                reader->swapped = 0;
+            }
+        }
+    }
+
+    pcap_reader_next(reader);
+
+    return 1;
+}
+
+static void local_pcap_close(local_pcap_t *local_pcap) {
+    size_t i;
+
+    for (i = 0; i < local_pcap->num_readers; i++)
+        pcap_reader_close(&(local_pcap->readers[i]));
+
+    free(local_pcap->readers);
+    local_pcap->readers = NULL;
+    local_pcap->num_readers = 0;
+}
+
 int probe_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
         char *msg, char **uuid, KismetExternal__Command *frame,
         cf_params_interface_t **ret_interface, 
@@ -161,6 +366,10 @@ int open_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
 
     char errstr[PCAP_ERRBUF_SIZE] = "";
 
+    char **files = NULL;
+    size_t num_files = 0;
+    size_t i;
+
     /* pcapfile does not support channel ops */
     *ret_interface = cf_params_interface_new();
     *ret_spectrum = NULL;
@@ -174,10 +383,7 @@ int open_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
         local_pcap->pcapfname = NULL;
     }
 
-    if (local_pcap->pd != NULL) {
-        pcap_close(local_pcap->pd);
-        local_pcap->pd = NULL;
-    }
+    local_pcap_close(local_pcap);
 
     if ((placeholder_len = cf_parse_interface(&placeholder, definition)) <= 0) {
         /* What was not an error during probe definitely is an error during open */
@@ -194,17 +400,47 @@ int open_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
         return -1;
     }
 
+    /* Additional files are merged with the first by timestamp */
+    if ((placeholder_len = cf_find_flag(&placeholder, "files", definition)) > 0) {
+        if (cf_split_list(placeholder, placeholder_len, ',', &files, &num_files) < 0) {
+            snprintf(msg, STATUS_MAX, "Unable to parse list of additional files");
+            return -1;
+        }
+    }
+
+    local_pcap->readers = 
+        (pcap_reader_t *) calloc(num_files + 1, sizeof(pcap_reader_t));
+
+    if (local_pcap->readers == NULL) {
+        snprintf(msg, STATUS_MAX, "Unable to allocate pcapfile readers");
+        return -1;
+    }
+
     /* We don't check for regular file during open, only probe; we don't want to 
      * open a fifo during probe and then cause a glitch, but we could open it during
      * normal operation */
+    for (i = 0; i < num_files + 1; i++) {
+        const char *fname = i == 0 ? pcapfname : files[i - 1];
 
-    local_pcap->pd = pcap_open_offline(pcapfname, errstr);
-    if (strlen(errstr) > 0) {
-        snprintf(msg, STATUS_MAX, "%s", errstr);
+        if (pcap_reader_open(&(local_pcap->readers[i]), fname, errstr) < 0) {
+            snprintf(msg, STATUS_MAX, "Unable to open pcapfile '%s': %s", fname, errstr);
+            pcap_reader_close(&(local_pcap->readers[i]));
+            break;
+        }
+
+        local_pcap->num_readers++;
+    }
+
+    for (i = 0; i < num_files; i++)
+        free(files[i]);
+    free(files);
+
+    if (local_pcap->num_readers != num_files + 1) {
+        local_pcap_close(local_pcap);
         return -1;
     }
 
-    local_pcap->datalink_type = pcap_datalink(local_pcap->pd);
+    local_pcap->datalink_type = local_pcap->readers[0].dlt;
     *dlt = local_pcap->datalink_type;
 
     /* Kluge a UUID out of the name */
@@ -216,14 +452,29 @@ int open_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
     *uuid = strdup(errstr);
 
     /* Successful open with no channel, hop, or chanset data */
-    snprintf(msg, STATUS_MAX, "Opened pcapfile '%s' for playback", pcapfname);
+    if (num_files == 0)
+        snprintf(msg, STATUS_MAX, "Opened pcapfile '%s' for playback", pcapfname);
+    else
+        snprintf(msg, STATUS_MAX, "Opened pcapfile '%s' and %lu additional files for "
+                "playback", pcapfname, (unsigned long) num_files);
+
+    local_pcap->speed = 0;
+    local_pcap->pps_throttle = 0;
 
     if ((placeholder_len = cf_find_flag(&placeholder, "realtime", definition)) > 0) {
         if (strncasecmp(placeholder, "true", placeholder_len) == 0) {
             snprintf(errstr, PCAP_ERRBUF_SIZE, 
                     "Pcapfile '%s' will replay in realtime", pcapfname);
             cf_send_message(caph, errstr, MSGFLAG_INFO);
-            local_pcap->realtime = 1;
+            local_pcap->speed = 1;
+        }
+    } else if ((placeholder_len = cf_find_flag(&placeholder, "speed", definition)) > 0) {
+        double speed;
+        if (sscanf(placeholder, "%lf", &speed) == 1 && speed > 0) {
+            snprintf(errstr, PCAP_ERRBUF_SIZE,
+                    "Pcapfile '%s' will replay at %.2fx realtime", pcapfname, speed);
+            cf_send_message(caph, errstr, MSGFLAG_INFO);
+            local_pcap->speed = speed;
         }
     } else if ((placeholder_len = cf_find_flag(&placeholder, "pps", definition)) > 0) {
         unsigned int pps;
@@ -238,92 +489,239 @@ int open_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
     return 1;
 }
 
-void pcap_dispatch_cb(u_char *user, const struct pcap_pkthdr *header,
-        const u_char *data)  {
-    kis_capture_handler_t *caph = (kis_capture_handler_t *) user;
+/* Replay state for the capture thread */
+typedef struct {
+    cf_packet_t packets[REPLAY_BATCH_PACKETS];
+
+    /* Packets from libpcap readers are copied, since libpcap reuses its buffer; the
+     * offset of each copy in the arena, or -1 for packets sent from the map */
+    ssize_t arena_offt[REPLAY_BATCH_PACKETS];
+    uint8_t *arena;
+    size_t arena_sz;
+    size_t arena_len;
+
+    size_t num_packets;
+    size_t num_bytes;
+
+    struct timespec start;
+    struct timeval first_ts;
+    struct timeval last_ts;
+    uint64_t total_packets;
+
+    struct timespec last_report;
+    uint64_t last_report_packets;
+} replay_state_t;
+
+static int64_t timespec_diff_ns(const struct timespec *a, const struct timespec *b) {
+    return (int64_t) (a->tv_sec - b->tv_sec) * 1000000000LL + (a->tv_nsec - b->tv_nsec);
+}
+
+static int64_t timeval_diff_us(const struct timeval *a, const struct timeval *b) {
+    return (int64_t) (a->tv_sec - b->tv_sec) * 1000000LL + (a->tv_usec - b->tv_usec);
+}
+
+/* Report the achieved rate against the target */
+static void replay_report(kis_capture_handler_t *caph, replay_state_t *state,
+        struct timespec *now) {
     local_pcap_t *local_pcap = (local_pcap_t *) caph->userdata;
-    int ret;
-    unsigned long delay_usec = 0;
-
-    /* If we're doing 'realtime' playback, delay accordingly based on the
-     * previous packet. 
-     *
-     * Because we're in our own thread, we can block as long as we want - this
-     * simulates blocking IO for capturing from hardware, too.
-     */
-    if (local_pcap->realtime) {
-        if (local_pcap->last_ts.tv_sec == 0 && local_pcap->last_ts.tv_usec == 0) {
-            delay_usec = 0;
-        } else {
-            /* Catch corrupt pcaps w/ inconsistent times */
-            if (header->ts.tv_sec < local_pcap->last_ts.tv_sec) {
-                delay_usec = 0;
-            } else {
-                delay_usec = (header->ts.tv_sec - local_pcap->last_ts.tv_sec) * 1000000L;
-            }
+    int64_t elapsed_ns = timespec_diff_ns(now, &(state->start));
+    int64_t interval_ns = timespec_diff_ns(now, &(state->last_report));
+    double speed = 0, pps = 0;
 
-            if (header->ts.tv_usec < local_pcap->last_ts.tv_usec) {
-                delay_usec += (1000000L - local_pcap->last_ts.tv_usec) + 
-                    header->ts.tv_usec;
-            } else {
-                delay_usec += header->ts.tv_usec - local_pcap->last_ts.tv_usec;
-            }
+    if (elapsed_ns > 0)
+        speed = (double) timeval_diff_us(&(state->last_ts), &(state->first_ts)) * 1000 /
+            elapsed_ns;
 
-        }
+    if (interval_ns > 0)
+        pps = (double) (state->total_packets - state->last_report_packets) * 1000000000 /
+            interval_ns;
 
-        local_pcap->last_ts.tv_sec = header->ts.tv_sec;
-        local_pcap->last_ts.tv_usec = header->ts.tv_usec;
+    cf_send_replay_stats(caph, local_pcap->speed, speed, local_pcap->pps_throttle, pps);
 
-        if (delay_usec != 0) {
-            usleep(delay_usec);
-        }
-    }
+    state->last_report = *now;
+    state->last_report_packets = state->total_packets;
+}
 
-    /* If we're doing 'packet per second' throttling, delay accordingly */
-    if (local_pcap->pps_throttle > 0) {
-        delay_usec = 1000000L / local_pcap->pps_throttle;
+/* Send the batch; returns -1 if it could not be sent */
+static int replay_flush(kis_capture_handler_t *caph, replay_state_t *state) {
+    struct timespec now;
+    size_t i;
 
-        if (delay_usec != 0)
-            usleep(delay_usec);
-    }
+    if (state->num_packets != 0) {
+        for (i = 0; i < state->num_packets; i++) {
+            if (state->arena_offt[i] >= 0)
+                state->packets[i].pack = state->arena + state->arena_offt[i];
+        }
 
-    /* Try repeatedly to send the packet; go into a thread wait state if
-     * the write buffer is full & we'll be woken up as soon as it flushes
-     * data out in the main select() loop */
-    while (1) {
-        if ((ret = cf_send_data(caph, 
-                        NULL, NULL, NULL,
-                        header->ts, 
-                        local_pcap->datalink_type,
-                        header->caplen, (uint8_t *) data)) < 0) {
-            pcap_breakloop(local_pcap->pd);
+        if (cf_send_data_batch(caph, state->packets, state->num_packets) < 0) {
             cf_send_error(caph, 0, "unable to send DATA frame");
             cf_handler_spindown(caph);
-        } else if (ret == 0) {
-            /* Go into a wait for the write buffer to get flushed */
-            // fprintf(stderr, "debug - pcapfile - dispatch_cb - no room in write buffer - waiting for it to have more space\n");
-            cf_handler_wait_ringbuffer(caph);
-            continue;
-        } else {
-            break;
+            return -1;
         }
+
+        state->num_packets = 0;
+        state->num_bytes = 0;
+        state->arena_len = 0;
     }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if (timespec_diff_ns(&now, &(state->last_report)) >= 1000000000LL)
+        replay_report(caph, state, &now);
+
+    return 1;
+}
+
+/* Add the next packet from a file to the batch and advance the file */
+static int replay_queue(replay_state_t *state, pcap_reader_t *reader) {
+    cf_packet_t *packet = &(state->packets[state->num_packets]);
+    uint8_t *arena;
+
+    packet->ts = reader->ts;
+    packet->dlt = reader->dlt;
+    packet->packet_sz = reader->caplen;
+    packet->original_sz = reader->len;
+
+    if (reader->map != NULL) {
+        packet->pack = (uint8_t *) reader->data;
+        state->arena_offt[state->num_packets] = -1;
+    } else {
+        if (state->arena_len + reader->caplen > state->arena_sz) {
+            arena = (uint8_t *) realloc(state->arena, 
+                    state->arena_len + reader->caplen + REPLAY_BATCH_BYTES);
+
+            if (arena == NULL)
+                return -1;
+
+            state->arena = arena;
+            state->arena_sz = state->arena_len + reader->caplen + REPLAY_BATCH_BYTES;
+        }
+
+        memcpy(state->arena + state->arena_len, reader->data, reader->caplen);
+        packet->pack = NULL;
+        state->arena_offt[state->num_packets] = state->arena_len;
+        state->arena_len += reader->caplen;
+    }
+
+    state->num_packets++;
+    state->num_bytes += reader->caplen;
+
+    state->last_ts = reader->ts;
+    state->total_packets++;
+
+    pcap_reader_next(reader);
+
+    return 1;
 }
 
 void capture_thread(kis_capture_handler_t *caph) {
     local_pcap_t *local_pcap = (local_pcap_t *) caph->userdata;
     char errstr[PCAP_ERRBUF_SIZE];
-    char *pcap_errstr;
+    replay_state_t state;
+    pcap_reader_t *reader;
+    struct timespec now, delay;
+    int64_t offset_ns, wait_ns;
+    double elapsed;
+    size_t i;
+
+    memset(&state, 0, sizeof(replay_state_t));
+
+    clock_gettime(CLOCK_MONOTONIC, &(state.start));
+    state.last_report = state.start;
+
+    while (1) {
+        /* Replay the files in timestamp order */
+        reader = NULL;
+
+        for (i = 0; i < local_pcap->num_readers; i++) {
+            if (!local_pcap->readers[i].valid)
+                continue;
 
-    pcap_loop(local_pcap->pd, -1, pcap_dispatch_cb, (u_char *) caph);
+            if (reader == NULL || timercmp(&(local_pcap->readers[i].ts), &(reader->ts), <))
+                reader = &(local_pcap->readers[i]);
+        }
+
+        if (reader == NULL)
+            break;
+
+        if (state.total_packets == 0) {
+            clock_gettime(CLOCK_MONOTONIC, &(state.start));
+            state.last_report = state.start;
+            state.first_ts = reader->ts;
+        }
+
+        /* Pace against the start of the replay rather than the previous packet, so
+         * delays don't accumulate; packets which are already due are sent in batches
+         * and we only send a partial batch when we have to wait.  Packets with a time
+         * before the first packet are sent immediately. */
+        offset_ns = -1;
+
+        if (local_pcap->speed > 0)
+            offset_ns = (int64_t) (timeval_diff_us(&(reader->ts), &(state.first_ts)) * 
+                    1000 / local_pcap->speed);
+        else if (local_pcap->pps_throttle > 0)
+            offset_ns = (int64_t) (state.total_packets * 1000000000LL / 
+                    local_pcap->pps_throttle);
+
+        if (offset_ns > 0) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            wait_ns = offset_ns - timespec_diff_ns(&now, &(state.start));
+
+            if (wait_ns > 0) {
+                if (replay_flush(caph, &state) < 0)
+                    break;
+
+                /* Because we're in our own thread, we can block as long as we want -
+                 * this simulates blocking IO for capturing from hardware, too. */
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                wait_ns = offset_ns - timespec_diff_ns(&now, &(state.start));
+
+                if (wait_ns > 0) {
+                    delay.tv_sec = wait_ns / 1000000000LL;
+                    delay.tv_nsec = wait_ns % 1000000000LL;
+
+                    while (nanosleep(&delay, &delay) < 0 && errno == EINTR)
+                        ;
+                }
+            }
+        }
+
+        if (replay_queue(&state, reader) < 0) {
+            cf_send_error(caph, 0, "unable to allocate replay buffer");
+            cf_handler_spindown(caph);
+            break;
+        }
+
+        if (!reader->valid) {
+            snprintf(errstr, PCAP_ERRBUF_SIZE, "Pcapfile '%s' closed: %s", 
+                    reader->fname, 
+                    strlen(reader->errstr) == 0 ? "end of pcapfile reached" : reader->errstr);
+            cf_send_message(caph, errstr, MSGFLAG_INFO);
+        }
 
-    pcap_errstr = pcap_geterr(local_pcap->pd);
+        if (state.num_packets >= REPLAY_BATCH_PACKETS || 
+                state.num_bytes >= REPLAY_BATCH_BYTES) {
+            if (replay_flush(caph, &state) < 0)
+                break;
+        }
+    }
+
+    if (replay_flush(caph, &state) >= 0) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        replay_report(caph, &state, &now);
 
-    snprintf(errstr, PCAP_ERRBUF_SIZE, "Pcapfile '%s' closed: %s", 
-            local_pcap->pcapfname, 
-            strlen(pcap_errstr) == 0 ? "end of pcapfile reached" : pcap_errstr );
+        elapsed = (double) timespec_diff_ns(&now, &(state.start)) / 1000000000;
+
+        snprintf(errstr, PCAP_ERRBUF_SIZE, "Pcapfile '%s' replayed %llu packets in %.2f "
+                "seconds, %.0f packets per second, %.2fx realtime", local_pcap->pcapfname,
+                (unsigned long long) state.total_packets, elapsed,
+                elapsed > 0 ? state.total_packets / elapsed : 0,
+                elapsed > 0 ? 
+                    timeval_diff_us(&(state.last_ts), &(state.first_ts)) / 1000000.0 / elapsed : 0);
+        cf_send_message(caph, errstr, MSGFLAG_INFO);
+    }
 
-    cf_send_message(caph, errstr, MSGFLAG_INFO);
+    free(state.arena);
 
     /* Instead of dying, spin forever in a sleep loop */
     while (1) {
@@ -335,13 +733,12 @@ void capture_thread(kis_capture_handler_t *caph) {
 
 int main(int argc, char *argv[]) {
     local_pcap_t local_pcap = {
-        .pd = NULL,
+        .readers = NULL,
+        .num_readers = 0,
         .pcapfname = NULL,
         .datalink_type = -1,
         .override_dlt = -1,
-        .realtime = 0,
-        .last_ts.tv_sec = 0,
-        .last_ts.tv_usec = 0,
+        .speed = 0,
         .pps_throttle = 0,
     };
 
@@ -185,6 +185,65 @@ void channel_tracker_v2::update_device_counts(std::unordered_map<double, unsigne
     }
 }
 
+bool channel_tracker_v2::get_channel_activity(const std::string& in_channel, double in_freq_khz,
+        time_t in_window, double& out_packets_sec, double& out_devices) {
+    local_locker locker(&lock);
+
+    std::shared_ptr<channel_tracker_v2_channel> chan;
+
+    // Devices are only counted by frequency, so prefer it
+    if (in_freq_khz != 0) {
+        auto imi = frequency_map->find(in_freq_khz);
+
+        if (imi != frequency_map->end())
+            chan = std::static_pointer_cast<channel_tracker_v2_channel>(imi->second);
+    }
+
+    if (chan == nullptr && in_channel.length() != 0) {
+        auto smi = channel_map->find(in_channel);
+
+        if (smi != channel_map->end())
+            chan = std::static_pointer_cast<channel_tracker_v2_channel>(smi->second);
+    }
+
+    out_packets_sec = 0;
+    out_devices = 0;
+
+    if (chan == nullptr)
+        return false;
+
+    if (in_window < 1)
+        in_window = 1;
+    if (in_window > 60)
+        in_window = 60;
+
+    time_t now = time(0);
+
+    // The minute RRD holds one slot per second; a slot is only current if it was
+    // written within the last minute of the RRD
+    auto packets_rrd = chan->get_packets_rrd();
+    auto packets_last = packets_rrd->get_last_time();
+    auto packets_vec = packets_rrd->get_minute_vec();
+    double packets = 0;
+
+    for (time_t t = now - in_window + 1; t <= now; t++) {
+        if (t > packets_last || packets_last - t >= 60)
+            continue;
+
+        packets += packets_vec->at(t % 60);
+    }
+
+    out_packets_sec = packets / in_window;
+
+    auto device_rrd = chan->get_device_rrd();
+    auto device_last = device_rrd->get_last_time();
+
+    if (now - device_last < 60)
+        out_devices = device_rrd->get_minute_vec()->at(device_last % 60);
+
+    return true;
+}
+
 int channel_tracker_v2::packet_chain_handler(CHAINCALL_PARMS) {
     channel_tracker_v2 *cv2 = (channel_tracker_v2 *) auxdata;
 
@@ -158,6 +158,12 @@ public:
     int device_decay;
     void update_device_counts(std::unordered_map<double, unsigned int> in_counts, time_t in_ts);
 
+    // Recent activity on a channel, found by frequency or by name: the average packets
+    // per second over the past in_window seconds (at most a minute), and the latest
+    // count of active devices.  Returns false if nothing has been seen there.
+    bool get_channel_activity(const std::string& in_channel, double in_freq_khz,
+            time_t in_window, double& out_packets_sec, double& out_devices);
+
 protected:
     kis_recursive_timed_mutex lock;
 
@@ -0,0 +1,526 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_LIBPCAP
+extern "C" {
+#ifndef HAVE_PCAPPCAP_H
+#include <pcap.h>
+#else
+#include <pcap/pcap.h>
+#endif
+}
+#endif
+
+#include "datasource_offline.h"
+#include "gpstracker.h"
+#include "kismetdb_blob.h"
+#include "kismetdb_segments.h"
+#include "messagebus.h"
+#include "packetchain.h"
+
+kis_datasource_offline::kis_datasource_offline(shared_datasource_builder in_builder,
+        std::shared_ptr<kis_recursive_timed_mutex> mutex) :
+    kis_datasource(in_builder, mutex),
+    stop {false},
+    next_file {0},
+    running_readers {0},
+    batch_sz {256},
+    num_ingested {0},
+    last_report_packets {0},
+    first_ts_usec {0},
+    last_ts_usec {0} {
+
+    // We don't have a capture binary
+    set_int_source_cap_interface("offline");
+    set_int_source_hardware("offline");
+}
+
+kis_datasource_offline::~kis_datasource_offline() {
+    stop = true;
+
+    for (auto& t : readers)
+        t.join();
+}
+
+kis_datasource_offline::file_type kis_datasource_offline::detect_file(const std::string& in_path) {
+    uint8_t magic[16];
+    uint32_t m;
+
+    auto f = fopen(in_path.c_str(), "rb");
+
+    if (f == nullptr)
+        return file_type::unknown;
+
+    auto r = fread(magic, 1, sizeof(magic), f);
+    fclose(f);
+
+    if (r < 4)
+        return file_type::unknown;
+
+    memcpy(&m, magic, sizeof(uint32_t));
+
+    // pcap in either byte order and timestamp precision, and pcapng
+    if (m == 0xa1b2c3d4 || m == 0xd4c3b2a1 || m == 0xa1b23c4d || m == 0x4d3cb2a1 ||
+            m == 0x0a0d0d0a)
+        return file_type::pcap;
+
+    if (r == sizeof(magic) && memcmp(magic, "SQLite format 3", 16) == 0)
+        return file_type::kismetdb;
+
+    return file_type::unknown;
+}
+
+void kis_datasource_offline::stop_readers(local_demand_locker& lock) {
+    stop = true;
+
+    // Readers take the lock to update the source, so let them finish without it
+    lock.unlock();
+
+    for (auto& t : readers)
+        t.join();
+
+    lock.lock();
+
+    readers.clear();
+    stop = false;
+}
+
+void kis_datasource_offline::open_interface(std::string in_definition,
+        unsigned int in_transaction, open_callback_t in_cb) {
+    local_demand_locker lock(ext_mutex);
+    lock.lock();
+
+    stop_readers(lock);
+
+    set_int_source_definition(in_definition);
+
+    auto fail = [&](const std::string& msg) {
+        set_int_source_running(false);
+        set_int_source_error(true);
+        set_int_source_error_reason(msg);
+
+        if (in_cb != nullptr) {
+            lock.unlock();
+            in_cb(in_transaction, false, msg);
+            lock.lock();
+        }
+    };
+
+    if (!parse_interface_definition(in_definition)) {
+        fail("Malformed source config");
+        return;
+    }
+
+    files.clear();
+    files.push_back(get_source_interface());
+
+    for (const auto& f : str_tokenize(get_definition_opt("files"), ",")) {
+        if (f.length() != 0)
+            files.push_back(f);
+    }
+
+    for (const auto& f : files) {
+        if (detect_file(f) == file_type::unknown) {
+            fail(fmt::format("Unable to read '{}' as a pcap, pcapng, or kismetdb file", f));
+            return;
+        }
+    }
+
+    auto num_readers = (unsigned int) get_definition_opt_double("readers", 1);
+
+    if (num_readers == 0)
+        num_readers = 1;
+
+    if (num_readers > files.size())
+        num_readers = files.size();
+
+    batch_sz = (size_t) get_definition_opt_double("batch", 256);
+
+    if (batch_sz == 0)
+        batch_sz = 1;
+
+    if (!local_uuid) {
+        // Derive a UUID from the file name, the same way the capture tools do, so
+        // ingesting the same file twice gives the same source
+        auto u = uuid(fmt::format("{:08X}-0000-0000-0000-0000{:08X}",
+                    adler32_checksum("kismet_offline"), adler32_checksum(files[0])));
+        set_source_uuid(u);
+        set_source_key(adler32_checksum(u.uuid_to_string()));
+    }
+
+    set_int_source_cap_interface(files[0]);
+    set_int_source_retry_attempts(0);
+    set_int_source_running(true);
+    set_int_source_error(false);
+
+    next_file = 0;
+    num_ingested = 0;
+    running_readers = num_readers;
+    ingest_start = std::chrono::steady_clock::now();
+    last_report = ingest_start;
+    last_report_packets = 0;
+    first_ts_usec = 0;
+    last_ts_usec = 0;
+
+    source_replay_target_speed->set(0);
+    source_replay_target_pps->set(0);
+
+    for (unsigned int i = 0; i < num_readers; i++)
+        readers.push_back(std::thread([this]() { reader_thread(); }));
+
+    if (in_cb != nullptr) {
+        lock.unlock();
+        in_cb(in_transaction, true,
+                fmt::format("Reading {} file{} with {} reader{}", files.size(),
+                    files.size() == 1 ? "" : "s", num_readers, num_readers == 1 ? "" : "s"));
+        lock.lock();
+    }
+}
+
+void kis_datasource_offline::close_source() {
+    local_locker lock(ext_mutex);
+
+    // Readers stop at their next batch; they're joined when the source is reopened
+    // or destroyed, since we may be called with the lock held
+    stop = true;
+
+    kis_datasource::close_source();
+}
+
+void kis_datasource_offline::reader_thread() {
+    while (!stop) {
+        size_t n = next_file++;
+
+        if (n >= files.size())
+            break;
+
+        try {
+            if (detect_file(files[n]) == file_type::kismetdb)
+                ingest_kismetdb(files[n]);
+            else
+                ingest_pcap(files[n]);
+        } catch (const std::exception& e) {
+            _MSG_ERROR("Offline data source '{}' could not read '{}': {}",
+                    get_source_name(), files[n], e.what());
+        }
+    }
+
+    if (--running_readers != 0 || stop)
+        return;
+
+    local_locker lock(ext_mutex);
+
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+            ingest_start).count();
+
+    _MSG_INFO("Offline data source '{}' finished reading {} packets from {} file{} in "
+            "{:.2f} seconds, {:.0f} packets per second", get_source_name(),
+            (uint64_t) num_ingested, files.size(), files.size() == 1 ? "" : "s", elapsed,
+            elapsed > 0 ? num_ingested / elapsed : 0);
+}
+
+kis_packet *kis_datasource_offline::make_packet(const struct timeval& ts) {
+    auto packet = packetchain->generate_packet();
+
+    packet->ts = ts;
+
+    auto datasrcinfo = new packetchain_comp_datasource();
+    datasrcinfo->ref_source = this;
+    packet->insert(pack_comp_datasrc, datasrcinfo);
+
+    return packet;
+}
+
+void kis_datasource_offline::queue_packet(std::vector<kis_packet *>& batch, kis_packet *packet) {
+    batch.push_back(packet);
+
+    if (batch.size() >= batch_sz)
+        flush_packets(batch);
+}
+
+void kis_datasource_offline::flush_packets(std::vector<kis_packet *>& batch) {
+    if (batch.size() == 0)
+        return;
+
+    auto first_ts = (int64_t) batch.front()->ts.tv_sec * 1000000 + batch.front()->ts.tv_usec;
+    auto last_ts = (int64_t) batch.back()->ts.tv_sec * 1000000 + batch.back()->ts.tv_usec;
+
+    // Hold packets while the source is paused instead of discarding them
+    while (!stop && get_source_paused())
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    auto queued = packetchain->process_packets(batch, [this]() -> bool { return stop; });
+
+    if (queued == 0)
+        return;
+
+    num_ingested += queued;
+
+    local_locker lock(ext_mutex);
+
+    inc_source_num_packets(queued);
+    get_source_packet_rrd()->add_sample(queued, time(0));
+
+    if (first_ts_usec == 0 || first_ts < first_ts_usec)
+        first_ts_usec = first_ts;
+
+    if (last_ts > last_ts_usec)
+        last_ts_usec = last_ts;
+
+    // Report the ingest rate, and how much faster than the original capture it is
+    auto now = std::chrono::steady_clock::now();
+    auto interval = std::chrono::duration<double>(now - last_report).count();
+
+    if (interval < 1)
+        return;
+
+    auto elapsed = std::chrono::duration<double>(now - ingest_start).count();
+
+    source_replay_pps->set((num_ingested - last_report_packets) / interval);
+    source_replay_speed->set((last_ts_usec - first_ts_usec) / 1000000.0 / elapsed);
+
+    last_report = now;
+    last_report_packets = num_ingested;
+}
+
+void kis_datasource_offline::ingest_pcap(const std::string& in_path) {
+#ifdef HAVE_LIBPCAP
+    char errstr[PCAP_ERRBUF_SIZE] = "";
+    struct pcap_pkthdr *header;
+    const u_char *data;
+    int r;
+
+    auto pd = pcap_open_offline(in_path.c_str(), errstr);
+
+    if (pd == nullptr)
+        throw std::runtime_error(errstr);
+
+    auto dlt = pcap_datalink(pd);
+
+    if (get_source_override_linktype())
+        dlt = get_source_override_linktype();
+
+    std::vector<kis_packet *> batch;
+    batch.reserve(batch_sz);
+
+    while (!stop) {
+        r = pcap_next_ex(pd, &header, &data);
+
+        if (r == 0)
+            continue;
+
+        if (r == -2)
+            break;
+
+        if (r < 0) {
+            std::string err = pcap_geterr(pd);
+
+            flush_packets(batch);
+            pcap_close(pd);
+
+            throw std::runtime_error(err);
+        }
+
+        auto packet = make_packet(header->ts);
+
+        auto datachunk = new kis_datachunk();
+        datachunk->dlt = dlt;
+        datachunk->copy_data((const uint8_t *) data, header->caplen);
+        if (header->len > header->caplen)
+            datachunk->original_length = header->len;
+        packet->insert(pack_comp_linkframe, datachunk);
+
+        // Don't tag recorded packets with the current location
+        packet->insert(pack_comp_no_gps, new kis_no_gps_packinfo());
+
+        queue_packet(batch, packet);
+    }
+
+    flush_packets(batch);
+
+    for (auto p : batch)
+        packetchain->destroy_packet(p);
+
+    pcap_close(pd);
+#else
+    throw std::runtime_error("Kismet was compiled without libpcap, only kismetdb logs can "
+            "be read");
+#endif
+}
+
+void kis_datasource_offline::ingest_kismetdb(const std::string& in_path) {
+    sqlite3 *db = nullptr;
+    sqlite3_stmt *stmt = nullptr;
+    int db_version = 0;
+
+    if (sqlite3_open_v2(in_path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+        std::string err = sqlite3_errmsg(db);
+        sqlite3_close_v2(db);
+        throw std::runtime_error(err);
+    }
+
+    auto db_p = std::shared_ptr<sqlite3>(db, [](sqlite3 *d) { sqlite3_close_v2(d); });
+
+    if (sqlite3_prepare_v2(db, "SELECT db_version FROM KISMET", -1, &stmt, nullptr) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW)
+            db_version = sqlite3_column_int(stmt, 0);
+
+        sqlite3_finalize(stmt);
+    }
+
+    if (db_version == 0)
+        throw std::runtime_error("unable to find the kismetdb version");
+
+    auto dictionary = kismetdb_blob::load_dictionary(db);
+
+    // Segments are in time order after the main log
+    kismetdb_segments::segmented_log segments;
+    segments.open(db, in_path);
+
+    for (const auto& sdb : segments.all()) {
+        if (stop)
+            break;
+
+        ingest_kismetdb_db(sdb.get(), db_version, dictionary);
+    }
+}
+
+void kis_datasource_offline::ingest_kismetdb_db(sqlite3 *db, int db_version,
+        const std::string& dictionary) {
+    sqlite3_stmt *packet_stmt = nullptr;
+    sqlite3_stmt *data_stmt = nullptr;
+
+    // V4 didn't have speed, heading, etc, and used the normalized encoding
+    const char *packet_sql = db_version <= 4 ?
+        "SELECT ts_sec, ts_usec, (lat / 100000.0), (lon / 100000.0), 0, 0, 0, dlt, packet, "
+        "packet_len FROM packets ORDER BY ts_sec, ts_usec" :
+        "SELECT ts_sec, ts_usec, lat, lon, alt, speed, heading, dlt, packet, packet_len "
+        "FROM packets ORDER BY ts_sec, ts_usec";
+
+    const char *data_sql = db_version <= 4 ?
+        "SELECT ts_sec, ts_usec, (lat / 100000.0), (lon / 100000.0), 0, 0, 0, type, json "
+        "FROM data ORDER BY ts_sec, ts_usec" :
+        "SELECT ts_sec, ts_usec, lat, lon, alt, speed, heading, type, json "
+        "FROM data ORDER BY ts_sec, ts_usec";
+
+    if (sqlite3_prepare_v2(db, packet_sql, -1, &packet_stmt, nullptr) != SQLITE_OK ||
+            sqlite3_prepare_v2(db, data_sql, -1, &data_stmt, nullptr) != SQLITE_OK) {
+        std::string err = sqlite3_errmsg(db);
+        sqlite3_finalize(packet_stmt);
+        sqlite3_finalize(data_stmt);
+        throw std::runtime_error(err);
+    }
+
+    std::vector<kis_packet *> batch;
+    batch.reserve(batch_sz);
+
+    auto packet_r = sqlite3_step(packet_stmt);
+    auto data_r = sqlite3_step(data_stmt);
+
+    auto row_ts = [](sqlite3_stmt *stmt) -> int64_t {
+        return sqlite3_column_int64(stmt, 0) * 1000000 + sqlite3_column_int64(stmt, 1);
+    };
+
+    // Merge the timelines of the packets and data
+    while (!stop && (packet_r == SQLITE_ROW || data_r == SQLITE_ROW)) {
+        bool is_packet = data_r != SQLITE_ROW ||
+            (packet_r == SQLITE_ROW && row_ts(packet_stmt) <= row_ts(data_stmt));
+
+        auto stmt = is_packet ? packet_stmt : data_stmt;
+
+        struct timeval ts;
+        ts.tv_sec = sqlite3_column_int64(stmt, 0);
+        ts.tv_usec = sqlite3_column_int64(stmt, 1);
+
+        auto packet = make_packet(ts);
+
+        auto lat = sqlite3_column_double(stmt, 2);
+        auto lon = sqlite3_column_double(stmt, 3);
+
+        if (lat != 0 || lon != 0) {
+            auto gpsinfo = new kis_gps_packinfo();
+
+            gpsinfo->lat = lat;
+            gpsinfo->lon = lon;
+            gpsinfo->alt = sqlite3_column_double(stmt, 4);
+            gpsinfo->speed = sqlite3_column_double(stmt, 5);
+            gpsinfo->heading = sqlite3_column_double(stmt, 6);
+            gpsinfo->fix = gpsinfo->alt != 0 ? 3 : 2;
+            gpsinfo->tv = ts;
+            gpsinfo->gpsname = "kismetdb";
+
+            packet->insert(pack_comp_gps, gpsinfo);
+        } else {
+            packet->insert(pack_comp_no_gps, new kis_no_gps_packinfo());
+        }
+
+        if (is_packet) {
+            auto datachunk = new kis_datachunk();
+
+            if (get_source_override_linktype())
+                datachunk->dlt = get_source_override_linktype();
+            else
+                datachunk->dlt = sqlite3_column_int(stmt, 7);
+
+            datachunk->copy_data((const uint8_t *) sqlite3_column_blob(stmt, 8),
+                    sqlite3_column_bytes(stmt, 8));
+
+            // Packets captured with truncate_data were logged with their original length
+            if (sqlite3_column_int64(stmt, 9) > datachunk->length)
+                datachunk->original_length = sqlite3_column_int64(stmt, 9);
+
+            packet->insert(pack_comp_linkframe, datachunk);
+
+            packet_r = sqlite3_step(packet_stmt);
+        } else {
+            auto jsoninfo = new kis_json_packinfo();
+
+            auto type = (const char *) sqlite3_column_text(stmt, 7);
+            jsoninfo->type = type == nullptr ? "" : type;
+
+            auto json = std::string((const char *) sqlite3_column_blob(stmt, 8),
+                    sqlite3_column_bytes(stmt, 8));
+
+            try {
+                jsoninfo->json_string = kismetdb_blob::decompress(json, dictionary);
+            } catch (const std::runtime_error& e) {
+                jsoninfo->json_string = "";
+            }
+
+            packet->insert(pack_comp_json, jsoninfo);
+
+            data_r = sqlite3_step(data_stmt);
+        }
+
+        queue_packet(batch, packet);
+    }
+
+    flush_packets(batch);
+
+    for (auto p : batch)
+        packetchain->destroy_packet(p);
+
+    sqlite3_finalize(packet_stmt);
+    sqlite3_finalize(data_stmt);
+}
+
@@ -0,0 +1,159 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __DATASOURCE_OFFLINE_H__
+#define __DATASOURCE_OFFLINE_H__
+
+#include "config.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <sqlite3.h>
+
+#include "kis_datasource.h"
+
+class kis_datasource_offline;
+typedef std::shared_ptr<kis_datasource_offline> shared_datasource_offline;
+
+// Offline ingest of pcap, pcapng, and kismetdb files, read directly by the server
+// instead of replayed through a capture tool:
+//
+//  -c /path/to/file.pcapng:type=offline
+//  -c /path/to/Kismet.kismet:type=offline,files="/path/a.pcap,/path/b.kismet",readers=2
+//
+// Packets are built in the reader threads and queued to the packet chain in batches;
+// when the packet queue is full the readers wait instead of dropping packets.  Each
+// reader processes one file at a time, so with more than one reader the packets of
+// different files are interleaved.
+class kis_datasource_offline : public kis_datasource {
+public:
+    kis_datasource_offline(shared_datasource_builder in_builder,
+            std::shared_ptr<kis_recursive_timed_mutex> mutex);
+
+    virtual ~kis_datasource_offline();
+
+    // Files are only read once unless we're explicitly told to retry
+    virtual std::string override_default_option(std::string in_opt) override {
+        if (in_opt == "retry")
+            return "false";
+
+        return "";
+    }
+
+    virtual void open_interface(std::string in_definition, unsigned int in_transaction,
+            open_callback_t in_cb) override;
+
+    virtual void close_source() override;
+
+protected:
+    enum class file_type {
+        unknown, pcap, kismetdb
+    };
+
+    static file_type detect_file(const std::string& in_path);
+
+    // Stop the readers; the lock on ext_mutex is released while they finish
+    void stop_readers(local_demand_locker& lock);
+
+    void reader_thread();
+
+    void ingest_pcap(const std::string& in_path);
+    void ingest_kismetdb(const std::string& in_path);
+    void ingest_kismetdb_db(sqlite3 *db, int db_version, const std::string& dictionary);
+
+    // Packets are batched and handed to the packet chain at once
+    kis_packet *make_packet(const struct timeval& ts);
+    void queue_packet(std::vector<kis_packet *>& batch, kis_packet *packet);
+    void flush_packets(std::vector<kis_packet *>& batch);
+
+    std::vector<std::string> files;
+    std::vector<std::thread> readers;
+
+    std::atomic<bool> stop;
+    std::atomic<size_t> next_file;
+    std::atomic<unsigned int> running_readers;
+
+    size_t batch_sz;
+
+    // Ingest rate
+    std::atomic<uint64_t> num_ingested;
+    std::chrono::steady_clock::time_point ingest_start;
+    std::chrono::steady_clock::time_point last_report;
+    uint64_t last_report_packets;
+    int64_t first_ts_usec, last_ts_usec;
+};
+
+class datasource_offline_builder : public kis_datasource_builder {
+public:
+    datasource_offline_builder() :
+        kis_datasource_builder() {
+
+        register_fields();
+        reserve_fields(NULL);
+        initialize();
+    }
+
+    datasource_offline_builder(int in_id) :
+        kis_datasource_builder(in_id) {
+
+        register_fields();
+        reserve_fields(NULL);
+        initialize();
+    }
+
+    datasource_offline_builder(int in_id, std::shared_ptr<tracker_element_map> e) :
+        kis_datasource_builder(in_id, e) {
+
+        register_fields();
+        reserve_fields(NULL);
+        initialize();
+    }
+
+    virtual ~datasource_offline_builder() { }
+
+    virtual shared_datasource build_datasource(shared_datasource_builder in_sh_this,
+            std::shared_ptr<kis_recursive_timed_mutex> mutex) override {
+        return shared_datasource_offline(new kis_datasource_offline(in_sh_this, mutex));
+    }
+
+    virtual void initialize() override {
+        set_source_type("offline");
+        set_source_description("Pre-recorded pcap, pcapng, or kismetdb files read directly "
+                "by Kismet");
+
+        // Only used when asked for by type, so the pcapfile and kismetdb capture tools
+        // still pick up files by default
+        set_probe_capable(false);
+
+        set_list_capable(false);
+        set_local_capable(true);
+
+        // Files are read by the server itself
+        set_remote_capable(false);
+
+        set_passive_capable(false);
+        set_tune_capable(false);
+    }
+
+};
+
+#endif
+
@@ -16,6 +16,10 @@
     Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
+#include "config.h"
+
+#include <arpa/inet.h>
+
 #include "configfile.h"
 #include "datasourcetracker.h"
 #include "datasource_virtual.h"
@@ -52,10 +56,35 @@ tzsp_source::tzsp_source() :
         auto tzsp_buffer_sz =
             Globalreg::globalreg->kismet_config->fetch_opt_as<unsigned int>("tzsp_buffer_kb", 64);
 
+        auto tzsp_rcvbuf_sz =
+            Globalreg::globalreg->kismet_config->fetch_opt_as<unsigned int>("tzsp_rcvbuf_kb", 4096);
+
+        auto tzsp_batch =
+            Globalreg::globalreg->kismet_config->fetch_opt_as<unsigned int>("tzsp_recv_batch", 64);
+
+        if (tzsp_batch == 0)
+            tzsp_batch = 1;
+
+        batch.reserve(tzsp_batch);
+
         tzsp_listener = std::make_shared<udp_dgram_server>();
 
-        tzsp_listener->configure_server(tzsp_port, tzsp_listen, tzsp_filter, std::chrono::seconds(60), 
-                4096, tzsp_buffer_sz);
+        tzsp_listener->set_datagram_cb([this](uint32_t key, const struct sockaddr_in *addr, 
+                    const char *data, size_t len) {
+                handle_datagram(key, addr, data, len);
+            });
+
+        tzsp_listener->set_batch_cb([this](uint64_t drops) {
+                handle_batch(drops);
+            });
+
+        if (tzsp_listener->configure_server(tzsp_port, tzsp_listen, tzsp_filter, std::chrono::seconds(60), 
+                4096, tzsp_buffer_sz * 1024, tzsp_rcvbuf_sz * 1024, tzsp_batch) < 0) {
+            _MSG_ERROR("TZSP datasource could not listen on {}:{}", tzsp_listen, tzsp_port);
+            return;
+        }
+
+        _MSG_INFO("TZSP datasource listening on {}:{}", tzsp_listen, tzsp_port);
 
         pollabletracker->register_pollable(tzsp_listener);
 
@@ -67,8 +96,167 @@ tzsp_source::tzsp_source() :
 }
 
 tzsp_source::~tzsp_source() {
-    pollabletracker->remove_pollable(tzsp_listener);
+    if (tzsp_listener != nullptr)
+        pollabletracker->remove_pollable(tzsp_listener);
+
+    for (auto p : batch)
+        packetchain->destroy_packet(p);
 
     Globalreg::globalreg->remove_global(global_name());
 }
 
+shared_datasource_virtual tzsp_source::find_source(uint32_t in_key, const struct sockaddr_in *in_addr) {
+    auto si = tzsp_sources.find(in_key);
+
+    if (si != tzsp_sources.end())
+        return si->second;
+
+    // Each sending host gets a stable UUID so that it's the same source across restarts and 
+    // if the sender changes ports
+    auto ip = ntohl(in_addr->sin_addr.s_addr);
+    auto src_uuid = uuid(fmt::format("{:08X}-0000-0000-0000-{:012X}", 
+                adler32_checksum("tzsp"), ip));
+
+    char ipstr[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &in_addr->sin_addr, ipstr, INET_ADDRSTRLEN);
+
+    shared_datasource_virtual virtual_source;
+
+    auto existing = datasourcetracker->find_datasource(src_uuid);
+
+    if (existing != nullptr) {
+        virtual_source = std::static_pointer_cast<kis_datasource_virtual>(existing);
+    } else {
+        auto virtual_builder = Globalreg::fetch_mandatory_global_as<datasource_virtual_builder>();
+
+        virtual_source = std::static_pointer_cast<kis_datasource_virtual>(
+                virtual_builder->build_datasource(virtual_builder, nullptr));
+
+        virtual_source->set_virtual_hardware("tzsp");
+
+        virtual_source->set_source_uuid(src_uuid);
+        virtual_source->set_source_key(adler32_checksum(src_uuid.uuid_to_string()));
+        virtual_source->set_source_name(fmt::format("tzsp-{}", ipstr));
+
+        datasourcetracker->merge_source(virtual_source);
+
+        _MSG_INFO("TZSP datasource receiving packets from {}", ipstr);
+    }
+
+    tzsp_sources[in_key] = virtual_source;
+
+    return virtual_source;
+}
+
+void tzsp_source::handle_datagram(uint32_t in_key, const struct sockaddr_in *in_addr,
+        const char *in_data, size_t in_len) {
+
+    if (in_len < sizeof(tzsp_header))
+        return;
+
+    auto hdr = (const tzsp_header *) in_data;
+
+    if (hdr->tzsp_version != TZSP_VERSION || hdr->tzsp_type != TZSP_PACKET_RECEIVED)
+        return;
+
+    auto virtual_source = find_source(in_key, in_addr);
+
+    auto packet = packetchain->generate_packet();
+    gettimeofday(&packet->ts, nullptr);
+
+    kis_layer1_packinfo *l1info = nullptr;
+
+    // Walk the tags until the end tag; padding and end have no length
+    size_t pos = sizeof(tzsp_header);
+    bool tags_ok = false;
+
+    while (pos < in_len) {
+        uint8_t tagno = in_data[pos++];
+
+        if (tagno == TZSP_TAG_END) {
+            tags_ok = true;
+            break;
+        }
+
+        if (tagno == TZSP_TAG_PADDING)
+            continue;
+
+        if (pos >= in_len)
+            break;
+
+        uint8_t taglen = in_data[pos++];
+
+        if (pos + taglen > in_len)
+            break;
+
+        auto tagdata = (const uint8_t *) &in_data[pos];
+        pos += taglen;
+
+        if (taglen < 1)
+            continue;
+
+        switch (tagno) {
+            case TZSP_TAG_RSSI:
+                if (l1info == nullptr)
+                    l1info = new kis_layer1_packinfo();
+                l1info->signal_dbm = (int8_t) tagdata[0];
+                l1info->signal_type = kis_l1_signal_type_dbm;
+                break;
+            case TZSP_TAG_DATARATE:
+                // Rate in 500kbps units, stored in 100kbps units
+                if (l1info == nullptr)
+                    l1info = new kis_layer1_packinfo();
+                l1info->datarate = tagdata[0] * 5;
+                break;
+            case TZSP_TAG_RX_CHANNEL:
+                if (l1info == nullptr)
+                    l1info = new kis_layer1_packinfo();
+                l1info->channel = fmt::format("{}", tagdata[0]);
+                break;
+            case TZSP_TAG_FCS_ERROR:
+                if (tagdata[0])
+                    packet->error = 1;
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (l1info != nullptr)
+        packet->insert(pack_comp_l1info, l1info);
+
+    auto srcinfo = new packetchain_comp_datasource();
+    srcinfo->ref_source = virtual_source.get();
+    packet->insert(pack_comp_datasrc, srcinfo);
+
+    // We only decode 802.11; anything else is passed along as an error so it's still counted
+    if (!tags_ok || ntohs(hdr->tzsp_encapsulation) != TZSP_DLT_IEEE80211 || pos >= in_len) {
+        packet->error = 1;
+    } else {
+        auto datachunk = new kis_datachunk();
+        datachunk->dlt = KDLT_IEEE802_11;
+        datachunk->copy_data((const uint8_t *) &in_data[pos], in_len - pos);
+        packet->insert(pack_comp_linkframe, datachunk);
+    }
+
+    batch.push_back(packet);
+    batch_counts[virtual_source.get()]++;
+}
+
+void tzsp_source::handle_batch(uint64_t in_drops) {
+    if (batch.size() > 0) {
+        // The whole batch is dropped if the packet queue is full
+        if (packetchain->process_packets(batch) > 0) {
+            for (auto c : batch_counts)
+                c.first->inc_source_num_packets(c.second);
+        }
+
+        batch.clear();
+        batch_counts.clear();
+    }
+
+    // Drops are counted on the shared socket, so every TZSP source reports the total
+    for (auto s : tzsp_sources)
+        s.second->set_virtual_kernel_drops(in_drops);
+}
+
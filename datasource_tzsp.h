@@ -21,17 +21,23 @@
 
 #include "config.h"
 
+#include <map>
+#include <vector>
+
 #include "globalregistry.h"
+#include "datasource_virtual.h"
 #include "kis_datasource.h"
 #include "udpserver.h"
 
-// TZSP per-frame header
+// TZSP per-frame header; the encapsulation is big-endian
 typedef struct {
     uint8_t tzsp_version;
     uint8_t tzsp_type;
-    uint8_t tzsp_encapsulation;
+    uint16_t tzsp_encapsulation;
 } __attribute__((packed)) tzsp_header;
 
+#define TZSP_VERSION                0x01
+
 #define TZSP_PACKET_RECEIVED        0x00
 #define TZSP_PACKET_TRANSMIT        0x01
 #define TZSP_PACKET_RESERVED        0x02
@@ -65,6 +71,9 @@ typedef struct {
 #define TZSP_TAG_RX_FRAMELEN        0x29
 #define TZSP_TAG_RX_RADIO_SERIAL    0x3C
 
+// Receives TZSP streams (such as from Mikrotik routers) and turns each sender into a
+// virtual datasource.  Datagrams are received in batches and the packets of a batch are
+// handed to the packet chain together.
 class tzsp_source : public lifetime_global {
 public:
     static std::string global_name() { return "tzsp_source"; }
@@ -85,6 +94,19 @@ public:
 protected:
     std::shared_ptr<udp_dgram_server> tzsp_listener;
 
+    // Virtual sources by UDP client key
+    std::map<uint32_t, shared_datasource_virtual> tzsp_sources;
+
+    // Packets of the current receive batch, and how many came from each source
+    std::vector<kis_packet *> batch;
+    std::map<kis_datasource *, unsigned int> batch_counts;
+
+    void handle_datagram(uint32_t in_key, const struct sockaddr_in *in_addr, 
+            const char *in_data, size_t in_len);
+    void handle_batch(uint64_t in_drops);
+
+    shared_datasource_virtual find_source(uint32_t in_key, const struct sockaddr_in *in_addr);
+
     std::shared_ptr<packet_chain> packetchain;
     std::shared_ptr<datasource_tracker> datasourcetracker;
     std::shared_ptr<pollable_tracker> pollabletracker;
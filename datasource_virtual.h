@@ -48,6 +48,13 @@ public:
     void set_virtual_hardware(const std::string& in_hw) {
         set_int_source_hardware(in_hw);
     }
+
+    // Packets dropped by the host before Kismet saw them, for virtual sources fed by
+    // a socket
+    void set_virtual_kernel_drops(uint64_t in_drops) {
+        local_locker lock(ext_mutex);
+        source_num_kernel_drops->set(in_drops);
+    }
     
 };
 
@@ -22,12 +22,14 @@
 
 #include "alertracker.h"
 #include "base64.h"
+#include "channeltracker2.h"
 #include "configfile.h"
 #include "datasourcetracker.h"
 #include "endian_magic.h"
 #include "getopt.h"
 #include "globalregistry.h"
 #include "kis_databaselogfile.h"
+#include "kis_external_packet.h"
 #include "kis_httpd_registry.h"
 #include "messagebus.h"
 #include "pcapng_stream_ringbuf.h"
@@ -332,6 +334,20 @@ datasource_tracker::datasource_tracker() :
         std::make_shared<kis_net_httpd_simple_tracked_endpoint>("/datasource/types", 
                 proto_vec, &dst_lock);
 
+    capture_filter_pushdown = false;
+    capture_filter_timer = -1;
+    capture_filter_chain_id = -1;
+    capture_filter_eb_id = 0;
+
+    hop_stats_timer = -1;
+    hop_stats_chain_id = -1;
+    hop_adaptive_active = false;
+    hop_stats_last = 0;
+    hop_adaptive_last = 0;
+    hop_adaptive_interval = 30;
+    hop_adaptive_min_dwell = 0.25;
+    hop_adaptive_max_dwell = 4;
+
     list_interfaces_endp =
         std::make_shared<kis_net_httpd_simple_tracked_endpoint>("/datasource/list_interfaces", 
                 [this]() -> std::shared_ptr<tracker_element> {
@@ -373,6 +389,29 @@ datasource_tracker::~datasource_tracker() {
     if (completion_cleanup_id >= 0)
         timetracker->remove_timer(completion_cleanup_id);
 
+    if (capture_filter_timer >= 0)
+        timetracker->remove_timer(capture_filter_timer);
+
+    if (capture_filter_eb_id != 0)
+        eventbus->remove_listener(capture_filter_eb_id);
+
+    if (capture_filter_chain_id >= 0) {
+        auto packetchain = Globalreg::fetch_global_as<packet_chain>();
+
+        if (packetchain != nullptr)
+            packetchain->remove_handler(capture_filter_chain_id, CHAINPOS_CLASSIFIER);
+    }
+
+    if (hop_stats_timer >= 0)
+        timetracker->remove_timer(hop_stats_timer);
+
+    if (hop_stats_chain_id >= 0) {
+        auto packetchain = Globalreg::fetch_global_as<packet_chain>();
+
+        if (packetchain != nullptr)
+            packetchain->remove_handler(hop_stats_chain_id, CHAINPOS_LOGGING);
+    }
+
     if (database_log_timer >= 0) {
         timetracker->remove_timer(database_log_timer);
         databaselog_write_datasources();
@@ -422,6 +461,11 @@ void datasource_tracker::trigger_deferred_startup() {
     tcp_buffer_sz = 
         Globalreg::globalreg->kismet_config->fetch_opt_as<size_t>("tcp_buffer_kb", 512);
 
+    // Each source on a multiplexed remote connection only needs to hold the frames it's
+    // handed at once
+    remote_mux_buffer_sz =
+        Globalreg::globalreg->kismet_config->fetch_opt_as<size_t>("remote_capture_mux_buffer_kb", 256);
+
     config_defaults = 
         Globalreg::globalreg->entrytracker->register_and_get_field_as<datasource_tracker_defaults>("kismet.datasourcetracker.defaults",
                 tracker_element_factory<datasource_tracker_defaults>(),
@@ -450,6 +494,8 @@ void datasource_tracker::trigger_deferred_startup() {
         config_defaults->set_hop_rate(1);
     }
 
+    configure_adaptive_hopping();
+
     if (Globalreg::globalreg->kismet_config->fetch_opt_bool("split_source_hopping", true)) {
         _MSG("Enabling channel list splitting on sources which share the same list "
                 "of channels", MSGFLAG_INFO);
@@ -485,6 +531,37 @@ void datasource_tracker::trigger_deferred_startup() {
 
     config_defaults->set_remote_cap_timestamp(Globalreg::globalreg->kismet_config->fetch_opt_bool("override_remote_timestamp", true));
 
+    // Compressed transport offered to remote captures which support it; blocks have
+    // to fit in the read buffer of the connection
+    if (Globalreg::globalreg->kismet_config->fetch_opt_bool("remote_capture_compression", true)) {
+        auto block_kb = 
+            Globalreg::globalreg->kismet_config->fetch_opt_uint("remote_capture_block_kb", 64);
+        auto flush_ms =
+            Globalreg::globalreg->kismet_config->fetch_opt_uint("remote_capture_flush_ms", 100);
+        auto level = 
+            Globalreg::globalreg->kismet_config->fetch_opt_uint("remote_capture_compress_level", 1);
+
+        if (block_kb > tcp_buffer_sz / 2)
+            block_kb = tcp_buffer_sz / 2;
+
+        if (block_kb > KIS_EXTERNAL_BLOCK_MAX / 1024)
+            block_kb = KIS_EXTERNAL_BLOCK_MAX / 1024;
+
+        if (block_kb == 0)
+            block_kb = 1;
+
+        if (level < 1 || level > 9)
+            level = 1;
+
+        remote_transport = std::make_shared<KismetDatasource::Transport>();
+        remote_transport->set_compression("zlib");
+        remote_transport->set_block_size(block_kb * 1024);
+        remote_transport->set_flush_ms(flush_ms);
+        remote_transport->set_level(level);
+    }
+
+    configure_capture_filters();
+
     httpd_pcap = std::make_shared<datasource_tracker_httpd_pcap>();
 
     // Register js module for UI
@@ -973,6 +1050,8 @@ void datasource_tracker::merge_source(shared_datasource in_source) {
     // Figure out channel hopping
     calculate_source_hopping(in_source);
 
+    push_capture_filter(in_source);
+
     if (database_log_enabled) {
         std::shared_ptr<kis_database_logfile> dbf =
             Globalreg::fetch_global_as<kis_database_logfile>("DATABASELOG");
@@ -985,6 +1064,290 @@ void datasource_tracker::merge_source(shared_datasource in_source) {
     datasource_vec->push_back(in_source);
 }
 
+void datasource_tracker::configure_capture_filters() {
+    capture_mac_filter =
+        std::make_shared<packet_filter_mac_addr>("capture", "Capture MAC filtering");
+    capture_dot11_filter =
+        std::make_shared<packet_filter_dot11_type>("capture_dot11", "Capture 802.11 frame filtering");
+
+    auto filter_dfl = 
+        Globalreg::globalreg->kismet_config->fetch_opt_dfl("capture_filter_default", "pass");
+
+    if (filter_dfl == "pass" || filter_dfl == "false") {
+        capture_mac_filter->set_filter_default(false);
+    } else if (filter_dfl == "block" || filter_dfl == "true") {
+        capture_mac_filter->set_filter_default(true);
+    } else {
+        _MSG_ERROR("Couldn't parse 'capture_filter_default', expected 'pass' or 'block', filter "
+                "defaulting to 'pass'.");
+    }
+
+    for (auto fi : Globalreg::globalreg->kismet_config->fetch_opt_vec("capture_filter")) {
+        // phy,block,mac,value
+        auto filter_toks = str_tokenize(fi, ",");
+
+        if (filter_toks.size() != 4) {
+            _MSG_ERROR("Skipping invalid capture_filter option '{}', expected "
+                    "phyname,filterblock,mac,filtertype.", fi);
+            continue;
+        }
+
+        mac_addr m(filter_toks[2]);
+        if (m.error) {
+            _MSG_ERROR("Skipping invalid capture_filter option '{}', expected "
+                    "phyname,filterblock,mac,filtertype but got error parsing '{}' as a MAC "
+                    "address.", fi, filter_toks[2]);
+            continue;
+        }
+
+        bool filter_opt = false;
+        if (filter_toks[3] == "pass" || filter_toks[3] == "false") {
+            filter_opt = false;
+        } else if (filter_toks[3] == "block" || filter_toks[3] == "true") {
+            filter_opt = true;
+        } else {
+            _MSG_ERROR("Skipping invalid capture_filter option '{}', expected "
+                    "phyname,filterblock,mac,filtertype but got an error parsing '{}' as a "
+                    "filter block or pass.", fi, filter_toks[3]);
+            continue;
+        }
+
+        try {
+            capture_mac_filter->set_filter(m, filter_toks[0], filter_toks[1], filter_opt);
+        } catch (const std::exception& e) {
+            _MSG_ERROR("Skipping invalid capture_filter option '{}': {}", fi, e.what());
+        }
+    }
+
+    auto dot11_dfl = 
+        Globalreg::globalreg->kismet_config->fetch_opt_dfl("capture_filter_dot11_default", "pass");
+
+    if (dot11_dfl == "pass" || dot11_dfl == "false") {
+        capture_dot11_filter->set_filter_default(false);
+    } else if (dot11_dfl == "block" || dot11_dfl == "true") {
+        capture_dot11_filter->set_filter_default(true);
+    } else {
+        _MSG_ERROR("Couldn't parse 'capture_filter_dot11_default', expected 'pass' or 'block', "
+                "filter defaulting to 'pass'.");
+    }
+
+    for (auto fi : Globalreg::globalreg->kismet_config->fetch_opt_vec("capture_filter_dot11")) {
+        // frame,value
+        auto filter_toks = str_tokenize(fi, ",");
+
+        if (filter_toks.size() != 2) {
+            _MSG_ERROR("Skipping invalid capture_filter_dot11 option '{}', expected "
+                    "frametype,filtertype.", fi);
+            continue;
+        }
+
+        bool filter_opt = false;
+        if (filter_toks[1] == "pass" || filter_toks[1] == "false") {
+            filter_opt = false;
+        } else if (filter_toks[1] == "block" || filter_toks[1] == "true") {
+            filter_opt = true;
+        } else {
+            _MSG_ERROR("Skipping invalid capture_filter_dot11 option '{}', expected "
+                    "frametype,filtertype but got an error parsing '{}' as a filter block "
+                    "or pass.", fi, filter_toks[1]);
+            continue;
+        }
+
+        try {
+            capture_dot11_filter->set_filter(filter_toks[0], filter_opt);
+        } catch (const std::exception& e) {
+            _MSG_ERROR("Skipping invalid capture_filter_dot11 option '{}': {}", fi, e.what());
+        }
+    }
+
+    // Kismet always applies the filters, so they work for every source and stay in
+    // effect while a source is re-opened
+    auto packetchain = Globalreg::fetch_mandatory_global_as<packet_chain>();
+
+    capture_filter_chain_id = 
+        packetchain->register_handler([this](kis_packet *in_pack) -> int {
+                if (in_pack->filtered)
+                    return 1;
+
+                if (capture_dot11_filter->filter_packet(in_pack) ||
+                        capture_mac_filter->filter_packet(in_pack))
+                    in_pack->filtered = 1;
+
+                return 1;
+            }, CHAINPOS_CLASSIFIER, -100);
+
+    capture_filter_pushdown = 
+        Globalreg::globalreg->kismet_config->fetch_opt_bool("capture_filter_pushdown", true);
+
+    if (!capture_filter_pushdown)
+        return;
+
+    // New sources get the filters when they're merged; push them again when a source
+    // re-opens, and to all running sources a moment after the filters change, so a
+    // batch of changes is only sent once
+    capture_filter_eb_id = 
+        eventbus->register_listener({kis_datasource::event_datasource_opened(),
+                packet_filter::event_packet_filter_changed()},
+                [this](std::shared_ptr<eventbus_event> evt) {
+                    if (evt->get_event_id() == packet_filter::event_packet_filter_changed()) {
+                        local_locker lock(&dst_lock);
+
+                        if (capture_filter_timer >= 0)
+                            return;
+
+                        capture_filter_timer = 
+                            timetracker->register_timer(SERVER_TIMESLICES_SEC, NULL, 0,
+                                    [this](int) -> int {
+                                    local_locker lock(&dst_lock);
+
+                                    capture_filter_timer = -1;
+
+                                    for (auto si : *datasource_vec) 
+                                        push_capture_filter(std::static_pointer_cast<kis_datasource>(si));
+
+                                    return 0;
+                                    });
+
+                        return;
+                    }
+
+                    auto ui = evt->get_event_content()->find(kis_datasource::event_datasource_opened());
+
+                    if (ui == evt->get_event_content()->end())
+                        return;
+
+                    auto ds = find_datasource(get_tracker_value<uuid>(ui->second));
+
+                    if (ds != nullptr)
+                        push_capture_filter(ds);
+                });
+}
+
+bool datasource_tracker::compile_capture_filter(unsigned int in_dlt, 
+        std::vector<kis_bpf_insn>& out_program) {
+    kis_bpf_program prog;
+
+    auto accept = prog.new_label();
+    auto have_fc = prog.new_label();
+
+    // Find the 802.11 header and keep its offset in M[0] for the filters
+    if (in_dlt == KDLT_IEEE802_11) {
+        prog.stmt(kis_bpf::ld | kis_bpf::w | kis_bpf::imm, 0);
+    } else if (in_dlt == KDLT_RADIOTAP || in_dlt == KDLT_PPI) {
+        if (in_dlt == KDLT_PPI) {
+            // Only PPI carrying 802.11; the little-endian DLT at offset 4
+            auto is_dot11 = prog.new_label();
+            prog.stmt(kis_bpf::ld | kis_bpf::w | kis_bpf::abs, 4);
+            prog.jump(kis_bpf::jeq | kis_bpf::k, 0x69000000, is_dot11, kis_bpf_program::next);
+            prog.jump_always(accept);
+            prog.place(is_dot11);
+        }
+
+        // Both put the little-endian header length at offset 2
+        prog.stmt(kis_bpf::ld | kis_bpf::b | kis_bpf::abs, 3);
+        prog.stmt(kis_bpf::alu | kis_bpf::op_lsh | kis_bpf::k, 8);
+        prog.stmt(kis_bpf::misc | kis_bpf::tax);
+        prog.stmt(kis_bpf::ld | kis_bpf::b | kis_bpf::abs, 2);
+        prog.stmt(kis_bpf::alu | kis_bpf::op_add | kis_bpf::x);
+    } else {
+        return false;
+    }
+
+    prog.stmt(kis_bpf::st, 0);
+
+    // Anything too short for the frame control is accepted
+    prog.stmt(kis_bpf::alu | kis_bpf::op_add | kis_bpf::k, 2);
+    prog.stmt(kis_bpf::misc | kis_bpf::tax);
+    prog.stmt(kis_bpf::ld | kis_bpf::w | kis_bpf::len);
+    prog.jump(kis_bpf::jge | kis_bpf::x, 0, have_fc, kis_bpf_program::next);
+    prog.jump_always(accept);
+    prog.place(have_fc);
+
+    auto prologue_sz = prog.size();
+
+    // A filter which can't be compiled is left out; Kismet still applies it
+    for (auto f : std::vector<std::shared_ptr<packet_filter>>{capture_dot11_filter, capture_mac_filter}) {
+        auto attempt = prog;
+        auto next = attempt.new_label();
+
+        attempt.stmt(kis_bpf::ldx | kis_bpf::w | kis_bpf::mem, 0);
+
+        if (!f->compile_dot11_bpf(attempt, next))
+            continue;
+
+        attempt.place(next);
+
+        auto check = attempt;
+        std::vector<kis_bpf_insn> check_out;
+
+        check.place(accept);
+        check.stmt(kis_bpf::ret | kis_bpf::k, kis_bpf::accept_len);
+
+        if (!check.assemble(check_out))
+            continue;
+
+        prog = attempt;
+    }
+
+    prog.place(accept);
+    prog.stmt(kis_bpf::ret | kis_bpf::k, kis_bpf::accept_len);
+
+    out_program.clear();
+
+    if (!prog.assemble(out_program))
+        return false;
+
+    // Don't bother the source with a filter that accepts everything
+    bool rejects = false;
+
+    for (auto i = prologue_sz; i < out_program.size(); i++) {
+        if (out_program[i].code == (kis_bpf::ret | kis_bpf::k) && out_program[i].k == 0) {
+            rejects = true;
+            break;
+        }
+    }
+
+    if (!rejects)
+        out_program.clear();
+
+    return true;
+}
+
+void datasource_tracker::push_capture_filter(shared_datasource in_ds) {
+    if (!capture_filter_pushdown || in_ds == nullptr)
+        return;
+
+    if (!in_ds->get_source_running())
+        return;
+
+    // Only capture tools, local or remote, can apply a filter
+    if (!in_ds->get_source_remote() && in_ds->get_source_ipc_pid() <= 0)
+        return;
+
+    auto dlt = in_ds->get_source_dlt();
+    std::vector<kis_bpf_insn> program;
+
+    if (!compile_capture_filter(dlt, program))
+        return;
+
+    // Nothing to remove
+    if (program.size() == 0 && in_ds->get_source_capture_filter_len() == 0)
+        return;
+
+    auto name = in_ds->get_source_name();
+    auto len = program.size();
+
+    in_ds->set_capture_filter(dlt, program, 0,
+            [name, len](unsigned int, bool success, std::string msg) {
+                if (success && len > 0)
+                    _MSG_INFO("Data source '{}' is applying a capture filter of {} instructions",
+                            name, len);
+                else if (!success)
+                    _MSG_INFO("Data source '{}' could not apply the capture filter, Kismet will "
+                            "filter its packets instead{}{}", name, msg.length() ? ": " : "", msg);
+            });
+}
+
 void datasource_tracker::list_interfaces(const std::function<void (std::vector<shared_interface>)>& in_cb) {
     local_locker lock(&dst_lock);
 
@@ -1083,20 +1446,51 @@ void datasource_tracker::new_remote_tcp_connection(int in_fd) {
     auto socketcli = 
         std::make_shared<socket_client>(in_fd, conn_handler);
 
+    new_remote_incoming(conn_handler, remote_transport);
+
+    // Register the connection as pollable
+    auto pollabletracker = 
+        Globalreg::fetch_mandatory_global_as<pollable_tracker>();
+    pollabletracker->register_pollable(socketcli);
+}
+
+void datasource_tracker::new_remote_incoming(std::shared_ptr<buffer_handler_generic> in_handler,
+        std::shared_ptr<KismetDatasource::Transport> in_transport) {
     // Bind a new incoming remote which will pivot to the proper data source type
-    auto incoming_remote = new dst_incoming_remote(conn_handler, 
+    auto incoming_remote = new dst_incoming_remote(in_handler, in_transport,
                 [this] (dst_incoming_remote *i, std::string in_type, std::string in_def, 
                     uuid in_uuid, std::shared_ptr<buffer_handler_generic> in_handler) {
             in_handler->remove_read_buffer_interface();
             open_remote_datasource(i, in_type, in_def, in_uuid, in_handler);
         });
 
-    conn_handler->set_read_buffer_interface(incoming_remote);
+    in_handler->set_read_buffer_interface(incoming_remote);
+}
 
-    // Register the connection as pollable
-    auto pollabletracker = 
-        Globalreg::fetch_mandatory_global_as<pollable_tracker>();
-    pollabletracker->register_pollable(socketcli);
+void datasource_tracker::new_remote_mux(std::shared_ptr<buffer_handler_generic> in_handler,
+        bool in_transport) {
+    local_locker lock(&dst_lock);
+
+    remote_mux_vec.push_back(std::make_shared<dst_remote_mux>(in_handler, 
+                remote_mux_buffer_sz * 1024, in_transport));
+}
+
+void datasource_tracker::remove_remote_mux(dst_remote_mux *in_mux) {
+    // Multiplexers remove themselves from inside their own error handling, so they're
+    // released once that's done
+    timetracker->register_timer(1, NULL, 0, 
+            [this, in_mux] (int) -> int {
+                local_locker lock(&dst_lock);
+
+                for (auto i = remote_mux_vec.begin(); i != remote_mux_vec.end(); ++i) {
+                    if (i->get() == in_mux) {
+                        remote_mux_vec.erase(i);
+                        break;
+                    }
+                }
+
+                return 0;
+            });
 }
 
 void datasource_tracker::open_remote_datasource(dst_incoming_remote *incoming,
@@ -1135,11 +1529,14 @@ void datasource_tracker::open_remote_datasource(dst_incoming_remote *incoming,
         lock.unlock();
 
         auto dup_definition(in_definition);
+        auto transport = incoming->get_transport_negotiated();
 
         // Generate a detached thread for joining the ring buffer; it acts as a blocking
         // wait for the buffer to be filled
-        incoming->handshake_rb(std::thread([this, merge_target_device, in_handler, dup_definition]  {
-                    merge_target_device->connect_remote(in_handler, dup_definition, NULL);
+        incoming->handshake_rb(std::thread([this, merge_target_device, in_handler, dup_definition, 
+                    transport]  {
+                    merge_target_device->connect_remote(in_handler, dup_definition, 
+                            transport, NULL);
                     calculate_source_hopping(merge_target_device);
                 }));
 
@@ -1159,7 +1556,7 @@ void datasource_tracker::open_remote_datasource(dst_incoming_remote *incoming,
 
             // Make a data source from the builder
             shared_datasource ds = b->build_datasource(b, in_handler->get_mutex());
-            ds->connect_remote(in_handler, in_definition,
+            ds->connect_remote(in_handler, in_definition, incoming->get_transport_negotiated(),
                 [this, ds](unsigned int, bool success, std::string msg) {
                     if (success)
                         merge_source(ds); 
@@ -1237,8 +1634,9 @@ public:
 
     virtual void finalize() {
         if (target_sources.size() <= 1) {
-            initial_ds->set_channel_hop(defaults->get_hop_rate(),
+            initial_ds->set_channel_hop_dwell(defaults->get_hop_rate(),
                     initial_ds->get_source_hop_vec(),
+                    dst->source_hop_dwell(initial_ds),
                     defaults->get_random_channel_order(),
                     0, 0, NULL);
             return;
@@ -1271,8 +1669,8 @@ public:
                 rate = defaults->get_hop_rate();
             }
 
-            ds->set_channel_hop(rate, ds_hopchans, defaults->get_random_channel_order(),
-                    ds_offt, 0, NULL);
+            ds->set_channel_hop_dwell(rate, ds_hopchans, dst->source_hop_dwell(ds),
+                    defaults->get_random_channel_order(), ds_offt, 0, NULL);
 
             nintf++;
         }
@@ -1297,6 +1695,28 @@ void datasource_tracker::calculate_source_hopping(shared_datasource in_ds) {
         return;
     }
 
+    auto hop_mode = str_lower(in_ds->get_definition_opt("channel_hop_mode"));
+
+    if (hop_mode == "") {
+        hop_mode = config_defaults->get_hop_mode();
+    } else if (hop_mode != "fixed" && hop_mode != "adaptive") {
+        _MSG_ERROR("Source '{}' has an unknown channel_hop_mode= option '{}', expected "
+                "'fixed' or 'adaptive'; using the default channel hop mode.",
+                in_ds->get_source_name(), hop_mode);
+        hop_mode = config_defaults->get_hop_mode();
+    }
+
+    {
+        // Set the mode and flag together, so the hop stats timer can't see a stale mode
+        // and clear the flag
+        local_locker lock(&dst_lock);
+
+        in_ds->set_source_hop_mode(hop_mode);
+
+        if (hop_mode == "adaptive")
+            hop_adaptive_active = true;
+    }
+
     // Turn on channel hopping if we do that
     if (config_defaults->get_hop() && in_ds->get_source_builder()->get_tune_capable() &&
             in_ds->get_source_builder()->get_hop_capable()) {
@@ -1305,14 +1725,288 @@ void datasource_tracker::calculate_source_hopping(shared_datasource in_ds) {
             dst_chansplit_worker worker(this, config_defaults, in_ds);
             iterate_datasources(&worker);
         } else {
-            in_ds->set_channel_hop(config_defaults->get_hop_rate(),
+            in_ds->set_channel_hop_dwell(config_defaults->get_hop_rate(),
                     in_ds->get_source_hop_vec(),
+                    source_hop_dwell(in_ds),
                     config_defaults->get_random_channel_order(),
                     0, 0, NULL);
         }
     }
 }
 
+std::vector<double> datasource_tracker::source_hop_dwell(shared_datasource in_ds) {
+    if (in_ds->get_source_hop_mode() != "adaptive")
+        return std::vector<double>();
+
+    auto dwell = in_ds->get_source_hop_dwell_vec();
+
+    if (dwell->size() != in_ds->get_source_hop_vec()->size())
+        return std::vector<double>();
+
+    return dwell->get();
+}
+
+void datasource_tracker::configure_adaptive_hopping() {
+    auto hop_mode = 
+        str_lower(Globalreg::globalreg->kismet_config->fetch_opt_dfl("channel_hop_mode", "fixed"));
+
+    if (hop_mode != "fixed" && hop_mode != "adaptive") {
+        _MSG_ERROR("Unknown channel_hop_mode= '{}' in the Kismet config, expected 'fixed' or "
+                "'adaptive'; sources will hop at a fixed rate.", hop_mode);
+        hop_mode = "fixed";
+    }
+
+    config_defaults->set_hop_mode(hop_mode);
+
+    if (hop_mode == "adaptive")
+        _MSG_INFO("Sources will adapt the time spent on each channel to the activity seen "
+                "there");
+
+    hop_adaptive_interval = 
+        Globalreg::globalreg->kismet_config->fetch_opt_as<unsigned int>("channel_hop_adaptive_interval", 30);
+    hop_adaptive_min_dwell =
+        Globalreg::globalreg->kismet_config->fetch_opt_as<double>("channel_hop_adaptive_min_dwell", 0.25);
+    hop_adaptive_max_dwell =
+        Globalreg::globalreg->kismet_config->fetch_opt_as<double>("channel_hop_adaptive_max_dwell", 4);
+
+    if (hop_adaptive_interval < 5)
+        hop_adaptive_interval = 5;
+
+    // The dwell is normalized to an average of 1, so the limits have to allow that
+    if (hop_adaptive_min_dwell <= 0 || hop_adaptive_min_dwell > 1)
+        hop_adaptive_min_dwell = 0.25;
+
+    if (hop_adaptive_max_dwell < 1)
+        hop_adaptive_max_dwell = 4;
+
+    hop_stats_last = time(0);
+    hop_adaptive_last = hop_stats_last;
+
+    hop_stats_timer =
+        timetracker->register_timer(SERVER_TIMESLICES_SEC, NULL, 1,
+                [this](int) -> int {
+                    auto now = time(0);
+
+                    if (!hop_adaptive_active) {
+                        hop_stats_last = now;
+                        return 1;
+                    }
+
+                    enable_hop_packet_stats();
+
+                    local_locker lock(&dst_lock);
+
+                    if (now <= hop_stats_last)
+                        return 1;
+
+                    bool any_adaptive = false;
+
+                    for (auto si : *datasource_vec) {
+                        auto ds = std::static_pointer_cast<kis_datasource>(si);
+
+                        ds->update_hop_stats(now - hop_stats_last);
+
+                        if (ds->get_source_hop_mode() == "adaptive")
+                            any_adaptive = true;
+                    }
+
+                    hop_stats_last = now;
+
+                    if (!any_adaptive) {
+                        hop_adaptive_active = false;
+                        return 1;
+                    }
+
+                    if (now - hop_adaptive_last >= (time_t) hop_adaptive_interval) {
+                        hop_adaptive_last = now;
+                        plan_adaptive_hopping();
+                    }
+
+                    return 1;
+                });
+}
+
+void datasource_tracker::enable_hop_packet_stats() {
+    // Only called from the hop stats timer, so the handler is registered once
+    if (hop_stats_chain_id >= 0)
+        return;
+
+    auto packetchain = Globalreg::fetch_mandatory_global_as<packet_chain>();
+    auto pack_comp_datasrc = packetchain->register_packet_component("KISDATASRC");
+    auto pack_comp_l1info = packetchain->register_packet_component("RADIODATA");
+    auto pack_comp_common = packetchain->register_packet_component("COMMON");
+
+    hop_stats_chain_id =
+        packetchain->register_handler([pack_comp_datasrc, pack_comp_l1info, 
+                pack_comp_common](kis_packet *in_pack) -> int {
+                auto datasrc = in_pack->fetch<packetchain_comp_datasource>(pack_comp_datasrc);
+                auto l1info = in_pack->fetch<kis_layer1_packinfo>(pack_comp_l1info);
+
+                if (datasrc == nullptr || datasrc->ref_source == nullptr || l1info == nullptr)
+                    return 1;
+
+                if (l1info->channel.length() != 0 || l1info->freq_khz != 0) {
+                    datasrc->ref_source->count_hop_packet(l1info->channel, l1info->freq_khz);
+                    return 1;
+                }
+
+                auto common = in_pack->fetch<kis_common_info>(pack_comp_common);
+
+                if (common != nullptr)
+                    datasrc->ref_source->count_hop_packet(common->channel, common->freq_khz);
+
+                return 1;
+            }, CHAINPOS_LOGGING, 0);
+}
+
+void datasource_tracker::plan_adaptive_hopping() {
+    local_locker lock(&dst_lock);
+
+    auto channeltracker = 
+        Globalreg::fetch_global_as<channel_tracker_v2>(channel_tracker_v2::global_name());
+
+    if (channeltracker == nullptr)
+        return;
+
+    // Sources of the same type hopping the same channels share a plan, so that between
+    // them they spend the longest on the busiest channels
+    std::map<std::string, std::vector<shared_datasource>> groups;
+
+    for (auto si : *datasource_vec) {
+        auto ds = std::static_pointer_cast<kis_datasource>(si);
+
+        if (!ds->get_source_running() || !ds->get_source_hopping() ||
+                ds->get_source_hop_mode() != "adaptive" || ds->get_source_hop_vec()->size() < 2)
+            continue;
+
+        std::vector<std::string> chans;
+        for (auto c : *ds->get_source_hop_vec())
+            chans.push_back(get_tracker_value<std::string>(c));
+
+        std::sort(chans.begin(), chans.end());
+
+        std::stringstream key;
+        key << ds->get_source_builder()->get_source_type();
+        for (auto c : chans)
+            key << "," << c;
+
+        groups[key.str()].push_back(ds);
+    }
+
+    for (auto g : groups) {
+        auto& group_sources = g.second;
+        auto first_ds = group_sources[0];
+
+        std::map<std::string, double> share, current, packets_sec, devices;
+
+        for (auto c : *first_ds->get_source_hop_vec()) {
+            auto chan = get_tracker_value<std::string>(c);
+            share[chan] = 0;
+            current[chan] = 0;
+        }
+
+        // How much of the time the group spent on each channel; activity on a channel
+        // we rarely visit is scaled up, so a busy channel isn't just one we sat on
+        for (auto ds : group_sources) {
+            auto ds_chans = ds->get_source_hop_vec();
+            auto ds_dwell = ds->get_source_hop_dwell_vec();
+            bool has_dwell = ds_dwell->size() == ds_chans->size();
+
+            double total = 0;
+            for (size_t i = 0; i < ds_chans->size(); i++) 
+                total += has_dwell ? ds_dwell->at(i) : 1;
+
+            for (size_t i = 0; i < ds_chans->size(); i++) {
+                auto chan = get_tracker_value<std::string>(ds_chans->at(i));
+                auto d = has_dwell ? ds_dwell->at(i) : 1;
+
+                share[chan] += d / total;
+                current[chan] += d / group_sources.size();
+            }
+        }
+
+        double total_packets = 0, total_devices = 0;
+
+        for (auto c : share) {
+            double pps, devs;
+
+            channeltracker->get_channel_activity(c.first, 
+                    first_ds->hop_channel_freq_khz(c.first), hop_adaptive_interval, pps, devs);
+
+            if (c.second > 0)
+                pps = pps / c.second;
+
+            packets_sec[c.first] = pps;
+            devices[c.first] = devs;
+
+            total_packets += pps;
+            total_devices += devs;
+        }
+
+        // Nothing seen anywhere yet; keep hopping as we are
+        if (total_packets == 0 && total_devices == 0)
+            continue;
+
+        auto nchans = (double) share.size();
+        std::map<std::string, double> plan;
+
+        for (auto c : share) {
+            double target = 0;
+            int n = 0;
+
+            if (total_packets > 0) {
+                target += packets_sec[c.first] / (total_packets / nchans);
+                n++;
+            }
+
+            if (total_devices > 0) {
+                target += devices[c.first] / (total_devices / nchans);
+                n++;
+            }
+
+            target = target / n;
+
+            // Move halfway to the new weight so one busy interval doesn't swing the plan
+            plan[c.first] = (current[c.first] + target) / 2;
+        }
+
+        // Keep the average dwell at 1, so a pass through the channels takes as long
+        // as it does at the fixed rate, and every channel gets at least the minimum
+        for (int pass = 0; pass < 4; pass++) {
+            double total = 0;
+
+            for (auto p : plan)
+                total += p.second;
+
+            for (auto& p : plan) {
+                p.second = p.second * nchans / total;
+                p.second = std::max(hop_adaptive_min_dwell, std::min(hop_adaptive_max_dwell, p.second));
+            }
+        }
+
+        bool changed = false;
+        for (auto p : plan) {
+            if (fabs(p.second - current[p.first]) >= 0.05) {
+                changed = true;
+                break;
+            }
+        }
+
+        if (!changed)
+            continue;
+
+        for (auto ds : group_sources) {
+            std::vector<double> dwell;
+
+            for (auto c : *ds->get_source_hop_vec())
+                dwell.push_back(plan[get_tracker_value<std::string>(c)]);
+
+            ds->set_channel_hop_dwell(ds->get_source_hop_rate(), ds->get_source_hop_vec(),
+                    dwell, ds->get_source_hop_shuffle(), ds->get_source_hop_offset(), 0, NULL);
+        }
+    }
+}
+
 void datasource_tracker::queue_dead_remote(dst_incoming_remote *in_dead) {
     local_locker lock(&dst_lock);
 
@@ -2003,11 +2697,13 @@ KIS_MHD_RETURN datasource_tracker_httpd_pcap::httpd_create_stream_response(kis_n
 }
 
 dst_incoming_remote::dst_incoming_remote(std::shared_ptr<buffer_handler_generic> in_rbufhandler,
+        std::shared_ptr<KismetDatasource::Transport> in_transport,
         std::function<void (dst_incoming_remote *, std::string, std::string, 
             uuid, std::shared_ptr<buffer_handler_generic>)> in_cb) :
     kis_external_interface() {
     
     cb = in_cb;
+    transport = in_transport;
 
     connect_buffer(in_rbufhandler);
 
@@ -2042,6 +2738,9 @@ bool dst_incoming_remote::dispatch_rx_packet(std::shared_ptr<KismetExternal::Com
     if (c->command() == "KDSNEWSOURCE") {
         handle_packet_newsource(c->seqno(), c->content());
         return true;
+    } else if (c->command() == "KDSMUX") {
+        handle_packet_mux(c->seqno(), c->content());
+        return true;
     }
 
     return false;
@@ -2073,6 +2772,10 @@ void dst_incoming_remote::handle_packet_newsource(uint32_t in_seqno, std::string
         return;
     }
 
+    // The capture tool only starts sending blocks once it has seen the KDSTRANSPORT, and
+    // blocks are handled by the datasource the connection is handed to
+    offer_transport(std::vector<std::string>(c.compression().begin(), c.compression().end()));
+
     if (cb != NULL)
         cb(this, c.sourcetype(), c.definition(), c.uuid(), ringbuf_handler);
 
@@ -2082,9 +2785,286 @@ void dst_incoming_remote::handle_packet_newsource(uint32_t in_seqno, std::string
     kill();
 }
 
+void dst_incoming_remote::handle_packet_mux(uint32_t in_seqno, std::string in_content) {
+    local_locker lock(ext_mutex);
+
+    KismetDatasource::Multiplex m;
+
+    if (!m.ParseFromString(in_content)) {
+        _MSG_ERROR("Could not process incoming multiplexed remote capture announcement");
+        kill();
+        return;
+    }
+
+    _MSG_INFO("Remote capture connection will carry {} sources", m.streams());
+
+    // Blocks are shared by all the sources on the connection and handled by the 
+    // multiplexer
+    offer_transport(std::vector<std::string>(m.compression().begin(), m.compression().end()));
+
+    auto datasourcetracker = 
+        Globalreg::fetch_global_as<datasource_tracker>("DATASOURCETRACKER");
+
+    if (datasourcetracker != nullptr) {
+        ringbuf_handler->remove_read_buffer_interface();
+        datasourcetracker->new_remote_mux(ringbuf_handler, transport_negotiated);
+    }
+
+    // Zero out the rbuf handler so that it doesn't get closed
+    ringbuf_handler.reset();
+
+    kill();
+}
+
+void dst_incoming_remote::offer_transport(const std::vector<std::string>& in_compression) {
+    transport_negotiated = false;
+
+    if (transport == nullptr)
+        return;
+
+    for (auto comp : in_compression) {
+        if (comp != transport->compression())
+            continue;
+
+        std::shared_ptr<KismetExternal::Command> tc(new KismetExternal::Command());
+
+        tc->set_command("KDSTRANSPORT");
+        tc->set_content(transport->SerializeAsString());
+
+        send_packet(tc);
+
+        transport_negotiated = true;
+
+        break;
+    }
+}
+
 void dst_incoming_remote::buffer_error(std::string in_error) {
     _MSG("Incoming remote source failed: " + in_error, MSGFLAG_ERROR);
     kill();
     return;
 }
 
+dst_remote_mux::dst_remote_mux(std::shared_ptr<buffer_handler_generic> in_rbufhandler,
+        size_t in_stream_buf_sz, bool in_transport) :
+    kis_external_interface(),
+    stream_buf_sz {in_stream_buf_sz},
+    closed {false} {
+
+    connect_buffer(in_rbufhandler, in_transport);
+
+    // The capture tool stops if it doesn't hear from us
+    last_pong = time(0);
+
+    ping_timer_id =
+        timetracker->register_timer(SERVER_TIMESLICES_SEC, NULL, 1,
+            [this] (int) -> int {
+                local_locker lock(ext_mutex);
+
+                if (time(0) - last_pong > 15) {
+                    _MSG_ERROR("Multiplexed remote capture connection did not answer a PING "
+                            "for over 15 seconds, closing connection.");
+                    trigger_error("no PONG from remote capture");
+                    return 0;
+                }
+
+                send_ping();
+                return 1;
+            });
+}
+
+dst_remote_mux::~dst_remote_mux() {
+    for (auto s : streams) {
+        s.second->mux = nullptr;
+        s.second->handler->remove_write_buffer_interface();
+        s.second->handler->set_protocol_error_cb(nullptr);
+    }
+
+    streams.clear();
+}
+
+size_t dst_remote_mux::get_num_streams() {
+    local_locker lock(ext_mutex);
+    return streams.size();
+}
+
+bool dst_remote_mux::handle_mux_frame(uint32_t in_stream, const uint8_t *in_data, 
+        size_t in_data_sz) {
+    local_demand_locker lock(ext_mutex);
+    lock.lock();
+
+    if (closed)
+        return true;
+
+    // An empty frame means the source on the capture side is gone
+    if (in_data_sz == 0) {
+        close_stream(in_stream, false, "Remote capture closed the source");
+        return true;
+    }
+
+    std::shared_ptr<mux_stream> stream;
+
+    auto si = streams.find(in_stream);
+
+    if (si == streams.end()) {
+        // A new source; it gets a buffer of its own which looks like a connection to 
+        // the source, sharing our lock, and announces itself like any other remote source
+        stream = std::make_shared<mux_stream>(this, in_stream);
+
+        stream->handler = 
+            std::make_shared<buffer_handler<ringbuf_v2>>(stream_buf_sz, 32 * 1024, ext_mutex);
+
+        stream->handler->set_write_buffer_interface(stream.get());
+
+        std::weak_ptr<mux_stream> wstream = stream;
+        stream->handler->set_protocol_error_cb([wstream]() {
+                auto s = wstream.lock();
+
+                if (s != nullptr && s->mux != nullptr)
+                    s->mux->close_stream(s->id, true, "");
+            });
+
+        streams[in_stream] = stream;
+
+        lock.unlock();
+
+        auto datasourcetracker = 
+            Globalreg::fetch_global_as<datasource_tracker>("DATASOURCETRACKER");
+
+        if (datasourcetracker != nullptr)
+            datasourcetracker->new_remote_incoming(stream->handler, nullptr);
+    } else {
+        stream = si->second;
+        lock.unlock();
+    }
+
+    // The source handles the frames as they're written, like any other remote source
+    if (stream->handler->put_read_buffer_data((void *) in_data, in_data_sz, true) != in_data_sz) {
+        _MSG_ERROR("Multiplexed remote capture source could not buffer {} bytes; the source "
+                "may have stalled, or remote_capture_mux_buffer_kb may be too small for the "
+                "packets being captured.", in_data_sz);
+        close_stream(in_stream, true, "insufficient buffer space");
+    }
+
+    return true;
+}
+
+void dst_remote_mux::send_stream(uint32_t in_stream) {
+    local_locker lock(ext_mutex);
+
+    if (ringbuf_handler == nullptr)
+        return;
+
+    auto si = streams.find(in_stream);
+
+    if (si == streams.end())
+        return;
+
+    auto handler = si->second->handler;
+
+    while (handler->get_write_buffer_used() > 0) {
+        size_t used = handler->get_write_buffer_used();
+
+        if (used > max_send_sz)
+            used = max_send_sz;
+
+        uint8_t *data = nullptr;
+        auto data_sz = handler->peek_write_buffer_data((void **) &data, used);
+
+        if (data_sz <= 0) {
+            handler->peek_free_write_buffer_data(data);
+            return;
+        }
+
+        ssize_t frame_sz = sizeof(kismet_external_mux_frame_t) + data_sz;
+        kismet_external_mux_frame_t *frame = nullptr;
+
+        if (ringbuf_handler->reserve_write_buffer_data((void **) &frame, frame_sz) < frame_sz || 
+                frame == nullptr) {
+            if (frame != nullptr)
+                ringbuf_handler->commit_write_buffer_data(NULL, 0);
+
+            handler->peek_free_write_buffer_data(data);
+
+            _MSG_ERROR("Multiplexed remote capture connection couldn't find space in the output "
+                    "buffer for the next command, something may have stalled.");
+            trigger_error("write buffer full");
+
+            return;
+        }
+
+        frame->signature = kis_hton32(KIS_EXTERNAL_MUX_SIG);
+        frame->stream = kis_hton32(in_stream);
+        frame->data_sz = kis_hton32(data_sz);
+        memcpy(frame->data, data, data_sz);
+
+        ringbuf_handler->commit_write_buffer_data((void *) frame, frame_sz);
+
+        handler->peek_free_write_buffer_data(data);
+        handler->consume_write_buffer_data(data_sz);
+    }
+}
+
+void dst_remote_mux::send_stream_close(uint32_t in_stream) {
+    if (ringbuf_handler == nullptr)
+        return;
+
+    kismet_external_mux_frame_t frame;
+
+    frame.signature = kis_hton32(KIS_EXTERNAL_MUX_SIG);
+    frame.stream = kis_hton32(in_stream);
+    frame.data_sz = 0;
+
+    ringbuf_handler->put_write_buffer_data(&frame, sizeof(kismet_external_mux_frame_t), true);
+}
+
+void dst_remote_mux::close_stream(uint32_t in_stream, bool in_notify_remote, 
+        const std::string& in_reason) {
+    local_locker lock(ext_mutex);
+
+    auto si = streams.find(in_stream);
+
+    if (si == streams.end())
+        return;
+
+    // Remove it first, so the source closing in turn doesn't come back here
+    auto stream = si->second;
+    streams.erase(si);
+
+    stream->mux = nullptr;
+    stream->handler->remove_write_buffer_interface();
+
+    if (in_notify_remote)
+        send_stream_close(in_stream);
+    else
+        stream->handler->buffer_error(in_reason);
+}
+
+void dst_remote_mux::buffer_error(std::string in_error) {
+    local_locker lock(ext_mutex);
+
+    if (closed)
+        return;
+
+    closed = true;
+
+    _MSG_ERROR("Multiplexed remote capture connection failed: {}", in_error);
+
+    timetracker->remove_timer(ping_timer_id);
+    ping_timer_id = -1;
+
+    auto stream_ids = std::vector<uint32_t>();
+    for (auto s : streams)
+        stream_ids.push_back(s.first);
+
+    for (auto s : stream_ids)
+        close_stream(s, false, fmt::format("Remote capture connection failed: {}", in_error));
+
+    close_external();
+
+    auto datasourcetracker = 
+        Globalreg::fetch_global_as<datasource_tracker>("DATASOURCETRACKER");
+
+    if (datasourcetracker != nullptr)
+        datasourcetracker->remove_remote_mux(this);
+}
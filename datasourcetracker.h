@@ -42,6 +42,7 @@
 #include "trackedrrd.h"
 #include "kis_mutex.h"
 #include "eventbus.h"
+#include "packet_filter.h"
 
 /* Data source tracker
  *
@@ -237,6 +238,7 @@ public:
 
     __Proxy(hop_rate, double, double, double, hop_rate);
     __Proxy(hop, uint8_t, bool, bool, hop);
+    __Proxy(hop_mode, std::string, std::string, std::string, hop_mode);
     __Proxy(split_same_sources, uint8_t, bool, bool, split_same_sources);
     __Proxy(random_channel_order, uint8_t, bool, bool, random_channel_order);
     __Proxy(retry_on_error, uint8_t, bool, bool, retry_on_error);
@@ -254,6 +256,8 @@ protected:
                 "default hop rate for sources", &hop_rate);
         register_field("kismet.datasourcetracker.default.hop", 
                 "do sources hop by default", &hop);
+        register_field("kismet.datasourcetracker.default.hop_mode", 
+                "default hop scheduling mode (fixed or adaptive)", &hop_mode);
         register_field("kismet.datasourcetracker.default.split", 
                 "split channels among sources with the same type", 
                 &split_same_sources);
@@ -281,6 +285,9 @@ protected:
     // Boolean, do we hop at all
     std::shared_ptr<tracker_element_uint8> hop;
 
+    // Hop scheduling, fixed rate or adaptive
+    std::shared_ptr<tracker_element_string> hop_mode;
+
     // Boolean, do we try to split channels up among the same driver?
     std::shared_ptr<tracker_element_uint8> split_same_sources;
 
@@ -304,6 +311,7 @@ protected:
 class dst_incoming_remote : public kis_external_interface {
 public:
     dst_incoming_remote(std::shared_ptr<buffer_handler_generic> in_rbufhandler,
+            std::shared_ptr<KismetDatasource::Transport> in_transport,
             std::function<void (dst_incoming_remote *, std::string srctype, std::string srcdef,
                 uuid srcuuid, std::shared_ptr<buffer_handler_generic> handler)> in_cb);
     ~dst_incoming_remote();
@@ -317,24 +325,97 @@ public:
 
     virtual void handle_packet_newsource(uint32_t in_seqno, std::string in_packet);
 
+    // Hand the connection to a multiplexer for the sources it carries
+    virtual void handle_packet_mux(uint32_t in_seqno, std::string in_packet);
+
     virtual void kill();
 
     virtual void handshake_rb(std::thread t) {
         std::swap(handshake_thread, t);
     }
 
+    // Did we switch the capture tool to compressed blocks?
+    bool get_transport_negotiated() const {
+        return transport_negotiated;
+    }
+
     virtual void buffer_error(std::string in_error) override;
 
 protected:
+    // Switch the connection to compressed blocks if the capture tool supports the 
+    // transport we offer, and record if it did
+    void offer_transport(const std::vector<std::string>& in_compression);
+
     // Timeout for killing this connection
     int timerid;
 
     std::function<void (dst_incoming_remote *, std::string, std::string, uuid, 
             std::shared_ptr<buffer_handler_generic> )> cb;
 
+    // Compressed transport to offer, or null if disabled
+    std::shared_ptr<KismetDatasource::Transport> transport;
+
     std::thread handshake_thread;
 };
 
+// Multiplexed remote capture connection, which carries several sources from one
+// capture tool.  Each stream of the connection gets a small buffer pair which stands
+// in for the TCP connection of a normal remote source, so the sources themselves 
+// are handled exactly the same way; the connection, its buffers, and the compressed
+// transport are shared.
+class dst_remote_mux : public kis_external_interface {
+public:
+    dst_remote_mux(std::shared_ptr<buffer_handler_generic> in_rbufhandler, 
+            size_t in_stream_buf_sz, bool in_transport);
+    virtual ~dst_remote_mux();
+
+    virtual void handle_msg_proxy(const std::string& msg, const int msgtype) override {
+        _MSG(fmt::format("(Remote) - {}", msg), msgtype);
+    }
+
+    virtual void buffer_error(std::string in_error) override;
+
+    size_t get_num_streams();
+
+protected:
+    class mux_stream : public buffer_interface {
+    public:
+        mux_stream(dst_remote_mux *in_mux, uint32_t in_id) :
+            buffer_interface(),
+            mux {in_mux},
+            id {in_id} { }
+
+        // Data written by the source is sent on the connection
+        virtual void buffer_available(size_t in_amt) override {
+            if (mux != nullptr)
+                mux->send_stream(id);
+        }
+
+        dst_remote_mux *mux;
+        uint32_t id;
+        std::shared_ptr<buffer_handler_generic> handler;
+    };
+
+    virtual bool handle_mux_frame(uint32_t in_stream, const uint8_t *in_data, 
+            size_t in_data_sz) override;
+
+    void send_stream(uint32_t in_stream);
+    void send_stream_close(uint32_t in_stream);
+
+    // Close a stream, and either tell the capture tool or tell the source
+    void close_stream(uint32_t in_stream, bool in_notify_remote, const std::string& in_reason);
+
+    std::map<uint32_t, std::shared_ptr<mux_stream>> streams;
+
+    size_t stream_buf_sz;
+
+    // Largest piece of a stream sent in one frame; the capture tool reads commands 
+    // into a small buffer
+    const static size_t max_send_sz = 8192;
+
+    bool closed;
+};
+
 // Fwd def of datasource pcap feed
 class datasource_tracker_httpd_pcap;
 
@@ -429,6 +510,10 @@ public:
 
     virtual KIS_MHD_RETURN httpd_post_complete(kis_net_httpd_connection *concls) override;
 
+    // Dwell to keep when re-sending the hop list to a source; empty unless the source
+    // is in the adaptive hop mode
+    std::vector<double> source_hop_dwell(shared_datasource in_ds);
+
     // Operate on all data sources currently defined.  The datasource tracker is locked
     // during this operation, making it thread safe.
     void iterate_datasources(datasource_tracker_worker *in_worker);
@@ -442,6 +527,15 @@ public:
     // Queue a remote handler to be removed
     void queue_dead_remote(dst_incoming_remote *in_dead);
 
+    // Start handling a remote capture connection, or a stream of a multiplexed connection,
+    // which will announce its sources
+    void new_remote_incoming(std::shared_ptr<buffer_handler_generic> in_handler,
+            std::shared_ptr<KismetDatasource::Transport> in_transport);
+
+    // Hand a remote capture connection to a multiplexer, and remove it once it fails
+    void new_remote_mux(std::shared_ptr<buffer_handler_generic> in_handler, bool in_transport);
+    void remove_remote_mux(dst_remote_mux *in_mux);
+
     // Merge a source into the source list, preserving UUID and source number
     virtual void merge_source(shared_datasource in_source);
 
@@ -505,9 +599,50 @@ protected:
     // and want to do channel split
     void calculate_source_hopping(shared_datasource in_ds);
 
+    // Adaptive hopping; sources in the adaptive mode dwell longer on channels
+    // where channel_tracker_v2 has seen more activity.  Every channel is still
+    // visited once per pass through the hop list.
+    int hop_stats_timer, hop_stats_chain_id;
+    time_t hop_stats_last, hop_adaptive_last;
+    unsigned int hop_adaptive_interval;
+    double hop_adaptive_min_dwell, hop_adaptive_max_dwell;
+
+    void configure_adaptive_hopping();
+
+    // Is any source hopping adaptively?  Set when an adaptive source is configured and
+    // cleared by the hop stats timer when none are left; until then the timer does
+    // nothing, so fixed hopping costs nothing
+    std::atomic<bool> hop_adaptive_active;
+
+    // Count packets per hop channel; only needed once a source hops adaptively, so the
+    // packet chain handler is registered by the hop stats timer after the first adaptive
+    // source is configured.  Sources are configured under dst_lock, which must not be
+    // held while registering with the packet chain.
+    void enable_hop_packet_stats();
+
+    // Re-weight the dwell of the adaptive sources; sources of the same type hopping
+    // the same channels are planned together
+    void plan_adaptive_hopping();
+
     // Our pcap http interface
     std::shared_ptr<datasource_tracker_httpd_pcap> httpd_pcap;
 
+    // Capture filters; they're compiled and applied by the capture tools which can,
+    // and applied by Kismet for all sources
+    std::shared_ptr<packet_filter_mac_addr> capture_mac_filter;
+    std::shared_ptr<packet_filter_dot11_type> capture_dot11_filter;
+    bool capture_filter_pushdown;
+    int capture_filter_timer, capture_filter_chain_id;
+    unsigned long capture_filter_eb_id;
+
+    void configure_capture_filters();
+
+    // Compile the capture filters for a DLT; an empty program means nothing would be
+    // filtered.  Returns false if the DLT isn't supported.
+    bool compile_capture_filter(unsigned int in_dlt, std::vector<kis_bpf_insn>& out_program);
+
+    void push_capture_filter(shared_datasource in_ds);
+
     // Datasource logging
     int database_log_timer;
     bool database_log_enabled, database_logging;
@@ -519,6 +654,13 @@ protected:
 
     // Buffer sizes
     size_t tcp_buffer_sz;
+    size_t remote_mux_buffer_sz;
+
+    // Multiplexed remote capture connections
+    std::vector<std::shared_ptr<dst_remote_mux>> remote_mux_vec;
+
+    // Compressed transport offered to remote captures, or null if disabled
+    std::shared_ptr<KismetDatasource::Transport> remote_transport;
 };
 
 /* This implements the core 'all data' pcap, and pcap filtered by datasource UUID.
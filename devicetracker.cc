@@ -189,6 +189,13 @@ device_tracker::device_tracker(global_registry *in_globalreg) :
         map_phy_views = true;
     }
 
+    view_sort_index_fields = 
+        globalreg->kismet_config->fetch_opt_vec("device_view_sort_index");
+
+    if (view_sort_index_fields.size() > 0)
+        _MSG_INFO("Maintaining sorted device view indexes on {} field(s)", 
+                view_sort_index_fields.size());
+
     if (globalreg->kismet_config->fetch_opt_bool("kis_log_devices", true)) {
         unsigned int lograte = 
             globalreg->kismet_config->fetch_opt_uint("kis_log_device_rate", 30);
@@ -197,6 +204,7 @@ device_tracker::device_tracker(global_registry *in_globalreg) :
                 " seconds.", MSGFLAG_INFO);
 
         databaselog_logging = false;
+        databaselog_enabled = true;
 
         databaselog_timer =
             timetracker->register_timer(SERVER_TIMESLICES_SEC * lograte, NULL, 1,
@@ -231,6 +239,7 @@ device_tracker::device_tracker(global_registry *in_globalreg) :
                 });
     } else {
         databaselog_timer = -1;
+        databaselog_enabled = false;
     }
 
 #if 0
@@ -326,6 +335,43 @@ device_tracker::device_tracker(global_registry *in_globalreg) :
                 return multikey_endp_handler(stream, uri, json, variable_cache);
                 });
 
+    // Device change subscriptions
+    next_subscription_id = 1;
+    num_subscriptions = 0;
+
+    subscribe_endp =
+        std::make_shared<kis_net_httpd_simple_post_endpoint>("/devices/subscriptions/subscribe",
+                [this](std::ostream& stream, const std::string& uri, 
+                    const Json::Value& json,
+                    kis_net_httpd_connection::variable_cache_map& variable_cache) -> unsigned int {
+                return subscribe_endp_handler(stream, uri, json, variable_cache);
+                });
+
+    subscription_endp =
+        std::make_shared<kis_net_httpd_path_post_endpoint>(
+                [this](const std::vector<std::string>& path, const std::string& uri) -> bool {
+                    // /devices/subscriptions/[id]/poll|cancel
+                    if (path.size() != 4)
+                        return false;
+
+                    if (path[0] != "devices" || path[1] != "subscriptions")
+                        return false;
+
+                    return path[3] == "poll" || path[3] == "cancel";
+                },
+                [this](std::ostream& stream, const std::vector<std::string>& path, 
+                        const std::string& uri, const Json::Value& json, 
+                        kis_net_httpd_connection::variable_cache_map& variable_cache) -> unsigned int {
+                    return subscription_endp_handler(stream, path, uri, json);
+                });
+
+    subscription_timer =
+        timetracker->register_timer(SERVER_TIMESLICES_SEC * 30, NULL, 1,
+                [this](int) -> int {
+                    expire_subscriptions();
+                    return 1;
+                });
+
     phy_phyentry_id =
         entrytracker->register_field("kismet.phy.phy",
                 tracker_element_factory<tracker_element_map>(),
@@ -439,6 +485,17 @@ device_tracker::device_tracker(global_registry *in_globalreg) :
                     return 1;
                 });
 
+    view_snapshot_timer =
+        timetracker->register_timer(SERVER_TIMESLICES_SEC * 30, NULL, 1,
+                [this](int) -> int {
+                    local_shared_locker l(&view_mutex);
+
+                    for (auto i : *view_vec)
+                        std::static_pointer_cast<device_tracker_view>(i)->expire_snapshots();
+
+                    return 1;
+                });
+
     httpd->register_alias("/devices/summary/devices.json", "/devices/views/all/devices.json");
 }
 
@@ -467,6 +524,18 @@ device_tracker::~device_tracker() {
         timetracker->remove_timer(device_idle_timer);
         timetracker->remove_timer(max_devices_timer);
         timetracker->remove_timer(device_storage_timer);
+        timetracker->remove_timer(subscription_timer);
+        timetracker->remove_timer(view_snapshot_timer);
+    }
+
+    {
+        local_locker l(&subscription_mutex);
+
+        for (auto s : subscription_map)
+            s.second->cancel();
+
+        subscription_map.clear();
+        num_subscriptions = 0;
     }
 
     // TODO broken for now
@@ -757,6 +826,7 @@ std::shared_ptr<kis_tracked_device_base>
 
     // Update the mod data
     device->update_modtime();
+    databaselog_mark_dirty(device);
 
     // Raise alerts for new devices or devices which have been
     // idle and re-appeared
@@ -903,7 +973,9 @@ std::shared_ptr<kis_tracked_device_base>
 
         device->inc_seenby_count(pack_datasrc->ref_source, in_pack->ts.tv_sec, f, sc, !ram_no_rrd);
 
-        if (map_seenby_views)
+        // Sorted view indexes and subscriptions need to know about every device change,
+        // even without seenby views
+        if (map_seenby_views || view_sort_index_fields.size() > 0 || num_subscriptions > 0)
             update_view_device(device);
 
         if (sc != NULL)
@@ -1209,6 +1281,9 @@ bool device_tracker::add_view(std::shared_ptr<device_tracker_view> in_view) {
 
     view_vec->push_back(in_view);
 
+    for (auto f : view_sort_index_fields)
+        in_view->add_sort_index(f);
+
     for (auto i : *immutable_tracked_vec) {
         auto di = std::static_pointer_cast<kis_tracked_device_base>(i);
         in_view->new_device(di);
@@ -1236,6 +1311,8 @@ void device_tracker::new_view_device(std::shared_ptr<kis_tracked_device_base> in
         auto vi = std::static_pointer_cast<device_tracker_view>(i);
         vi->new_device(in_device);
     }
+
+    subscription_device_changed(in_device);
 }
 
 void device_tracker::update_view_device(std::shared_ptr<kis_tracked_device_base> in_device) {
@@ -1245,6 +1322,17 @@ void device_tracker::update_view_device(std::shared_ptr<kis_tracked_device_base>
         auto vi = std::static_pointer_cast<device_tracker_view>(i);
         vi->update_device(in_device);
     }
+
+    subscription_device_changed(in_device);
+}
+
+void device_tracker::reindex_view_device(std::shared_ptr<kis_tracked_device_base> in_device) {
+    local_shared_locker l(&view_mutex);
+
+    for (auto i : *view_vec) {
+        auto vi = std::static_pointer_cast<device_tracker_view>(i);
+        vi->reindex_device(in_device);
+    }
 }
 
 void device_tracker::remove_view_device(std::shared_ptr<kis_tracked_device_base> in_device) {
@@ -1254,6 +1342,45 @@ void device_tracker::remove_view_device(std::shared_ptr<kis_tracked_device_base>
         auto vi = std::static_pointer_cast<device_tracker_view>(i);
         vi->remove_device(in_device);
     }
+
+    subscription_device_removed(in_device);
+}
+
+void device_tracker::subscription_device_changed(std::shared_ptr<kis_tracked_device_base> in_device) {
+    if (num_subscriptions == 0)
+        return;
+
+    local_shared_locker l(&subscription_mutex);
+
+    for (auto s : subscription_map)
+        s.second->device_changed(in_device);
+}
+
+void device_tracker::subscription_device_removed(std::shared_ptr<kis_tracked_device_base> in_device) {
+    if (num_subscriptions == 0)
+        return;
+
+    local_shared_locker l(&subscription_mutex);
+
+    for (auto s : subscription_map)
+        s.second->device_removed(in_device);
+}
+
+void device_tracker::expire_subscriptions() {
+    local_locker l(&subscription_mutex);
+
+    auto now = time(0);
+
+    for (auto si = subscription_map.begin(); si != subscription_map.end(); ) {
+        if (now - si->second->get_last_poll() > DEVICE_SUBSCRIPTION_TIMEOUT) {
+            si->second->cancel();
+            si = subscription_map.erase(si);
+        } else {
+            ++si;
+        }
+    }
+
+    num_subscriptions = subscription_map.size();
 }
 
 std::shared_ptr<device_tracker_view> device_tracker::get_phy_view(int in_phyid) {
@@ -1266,28 +1393,56 @@ std::shared_ptr<device_tracker_view> device_tracker::get_phy_view(int in_phyid)
     return nullptr;
 }
 
+void device_tracker::databaselog_mark_dirty(std::shared_ptr<kis_tracked_device_base> device) {
+    if (!databaselog_enabled)
+        return;
+
+    if (device->databaselog_dirty.exchange(true))
+        return;
+
+    std::lock_guard<std::mutex> lk(databaselog_dirty_mutex);
+    databaselog_dirty_vec.push_back(device);
+}
+
 void device_tracker::databaselog_write_devices() {
+    std::vector<std::shared_ptr<kis_tracked_device_base>> dirty_vec;
+
+    {
+        std::lock_guard<std::mutex> lk(databaselog_dirty_mutex);
+        dirty_vec.swap(databaselog_dirty_vec);
+    }
+
     auto dbf = Globalreg::fetch_global_as<kis_database_logfile>();
     
-    if (dbf == nullptr)
+    // Clear the dirty flags even if we're not logging, so the set doesn't grow
+    if (dbf == nullptr) {
+        for (auto d : dirty_vec)
+            d->databaselog_dirty = false;
         return;
+    }
 
-    device_tracker_view_function_worker worker([this, dbf](std::shared_ptr<kis_tracked_device_base> dev) -> bool {
-            if (dev->get_mod_time() >= last_database_logged) {
-                dbf->log_device(dev);
-            }
+    size_t num_devices = 0;
+    size_t num_bytes = 0;
 
-            return false;
-        });
+    for (auto d : dirty_vec) {
+        // Hold the device while it's serialized, the same as a readonly device worker
+        local_shared_locker devlocker(&d->device_mutex);
+
+        // Clear the flag before logging so that a change made while we serialize the
+        // device queues it again for the next pass
+        d->databaselog_dirty = false;
 
-    // Remember the time BEFORE we spend time looking at all the devices
-    auto log_time = time(0);
+        auto r = dbf->log_device(d);
+
+        if (r > 0) {
+            num_devices++;
+            num_bytes += r;
+        }
+    }
 
-    do_readonly_device_work(worker);
+    last_database_logged = time(0);
 
-    // Then update the log; we might catch a few high-change devices twice, but this is
-    // safer by far
-    last_database_logged = log_time;
+    dbf->log_device_pass(num_devices, num_bytes);
 }
 
 void device_tracker::load_stored_username(std::shared_ptr<kis_tracked_device_base> in_dev) {
@@ -1407,6 +1562,13 @@ void device_tracker::set_device_user_name(std::shared_ptr<kis_tracked_device_bas
     local_locker devlocker(&(in_dev->device_mutex));
 
     in_dev->set_username(in_username);
+    in_dev->update_modtime();
+    databaselog_mark_dirty(in_dev);
+
+    // The username replaces the common name, so indexes sorted on either are stale
+    reindex_view_device(in_dev);
+
+    subscription_device_changed(in_dev);
 
     if (!database_valid()) {
         _MSG("Unable to store device name to permanent storage, the database connection "
@@ -1469,6 +1631,11 @@ void device_tracker::set_device_tag(std::shared_ptr<kis_tracked_device_base> in_
         sm->insert(in_tag, e);
     }
 
+    in_dev->update_modtime();
+    databaselog_mark_dirty(in_dev);
+
+    subscription_device_changed(in_dev);
+
     if (!database_valid()) {
         _MSG("Unable to store device name to permanent storage, the database connection "
                 "is not available", MSGFLAG_ERROR);
@@ -26,6 +26,7 @@
 #include <time.h>
 #include <list>
 #include <map>
+#include <mutex>
 #include <unordered_map>
 #include <vector>
 #include <algorithm>
@@ -53,6 +54,7 @@
 #include "kis_net_microhttpd.h"
 #include "devicetracker_view.h"
 #include "devicetracker_view_workers.h"
+#include "devicetracker_subscription.h"
 #include "kis_database.h"
 #include "eventbus.h"
 
@@ -223,6 +225,7 @@ public:
     virtual void new_view_device(std::shared_ptr<kis_tracked_device_base> in_device);
     virtual void update_view_device(std::shared_ptr<kis_tracked_device_base> in_device);
     virtual void remove_view_device(std::shared_ptr<kis_tracked_device_base> in_device);
+    virtual void reindex_view_device(std::shared_ptr<kis_tracked_device_base> in_device);
 
     // Get phy views
     std::shared_ptr<device_tracker_view> get_phy_view(int in_phy);
@@ -248,6 +251,12 @@ protected:
     bool map_phy_views;
     std::unordered_map<int, std::shared_ptr<device_tracker_view>> phy_view_map;
 
+    // Fields every view maintains a sorted index on
+    std::vector<std::string> view_sort_index_fields;
+
+    // Expire unused cursor snapshots in every view
+    int view_snapshot_timer;
+
     // Base IDs for tracker components
     int device_list_base_id, device_base_id;
     int device_summary_base_id;
@@ -354,6 +363,24 @@ protected:
     unsigned int multikey_endp_handler(std::ostream& stream, const std::string& uri,
             const Json::Value& json, kis_net_httpd_connection::variable_cache_map& variable_cache);
 
+    // Device change subscriptions; subscriptions which are not polled are expired
+    kis_recursive_timed_mutex subscription_mutex;
+    uint64_t next_subscription_id;
+    std::map<uint64_t, std::shared_ptr<device_tracker_subscription>> subscription_map;
+    std::atomic<unsigned int> num_subscriptions;
+    int subscription_timer;
+
+    std::shared_ptr<kis_net_httpd_simple_post_endpoint> subscribe_endp;
+    std::shared_ptr<kis_net_httpd_path_post_endpoint> subscription_endp;
+    unsigned int subscribe_endp_handler(std::ostream& stream, const std::string& uri,
+            const Json::Value& json, kis_net_httpd_connection::variable_cache_map& variable_cache);
+    unsigned int subscription_endp_handler(std::ostream& stream, const std::vector<std::string>& path,
+            const std::string& uri, const Json::Value& json);
+
+    void subscription_device_changed(std::shared_ptr<kis_tracked_device_base> in_device);
+    void subscription_device_removed(std::shared_ptr<kis_tracked_device_base> in_device);
+    void expire_subscriptions();
+
 	// Registered PHY types
 	int next_phy_id;
     std::map<int, kis_phy_handler *> phy_handler_map;
@@ -369,6 +396,14 @@ protected:
     kis_recursive_timed_mutex databaselog_mutex;
     bool databaselog_logging;
 
+    // Devices modified since the last database log pass; a device is only added when
+    // its dirty flag is first set, so repeated changes to a device between passes
+    // don't touch the lock
+    bool databaselog_enabled;
+    std::mutex databaselog_dirty_mutex;
+    std::vector<std::shared_ptr<kis_tracked_device_base>> databaselog_dirty_vec;
+    void databaselog_mark_dirty(std::shared_ptr<kis_tracked_device_base> device);
+
     // Do we constrain memory by not tracking RRD data?
     bool ram_no_rrd;
 
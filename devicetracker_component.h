@@ -22,6 +22,7 @@
 #include "config.h"
 
 #include <algorithm>
+#include <atomic>
 #include <list>
 #include <map>
 #include <string>
@@ -239,19 +240,22 @@ protected:
 class kis_tracked_device_base : public tracker_component {
 public:
     kis_tracked_device_base() :
-        tracker_component() {
+        tracker_component(),
+        databaselog_dirty {false} {
         register_fields();
         reserve_fields(NULL);
     }
 
     kis_tracked_device_base(int in_id) :
-        tracker_component(in_id) {
+        tracker_component(in_id),
+        databaselog_dirty {false} {
         register_fields();
         reserve_fields(NULL);
     }
 
     kis_tracked_device_base(int in_id, std::shared_ptr<tracker_element_map> e) : 
-        tracker_component(in_id) {
+        tracker_component(in_id),
+        databaselog_dirty {false} {
         register_fields();
         reserve_fields(e);
     }
@@ -448,6 +452,10 @@ public:
     // inside it
     kis_recursive_timed_mutex device_mutex;
 
+    // Set when the device is queued to be written to the database log; lets the device
+    // tracker queue each modified device once per logging pass without taking a lock
+    std::atomic<bool> databaselog_dirty;
+
 protected:
     virtual void register_fields() override;
     virtual void reserve_fields(std::shared_ptr<tracker_element_map> e) override;
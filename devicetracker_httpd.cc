@@ -809,3 +809,147 @@ unsigned int device_tracker::multikey_endp_handler(std::ostream& stream, const s
     return 500;
 }
 
+unsigned int device_tracker::subscribe_endp_handler(std::ostream& stream, const std::string& uri,
+        const Json::Value& json, kis_net_httpd_connection::variable_cache_map& variable_cache) {
+
+    auto summary_vec = std::vector<SharedElementSummary>{};
+    auto regex_vec = std::vector<std::pair<std::string, std::string>>{};
+    std::shared_ptr<device_tracker_view> view;
+    double interval;
+    unsigned int max_batch;
+    unsigned int max_pending;
+
+    try {
+        auto fields = json.get("fields", Json::Value(Json::arrayValue));
+
+        for (const auto& i : fields) {
+            if (i.isString()) {
+                summary_vec.push_back(std::make_shared<tracker_element_summary>(i.asString()));
+            } else if (i.isArray()) {
+                if (i.size() != 2) 
+                    throw std::runtime_error("Invalid field map, expected [field, rename]");
+
+                summary_vec.push_back(std::make_shared<tracker_element_summary>(i[0].asString(), i[1].asString()));
+            } else {
+                throw std::runtime_error("Invalid field map, exected field or [field, rename]");
+            }
+        }
+
+        for (const auto& i : json.get("regex", Json::Value(Json::arrayValue))) {
+            if (!i.isArray() || i.size() != 2)
+                throw std::runtime_error("expected array of [field, regex] pairs for regex filter");
+
+            regex_vec.push_back(std::make_pair(i[0].asString(), i[1].asString()));
+        }
+
+        // Compile the filter now to report errors to the client
+        if (regex_vec.size() > 0)
+            device_tracker_view_regex_worker{regex_vec};
+
+        auto view_id = json.get("view", "all").asString();
+
+        {
+            local_shared_locker l(&view_mutex);
+
+            for (auto i : *view_vec) {
+                auto vi = std::static_pointer_cast<device_tracker_view>(i);
+                if (vi->get_view_id() == view_id) {
+                    view = vi;
+                    break;
+                }
+            }
+        }
+
+        if (view == nullptr)
+            throw std::runtime_error(fmt::format("Unknown view '{}'", kishttpd::escape_html(view_id)));
+
+        interval = json.get("interval", 1.0).asDouble();
+        if (interval < 0 || interval > 3600)
+            throw std::runtime_error("interval must be between 0 and 3600 seconds");
+
+        max_batch = json.get("max_batch", 1000).asUInt();
+        if (max_batch == 0 || max_batch > 10000)
+            throw std::runtime_error("max_batch must be between 1 and 10000");
+
+        max_pending = json.get("max_pending", DEVICE_SUBSCRIPTION_MAX_PENDING).asUInt();
+        if (max_pending < max_batch)
+            throw std::runtime_error("max_pending must be at least max_batch");
+
+    } catch (const std::exception& e) {
+        stream << "Invalid request: " << e.what() << "\n";
+        return 400;
+    }
+
+    expire_subscriptions();
+
+    local_locker l(&subscription_mutex);
+
+    if (subscription_map.size() >= DEVICE_SUBSCRIPTION_MAX) {
+        stream << "Too many device subscriptions\n";
+        return 503;
+    }
+
+    auto sub_id = next_subscription_id++;
+
+    subscription_map[sub_id] = 
+        std::make_shared<device_tracker_subscription>(sub_id, view, summary_vec, regex_vec,
+                interval, max_batch, max_pending);
+    num_subscriptions = subscription_map.size();
+
+    auto wrapper_elem = std::make_shared<tracker_element_string_map>();
+    auto id_elem = std::make_shared<tracker_element_uint64>();
+    id_elem->set(sub_id);
+    wrapper_elem->insert("id", id_elem);
+
+    Globalreg::globalreg->entrytracker->serialize(kishttpd::get_suffix(uri), stream, wrapper_elem, nullptr);
+
+    return 200;
+}
+
+unsigned int device_tracker::subscription_endp_handler(std::ostream& stream, 
+        const std::vector<std::string>& path, const std::string& uri, const Json::Value& json) {
+
+    auto sub_id = string_to_n_dfl<uint64_t>(path[2], 0);
+    std::shared_ptr<device_tracker_subscription> sub;
+
+    {
+        local_locker l(&subscription_mutex);
+
+        auto si = subscription_map.find(sub_id);
+
+        if (si == subscription_map.end()) {
+            stream << "Unknown or expired subscription\n";
+            return 404;
+        }
+
+        sub = si->second;
+
+        if (path[3] == "cancel") {
+            sub->cancel();
+            subscription_map.erase(si);
+            num_subscriptions = subscription_map.size();
+
+            stream << "Subscription cancelled\n";
+            return 200;
+        }
+    }
+
+    double timeout;
+
+    try {
+        timeout = json.get("timeout", 30.0).asDouble();
+
+        if (timeout < 0 || timeout > 60)
+            throw std::runtime_error("timeout must be between 0 and 60 seconds");
+    } catch (const std::exception& e) {
+        stream << "Invalid request: " << e.what() << "\n";
+        return 400;
+    }
+
+    auto rename_map = std::make_shared<tracker_element_serializer::rename_map>();
+    auto output = sub->poll(timeout, rename_map);
+
+    Globalreg::globalreg->entrytracker->serialize(kishttpd::get_suffix(uri), stream, output, rename_map);
+
+    return 200;
+}
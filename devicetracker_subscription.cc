@@ -0,0 +1,286 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <sstream>
+#include <unordered_set>
+
+#include "devicetracker_subscription.h"
+#include "devicetracker_view_workers.h"
+#include "kismet_algorithm.h"
+#include "msgpack_adapter.h"
+
+device_tracker_subscription::device_tracker_subscription(uint64_t in_id,
+        std::shared_ptr<device_tracker_view> in_view,
+        const std::vector<SharedElementSummary>& in_summary_vec,
+        const std::vector<std::pair<std::string, std::string>>& in_regex_vec,
+        double in_interval, size_t in_max_batch, size_t in_max_pending) :
+    sub_id {in_id},
+    view {in_view},
+    summary_vec {in_summary_vec},
+    regex_vec {in_regex_vec},
+    interval {std::chrono::milliseconds(static_cast<long>(in_interval * 1000))},
+    max_batch {in_max_batch},
+    max_pending {in_max_pending},
+    last_poll {time(0)},
+    overflow {false},
+    cancelled {false},
+    last_delivery {std::chrono::steady_clock::time_point::min()} { }
+
+void device_tracker_subscription::device_changed(std::shared_ptr<kis_tracked_device_base> device) {
+    std::lock_guard<std::mutex> lk(pending_mutex);
+
+    if (cancelled || overflow)
+        return;
+
+    auto pi = pending_map.find(device->get_key());
+
+    if (pi != pending_map.end()) {
+        pi->second = device;
+        return;
+    }
+
+    // The client has fallen behind; drop the pending changes and re-scan the view
+    // on the next poll
+    if (pending_map.size() >= max_pending) {
+        pending_map.clear();
+        overflow = true;
+        pending_cv.notify_all();
+        return;
+    }
+
+    pending_map.emplace(device->get_key(), device);
+    pending_cv.notify_all();
+}
+
+void device_tracker_subscription::device_removed(std::shared_ptr<kis_tracked_device_base> device) {
+    std::lock_guard<std::mutex> lk(pending_mutex);
+
+    if (cancelled || overflow)
+        return;
+
+    pending_map[device->get_key()] = nullptr;
+    pending_cv.notify_all();
+}
+
+void device_tracker_subscription::cancel() {
+    std::lock_guard<std::mutex> lk(pending_mutex);
+
+    cancelled = true;
+    pending_map.clear();
+    pending_cv.notify_all();
+}
+
+std::shared_ptr<tracker_element>
+    device_tracker_subscription::project_device(std::shared_ptr<kis_tracked_device_base> device,
+            std::shared_ptr<tracker_element_serializer::rename_map> rename_map,
+            std::vector<std::pair<int, size_t>>& hashes) {
+
+    auto rec = summarize_single_tracker_element(device, summary_vec, rename_map);
+
+    auto hash_elem = [](shared_tracker_element e) -> size_t {
+        std::stringstream ss;
+        msgpack_adapter::pack(ss, e);
+        return std::hash<std::string>{}(ss.str());
+    };
+
+    if (rec->get_type() == tracker_type::tracker_map) {
+        for (const auto& i : *std::static_pointer_cast<tracker_element_map>(rec))
+            hashes.push_back(std::make_pair(i.first, hash_elem(i.second)));
+
+        std::sort(hashes.begin(), hashes.end());
+    } else {
+        hashes.push_back(std::make_pair(0, hash_elem(rec)));
+    }
+
+    return rec;
+}
+
+std::shared_ptr<tracker_element> device_tracker_subscription::poll(double timeout,
+        std::shared_ptr<tracker_element_serializer::rename_map> rename_map) {
+    std::lock_guard<std::mutex> pl(poll_mutex);
+
+    last_poll = time(0);
+
+    auto deadline = std::chrono::steady_clock::now() +
+        std::chrono::milliseconds(static_cast<long>(timeout * 1000));
+
+    bool rescan = false;
+
+    {
+        std::unique_lock<std::mutex> lk(pending_mutex);
+
+        // Wait for changes, and for the delivery interval to elapse, or for the poll to
+        // time out
+        while (!cancelled) {
+            auto now = std::chrono::steady_clock::now();
+            auto due = last_delivery == std::chrono::steady_clock::time_point::min() ?
+                now : last_delivery + interval;
+            bool ready = pending_map.size() > 0 || overflow ||
+                resync_vec.size() > 0 || resync_removed_vec.size() > 0;
+
+            if ((ready && now >= due) || now >= deadline)
+                break;
+
+            pending_cv.wait_until(lk, ready ? std::min(due, deadline) : deadline);
+        }
+
+        if (overflow) {
+            overflow = false;
+            rescan = true;
+        }
+    }
+
+    auto wrapper_elem = std::make_shared<tracker_element_string_map>();
+    auto new_elem = std::make_shared<tracker_element_device_key_map>();
+    auto changed_elem = std::make_shared<tracker_element_device_key_map>();
+    auto removed_elem = std::make_shared<tracker_element_vector>();
+    auto more_elem = std::make_shared<tracker_element_uint8>();
+    auto resync_elem = std::make_shared<tracker_element_uint8>();
+
+    wrapper_elem->insert("new", new_elem);
+    wrapper_elem->insert("changed", changed_elem);
+    wrapper_elem->insert("removed", removed_elem);
+    wrapper_elem->insert("more", more_elem);
+    wrapper_elem->insert("resync", resync_elem);
+
+    // Queue every device in the view, and every device the client knows about, for
+    // comparison
+    if (rescan) {
+        auto all_worker = device_tracker_view_function_worker(
+                [](std::shared_ptr<kis_tracked_device_base>) -> bool { return true; });
+        auto devices = view->do_readonly_device_work(all_worker);
+
+        std::unordered_set<device_key> view_keys;
+
+        resync_vec.clear();
+        resync_vec.reserve(devices->size());
+
+        for (auto d : *devices) {
+            auto dev = std::static_pointer_cast<kis_tracked_device_base>(d);
+            view_keys.insert(dev->get_key());
+            resync_vec.push_back(dev);
+        }
+
+        resync_removed_vec.clear();
+
+        for (const auto& s : sent_map) {
+            if (view_keys.find(s.first) == view_keys.end())
+                resync_removed_vec.push_back(s.first);
+        }
+    }
+
+    resync_elem->set(rescan || resync_vec.size() > 0 || resync_removed_vec.size() > 0);
+
+    // Take the next batch, resync first
+    std::vector<std::pair<device_key, std::shared_ptr<kis_tracked_device_base>>> batch;
+
+    while (batch.size() < max_batch && resync_removed_vec.size() > 0) {
+        batch.push_back(std::make_pair(resync_removed_vec.back(), nullptr));
+        resync_removed_vec.pop_back();
+    }
+
+    while (batch.size() < max_batch && resync_vec.size() > 0) {
+        batch.push_back(std::make_pair(resync_vec.back()->get_key(), resync_vec.back()));
+        resync_vec.pop_back();
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(pending_mutex);
+
+        auto pi = pending_map.begin();
+        while (batch.size() < max_batch && pi != pending_map.end()) {
+            batch.push_back(*pi);
+            pi = pending_map.erase(pi);
+        }
+
+        more_elem->set(pending_map.size() > 0 || resync_vec.size() > 0 ||
+                resync_removed_vec.size() > 0);
+
+        if (batch.size() > 0)
+            last_delivery = std::chrono::steady_clock::now();
+    }
+
+    std::unique_ptr<device_tracker_view_regex_worker> regex_worker;
+    if (regex_vec.size() > 0)
+        regex_worker.reset(new device_tracker_view_regex_worker(regex_vec));
+
+    for (const auto& b : batch) {
+        auto dev = b.second;
+        shared_tracker_element rec;
+        std::vector<std::pair<int, size_t>> hashes;
+
+        if (dev != nullptr && view->contains_device(b.first)) {
+            local_shared_locker dl(&dev->device_mutex);
+
+            if (regex_worker == nullptr || regex_worker->match_device(dev))
+                rec = project_device(dev, rename_map, hashes);
+        }
+
+        auto si = sent_map.find(b.first);
+
+        // Removed, or no longer part of the view or filter
+        if (rec == nullptr) {
+            if (si != sent_map.end()) {
+                auto key_elem = std::make_shared<tracker_element_device_key>();
+                key_elem->set(b.first);
+                removed_elem->push_back(key_elem);
+                sent_map.erase(si);
+            }
+
+            continue;
+        }
+
+        if (si == sent_map.end()) {
+            new_elem->insert(b.first, rec);
+            sent_map.emplace(b.first, std::move(hashes));
+            continue;
+        }
+
+        if (rec->get_type() == tracker_type::tracker_map) {
+            // Only include the fields which have changed since the last delivery
+            auto rec_map = std::static_pointer_cast<tracker_element_map>(rec);
+            auto delta = std::make_shared<tracker_element_map>();
+
+            for (const auto& h : hashes) {
+                auto prev = std::lower_bound(si->second.begin(), si->second.end(), h,
+                        [](const std::pair<int, size_t>& a, const std::pair<int, size_t>& b) -> bool {
+                            return a.first < b.first;
+                        });
+
+                if (prev != si->second.end() && prev->first == h.first && prev->second == h.second)
+                    continue;
+
+                auto fi = rec_map->find(h.first);
+                if (fi != rec_map->end())
+                    delta->insert(fi->first, fi->second);
+            }
+
+            if (delta->size() > 0)
+                changed_elem->insert(b.first, delta);
+        } else if (hashes != si->second) {
+            changed_elem->insert(b.first, rec);
+        }
+
+        si->second = std::move(hashes);
+    }
+
+    return wrapper_elem;
+}
+
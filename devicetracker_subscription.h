@@ -0,0 +1,132 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __DEVICE_SUBSCRIPTION_H__
+#define __DEVICE_SUBSCRIPTION_H__
+
+#include "config.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "trackedelement.h"
+#include "devicetracker_component.h"
+#include "devicetracker_view.h"
+
+// Device change subscription
+//
+// A subscription follows the devices of a view (optionally filtered by a set of
+// field:regex pairs) and delivers batches of changes to a long-polling client instead
+// of the client re-fetching every device modified since a timestamp.
+//
+// The device tracker hooks only record which devices have changed; the projected
+// fields of each changed device are built when the batch is delivered, so multiple
+// changes to a device between polls are coalesced into a single delta.  The subscription
+// remembers a hash of each field last delivered per device, and changed devices only
+// include the fields which differ.
+//
+// Pending changes are bounded; if a client falls too far behind the pending set is
+// discarded and the next poll re-scans the view, delivering a resync batch which still
+// only contains the fields which differ from what the client was last sent.
+//
+// Subscriptions live under:
+// /devices/subscriptions/subscribe.json
+// /devices/subscriptions/[id]/poll.json
+// /devices/subscriptions/[id]/cancel.json
+
+// Subscriptions which have not been polled in this many seconds are removed
+#define DEVICE_SUBSCRIPTION_TIMEOUT         120
+// Maximum number of concurrent subscriptions
+#define DEVICE_SUBSCRIPTION_MAX             32
+// Default maximum number of pending device changes before a subscription resyncs
+#define DEVICE_SUBSCRIPTION_MAX_PENDING     100000
+
+class device_tracker_subscription {
+public:
+    device_tracker_subscription(uint64_t in_id, std::shared_ptr<device_tracker_view> in_view,
+            const std::vector<SharedElementSummary>& in_summary_vec,
+            const std::vector<std::pair<std::string, std::string>>& in_regex_vec,
+            double in_interval, size_t in_max_batch, size_t in_max_pending);
+
+    uint64_t get_id() const {
+        return sub_id;
+    }
+
+    time_t get_last_poll() const {
+        return last_poll;
+    }
+
+    // Device tracker hooks; these are called from the packet thread and only record
+    // the device
+    void device_changed(std::shared_ptr<kis_tracked_device_base> device);
+    void device_removed(std::shared_ptr<kis_tracked_device_base> device);
+
+    // Wait up to timeout seconds for changes, then build the next batch.  Changes are
+    // delivered at most once per subscription interval.
+    std::shared_ptr<tracker_element> poll(double timeout,
+            std::shared_ptr<tracker_element_serializer::rename_map> rename_map);
+
+    // Release any waiting poll; the subscription delivers nothing further
+    void cancel();
+
+protected:
+    // Build the projected record of a device and the hash of each projected field;
+    // caller must hold the device lock
+    std::shared_ptr<tracker_element> project_device(std::shared_ptr<kis_tracked_device_base> device,
+            std::shared_ptr<tracker_element_serializer::rename_map> rename_map,
+            std::vector<std::pair<int, size_t>>& hashes);
+
+    uint64_t sub_id;
+    std::shared_ptr<device_tracker_view> view;
+    std::vector<SharedElementSummary> summary_vec;
+    std::vector<std::pair<std::string, std::string>> regex_vec;
+
+    std::chrono::milliseconds interval;
+    size_t max_batch;
+    size_t max_pending;
+
+    std::atomic<time_t> last_poll;
+
+    // Pending changes, written by the device tracker hooks; a null device marks a
+    // removal
+    std::mutex pending_mutex;
+    std::condition_variable pending_cv;
+    std::unordered_map<device_key, std::shared_ptr<kis_tracked_device_base>> pending_map;
+    bool overflow;
+    bool cancelled;
+    std::chrono::steady_clock::time_point last_delivery;
+
+    // Only one poll of a subscription runs at a time
+    std::mutex poll_mutex;
+
+    // Devices queued for a resync scan after an overflow, processed before the pending map
+    std::vector<std::shared_ptr<kis_tracked_device_base>> resync_vec;
+    std::vector<device_key> resync_removed_vec;
+
+    // Field hashes of every device last delivered to the client, sorted by field id;
+    // protected by the poll mutex
+    std::unordered_map<device_key, std::vector<std::pair<int, size_t>>> sent_map;
+};
+
+#endif
+
@@ -29,7 +29,8 @@ device_tracker_view::device_tracker_view(const std::string& in_id, const std::st
         new_device_cb in_new_cb, updated_device_cb in_update_cb) :
     tracker_component{},
     new_cb {in_new_cb},
-    update_cb {in_update_cb} {
+    update_cb {in_update_cb},
+    snapshot_generation {0} {
 
     mutex.set_name(fmt::format("devicetracker_view({})", in_id));
 
@@ -51,6 +52,14 @@ device_tracker_view::device_tracker_view(const std::string& in_id, const std::st
                     return device_endpoint_handler(stream, uri, json, variable_cache);
                 });
 
+    cursor_endp =
+        std::make_shared<kis_net_httpd_simple_post_endpoint>(
+                fmt::format("/devices/views/{}/cursor", in_id),
+                [this](std::ostream& stream, const std::string& uri, const Json::Value& json,
+                    kis_net_httpd_connection::variable_cache_map& variable_cache) -> unsigned int {
+                    return device_cursor_endpoint_handler(stream, uri, json, variable_cache);
+                });
+
     time_endp =
         std::make_shared<kis_net_httpd_path_tracked_endpoint>(
                 [this](const std::vector<std::string>& path) -> bool {
@@ -67,6 +76,7 @@ device_tracker_view::device_tracker_view(const std::string& in_id, const std::st
     tracker_component{},
     new_cb {in_new_cb},
     update_cb {in_update_cb},
+    snapshot_generation {0},
     uri_extras {in_aux_path} {
 
     using namespace std::placeholders;
@@ -90,6 +100,14 @@ device_tracker_view::device_tracker_view(const std::string& in_id, const std::st
                     return device_endpoint_handler(stream, uri, json, variable_cache);
                 });
 
+    cursor_endp =
+        std::make_shared<kis_net_httpd_simple_post_endpoint>(
+                fmt::format("/devices/views/{}/cursor", in_id),
+                [this](std::ostream& stream, const std::string& uri, const Json::Value& json,
+                    kis_net_httpd_connection::variable_cache_map& variable_cache) -> unsigned int {
+                    return device_cursor_endpoint_handler(stream, uri, json, variable_cache);
+                });
+
     time_endp =
         std::make_shared<kis_net_httpd_path_tracked_endpoint>(
                 [this](const std::vector<std::string>& path) -> bool {
@@ -115,6 +133,14 @@ device_tracker_view::device_tracker_view(const std::string& in_id, const std::st
                     return device_endpoint_handler(stream, uri, json, variable_cache);
                 });
 
+    cursor_uri_endp =
+        std::make_shared<kis_net_httpd_simple_post_endpoint>(
+                fmt::format("/devices/views/{}cursor", ss.str()),
+                [this](std::ostream& stream, const std::string& uri, const Json::Value& json,
+                    kis_net_httpd_connection::variable_cache_map& variable_cache) -> unsigned int {
+                    return device_cursor_endpoint_handler(stream, uri, json, variable_cache);
+                });
+
     time_uri_endp =
         std::make_shared<kis_net_httpd_path_tracked_endpoint>(
                 [this](const std::vector<std::string>& path) -> bool {
@@ -220,6 +246,7 @@ void device_tracker_view::new_device(std::shared_ptr<kis_tracked_device_base> de
             if (dpmi == device_presence_map.end()) {
                 device_presence_map[device->get_key()] = true;
                 device_list->push_back(device);
+                mark_index_dirty(device);
             }
 
             list_sz->set(device_list->size());
@@ -243,10 +270,17 @@ void device_tracker_view::update_device(std::shared_ptr<kis_tracked_device_base>
         if (retain && dpmi == device_presence_map.end()) {
             device_list->push_back(device);
             device_presence_map[device->get_key()] = true;
+            mark_index_dirty(device);
             list_sz->set(device_list->size());
             return;
         }
 
+        // If we're keeping a device we already have, its sort keys may have changed
+        if (retain) {
+            mark_index_dirty(device);
+            return;
+        }
+
         // if we're removing the device, find it in the vector and remove it, and remove
         // it from the presence map; this is expensive
         if (!retain && dpmi != device_presence_map.end()) {
@@ -257,6 +291,7 @@ void device_tracker_view::update_device(std::shared_ptr<kis_tracked_device_base>
                 }
             }
             device_presence_map.erase(dpmi);
+            remove_indexed_device(device);
             list_sz->set(device_list->size());
             return;
         }
@@ -277,6 +312,8 @@ void device_tracker_view::remove_device(std::shared_ptr<kis_tracked_device_base>
                 break;
             }
         }
+
+        remove_indexed_device(device);
         
         list_sz->set(device_list->size());
     }
@@ -292,10 +329,142 @@ void device_tracker_view::add_device_direct(std::shared_ptr<kis_tracked_device_b
 
     device_presence_map[device->get_key()] = true;
     device_list->push_back(device);
+    mark_index_dirty(device);
 
     list_sz->set(device_list->size());
 }
 
+void device_tracker_view::add_sort_index(const std::string& in_field) {
+    local_locker l(&mutex);
+
+    for (auto i : sort_indexes)
+        if (i->get_field() == in_field)
+            return;
+
+    sort_indexes.push_back(std::make_shared<device_tracker_view_index>(in_field));
+
+    // Queue every device we already have for indexing
+    for (auto d : *device_list)
+        mark_index_dirty(std::static_pointer_cast<kis_tracked_device_base>(d));
+}
+
+bool device_tracker_view::contains_device(const device_key& in_key) {
+    local_shared_locker l(&mutex);
+
+    return device_presence_map.find(in_key) != device_presence_map.end();
+}
+
+void device_tracker_view::reindex_device(std::shared_ptr<kis_tracked_device_base> device) {
+    local_locker l(&mutex);
+
+    if (device_presence_map.find(device->get_key()) == device_presence_map.end())
+        return;
+
+    mark_index_dirty(device);
+}
+
+void device_tracker_view::mark_index_dirty(std::shared_ptr<kis_tracked_device_base> device) {
+    if (sort_indexes.size() == 0)
+        return;
+
+    index_dirty_map[device->get_key()] = device;
+}
+
+void device_tracker_view::remove_indexed_device(std::shared_ptr<kis_tracked_device_base> device) {
+    if (sort_indexes.size() == 0)
+        return;
+
+    index_dirty_map.erase(device->get_key());
+
+    for (auto i : sort_indexes)
+        i->remove_device(device->get_key());
+}
+
+void device_tracker_view::sync_indexes() {
+    // Only one sync at a time, otherwise an older sync could overwrite newer keys
+    local_locker sl(&index_sync_mutex);
+
+    std::unordered_map<device_key, std::shared_ptr<kis_tracked_device_base>> dirty;
+    std::vector<std::shared_ptr<device_tracker_view_index>> indexes;
+
+    {
+        local_locker l(&mutex);
+
+        if (index_dirty_map.size() == 0)
+            return;
+
+        dirty.swap(index_dirty_map);
+        indexes = sort_indexes;
+    }
+
+    // Extract the keys under the device lock only; the view can't be locked while
+    // we acquire device locks because the packet thread takes them the other way around
+    std::vector<std::vector<device_tracker_view_index::index_key>> keys;
+    keys.reserve(dirty.size());
+
+    for (auto d : dirty) {
+        local_shared_locker dl(&d.second->device_mutex);
+
+        std::vector<device_tracker_view_index::index_key> dkeys;
+        dkeys.reserve(indexes.size());
+
+        for (auto i : indexes)
+            dkeys.push_back(i->extract_key(d.second));
+
+        keys.push_back(std::move(dkeys));
+    }
+
+    local_locker l(&mutex);
+
+    auto ki = keys.begin();
+    for (auto d = dirty.begin(); d != dirty.end(); ++d, ++ki) {
+        // The device may have left the view while we were extracting keys
+        if (device_presence_map.find(d->first) == device_presence_map.end())
+            continue;
+
+        for (size_t i = 0; i < indexes.size(); i++)
+            indexes[i]->set_device(d->second, (*ki)[i]);
+    }
+}
+
+std::shared_ptr<device_tracker_view_index> device_tracker_view::find_sort_index(const std::vector<int>& in_path) {
+    local_locker sl(&index_sync_mutex);
+    local_shared_locker l(&mutex);
+
+    for (auto i : sort_indexes)
+        if (i->matches_path(in_path))
+            return i;
+
+    return nullptr;
+}
+
+std::shared_ptr<device_tracker_view_index> device_tracker_view::find_sort_index(const std::string& in_field) {
+    local_shared_locker l(&mutex);
+
+    for (auto i : sort_indexes)
+        if (i->get_field() == in_field)
+            return i;
+
+    return nullptr;
+}
+
+// How long an unused snapshot is kept, and how many we keep at most
+#define VIEW_SNAPSHOT_TIMEOUT       60
+#define VIEW_SNAPSHOT_MAX           8
+
+void device_tracker_view::expire_snapshots() {
+    local_locker l(&mutex);
+
+    auto now = time(0);
+
+    for (auto si = snapshot_map.begin(); si != snapshot_map.end(); ) {
+        if (now - si->second.last_used > VIEW_SNAPSHOT_TIMEOUT)
+            si = snapshot_map.erase(si);
+        else
+            ++si;
+    }
+}
+
 void device_tracker_view::remove_device_direct(std::shared_ptr<kis_tracked_device_base> device) {
     local_locker l(&mutex);
 
@@ -310,6 +479,8 @@ void device_tracker_view::remove_device_direct(std::shared_ptr<kis_tracked_devic
                 break;
             }
         }
+
+        remove_indexed_device(device);
         
         list_sz->set(device_list->size());
     }
@@ -587,16 +758,63 @@ unsigned int device_tracker_view::device_endpoint_handler(std::ostream& stream,
         return 400;
     }
 
+    // If we maintain an index on the sort field, the devices can be pulled from the index
+    // already in order
+    std::shared_ptr<device_tracker_view_index> sort_index;
+    bool descending = in_order_direction != 0;
+
+    if (in_order_column_num.length() && order_field.size() > 0) {
+        sort_index = find_sort_index(order_field);
+
+        if (sort_index != nullptr)
+            sync_indexes();
+    }
+
+    // Without any filtering, we can seek directly to the requested window of the index
+    if (sort_index != nullptr && timestamp_min <= 0 && search_term.length() == 0 && regex.isNull()) {
+        auto window_vec = std::make_shared<tracker_element_vector>();
+
+        {
+            local_shared_locker l(&mutex);
+
+            total_sz_elem->set(sort_index->size());
+            filtered_sz_elem->set(sort_index->size());
+
+            if (in_window_start >= sort_index->size())
+                in_window_start = 0;
+
+            sort_index->get_window(in_window_start, in_window_len, descending, window_vec);
+        }
+
+        start_elem->set(in_window_start);
+        length_elem->set(window_vec->size());
+
+        for (auto i : *window_vec)
+            output_devices_elem->push_back(summarize_single_tracker_element(i, summary_vec, rename_map));
+
+        if (transmit == nullptr)
+            transmit = output_devices_elem;
+
+        Globalreg::globalreg->entrytracker->serialize(kishttpd::get_suffix(uri), stream, transmit, rename_map);
+
+        return 200;
+    }
+
     // Next vector we do work on
     auto next_work_vec = std::make_shared<tracker_element_vector>();
 
     // Copy the entire vector list, under lock, to the next work vector; this makes it an independent copy
     // which is protected from the main vector being grown/shrank.  While we're in there, log the total
-    // size of the original vector for windowed ops.
+    // size of the original vector for windowed ops.  If we have a sort index, copy it in order instead;
+    // the filters below preserve the order.
     {
         local_shared_locker l(&mutex);
 
-        next_work_vec->set(device_list->begin(), device_list->end());
+        if (sort_index != nullptr)
+            sort_index->get_window(0, 0, descending, next_work_vec);
+        else
+            next_work_vec->set(device_list->begin(), device_list->end());
+
         total_sz_elem->set(next_work_vec->size());
     }
 
@@ -658,7 +876,7 @@ unsigned int device_tracker_view::device_endpoint_handler(std::ostream& stream,
     length_elem->set(ei - si);
 
     // Unfortunately we need to do a stable sort to get a consistent display
-    if (in_order_column_num.length() && order_field.size() > 0) {
+    if (sort_index == nullptr && in_order_column_num.length() && order_field.size() > 0) {
         std::stable_sort(next_work_vec->begin(), next_work_vec->end(),
                 [&](shared_tracker_element a, shared_tracker_element b) -> bool {
                 shared_tracker_element fa;
@@ -697,3 +915,201 @@ unsigned int device_tracker_view::device_endpoint_handler(std::ostream& stream,
 }
 
 
+// Cursors are an opaque hex encoding of the position in a view:
+// version|generation|snapshot position|descending|null|number|id|field|string
+// The device internal id is the index tie-break, so it fully identifies the position
+static std::string encode_view_cursor(const std::string& field, bool descending, uint64_t generation,
+        uint64_t snap_pos, const device_tracker_view_index::index_key& key, uint64_t id) {
+    auto raw = fmt::format("2|{}|{}|{}|{}|{}|{}|{}|{}", generation, snap_pos, descending ? 1 : 0,
+            key.null ? 1 : 0, key.num, id, field, key.str);
+
+    std::string ret;
+    ret.reserve(raw.length() * 2);
+
+    for (auto c : raw)
+        ret += fmt::format("{:02x}", (uint8_t) c);
+
+    return ret;
+}
+
+static void decode_view_cursor(const std::string& cursor, std::string& field, bool& descending,
+        uint64_t& generation, uint64_t& snap_pos, device_tracker_view_index::index_key& key, 
+        uint64_t& id) {
+    auto raw = hex_to_bytes(cursor);
+
+    // The trailing string key may contain the separator, so only split the leading fields
+    std::vector<std::string> tokens;
+    size_t start = 0;
+
+    while (tokens.size() < 8) {
+        auto end = raw.find('|', start);
+
+        if (end == std::string::npos)
+            throw std::runtime_error("malformed cursor");
+
+        tokens.push_back(raw.substr(start, end - start));
+        start = end + 1;
+    }
+
+    if (tokens[0] != "2")
+        throw std::runtime_error("unsupported cursor version");
+
+    generation = string_to_n<uint64_t>(tokens[1]);
+    snap_pos = string_to_n<uint64_t>(tokens[2]);
+    descending = tokens[3] == "1";
+    key.null = tokens[4] == "1";
+    key.num = std::strtod(tokens[5].c_str(), nullptr);
+    id = string_to_n<uint64_t>(tokens[6]);
+    field = tokens[7];
+    key.str = raw.substr(start);
+}
+
+unsigned int device_tracker_view::device_cursor_endpoint_handler(std::ostream& stream, 
+        const std::string& uri, const Json::Value& json,
+        kis_net_httpd_connection::variable_cache_map& postvars) {
+    // Summarization vector based on simplification part of shared data
+    auto summary_vec = std::vector<SharedElementSummary>{};
+
+    // Rename cache generated by summarization
+    auto rename_map = std::make_shared<tracker_element_serializer::rename_map>();
+
+    std::string sort_field;
+    bool descending = false;
+    bool make_snapshot = false;
+    unsigned int page_len = 500;
+
+    // Position we resume from, if any
+    bool has_position = false;
+    uint64_t generation = 0;
+    uint64_t snap_pos = 0;
+    device_tracker_view_index::index_key pos_key;
+    uint64_t pos_id = 0;
+
+    try {
+        auto fields = json.get("fields", Json::Value(Json::arrayValue));
+
+        for (const auto& i : fields) {
+            if (i.isString()) {
+                summary_vec.push_back(std::make_shared<tracker_element_summary>(i.asString()));
+            } else if (i.isArray()) {
+                if (i.size() != 2) 
+                    throw std::runtime_error("Invalid field map, expected [field, rename]");
+
+                summary_vec.push_back(std::make_shared<tracker_element_summary>(i[0].asString(), i[1].asString()));
+            } else {
+                throw std::runtime_error("Invalid field map, exected field or [field, rename]");
+            }
+        }
+
+        page_len = json.get("length", 500).asUInt();
+
+        if (page_len == 0 || page_len > 10000)
+            throw std::runtime_error("length must be between 1 and 10000");
+
+        auto cursor = json.get("cursor", "").asString();
+
+        if (cursor.length() > 0) {
+            decode_view_cursor(cursor, sort_field, descending, generation, snap_pos, pos_key, pos_id);
+            has_position = true;
+        } else {
+            sort_field = json.get("sort", "").asString();
+            descending = json.get("sort_dir", "asc").asString() == "desc";
+            make_snapshot = json.get("snapshot", false).asBool();
+
+            // Default to the first index the view maintains
+            if (sort_field.length() == 0) {
+                local_shared_locker l(&mutex);
+                if (sort_indexes.size() > 0)
+                    sort_field = sort_indexes[0]->get_field();
+            }
+        }
+    } catch (const std::exception& e) {
+        stream << "Invalid request: " << e.what() << "\n";
+        return 400;
+    }
+
+    auto sort_index = find_sort_index(sort_field);
+
+    if (sort_index == nullptr) {
+        stream << "Invalid request: cursor pagination requires a sort field with a view index\n";
+        return 400;
+    }
+
+    sync_indexes();
+
+    auto page_vec = std::make_shared<tracker_element_vector>();
+    bool more = false;
+
+    {
+        local_locker l(&mutex);
+
+        expire_snapshots();
+
+        // Freeze the current ordering of the view for the following pages
+        if (make_snapshot) {
+            // Make room by evicting the least recently used snapshot
+            while (snapshot_map.size() >= VIEW_SNAPSHOT_MAX) {
+                auto oldest = snapshot_map.begin();
+
+                for (auto si = snapshot_map.begin(); si != snapshot_map.end(); ++si)
+                    if (si->second.last_used < oldest->second.last_used)
+                        oldest = si;
+
+                snapshot_map.erase(oldest);
+            }
+
+            generation = ++snapshot_generation;
+
+            auto& snap = snapshot_map[generation];
+            snap.field = sort_field;
+            snap.descending = descending;
+            snap.devices = std::make_shared<tracker_element_vector>();
+
+            sort_index->get_window(0, 0, descending, snap.devices);
+        }
+
+        if (generation != 0) {
+            auto si = snapshot_map.find(generation);
+
+            if (si == snapshot_map.end()) {
+                stream << "Snapshot generation " << generation << " has expired\n";
+                return 400;
+            }
+
+            si->second.last_used = time(0);
+
+            auto snap_devs = si->second.devices;
+
+            for (; snap_pos < snap_devs->size() && page_vec->size() < page_len; snap_pos++)
+                page_vec->push_back((*snap_devs)[snap_pos]);
+
+            more = snap_pos < snap_devs->size();
+        } else {
+            more = sort_index->get_after(has_position, pos_key, pos_id, page_len, descending,
+                    page_vec, pos_key, pos_id);
+        }
+    }
+
+    auto wrapper_elem = std::make_shared<tracker_element_string_map>();
+    auto output_devices_elem = std::make_shared<tracker_element_vector>();
+    auto cursor_elem = std::make_shared<tracker_element_string>();
+    auto generation_elem = std::make_shared<tracker_element_uint64>();
+
+    generation_elem->set(generation);
+
+    wrapper_elem->insert("devices", output_devices_elem);
+    wrapper_elem->insert("cursor", cursor_elem);
+    wrapper_elem->insert("generation", generation_elem);
+
+    if (more && page_vec->size() > 0)
+        cursor_elem->set(encode_view_cursor(sort_field, descending, generation, snap_pos, 
+                    pos_key, pos_id));
+
+    for (auto i : *page_vec) 
+        output_devices_elem->push_back(summarize_single_tracker_element(i, summary_vec, rename_map));
+
+    Globalreg::globalreg->entrytracker->serialize(kishttpd::get_suffix(uri), stream, wrapper_elem, rename_map);
+
+    return 200;
+}
+
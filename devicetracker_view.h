@@ -22,6 +22,7 @@
 #include "config.h"
 
 #include <functional>
+#include <map>
 #include <unordered_map>
 
 #include "kis_mutex.h"
@@ -30,6 +31,7 @@
 #include "trackedcomponent.h"
 #include "devicetracker_component.h"
 #include "devicetracker_view_workers.h"
+#include "devicetracker_view_index.h"
 
 // Common view holder mechanism which handles view endpoints, view filtering, and so on.
 //
@@ -48,6 +50,13 @@
 //
 // Main device sorting/filtering/datatables view lives under:
 // /devices/view/[view id]/devices.json
+//
+// Keyset (cursor) paginated access to an indexed view lives under:
+// /devices/view/[view id]/cursor.json
+//
+// Views may maintain sorted indexes on commonly sorted fields; devices are queued for
+// re-indexing as they are updated, and windowed requests sorted by an indexed field
+// are served directly from the index instead of sorting the entire view.
 
 class kis_tracked_device;
 class device_tracker_view;
@@ -119,6 +128,22 @@ public:
     virtual void add_device_direct(std::shared_ptr<kis_tracked_device_base> device);
     virtual void remove_device_direct(std::shared_ptr<kis_tracked_device_base> device);
 
+    // Maintain a sorted index on a field (such as kismet.device.base.last_time); sorted
+    // requests on an indexed field no longer need to sort the entire view
+    virtual void add_sort_index(const std::string& in_field);
+
+    // Re-sort a device already in the view whose fields were changed outside of the
+    // packet path (such as a user-assigned name)
+    virtual void reindex_device(std::shared_ptr<kis_tracked_device_base> device);
+
+    // Drop cursor snapshots which haven't been used recently; snapshots hold every device
+    // in the view, so this runs on every cursor request and periodically from the
+    // device tracker
+    void expire_snapshots();
+
+    // Is a device currently part of this view
+    virtual bool contains_device(const device_key& in_key);
+
 protected:
     virtual void register_fields() override {
         tracker_component::register_fields();
@@ -146,10 +171,45 @@ protected:
     // Map of device presence in our list for fast reference during updates
     std::unordered_map<device_key, bool> device_presence_map;
 
+    // Sorted indexes, if any, and the devices which have changed since the indexes
+    // were last synced.  Indexes are synced lazily when a request needs them.
+    std::vector<std::shared_ptr<device_tracker_view_index>> sort_indexes;
+    std::unordered_map<device_key, std::shared_ptr<kis_tracked_device_base>> index_dirty_map;
+    kis_recursive_timed_mutex index_sync_mutex;
+
+    // Queue a device for re-indexing; must be called under the view mutex
+    void mark_index_dirty(std::shared_ptr<kis_tracked_device_base> device);
+    // Remove a device from all indexes; must be called under the view mutex
+    void remove_indexed_device(std::shared_ptr<kis_tracked_device_base> device);
+
+    // Re-index changed devices; the device keys are extracted without holding the
+    // view mutex, so this is safe to call while devices are being updated
+    void sync_indexes();
+
+    // Find an index matching a resolved field path, if any
+    std::shared_ptr<device_tracker_view_index> find_sort_index(const std::vector<int>& in_path);
+    std::shared_ptr<device_tracker_view_index> find_sort_index(const std::string& in_field);
+
+    // Frozen orderings of the view, used to page through a consistent snapshot of the
+    // devices; snapshots expire when they haven't been used for a while
+    struct view_snapshot {
+        time_t last_used;
+        std::string field;
+        bool descending;
+        std::shared_ptr<tracker_element_vector> devices;
+    };
+
+    uint64_t snapshot_generation;
+    std::map<uint64_t, view_snapshot> snapshot_map;
+
     // Complex endpoint and optional extended URI endpoint
     std::shared_ptr<kis_net_httpd_simple_post_endpoint> device_endp;
     std::shared_ptr<kis_net_httpd_simple_post_endpoint> device_uri_endp;
 
+    // Keyset paginated endpoints
+    std::shared_ptr<kis_net_httpd_simple_post_endpoint> cursor_endp;
+    std::shared_ptr<kis_net_httpd_simple_post_endpoint> cursor_uri_endp;
+
     // Simpler time-based endpoints
     std::shared_ptr<kis_net_httpd_path_tracked_endpoint> time_endp;
     std::shared_ptr<kis_net_httpd_path_tracked_endpoint> time_uri_endp;
@@ -159,6 +219,11 @@ protected:
             const Json::Value& json, 
             kis_net_httpd_connection::variable_cache_map& postvars);
 
+    // Keyset pagination endp handler
+    unsigned int device_cursor_endpoint_handler(std::ostream& stream, const std::string& uri, 
+            const Json::Value& json, 
+            kis_net_httpd_connection::variable_cache_map& postvars);
+
     // Time endp handler
     bool device_time_endpoint_path(const std::vector<std::string>& path);
     std::shared_ptr<tracker_element> device_time_endpoint(const std::vector<std::string>& path);
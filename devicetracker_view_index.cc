@@ -0,0 +1,405 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include "alphanum.hpp"
+#include "devicetracker_view_index.h"
+#include "kismet_algorithm.h"
+
+// Blocks are split when they grow past twice this size
+#define INDEX_BLOCK_SZ      512
+
+device_tracker_view_index::device_tracker_view_index(const std::string& in_field) :
+    field {in_field},
+    path_resolved {false} { }
+
+const std::vector<int>& device_tracker_view_index::get_path() {
+    if (path_resolved)
+        return path;
+
+    path = tracker_element_summary(field).resolved_path;
+
+    path_resolved = path.size() > 0 &&
+        std::find(path.begin(), path.end(), -1) == path.end();
+
+    return path;
+}
+
+bool device_tracker_view_index::matches_path(const std::vector<int>& in_path) {
+    if (in_path.size() == 0)
+        return false;
+
+    return get_path() == in_path;
+}
+
+device_tracker_view_index::index_key device_tracker_view_index::extract_key(std::shared_ptr<kis_tracked_device_base> device) {
+    index_key key;
+
+    auto elem = get_tracker_element_path(get_path(), device);
+
+    if (elem == nullptr)
+        return key;
+
+    key.null = false;
+
+    switch (elem->get_type()) {
+        case tracker_type::tracker_string:
+        case tracker_type::tracker_byte_array:
+            key.str = std::static_pointer_cast<tracker_element_string>(elem)->get();
+            break;
+        case tracker_type::tracker_int8:
+            key.num = std::static_pointer_cast<tracker_element_int8>(elem)->get();
+            break;
+        case tracker_type::tracker_uint8:
+            key.num = std::static_pointer_cast<tracker_element_uint8>(elem)->get();
+            break;
+        case tracker_type::tracker_int16:
+            key.num = std::static_pointer_cast<tracker_element_int16>(elem)->get();
+            break;
+        case tracker_type::tracker_uint16:
+            key.num = std::static_pointer_cast<tracker_element_uint16>(elem)->get();
+            break;
+        case tracker_type::tracker_int32:
+            key.num = std::static_pointer_cast<tracker_element_int32>(elem)->get();
+            break;
+        case tracker_type::tracker_uint32:
+            key.num = std::static_pointer_cast<tracker_element_uint32>(elem)->get();
+            break;
+        case tracker_type::tracker_int64:
+            key.num = std::static_pointer_cast<tracker_element_int64>(elem)->get();
+            break;
+        case tracker_type::tracker_uint64:
+            key.num = std::static_pointer_cast<tracker_element_uint64>(elem)->get();
+            break;
+        case tracker_type::tracker_float:
+            key.num = std::static_pointer_cast<tracker_element_float>(elem)->get();
+            break;
+        case tracker_type::tracker_double:
+            key.num = std::static_pointer_cast<tracker_element_double>(elem)->get();
+            break;
+        case tracker_type::tracker_mac_addr:
+            // 48 bits fit in a double without loss
+            key.num = std::static_pointer_cast<tracker_element_mac_addr>(elem)->get().longmac;
+            break;
+        case tracker_type::tracker_uuid:
+            key.str = std::static_pointer_cast<tracker_element_uuid>(elem)->get().uuid_to_string();
+            break;
+        default:
+            // Complex fields can't be sorted, same as the fast sort
+            key.null = true;
+            break;
+    }
+
+    return key;
+}
+
+int device_tracker_view_index::compare_key(const index_key& a, const index_key& b) {
+    if (a.null != b.null)
+        return a.null ? -1 : 1;
+
+    if (a.num < b.num)
+        return -1;
+
+    if (a.num > b.num)
+        return 1;
+
+    if (a.str.length() == 0 && b.str.length() == 0)
+        return 0;
+
+    return doj::alphanum_comp(a.str, b.str);
+}
+
+bool device_tracker_view_index::entry_less(const index_entry& e, const index_key& key, uint64_t id) {
+    auto c = compare_key(e.key, key);
+
+    if (c != 0)
+        return c < 0;
+
+    return e.id < id;
+}
+
+size_t device_tracker_view_index::find_block(const index_key& key, uint64_t id) const {
+    // First block whose last entry is not less than the key; blocks are never empty
+    size_t lo = 0;
+    size_t hi = blocks.size();
+
+    while (lo < hi) {
+        auto mid = lo + (hi - lo) / 2;
+
+        if (entry_less(blocks[mid].back(), key, id))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo == blocks.size() && lo > 0)
+        lo--;
+
+    return lo;
+}
+
+void device_tracker_view_index::insert_entry(const index_entry& entry) {
+    if (blocks.size() == 0) {
+        blocks.push_back(index_block{});
+        blocks[0].reserve(INDEX_BLOCK_SZ * 2);
+        rebuild_counts();
+    }
+
+    auto bi = find_block(entry.key, entry.id);
+    auto& block = blocks[bi];
+
+    auto pos = std::lower_bound(block.begin(), block.end(), entry,
+            [](const index_entry& a, const index_entry& b) -> bool {
+                return entry_less(a, b.key, b.id);
+            });
+
+    block.insert(pos, entry);
+    adjust_count(bi, 1);
+
+    if (block.size() >= INDEX_BLOCK_SZ * 2) {
+        auto split = index_block{};
+        split.reserve(INDEX_BLOCK_SZ * 2);
+
+        split.insert(split.end(), std::make_move_iterator(block.begin() + INDEX_BLOCK_SZ),
+                std::make_move_iterator(block.end()));
+        block.erase(block.begin() + INDEX_BLOCK_SZ, block.end());
+
+        blocks.insert(blocks.begin() + bi + 1, std::move(split));
+
+        // Every block after the split moved, so the cumulative counts are rebuilt
+        rebuild_counts();
+    }
+}
+
+void device_tracker_view_index::erase_entry(const index_key& key, uint64_t id) {
+    if (blocks.size() == 0)
+        return;
+
+    auto bi = find_block(key, id);
+    auto& block = blocks[bi];
+
+    auto pos = std::lower_bound(block.begin(), block.end(), key,
+            [id](const index_entry& a, const index_key& k) -> bool {
+                return entry_less(a, k, id);
+            });
+
+    if (pos == block.end() || pos->id != id)
+        return;
+
+    block.erase(pos);
+
+    if (block.size() == 0) {
+        blocks.erase(blocks.begin() + bi);
+        rebuild_counts();
+    } else {
+        adjust_count(bi, -1);
+    }
+}
+
+void device_tracker_view_index::rebuild_counts() {
+    // Linear-time construction of the Fenwick tree over the block sizes; each node
+    // pushes its partial sum up to its parent
+    block_counts.assign(blocks.size() + 1, 0);
+
+    for (size_t i = 1; i < block_counts.size(); i++) {
+        block_counts[i] += blocks[i - 1].size();
+
+        auto parent = i + (i & (~i + 1));
+        if (parent < block_counts.size())
+            block_counts[parent] += block_counts[i];
+    }
+}
+
+void device_tracker_view_index::adjust_count(size_t bi, int delta) {
+    for (size_t i = bi + 1; i < block_counts.size(); i += (i & (~i + 1)))
+        block_counts[i] += delta;
+}
+
+size_t device_tracker_view_index::find_rank(size_t& pos) const {
+    // Descend the Fenwick tree to find the last block whose cumulative count does not
+    // exceed the rank; the remainder is the offset within the following block
+    size_t bi = 0;
+    size_t step = 1;
+
+    while (step * 2 < block_counts.size())
+        step *= 2;
+
+    for (; step > 0; step /= 2) {
+        if (bi + step < block_counts.size() && block_counts[bi + step] <= pos) {
+            bi += step;
+            pos -= block_counts[bi];
+        }
+    }
+
+    return bi;
+}
+
+void device_tracker_view_index::set_device(std::shared_ptr<kis_tracked_device_base> device,
+        const index_key& key) {
+    auto id = device->get_kis_internal_id();
+    auto ki = key_map.find(device->get_key());
+
+    if (ki != key_map.end()) {
+        // Nothing to do if the key hasn't changed
+        if (compare_key(ki->second.first, key) == 0)
+            return;
+
+        erase_entry(ki->second.first, ki->second.second);
+        ki->second = std::make_pair(key, id);
+    } else {
+        key_map.emplace(device->get_key(), std::make_pair(key, id));
+    }
+
+    insert_entry(index_entry{key, id, device});
+}
+
+void device_tracker_view_index::remove_device(const device_key& in_key) {
+    auto ki = key_map.find(in_key);
+
+    if (ki == key_map.end())
+        return;
+
+    erase_entry(ki->second.first, ki->second.second);
+    key_map.erase(ki);
+}
+
+void device_tracker_view_index::clear() {
+    blocks.clear();
+    block_counts.clear();
+    key_map.clear();
+}
+
+void device_tracker_view_index::get_window(size_t start, size_t length, bool descending,
+        std::shared_ptr<tracker_element_vector> out) const {
+    auto sz = key_map.size();
+
+    if (start >= sz)
+        return;
+
+    if (length == 0 || start + length > sz)
+        length = sz - start;
+
+    // Convert the requested window to a position in ascending order
+    size_t pos = descending ? sz - start - length : start;
+
+    // Locate the block holding the first entry from the cumulative block counts
+    size_t bi = find_rank(pos);
+
+    auto window_start = out->size();
+    out->reserve(window_start + length);
+
+    for (size_t n = 0; bi < blocks.size() && n < length; bi++, pos = 0) {
+        for (auto ei = blocks[bi].begin() + pos; ei != blocks[bi].end() && n < length; ++ei, ++n)
+            out->push_back(ei->device);
+    }
+
+    if (descending)
+        std::reverse(out->begin() + window_start, out->end());
+}
+
+bool device_tracker_view_index::get_after(bool has_position, const index_key& key, uint64_t id,
+        size_t length, bool descending, std::shared_ptr<tracker_element_vector> out,
+        index_key& last_key, uint64_t& last_id) const {
+
+    if (blocks.size() == 0)
+        return false;
+
+    // Block and position of the first entry to return, in walk order
+    size_t bi;
+    size_t pos;
+
+    if (!has_position) {
+        if (descending) {
+            bi = blocks.size() - 1;
+            pos = blocks[bi].size() - 1;
+        } else {
+            bi = 0;
+            pos = 0;
+        }
+    } else {
+        bi = find_block(key, id);
+
+        // First entry not less than the position
+        auto lb = std::lower_bound(blocks[bi].begin(), blocks[bi].end(), key,
+                [id](const index_entry& a, const index_key& k) -> bool {
+                    return entry_less(a, k, id);
+                });
+
+        if (descending) {
+            // Step back to the last entry before the position
+            if (lb == blocks[bi].begin()) {
+                if (bi == 0)
+                    return false;
+                bi--;
+                pos = blocks[bi].size() - 1;
+            } else {
+                pos = (lb - blocks[bi].begin()) - 1;
+            }
+        } else {
+            // Skip the position itself if it is still in the index
+            if (lb != blocks[bi].end() && lb->id == id && compare_key(lb->key, key) == 0)
+                ++lb;
+
+            pos = lb - blocks[bi].begin();
+
+            if (pos >= blocks[bi].size()) {
+                bi++;
+                pos = 0;
+
+                if (bi >= blocks.size())
+                    return false;
+            }
+        }
+    }
+
+    size_t n = 0;
+
+    while (n < length) {
+        const auto& e = blocks[bi][pos];
+
+        out->push_back(e.device);
+        last_key = e.key;
+        last_id = e.id;
+        n++;
+
+        if (descending) {
+            if (pos == 0) {
+                if (bi == 0)
+                    return false;
+                bi--;
+                pos = blocks[bi].size() - 1;
+            } else {
+                pos--;
+            }
+        } else {
+            pos++;
+
+            if (pos >= blocks[bi].size()) {
+                bi++;
+                pos = 0;
+
+                if (bi >= blocks.size())
+                    return false;
+            }
+        }
+    }
+
+    return true;
+}
+
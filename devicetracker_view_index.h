@@ -0,0 +1,141 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __DEVICE_VIEW_INDEX_H__
+#define __DEVICE_VIEW_INDEX_H__
+
+#include "config.h"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "trackedelement.h"
+#include "devicetracker_component.h"
+
+// Sorted, rank-addressable index of the devices in a view, keyed on a single field.
+//
+// Indexes are maintained by the owning view; devices are re-positioned as they are
+// updated, so a sorted window of the view can be served by seeking to the requested
+// rank instead of sorting the entire device list for every request.
+//
+// Entries are held in a list of sorted blocks (a flattened B+-tree); inserts and
+// removals only shift the entries of a single block, and a rank is located with a
+// Fenwick tree of the block sizes.
+//
+// Index keys are snapshots of the field value taken when the device was last synced;
+// ties are broken by the device internal id, which keeps the ordering stable.
+//
+// The index is not internally locked; it is protected by the view mutex.
+
+class device_tracker_view_index {
+public:
+    struct index_key {
+        index_key() :
+            null{true},
+            num{0} { }
+
+        // Devices missing the field sort before any device which has it
+        bool null;
+        double num;
+        std::string str;
+    };
+
+    device_tracker_view_index(const std::string& in_field);
+
+    const std::string& get_field() const {
+        return field;
+    }
+
+    // Resolve the field path; fields may not be registered until the first device
+    // using them is created, so this is retried until the full path is known
+    const std::vector<int>& get_path();
+
+    // Does this index sort on the resolved path?
+    bool matches_path(const std::vector<int>& in_path);
+
+    // Extract the sort key from a device; caller must hold the device lock
+    index_key extract_key(std::shared_ptr<kis_tracked_device_base> device);
+
+    // Insert or re-position a device
+    void set_device(std::shared_ptr<kis_tracked_device_base> device, const index_key& key);
+
+    // Remove a device from the index
+    void remove_device(const device_key& in_key);
+
+    void clear();
+
+    size_t size() const {
+        return key_map.size();
+    }
+
+    // Append a window of the sorted devices to the output vector; a length of 0
+    // returns everything from the start position
+    void get_window(size_t start, size_t length, bool descending,
+            std::shared_ptr<tracker_element_vector> out) const;
+
+    // Append up to length devices which sort after a key and id (or from the beginning of
+    // the index when no position is given), for keyset pagination.  The key and id of the
+    // last device returned are placed in last_key and last_id to resume from.  Returns
+    // true if more devices remain.
+    bool get_after(bool has_position, const index_key& key, uint64_t id, 
+            size_t length, bool descending, std::shared_ptr<tracker_element_vector> out,
+            index_key& last_key, uint64_t& last_id) const;
+
+protected:
+    struct index_entry {
+        index_key key;
+        uint64_t id;
+        std::shared_ptr<kis_tracked_device_base> device;
+    };
+
+    using index_block = std::vector<index_entry>;
+
+    static int compare_key(const index_key& a, const index_key& b);
+    static bool entry_less(const index_entry& e, const index_key& key, uint64_t id);
+
+    // Find the block which holds, or would hold, a key
+    size_t find_block(const index_key& key, uint64_t id) const;
+
+    void insert_entry(const index_entry& entry);
+    void erase_entry(const index_key& key, uint64_t id);
+
+    // Maintain the cumulative block sizes; blocks are only added or removed when a block
+    // splits or empties, which is the only time the counts are rebuilt
+    void rebuild_counts();
+    void adjust_count(size_t bi, int delta);
+
+    // Find the block holding a rank; the rank is replaced with the offset in the block
+    size_t find_rank(size_t& pos) const;
+
+    std::string field;
+    std::vector<int> path;
+    bool path_resolved;
+
+    std::vector<index_block> blocks;
+
+    // Fenwick tree (1-based) of the number of entries in each block
+    std::vector<size_t> block_counts;
+
+    // Current key and id of every indexed device, used to find the existing entry
+    // when a device is re-positioned or removed
+    std::unordered_map<device_key, std::pair<index_key, uint64_t>> key_map;
+};
+
+#endif
+
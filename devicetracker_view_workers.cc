@@ -43,8 +43,10 @@ device_tracker_view_regex_worker::pcre_filter::pcre_filter(const std::string& in
 
     const char *compile_error, *study_error;
     int err_offt;
+    int study_opts = 0;
 
     target = in_target;
+    target_resolved = false;
 
     re = pcre_compile(in_regex.c_str(), 0, &compile_error, &err_offt, NULL);
 
@@ -52,7 +54,13 @@ device_tracker_view_regex_worker::pcre_filter::pcre_filter(const std::string& in
         throw std::runtime_error(fmt::format("Could not parse PCRE Regex: {} at {}",
                     compile_error, err_offt));
 
-    study = pcre_study(re, 0, &study_error);
+#ifdef PCRE_STUDY_JIT_COMPILE
+    // Use the JIT when libpcre was built with it; pcre_study silently falls back to the 
+    // interpreter otherwise
+    study_opts |= PCRE_STUDY_JIT_COMPILE;
+#endif
+
+    study = pcre_study(re, study_opts, &study_error);
     if (study_error != nullptr) {
         pcre_free(re);
         throw std::runtime_error(fmt::format("Could not parse PCRE Regex, optimization failed: {}",
@@ -63,15 +71,100 @@ device_tracker_view_regex_worker::pcre_filter::pcre_filter(const std::string& in
 device_tracker_view_regex_worker::pcre_filter::~pcre_filter() {
     if (re != NULL)
         pcre_free(re);
-    if (study != NULL)
+    if (study != NULL) {
+#ifdef PCRE_STUDY_JIT_COMPILE
+        pcre_free_study(study);
+#else
         pcre_free(study);
+#endif
+    }
+}
+
+void device_tracker_view_regex_worker::pcre_filter::resolve_target() {
+    if (target_resolved)
+        return;
+
+    target_path = tracker_element_summary(target).resolved_path;
+
+    target_resolved = target_path.size() > 0 &&
+        std::find(target_path.begin(), target_path.end(), -1) == target_path.end();
 }
 
 #endif
 
+// Maximum number of compiled filters we keep around
+#define REGEX_FILTER_CACHE_MAX      16
+
+std::shared_ptr<device_tracker_view_regex_worker::compiled_filter> 
+    device_tracker_view_regex_worker::fetch_compiled_filter(const std::vector<std::pair<std::string, std::string>>& str_pcre_vec) {
+    static kis_recursive_timed_mutex cache_mutex;
+    static std::unordered_map<std::string, std::shared_ptr<compiled_filter>> cache_map;
+
+    // Key the cache on the complete, ordered filter list
+    std::string cache_key;
+    for (const auto& i : str_pcre_vec) {
+        cache_key += i.first;
+        cache_key += '\0';
+        cache_key += i.second;
+        cache_key += '\0';
+    }
+
+    local_locker l(&cache_mutex);
+
+    auto ci = cache_map.find(cache_key);
+    if (ci != cache_map.end()) {
+        bool resolved = true;
+
+#ifdef HAVE_LIBPCRE
+        for (auto f : ci->second->filter_vec)
+            resolved = resolved && f->target_resolved;
+#endif
+
+        // Filters in use by other requests can't be modified; if a field was not yet
+        // registered when the filter was compiled, compile it again instead
+        if (resolved) {
+            ci->second->last_used = time(0);
+            return ci->second;
+        }
+
+        cache_map.erase(ci);
+    }
+
+    auto cf = std::make_shared<compiled_filter>();
+    cf->last_used = time(0);
+
+#ifdef HAVE_LIBPCRE
+    for (const auto& i : str_pcre_vec) {
+        auto f = std::make_shared<device_tracker_view_regex_worker::pcre_filter>(i.first, i.second);
+        f->resolve_target();
+        cf->filter_vec.push_back(f);
+    }
+#endif
+
+    // Drop the least recently used filter when the cache is full
+    if (cache_map.size() >= REGEX_FILTER_CACHE_MAX) {
+        auto oldest = cache_map.begin();
+
+        for (auto i = cache_map.begin(); i != cache_map.end(); ++i)
+            if (i->second->last_used < oldest->second->last_used)
+                oldest = i;
+
+        cache_map.erase(oldest);
+    }
+
+    cache_map[cache_key] = cf;
+
+    return cf;
+}
+
 device_tracker_view_regex_worker::device_tracker_view_regex_worker(const std::vector<std::shared_ptr<device_tracker_view_regex_worker::pcre_filter>>& in_filter_vec) {
 #ifdef HAVE_LIBPCRE
-    filter_vec = in_filter_vec;
+    filter = std::make_shared<compiled_filter>();
+    filter->filter_vec = in_filter_vec;
+    begin_pass();
+
+    for (auto f : filter->filter_vec)
+        f->resolve_target();
 #else
     throw std::runtime_error("Kismet was not compiled with PCRE support");
 #endif
@@ -79,6 +172,8 @@ device_tracker_view_regex_worker::device_tracker_view_regex_worker(const std::ve
 
 device_tracker_view_regex_worker::device_tracker_view_regex_worker(const Json::Value& json) {
 #ifdef HAVE_LIBPCRE
+    std::vector<std::pair<std::string, std::string>> str_pcre_vec;
+
     for (auto i : json) {
         if (!i.isArray())
             throw std::runtime_error("expected array of [field, regex] pairs for regex filter");
@@ -86,11 +181,11 @@ device_tracker_view_regex_worker::device_tracker_view_regex_worker(const Json::V
         if (i.size() != 2)
             throw std::runtime_error("expected array of [field, regex] pairs for regex filter");
 
-        auto worker_filter = 
-            std::make_shared<device_tracker_view_regex_worker::pcre_filter>(i[0].asString(), i[1].asString());
-
-        filter_vec.push_back(worker_filter);
+        str_pcre_vec.push_back(std::make_pair(i[0].asString(), i[1].asString()));
     }
+
+    filter = fetch_compiled_filter(str_pcre_vec);
+    begin_pass();
 #else
     throw std::runtime_error("Kismet was not compiled with PCRE support");
 #endif
@@ -98,25 +193,66 @@ device_tracker_view_regex_worker::device_tracker_view_regex_worker(const Json::V
 
 device_tracker_view_regex_worker::device_tracker_view_regex_worker(const std::vector<std::pair<std::string, std::string>>& str_pcre_vec) {
 #ifdef HAVE_LIBPCRE
-    for (auto i : str_pcre_vec) {
-        auto field = std::get<0>(i);
-        auto regex = std::get<1>(i);
+    filter = fetch_compiled_filter(str_pcre_vec);
+    begin_pass();
+#else
+    throw std::runtime_error("Kismet was not compiled with PCRE support");
+#endif
+}
+
+void device_tracker_view_regex_worker::begin_pass() {
+    eval_time = time(0);
 
-        auto worker_filter = std::make_shared<device_tracker_view_regex_worker::pcre_filter>(field, regex);
+    local_locker l(&filter->memo_mutex);
 
-        filter_vec.push_back(worker_filter);
+    generation = ++filter->generation;
+
+    for (auto mi = filter->memo_map.begin(); mi != filter->memo_map.end(); ) {
+        if (mi->second.generation + 1 < generation)
+            mi = filter->memo_map.erase(mi);
+        else
+            ++mi;
     }
+}
+
+bool device_tracker_view_regex_worker::match_device(std::shared_ptr<kis_tracked_device_base> device) {
+#ifdef HAVE_LIBPCRE
+    auto mod_time = device->get_mod_time();
+
+    {
+        local_locker l(&filter->memo_mutex);
+
+        auto mi = filter->memo_map.find(device->get_key());
+
+        // Re-use the last result if the device hasn't changed since the second it was
+        // evaluated in
+        if (mi != filter->memo_map.end() && mi->second.mod_time == mod_time &&
+                mi->second.eval_time > mod_time) {
+            mi->second.generation = generation;
+            return mi->second.matched;
+        }
+    }
+
+    auto m = match_filters(device);
+
+    {
+        local_locker l(&filter->memo_mutex);
+        filter->memo_map[device->get_key()] = 
+            compiled_filter::match_memo{mod_time, eval_time, generation, m};
+    }
+
+    return m;
 #else
-    throw std::runtime_error("Kismet was not compiled with PCRE support");
+    return false;
 #endif
 }
 
-bool device_tracker_view_regex_worker::match_device(std::shared_ptr<kis_tracked_device_base> device) {
+bool device_tracker_view_regex_worker::match_filters(std::shared_ptr<kis_tracked_device_base> device) {
 #ifdef HAVE_LIBPCRE
     bool matched = false;
 
-    for (auto i : filter_vec) {
-        auto fields = get_tracker_element_multi_path(i->target, device);
+    for (auto i : filter->filter_vec) {
+        auto fields = get_tracker_element_multi_path(i->target_path, device);
 
         for (auto fi : fields) {
             std::string val;
@@ -22,6 +22,7 @@
 #include "config.h"
 
 #include <functional>
+#include <unordered_map>
 
 #include "kis_mutex.h"
 #include "uuid.h"
@@ -75,6 +76,13 @@ protected:
 };
 
 // Field:Regex matcher
+//
+// Compiled filters are cached by their [field, regex] list, so repeated requests with
+// the same filter (such as a UI refreshing a filtered view) do not recompile them.  The
+// cached filter remembers the last result for each device, which is re-used as long as
+// the device has not been modified since it was last evaluated.  Each request starts a
+// new pass over the view; results for devices which the previous pass didn't see, 
+// because they were removed from the tracker or the view, are dropped.
 class device_tracker_view_regex_worker : public device_tracker_view_worker {
 public:
     struct pcre_filter {
@@ -82,12 +90,46 @@ public:
         pcre_filter(const std::string& target, const std::string& in_regex);
         ~pcre_filter();
 
+        // Resolve the target path once; fields may not exist until the phy which
+        // uses them has been loaded, so this is retried until it resolves.  Must not
+        // be called while the filter is in use by another request.
+        void resolve_target();
+
         std::string target;
+        std::vector<int> target_path;
+        bool target_resolved;
+
         pcre *re;
         pcre_extra *study;
 #endif
     };
 
+    // A compiled set of filters shared by all requests using the same filter
+    struct compiled_filter {
+        compiled_filter() :
+            generation{0},
+            last_used{0} {
+            memo_mutex.set_name("device_tracker_view_regex_worker memo");
+        }
+
+        struct match_memo {
+            time_t mod_time;
+            time_t eval_time;
+            uint64_t generation;
+            bool matched;
+        };
+
+        std::vector<std::shared_ptr<device_tracker_view_regex_worker::pcre_filter>> filter_vec;
+
+        kis_recursive_timed_mutex memo_mutex;
+        std::unordered_map<device_key, match_memo> memo_map;
+
+        // Pass over the view; protected by the memo mutex
+        uint64_t generation;
+
+        time_t last_used;
+    };
+
     // Filter baed on a prepared vector
     device_tracker_view_regex_worker(const std::vector<std::shared_ptr<device_tracker_view_regex_worker::pcre_filter>>& filter_vec);
 
@@ -101,7 +143,9 @@ public:
     device_tracker_view_regex_worker(const std::vector<std::pair<std::string, std::string>>& str_pcre_vec);
 
     device_tracker_view_regex_worker(const device_tracker_view_regex_worker& w) {
-        filter_vec = w.filter_vec;
+        filter = w.filter;
+        eval_time = w.eval_time;
+        generation = w.generation;
         matched = w.matched;
     }
 
@@ -110,8 +154,24 @@ public:
     virtual bool match_device(std::shared_ptr<kis_tracked_device_base> device) override;
 
 protected:
-    std::vector<std::shared_ptr<device_tracker_view_regex_worker::pcre_filter>> filter_vec;
+    // Find a compiled filter for a [field, regex] list in the cache, or compile it
+    static std::shared_ptr<compiled_filter> 
+        fetch_compiled_filter(const std::vector<std::pair<std::string, std::string>>& str_pcre_vec);
+
+    bool match_filters(std::shared_ptr<kis_tracked_device_base> device);
+
+    // Start a new pass over the view, and drop the results for devices the previous
+    // pass didn't see
+    void begin_pass();
+
+    std::shared_ptr<compiled_filter> filter;
+
+    // Time this request started; memoized results are only valid for devices which
+    // have not been modified since the second they were evaluated in
+    time_t eval_time;
 
+    // Pass this request is making over the view
+    uint64_t generation;
 };
 
 // Generic string search for any string-like value (and a few more complex values, like MAC addresses).
@@ -170,6 +170,18 @@ std::string entry_tracker::get_field_name(int in_id) {
     return iter->second->field_name;
 }
 
+std::vector<std::string> entry_tracker::get_field_names() {
+    local_locker lock(&entry_mutex);
+
+    std::vector<std::string> ret;
+    ret.reserve(field_id_map.size());
+
+    for (auto i : field_id_map)
+        ret.push_back(i.second->field_name);
+
+    return ret;
+}
+
 std::string entry_tracker::get_field_description(int in_id) {
     local_locker lock(&entry_mutex);
 
@@ -89,6 +89,9 @@ public:
     std::string get_field_name(int in_id);
     std::string get_field_description(int in_id);
 
+    // Names of all registered fields, in the order they were registered
+    std::vector<std::string> get_field_names();
+
     // Generate a shared field instance, using the builder
     template<class T> std::shared_ptr<T> get_shared_instance_as(const std::string& in_name) {
         return std::static_pointer_cast<T>(get_shared_instance(in_name));
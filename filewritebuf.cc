@@ -16,7 +16,15 @@
     Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
 
 #include "util.h"
 #include "filewritebuf.h"
@@ -141,3 +149,242 @@ bool file_write_buffer::commit(unsigned char *data, size_t in_sz) {
     return written == 1;
 }
 
+
+threaded_file_write_buffer::threaded_file_write_buffer(std::string in_filename, size_t in_block_sz,
+        unsigned int in_num_blocks, bool in_direct, std::chrono::milliseconds in_flush_interval) :
+    filename {in_filename},
+    fd {-1},
+    direct {false},
+    num_blocks {std::max(2U, in_num_blocks)},
+    blocks {nullptr},
+    fill_pos {0},
+    fill_waiting {false},
+    blocks_filled {0},
+    blocks_written {0},
+    writer_waiting {false},
+    writer_shutdown {false},
+    flush_interval {in_flush_interval},
+    bytes_accepted {0},
+    bytes_written {0},
+    stalls {0},
+    stall_usec {0},
+    write_errors {0} {
+
+    // Blocks are page-aligned and a whole number of pages, as required for direct IO
+    block_sz = std::max((size_t) 4096, (in_block_sz + 4095) & ~((size_t) 4095));
+    block_len.resize(num_blocks, 0);
+
+#ifdef O_DIRECT
+    if (in_direct) {
+        fd = open(in_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+
+        if (fd >= 0)
+            direct = true;
+    }
+#endif
+
+    if (fd < 0)
+        fd = open(in_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0)
+        throw std::runtime_error("Unable to open file " + in_filename + ":" + 
+                kis_strerror_r(errno));
+
+    void *b = nullptr;
+
+    if (posix_memalign(&b, 4096, block_sz * num_blocks) != 0) {
+        close(fd);
+        throw std::runtime_error("Unable to allocate write blocks for " + in_filename);
+    }
+
+    blocks = (uint8_t *) b;
+
+    writer_th = std::thread([this]() { writer(); });
+}
+
+threaded_file_write_buffer::~threaded_file_write_buffer() {
+    local_locker lock(&write_mutex);
+
+    // Drain the full blocks, then write the partial block ourselves; a direct IO file 
+    // can't take a partial block, so it goes through the page cache
+    writer_shutdown = true;
+
+    {
+        std::lock_guard<std::mutex> lk(writer_mutex);
+        writer_cv.notify_all();
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(fill_mutex);
+        fill_cv.notify_all();
+    }
+
+    if (writer_th.joinable())
+        writer_th.join();
+
+    if (fill_pos > 0) {
+#ifdef O_DIRECT
+        if (direct)
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+#endif
+
+        write_block(blocks + (blocks_filled % num_blocks) * block_sz, fill_pos);
+    }
+
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+
+    free(blocks);
+}
+
+void threaded_file_write_buffer::submit_block() {
+    block_len[blocks_filled % num_blocks] = fill_pos;
+    fill_pos = 0;
+
+    blocks_filled++;
+
+    if (writer_waiting) {
+        std::lock_guard<std::mutex> lk(writer_mutex);
+        writer_cv.notify_all();
+    }
+}
+
+ssize_t threaded_file_write_buffer::write(uint8_t *in_data, size_t in_sz) {
+    std::unique_lock<std::mutex> lk(fill_mutex);
+
+    size_t pos = 0;
+
+    while (pos < in_sz) {
+        // The block being filled may still be waiting to be written from the last time
+        // around the ring
+        if (blocks_filled - blocks_written >= num_blocks) {
+            auto start = std::chrono::steady_clock::now();
+
+            stalls++;
+
+            fill_waiting = true;
+            fill_cv.wait(lk, [this]() { 
+                    return blocks_filled - blocks_written < num_blocks || writer_shutdown; 
+                    });
+            fill_waiting = false;
+
+            stall_usec += std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - start).count();
+
+            if (writer_shutdown)
+                return pos;
+        }
+
+        auto len = std::min(in_sz - pos, block_sz - fill_pos);
+
+        memcpy(blocks + (blocks_filled % num_blocks) * block_sz + fill_pos, in_data + pos, len);
+
+        fill_pos += len;
+        pos += len;
+
+        if (fill_pos == block_sz)
+            submit_block();
+    }
+
+    bytes_accepted += in_sz;
+
+    return in_sz;
+}
+
+ssize_t threaded_file_write_buffer::reserve(unsigned char **data, size_t in_sz) {
+    local_eol_locker lock(&write_mutex);
+
+    if (write_reserved) {
+        throw std::runtime_error("filebuf already reserved");
+    }
+
+    write_reserved = true;
+
+    if (reserve_chunk.size() < in_sz)
+        reserve_chunk.resize(in_sz);
+
+    *data = reserve_chunk.data();
+
+    return in_sz;
+}
+
+ssize_t threaded_file_write_buffer::zero_copy_reserve(unsigned char **data, size_t in_sz) {
+    return reserve(data, in_sz);
+}
+
+bool threaded_file_write_buffer::commit(unsigned char *data, size_t in_sz) {
+    local_unlocker unwritelock(&write_mutex);
+
+    if (!write_reserved) 
+        throw std::runtime_error("filebuf no pending commit");
+
+    write_reserved = false;
+
+    return write(data, in_sz) == (ssize_t) in_sz;
+}
+
+void threaded_file_write_buffer::write_block(const uint8_t *data, size_t len) {
+    size_t pos = 0;
+
+    while (pos < len) {
+        auto r = ::write(fd, data + pos, len - pos);
+
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+
+            write_errors++;
+            return;
+        }
+
+        pos += r;
+    }
+
+    bytes_written += len;
+}
+
+void threaded_file_write_buffer::writer() {
+    while (true) {
+        uint64_t written = blocks_written;
+
+        if (written == blocks_filled) {
+            if (writer_shutdown)
+                break;
+
+            {
+                std::unique_lock<std::mutex> lk(writer_mutex);
+
+                writer_waiting = true;
+                writer_cv.wait_for(lk, flush_interval, [this, written]() {
+                        return blocks_filled != written || writer_shutdown;
+                        });
+                writer_waiting = false;
+            }
+
+            // Nothing has filled a block for a while; write what we have so a slow log 
+            // still reaches the disk.  If the fill mutex is busy, the block is being 
+            // filled anyway.
+            if (!direct && !writer_shutdown && blocks_filled == written) {
+                std::unique_lock<std::mutex> fl(fill_mutex, std::try_to_lock);
+
+                if (fl.owns_lock() && fill_pos > 0)
+                    submit_block();
+            }
+
+            continue;
+        }
+
+        auto b = written % num_blocks;
+
+        write_block(blocks + b * block_sz, block_len[b]);
+
+        blocks_written++;
+
+        if (fill_waiting) {
+            std::lock_guard<std::mutex> lk(fill_mutex);
+            fill_cv.notify_all();
+        }
+    }
+}
@@ -22,7 +22,14 @@
 #include <stdint.h>
 #include <unistd.h>
 #include <pthread.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <mutex>
+#include <thread>
+#include <vector>
+
 #include "buffer_handler.h"
 
 // Direct file IO buffer for writing logs via the buffer API
@@ -85,5 +92,146 @@ protected:
     FILE *backfile;
 };
 
+// Block-buffered file IO with a writer thread, for high-rate logs via the buffer API
+//
+// Writes are copied into a ring of large, page-aligned blocks; full blocks are handed to
+// a writer thread which writes each one with a single write() call, so the thread 
+// producing the log never waits on the disk unless every block is waiting to be written.
+// Filling blocks is serialized by the fill mutex; the filling side and the writer thread
+// only exchange blocks through the filled and written counters, and only take a lock to
+// sleep when one is waiting on the other.
+//
+// Partially filled blocks are written after the flush interval, and when the file is
+// closed.  With direct IO, the file is opened O_DIRECT and full blocks bypass the page
+// cache; partial blocks can't be written directly, so they are only written when the
+// file is closed.  Filesystems which don't support O_DIRECT fall back to buffered IO.
+//
+// MAY THROW EXCEPTIONS on construction if the file cannot be opened
+class threaded_file_write_buffer : public common_buffer {
+public:
+    threaded_file_write_buffer(std::string in_path, size_t in_block_sz, 
+            unsigned int in_num_blocks, bool in_direct, 
+            std::chrono::milliseconds in_flush_interval);
+    virtual ~threaded_file_write_buffer();
+
+    // Written data can't be discarded
+    virtual void clear() { }
+
+    // The filling side blocks when the ring is full, so any write can be accepted
+    virtual ssize_t size() {
+        return block_sz * num_blocks;
+    }
+
+    virtual ssize_t available() {
+        return block_sz * num_blocks;
+    }
+
+    virtual size_t used() {
+        return bytes_accepted;
+    }
+
+    virtual size_t total() {
+        return bytes_accepted;
+    }
+
+    // Write-only buffer, we don't allow peeking 
+    virtual ssize_t peek(unsigned char **ret_data, size_t in_sz) {
+        return -1;
+    }
+
+    virtual ssize_t zero_copy_peek(unsigned char **ret_data, size_t in_sz) {
+        return -1;
+    }
+
+    virtual void peek_free(unsigned char *in_data) {
+        return;
+    }
+
+    virtual ssize_t write(unsigned char *in_data, size_t in_sz);
+  
+    virtual ssize_t reserve(unsigned char **data, size_t in_sz);
+    virtual ssize_t zero_copy_reserve(unsigned char **data, size_t in_sz);
+    virtual bool commit(unsigned char *data, size_t in_sz);
+
+    size_t consume(size_t in_sz) {
+        return 0;
+    }
+
+    bool get_direct() const {
+        return direct;
+    }
+
+    size_t get_block_size() const {
+        return block_sz;
+    }
+
+    // Blocks filled and waiting for the writer thread
+    uint64_t get_blocks_queued() const {
+        return blocks_filled - blocks_written;
+    }
+
+    uint64_t get_bytes_written() const {
+        return bytes_written;
+    }
+
+    uint64_t get_blocks_written() const {
+        return blocks_written;
+    }
+
+    // Times the filling side had to wait for the writer, and the total time spent waiting
+    uint64_t get_stalls() const {
+        return stalls;
+    }
+
+    uint64_t get_stall_usec() const {
+        return stall_usec;
+    }
+
+    uint64_t get_write_errors() const {
+        return write_errors;
+    }
+
+protected:
+    void writer();
+
+    // Hand the filling block to the writer thread; caller must hold the fill mutex
+    void submit_block();
+
+    void write_block(const uint8_t *data, size_t len);
+
+    std::string filename;
+    int fd;
+    bool direct;
+
+    size_t block_sz;
+    unsigned int num_blocks;
+    uint8_t *blocks;
+    std::vector<size_t> block_len;
+
+    // Fill position in the current block, blocks_filled % num_blocks
+    std::mutex fill_mutex;
+    std::condition_variable fill_cv;
+    size_t fill_pos;
+    std::atomic<bool> fill_waiting;
+
+    std::atomic<uint64_t> blocks_filled;
+    std::atomic<uint64_t> blocks_written;
+
+    std::mutex writer_mutex;
+    std::condition_variable writer_cv;
+    std::atomic<bool> writer_waiting;
+    std::atomic<bool> writer_shutdown;
+    std::chrono::milliseconds flush_interval;
+    std::thread writer_th;
+
+    std::vector<uint8_t> reserve_chunk;
+
+    std::atomic<uint64_t> bytes_accepted;
+    std::atomic<uint64_t> bytes_written;
+    std::atomic<uint64_t> stalls;
+    std::atomic<uint64_t> stall_usec;
+    std::atomic<uint64_t> write_errors;
+};
+
 #endif
 
@@ -0,0 +1,119 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include "kis_bpf.h"
+
+kis_bpf_program::label kis_bpf_program::new_label() {
+    label_pos.push_back(-1);
+    return label_pos.size() - 1;
+}
+
+void kis_bpf_program::place(label in_label) {
+    label_pos[in_label] = insns.size();
+}
+
+void kis_bpf_program::stmt(uint16_t in_code, uint32_t in_k) {
+    pending_insn i;
+
+    i.insn.code = in_code;
+    i.insn.jt = 0;
+    i.insn.jf = 0;
+    i.insn.k = in_k;
+    i.jt = next;
+    i.jf = next;
+    i.ja = next;
+
+    insns.push_back(i);
+}
+
+void kis_bpf_program::jump(uint16_t in_code, uint32_t in_k, label in_true, label in_false) {
+    pending_insn i;
+
+    i.insn.code = kis_bpf::jmp | in_code;
+    i.insn.jt = 0;
+    i.insn.jf = 0;
+    i.insn.k = in_k;
+    i.jt = in_true;
+    i.jf = in_false;
+    i.ja = next;
+
+    insns.push_back(i);
+}
+
+void kis_bpf_program::jump_always(label in_label) {
+    pending_insn i;
+
+    i.insn.code = kis_bpf::jmp | kis_bpf::ja;
+    i.insn.jt = 0;
+    i.insn.jf = 0;
+    i.insn.k = 0;
+    i.jt = next;
+    i.jf = next;
+    i.ja = in_label;
+
+    insns.push_back(i);
+}
+
+bool kis_bpf_program::assemble(std::vector<kis_bpf_insn>& out) const {
+    out.clear();
+
+    if (insns.size() > kis_bpf::max_insns)
+        return false;
+
+    // Offset from the instruction after pos to the label
+    auto offset = [this](size_t pos, label l) -> long {
+        if (l == next)
+            return 0;
+
+        if (label_pos[l] < 0)
+            return -1;
+
+        return label_pos[l] - (long) pos - 1;
+    };
+
+    for (size_t pos = 0; pos < insns.size(); pos++) {
+        auto i = insns[pos].insn;
+
+        if ((i.code & 0x07) == kis_bpf::jmp) {
+            if ((i.code & 0xf0) == kis_bpf::ja) {
+                auto o = offset(pos, insns[pos].ja);
+
+                if (o < 0)
+                    return false;
+
+                i.k = o;
+            } else {
+                auto t = offset(pos, insns[pos].jt);
+                auto f = offset(pos, insns[pos].jf);
+
+                if (t < 0 || t > 255 || f < 0 || f > 255)
+                    return false;
+
+                i.jt = t;
+                i.jf = f;
+            }
+        }
+
+        out.push_back(i);
+    }
+
+    return true;
+}
+
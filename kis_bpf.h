@@ -0,0 +1,138 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __KIS_BPF_H__
+#define __KIS_BPF_H__
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Minimal classic BPF assembler, used to build capture filters which are pushed to
+// the capture sources and applied by libpcap or the kernel.  Kismet doesn't need
+// libpcap to build the programs, so the opcodes are defined here; they're the same
+// values as the BPF_ macros in pcap/bpf.h and linux/filter.h.
+
+namespace kis_bpf {
+    // Instruction classes
+    const uint16_t ld = 0x00;
+    const uint16_t ldx = 0x01;
+    const uint16_t st = 0x02;
+    const uint16_t stx = 0x03;
+    const uint16_t alu = 0x04;
+    const uint16_t jmp = 0x05;
+    const uint16_t ret = 0x06;
+    const uint16_t misc = 0x07;
+
+    // Load sizes
+    const uint16_t w = 0x00;
+    const uint16_t h = 0x08;
+    const uint16_t b = 0x10;
+
+    // Load modes
+    const uint16_t imm = 0x00;
+    const uint16_t abs = 0x20;
+    const uint16_t ind = 0x40;
+    const uint16_t mem = 0x60;
+    const uint16_t len = 0x80;
+
+    // ALU ops
+    const uint16_t op_add = 0x00;
+    const uint16_t op_and = 0x50;
+    const uint16_t op_lsh = 0x60;
+    const uint16_t op_rsh = 0x70;
+
+    // Jumps
+    const uint16_t ja = 0x00;
+    const uint16_t jeq = 0x10;
+    const uint16_t jgt = 0x20;
+    const uint16_t jge = 0x30;
+    const uint16_t jset = 0x40;
+
+    // Operand source
+    const uint16_t k = 0x00;
+    const uint16_t x = 0x08;
+
+    // Misc
+    const uint16_t tax = 0x00;
+    const uint16_t txa = 0x80;
+
+    // Scratch memory slots
+    const unsigned int memwords = 16;
+
+    // Longest program the Linux kernel accepts
+    const size_t max_insns = 4096;
+
+    // Snap length returned by an accepting program
+    const uint32_t accept_len = 262144;
+}
+
+// Same layout as struct bpf_insn and struct sock_filter
+struct kis_bpf_insn {
+    uint16_t code;
+    uint8_t jt;
+    uint8_t jf;
+    uint32_t k;
+};
+
+class kis_bpf_program {
+public:
+    typedef int label;
+
+    // Jump to the next instruction
+    const static label next = -1;
+
+    kis_bpf_program() { }
+
+    // Create a label which can be jumped to before it's placed
+    label new_label();
+
+    // Attach a label to the next instruction
+    void place(label in_label);
+
+    void stmt(uint16_t in_code, uint32_t in_k = 0);
+
+    // Conditional jump; jumps can only go forward, and conditional jumps can
+    // skip at most 255 instructions
+    void jump(uint16_t in_code, uint32_t in_k, label in_true, label in_false);
+
+    // Unconditional jump, which can reach any following instruction
+    void jump_always(label in_label);
+
+    size_t size() const {
+        return insns.size();
+    }
+
+    // Resolve the labels; returns false if a jump can't be encoded or the
+    // program is too long
+    bool assemble(std::vector<kis_bpf_insn>& out) const;
+
+protected:
+    struct pending_insn {
+        kis_bpf_insn insn;
+        label jt, jf, ja;
+    };
+
+    std::vector<pending_insn> insns;
+    std::vector<long> label_pos;
+};
+
+#endif
+
@@ -78,6 +78,11 @@ public:
     virtual int database_upgrade_db() = 0;
 
 protected:
+    // Called after the database file is opened and before any tables are created or
+    // read; subclasses can set connection and file options which must be set before
+    // the database has content, such as the page size
+    virtual bool database_init_connection() { return true; }
+
     virtual bool database_create_master_table();
 
     // Force-set db version, to be called after upgrading the db or
@@ -25,10 +25,41 @@
 #include "json_adapter.h"
 #include "kis_databaselogfile.h"
 #include "kis_datasource.h"
+#include "kismetdb_blob.h"
 #include "messagebus.h"
 #include "packetchain.h"
 #include "sqlite3_cpp11.h"
 
+// Indexes used by the pcap export filters; each ends with the timestamp so that a time
+// range within a source, device, or frequency is resolved in the index
+static int create_packet_indexes(sqlite3 *db, const std::string& schema) {
+    auto sql = fmt::format(
+            "CREATE INDEX IF NOT EXISTS {0}packets_ts ON packets (ts_sec, ts_usec); "
+            "CREATE INDEX IF NOT EXISTS {0}packets_datasource ON packets (datasource, ts_sec); "
+            "CREATE INDEX IF NOT EXISTS {0}packets_devkey ON packets (devkey, ts_sec); "
+            "CREATE INDEX IF NOT EXISTS {0}packets_frequency ON packets (frequency, ts_sec)",
+            schema);
+
+    return sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
+}
+
+// Nothing writes to a closed segment, so it can be indexed and converted back to a 
+// standalone file; if a reader still has it open it stays in WAL mode, which is harmless
+static void finalize_closed_segment(const std::string& path, bool index) {
+    sqlite3 *sdb = nullptr;
+
+    if (sqlite3_open_v2(path.c_str(), &sdb, SQLITE_OPEN_READWRITE, NULL) == SQLITE_OK) {
+        sqlite3_busy_timeout(sdb, 100);
+
+        if (index)
+            create_packet_indexes(sdb, "");
+
+        sqlite3_exec(sdb, "PRAGMA journal_mode=DELETE", NULL, NULL, NULL);
+    }
+
+    sqlite3_close_v2(sdb);
+}
+
 kis_database_logfile::kis_database_logfile():
     kis_logfile(shared_log_builder(NULL)), 
     kis_database(Globalreg::globalreg, "kismetlog"),
@@ -78,6 +109,97 @@ kis_database_logfile::kis_database_logfile():
 
     db_enabled = false;
 
+    transaction_timer = -1;
+
+    packet_writer_enabled = false;
+    packet_queue_max = 0;
+    commit_rows = 0;
+    packet_writer_shutdown = false;
+    last_packet_drop_warning = 0;
+
+    wal_enabled = false;
+    page_size = 0;
+    mmap_size = 0;
+    wal_limit = 0;
+    checkpoint_shutdown = false;
+
+    compress_records = false;
+    compress_level = 3;
+
+    packet_index_enabled = false;
+    packet_index_live = false;
+
+    segments_enabled = false;
+    segment_max_size = 0;
+    segment_max_age = 0;
+    segment_open = false;
+    segment_number = 0;
+    segment_opened = 0;
+    segment_page_size = 4096;
+    segment_first_time = 0;
+    segment_last_time = 0;
+    segment_packets = 0;
+    segment_data = 0;
+
+    auto entrytracker =
+        Globalreg::fetch_mandatory_global_as<entry_tracker>();
+
+    packet_queue_rrd_id =
+        entrytracker->register_field("kismet.kismetdb.queued_rows_rrd",
+                tracker_element_factory<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>>(),
+                "kismetdb packet writer backlog queue rrd");
+    packet_queue_rrd =
+        std::make_shared<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>>(packet_queue_rrd_id);
+
+    commit_latency_rrd_id =
+        entrytracker->register_field("kismet.kismetdb.commit_latency_rrd",
+                tracker_element_factory<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>>(),
+                "kismetdb transaction commit latency rrd (ms)");
+    commit_latency_rrd =
+        std::make_shared<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>>(commit_latency_rrd_id);
+
+    dropped_rows_rrd_id =
+        entrytracker->register_field("kismet.kismetdb.dropped_rows_rrd",
+                tracker_element_factory<kis_tracked_rrd<>>(),
+                "kismetdb packet writer dropped rows / queue overfull rrd");
+    dropped_rows_rrd =
+        std::make_shared<kis_tracked_rrd<>>(dropped_rows_rrd_id);
+
+    wal_size_rrd_id =
+        entrytracker->register_field("kismet.kismetdb.wal_pages_rrd",
+                tracker_element_factory<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>>(),
+                "kismetdb write-ahead log size rrd (pages)");
+    wal_size_rrd =
+        std::make_shared<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>>(wal_size_rrd_id);
+
+    devices_logged_rrd_id =
+        entrytracker->register_field("kismet.kismetdb.devices_logged_rrd",
+                tracker_element_factory<kis_tracked_rrd<>>(),
+                "kismetdb devices written per logging pass rrd");
+    devices_logged_rrd =
+        std::make_shared<kis_tracked_rrd<>>(devices_logged_rrd_id);
+
+    device_bytes_rrd_id =
+        entrytracker->register_field("kismet.kismetdb.device_bytes_rrd",
+                tracker_element_factory<kis_tracked_rrd<>>(),
+                "kismetdb serialized device bytes written per logging pass rrd");
+    device_bytes_rrd =
+        std::make_shared<kis_tracked_rrd<>>(device_bytes_rrd_id);
+
+    writer_stats_map =
+        std::make_shared<tracker_element_map>();
+    writer_stats_map->insert(packet_queue_rrd);
+    writer_stats_map->insert(commit_latency_rrd);
+    writer_stats_map->insert(dropped_rows_rrd);
+    writer_stats_map->insert(wal_size_rrd);
+    writer_stats_map->insert(devices_logged_rrd);
+    writer_stats_map->insert(device_bytes_rrd);
+
+    // RRDs are protected by their internal mutexes
+    writer_stats_endp =
+        std::make_shared<kis_net_httpd_simple_tracked_endpoint>("/logging/kismetdb/writer_stats",
+                writer_stats_map, nullptr);
+
     bind_httpd_server();
 }
 
@@ -87,6 +209,7 @@ kis_database_logfile::~kis_database_logfile() {
         messagebus->remove_client(this);
 
     close_log();
+    join_packet_writer();
 }
 
 void kis_database_logfile::trigger_deferred_startup() {
@@ -104,6 +227,92 @@ bool kis_database_logfile::open_log(std::string in_path) {
     auto timetracker = 
         Globalreg::fetch_mandatory_global_as<time_tracker>("TIMETRACKER");
 
+    auto ephemeral =
+        Globalreg::globalreg->kismet_config->fetch_opt_bool("kis_log_ephemeral_dangerous", false);
+
+    wal_enabled =
+        Globalreg::globalreg->kismet_config->fetch_opt_bool("kis_log_wal", true);
+
+    // Readers and the checkpointer open the log by name, which doesn't exist for an
+    // ephemeral log
+    if (wal_enabled && ephemeral) {
+        _MSG_INFO("The kismetdb log is ephemeral; WAL mode will not be used.");
+        wal_enabled = false;
+    }
+
+    synchronous_mode =
+        str_lower(Globalreg::globalreg->kismet_config->fetch_opt_dfl("kis_log_synchronous",
+                    wal_enabled ? "normal" : "full"));
+
+    if (synchronous_mode != "off" && synchronous_mode != "normal" &&
+            synchronous_mode != "full" && synchronous_mode != "extra") {
+        _MSG_ERROR("Couldn't parse 'kis_log_synchronous', expected off, normal, full, or extra; "
+                "using 'full'.");
+        synchronous_mode = "full";
+    }
+
+    page_size =
+        Globalreg::globalreg->kismet_config->fetch_opt_uint("kis_log_page_size", 0);
+
+    if (page_size != 0 && 
+            (page_size < 512 || page_size > 65536 || (page_size & (page_size - 1)) != 0)) {
+        _MSG_ERROR("Invalid 'kis_log_page_size' {}, expected a power of two between 512 and "
+                "65536; using the sqlite default.", page_size);
+        page_size = 0;
+    }
+
+    mmap_size = 
+        (uint64_t) Globalreg::globalreg->kismet_config->fetch_opt_uint("kis_log_mmap_mb", 0) * 1024 * 1024;
+    wal_limit =
+        (uint64_t) Globalreg::globalreg->kismet_config->fetch_opt_uint("kis_log_wal_limit_mb", 64) * 1024 * 1024;
+    checkpoint_interval =
+        std::chrono::seconds(std::max(1U, 
+                    Globalreg::globalreg->kismet_config->fetch_opt_uint("kis_log_checkpoint_rate", 5)));
+
+    compress_records =
+        Globalreg::globalreg->kismet_config->fetch_opt_bool("kis_log_compress", false);
+    compress_level =
+        Globalreg::globalreg->kismet_config->fetch_opt_int("kis_log_compress_level", 3);
+
+    if (compress_level < 1 || compress_level > 9) {
+        _MSG_ERROR("Invalid 'kis_log_compress_level' {}, expected 1-9; using 3.", compress_level);
+        compress_level = 3;
+    }
+
+    segment_max_size =
+        (uint64_t) Globalreg::globalreg->kismet_config->fetch_opt_uint("kis_log_segment_size_mb", 0) * 1024 * 1024;
+    segment_max_age =
+        Globalreg::globalreg->kismet_config->fetch_opt_uint("kis_log_segment_rate", 0);
+    segments_enabled = segment_max_size != 0 || segment_max_age != 0;
+
+    // Segments are found relative to the log, which doesn't exist for an ephemeral log
+    if (segments_enabled && ephemeral) {
+        _MSG_INFO("The kismetdb log is ephemeral; packets will not be written to log segments.");
+        segments_enabled = false;
+    }
+
+    packet_index_enabled =
+        Globalreg::globalreg->kismet_config->fetch_opt_bool("kis_log_packet_index", false);
+
+    auto device_format = 
+        str_lower(Globalreg::globalreg->kismet_config->fetch_opt_dfl("kis_log_device_format", "json"));
+
+    if (device_format == "msgpack") {
+        device_serializer = "storagemsgpack";
+        _MSG_INFO("Logging devices to the kismetdb log as MessagePack records.");
+    } else {
+        if (device_format != "json")
+            _MSG_ERROR("Couldn't parse 'kis_log_device_format', expected 'json' or 'msgpack'; "
+                    "using json.");
+        device_serializer = "json";
+    }
+
+    if (compress_records) {
+        compression_dict = 
+            kismetdb_blob::build_dictionary(Globalreg::globalreg->entrytracker->get_field_names());
+        _MSG_INFO("Compressing JSON records in the kismetdb log.");
+    }
+
     bool dbr = database_open(in_path);
 
     if (!dbr) {
@@ -126,12 +335,22 @@ bool kis_database_logfile::open_log(std::string in_path) {
 
 	_MSG("Opened kismetdb log file '" + in_path + "'", MSGFLAG_INFO);
 
-    if (Globalreg::globalreg->kismet_config->fetch_opt_bool("kis_log_ephemeral_dangerous", false)) {
+    if (ephemeral) {
         _MSG_INFO("KISMETDB LOG IS IN EPHEMERAL MODE.  LOG WILL *** NOT *** BE PRESERVED WHEN "
                 "KISMET EXITS.");
         unlink(in_path.c_str());
     }
 
+    packet_writer_enabled =
+        Globalreg::globalreg->kismet_config->fetch_opt_bool("kis_log_packet_writer", true);
+    packet_queue_max =
+        std::max(1U, Globalreg::globalreg->kismet_config->fetch_opt_uint("kis_log_packet_queue", 16384));
+    commit_rows =
+        std::max(1U, Globalreg::globalreg->kismet_config->fetch_opt_uint("kis_log_commit_rows", 20000));
+    commit_interval =
+        std::chrono::milliseconds(std::max(100U,
+                    Globalreg::globalreg->kismet_config->fetch_opt_uint("kis_log_commit_ms", 10000)));
+
     if (Globalreg::globalreg->kismet_config->fetch_opt_bool("kis_log_packets", true)) {
         _MSG("Saving packets to the Kismet database log.", MSGFLAG_INFO);
         std::shared_ptr<packet_chain> packetchain =
@@ -151,6 +370,11 @@ bool kis_database_logfile::open_log(std::string in_path) {
             timetracker->register_timer(SERVER_TIMESLICES_SEC * 15, NULL, 1,
                     [this](int) -> int {
 
+                    // Drop whole segments instead of deleting rows when packets are
+                    // being saved to segments
+                    if (segments_enabled && expire_segments(time(0) - packet_timeout))
+                        return 1;
+
                     auto pkt_delete = 
                         fmt::format("DELETE FROM packets WHERE ts_sec < {}",
                                 time(0) - packet_timeout);
@@ -373,26 +597,80 @@ bool kis_database_logfile::open_log(std::string in_path) {
 
     db_enabled = true;
 
-    sqlite3_exec(db, "PRAGMA journal_mode=PERSIST", NULL, NULL, NULL);
+    if (wal_enabled) {
+        std::string journal_mode;
+
+        sqlite3_exec(db, "PRAGMA journal_mode=WAL",
+                [] (void *aux, int argc, char **argv, char **) -> int {
+                    if (argc > 0 && argv[0] != nullptr)
+                        *((std::string *) aux) = argv[0];
+                    return 0;
+                }, (void *) &journal_mode, NULL);
+
+        if (str_lower(journal_mode) != "wal") {
+            _MSG_ERROR("Unable to put the kismetdb log in WAL mode, falling back to a persistent "
+                    "journal.");
+            wal_enabled = false;
+        }
+    }
+
+    if (wal_enabled) {
+        sqlite3_exec(db, fmt::format("PRAGMA journal_size_limit={}", wal_limit).c_str(),
+                NULL, NULL, NULL);
+    } else {
+        sqlite3_exec(db, "PRAGMA journal_mode=PERSIST", NULL, NULL, NULL);
+    }
+
+    // Checkpoints are handled by the checkpoint thread so the writer never stalls 
+    // copying the WAL back into the database; this applies to segments as well
+    if (wal_enabled || segments_enabled)
+        sqlite3_exec(db, "PRAGMA wal_autocheckpoint=0", NULL, NULL, NULL);
+
+    sqlite3_exec(db, fmt::format("PRAGMA synchronous={}", synchronous_mode).c_str(), 
+            NULL, NULL, NULL);
+
+    if (segments_enabled) {
+        if (open_segment()) {
+            _MSG_INFO("Saving packets to kismetdb log segments, starting with '{}'", segment_file);
+        } else {
+            _MSG_ERROR("Unable to open a kismetdb log segment; packets will be saved to the "
+                    "main log instead.");
+            segments_enabled = false;
+        }
+    }
+
+    if (wal_enabled || segments_enabled)
+        start_checkpointer();
     
-    // Go into transactional mode where we only commit every 10 seconds
+    // Go into transactional mode where we only commit every 10 seconds, or under the
+    // control of the packet writer thread
     sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL);
 
-    transaction_timer = 
-        timetracker->register_timer(SERVER_TIMESLICES_SEC * 10, NULL, 1,
-            [this](int) -> int {
+    if (packet_writer_enabled) {
+        start_packet_writer();
+    } else {
+        transaction_timer = 
+            timetracker->register_timer(SERVER_TIMESLICES_SEC * 10, NULL, 1,
+                [this](int) -> int {
 
-            local_locker dblock(&ds_mutex);
+                local_locker dblock(&ds_mutex);
 
-            in_transaction_sync = true;
+                in_transaction_sync = true;
 
-            sqlite3_exec(db, "END TRANSACTION", NULL, NULL, NULL);
-            sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL);
+                if (segment_rotation_due()) {
+                    rotate_segment();
+                } else {
+                    flush_summary();
+                    flush_segment_index(false);
+                    sqlite3_exec(db, "END TRANSACTION", NULL, NULL, NULL);
+                    sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL);
+                }
 
-            in_transaction_sync = false;
+                in_transaction_sync = false;
 
-            return 1;
-        });
+                return 1;
+            });
+    }
 
     // Post that we've got the logfile ready
     auto eventbus = Globalreg::fetch_mandatory_global_as<event_bus>();
@@ -403,12 +681,20 @@ bool kis_database_logfile::open_log(std::string in_path) {
 }
 
 void kis_database_logfile::close_log() {
+    // This is also reached from error paths which already hold the database lock, so the
+    // writer thread is only told to stop here; the rows it hasn't written are written 
+    // below, and the thread is joined once the lock is free
+    stop_packet_writer();
+    stop_checkpointer();
+
     local_demand_locker dblock(&ds_mutex);
 
     db_lock_with_sync_check(dblock, return);
 
     set_int_log_open(false);
 
+    flush_packet_writer();
+
     // Kill the timers
     auto timetracker = 
         Globalreg::fetch_global_as<time_tracker>();
@@ -423,9 +709,33 @@ void kis_database_logfile::close_log() {
 
     // End the transaction
     {
+        flush_summary();
+        flush_segment_index(true);
+
+        if (packet_index_enabled) {
+            _MSG_INFO("Indexing packets in the kismetdb log, this may take some time...");
+
+            create_packet_indexes(db, "");
+
+            if (segment_open)
+                create_packet_indexes(db, "seg.");
+        }
+
         sqlite3_exec(db, "END TRANSACTION", NULL, NULL, NULL);
     }
 
+    close_segment(true);
+
+    // Finish any segments the checkpoint thread didn't get to
+    {
+        std::lock_guard<std::mutex> lock(checkpoint_mutex);
+
+        for (const auto& c : checkpoint_closed_segments)
+            finalize_closed_segment(c, packet_index_enabled);
+
+        checkpoint_closed_segments.clear();
+    }
+
     db_enabled = false;
 
     auto packetchain =
@@ -531,84 +841,33 @@ int kis_database_logfile::database_upgrade_db() {
         return -1;
     }
 
-    sql =
-        "CREATE TABLE packets ("
-
-        "ts_sec INT, " // Timestamps
-        "ts_usec INT, "
-
-        "phyname TEXT, " // Packet phy
-
-        "sourcemac TEXT, " // Source, dest, and network addresses
-        "destmac TEXT, "
-        "transmac TEXT, "
-
-        "frequency REAL, " // Freq in khz
-
-        "devkey TEXT, " // Device key
-
-        "lat REAL, " // location
-        "lon REAL, "
-        "alt REAL, "
-        "speed REAL, "
-        "heading REAL, "
-
-        "packet_len INT, " // Packet length
-
-        "signal INT, " // Signal level
-
-        "datasource TEXT, " // UUID of data source
-
-        "dlt INT, " // pcap data - datalinktype and packet bin
-        "packet BLOB, "
-
-        "error INT, " // Packet was flagged as invalid
-
-        "tags TEXT" // Arbitrary packet tags
-        ")";
-
-    r = sqlite3_exec(db, sql.c_str(),
+    r = sqlite3_exec(db, kismetdb_summary::device_schema_sql,
             [] (void *, int, char **, char **) -> int { return 0; }, NULL, &sErrMsg);
 
     if (r != SQLITE_OK) {
-        _MSG("Kismet log was unable to create packet table in " + ds_dbfile + ": " +
+        _MSG("Kismet log was unable to create device summary table in " + ds_dbfile + ": " +
                 std::string(sErrMsg), MSGFLAG_ERROR);
         close_log();
         return -1;
     }
 
-    sql =
-        "CREATE TABLE data ("
-
-        "ts_sec INT, " // Timestamps
-        "ts_usec INT, "
-
-        "phyname TEXT, " // Packet name and phy
-        "devmac TEXT, "
-
-        "lat REAL, " // Location
-        "lon REAL, "
-        "alt REAL, "
-        "speed REAL, "
-        "heading REAL, "
-
-        "datasource TEXT, " // UUID of data source
-
-        "type TEXT, " // Type of arbitrary record
-
-        "json BLOB " // Arbitrary JSON record
-        ")";
-
-    r = sqlite3_exec(db, sql.c_str(),
-            [] (void *, int, char **, char **) -> int { return 0; }, NULL, &sErrMsg);
-
-    if (r != SQLITE_OK) {
-        _MSG("Kismet log was unable to create data table in " + ds_dbfile + ": " +
-                std::string(sErrMsg), MSGFLAG_ERROR);
+    if (!create_packet_tables("")) {
         close_log();
         return -1;
     }
 
+    if (segments_enabled) {
+        r = sqlite3_exec(db, kismetdb_segments::manifest_schema_sql,
+                [] (void *, int, char **, char **) -> int { return 0; }, NULL, &sErrMsg);
+
+        if (r != SQLITE_OK) {
+            _MSG("Kismet log was unable to create segment tables in " + ds_dbfile + ": " +
+                    std::string(sErrMsg), MSGFLAG_ERROR);
+            close_log();
+            return -1;
+        }
+    }
+
     sql =
         "CREATE TABLE datasources ("
 
@@ -711,6 +970,32 @@ int kis_database_logfile::database_upgrade_db() {
 
     database_set_db_version(6);
 
+    // Store the compression dictionary with the log so it can be decoded later
+    if (compress_records) {
+        sqlite3_stmt *dict_stmt = NULL;
+
+        r = sqlite3_exec(db, "ALTER TABLE KISMET ADD COLUMN compression_dict BLOB",
+                [] (void *, int, char **, char **) -> int { return 0; }, NULL, &sErrMsg);
+
+        if (r == SQLITE_OK)
+            r = sqlite3_prepare(db, "UPDATE KISMET SET compression_dict = ?", -1, &dict_stmt, NULL);
+
+        if (r == SQLITE_OK) {
+            sqlite3_bind_blob(dict_stmt, 1, compression_dict.data(), compression_dict.length(), 
+                    SQLITE_TRANSIENT);
+            r = sqlite3_step(dict_stmt) == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
+        }
+
+        if (dict_stmt != NULL)
+            sqlite3_finalize(dict_stmt);
+
+        if (r != SQLITE_OK) {
+            _MSG_ERROR("Kismet log was unable to save the compression dictionary in {}: {}; "
+                    "records will not be compressed.", ds_dbfile, sqlite3_errmsg(db));
+            compress_records = false;
+        }
+    }
+
     // Prepare the statements we'll need later
     //
     sql =
@@ -730,40 +1015,7 @@ int kis_database_logfile::database_upgrade_db() {
         return -1;
     }
 
-    sql =
-        "INSERT INTO packets "
-        "(ts_sec, ts_usec, phyname, "
-        "sourcemac, destmac, transmac, devkey, frequency, " 
-        "lat, lon, alt, speed, heading, "
-        "packet_len, signal, "
-        "datasource, "
-        "dlt, packet, "
-        "error, tags) "
-        "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
-
-    r = sqlite3_prepare(db, sql.c_str(), sql.length(), &packet_stmt, &packet_pz);
-
-    if (r != SQLITE_OK) {
-        _MSG("kis_database_logfile unable to prepare database insert for packets in " +
-                ds_dbfile + ":" + std::string(sqlite3_errmsg(db)), MSGFLAG_ERROR);
-        close_log();
-        return -1;
-    }
-
-    sql =
-        "INSERT INTO data "
-        "(ts_sec, ts_usec, "
-        "phyname, devmac, "
-        "lat, lon, alt, speed, heading, "
-        "datasource, "
-        "type, json) "
-        "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
-
-    r = sqlite3_prepare(db, sql.c_str(), sql.length(), &data_stmt, &data_pz);
-
-    if (r != SQLITE_OK) {
-        _MSG("kis_database_logfile unable to prepare database insert for data in " +
-                ds_dbfile + ":" + std::string(sqlite3_errmsg(db)), MSGFLAG_ERROR);
+    if (!prepare_packet_statements("")) {
         close_log();
         return -1;
     }
@@ -837,304 +1089,1359 @@ int kis_database_logfile::database_upgrade_db() {
     return 1;
 }
 
-void kis_database_logfile::process_message(std::string in_msg, int in_flags) {
-    if (!db_enabled)
-        return;
+bool kis_database_logfile::create_packet_tables(const std::string& schema) {
+    std::string sql;
+    int r;
+    char *sErrMsg = NULL;
 
-    local_demand_locker dblock(&ds_mutex);
-    db_lock_with_sync_check(dblock, return);
+    sql =
+        "CREATE TABLE " + schema + "packets ("
 
-    sqlite3_reset(msg_stmt);
+        "ts_sec INT, " // Timestamps
+        "ts_usec INT, "
 
-    unsigned int spos = 1;
+        "phyname TEXT, " // Packet phy
 
-    sqlite3_bind_int64(msg_stmt, spos++, time(0));
+        "sourcemac TEXT, " // Source, dest, and network addresses
+        "destmac TEXT, "
+        "transmac TEXT, "
 
-    if (gpstracker != nullptr) {
-        auto loc = std::shared_ptr<kis_gps_packinfo>(gpstracker->get_best_location());
+        "frequency REAL, " // Freq in khz
 
-        if (loc != nullptr && loc->fix >= 2) {
-            sqlite3_bind_double(msg_stmt, spos++, loc->lat);
-            sqlite3_bind_double(msg_stmt, spos++, loc->lon);
-        } else {
-            sqlite3_bind_double(msg_stmt, spos++, 0);
-            sqlite3_bind_double(msg_stmt, spos++, 0);
-        }
-    } else {
-        sqlite3_bind_double(msg_stmt, spos++, 0);
-        sqlite3_bind_double(msg_stmt, spos++, 0);
-    }
+        "devkey TEXT, " // Device key
 
-    std::string msgtype;
+        "lat REAL, " // location
+        "lon REAL, "
+        "alt REAL, "
+        "speed REAL, "
+        "heading REAL, "
 
-    if (in_flags & MSGFLAG_INFO)
-        msgtype = "INFO";
-    else if (in_flags & MSGFLAG_ERROR)
-        msgtype = "ERROR";
-    else if (in_flags & MSGFLAG_DEBUG)
-        msgtype = "DEBUG";
-    else if (in_flags & MSGFLAG_FATAL)
-        msgtype = "FATAL";
+        "packet_len INT, " // Packet length
 
-    sqlite3_bind_text(msg_stmt, spos++, msgtype.c_str(), msgtype.length(), SQLITE_TRANSIENT);
-    sqlite3_bind_text(msg_stmt, spos++, in_msg.c_str(), in_msg.length(), SQLITE_TRANSIENT);
+        "signal INT, " // Signal level
 
-    if (sqlite3_step(msg_stmt) != SQLITE_DONE) {
-        close_log();
-        _MSG_ERROR("Unable to insert message into {}: {}", ds_dbfile, sqlite3_errmsg(db));
-    }
-}
+        "datasource TEXT, " // UUID of data source
 
-int kis_database_logfile::log_device(std::shared_ptr<kis_tracked_device_base> d) {
-    // We avoid using external mutexes here and try to let sqlite3 handle its own
-    // internal locking state; we don't want a huge device list write to block packet
-    // writes for instance
-    
-    if (!db_enabled)
-        return 0;
+        "dlt INT, " // pcap data - datalinktype and packet bin
+        "packet BLOB, "
 
-    std::string sql;
+        "error INT, " // Packet was flagged as invalid
 
-    std::string phystring;
-    std::string macstring;
-    std::string typestring;
-    std::string keystring;
+        "tags TEXT" // Arbitrary packet tags
+        ")";
 
-    if (d == nullptr)
-        return 0;
+    r = sqlite3_exec(db, sql.c_str(),
+            [] (void *, int, char **, char **) -> int { return 0; }, NULL, &sErrMsg);
+
+    if (r != SQLITE_OK) {
+        _MSG("Kismet log was unable to create packet table in " + ds_dbfile + ": " +
+                std::string(sErrMsg), MSGFLAG_ERROR);
+        sqlite3_free(sErrMsg);
+        return false;
+    }
+
+    sql =
+        "CREATE TABLE " + schema + "data ("
+
+        "ts_sec INT, " // Timestamps
+        "ts_usec INT, "
+
+        "phyname TEXT, " // Packet name and phy
+        "devmac TEXT, "
+
+        "lat REAL, " // Location
+        "lon REAL, "
+        "alt REAL, "
+        "speed REAL, "
+        "heading REAL, "
+
+        "datasource TEXT, " // UUID of data source
+
+        "type TEXT, " // Type of arbitrary record
+
+        "json BLOB " // Arbitrary JSON record
+        ")";
+
+    r = sqlite3_exec(db, sql.c_str(),
+            [] (void *, int, char **, char **) -> int { return 0; }, NULL, &sErrMsg);
+
+    if (r != SQLITE_OK) {
+        _MSG("Kismet log was unable to create data table in " + ds_dbfile + ": " +
+                std::string(sErrMsg), MSGFLAG_ERROR);
+        sqlite3_free(sErrMsg);
+        return false;
+    }
+
+    sql = kismetdb_summary::packet_schema_sql(schema);
+
+    r = sqlite3_exec(db, sql.c_str(),
+            [] (void *, int, char **, char **) -> int { return 0; }, NULL, &sErrMsg);
+
+    if (r != SQLITE_OK) {
+        _MSG("Kismet log was unable to create packet summary table in " + ds_dbfile + ": " +
+                std::string(sErrMsg), MSGFLAG_ERROR);
+        sqlite3_free(sErrMsg);
+        return false;
+    }
+
+    return true;
+}
+
+bool kis_database_logfile::prepare_packet_statements(const std::string& schema) {
+    std::string sql;
+    int r;
+
+    finalize_packet_statements();
+
+    sql =
+        "INSERT INTO " + schema + "packets "
+        "(ts_sec, ts_usec, phyname, "
+        "sourcemac, destmac, transmac, devkey, frequency, " 
+        "lat, lon, alt, speed, heading, "
+        "packet_len, signal, "
+        "datasource, "
+        "dlt, packet, "
+        "error, tags) "
+        "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
+
+    r = sqlite3_prepare(db, sql.c_str(), sql.length(), &packet_stmt, &packet_pz);
+
+    if (r != SQLITE_OK) {
+        _MSG("kis_database_logfile unable to prepare database insert for packets in " +
+                ds_dbfile + ":" + std::string(sqlite3_errmsg(db)), MSGFLAG_ERROR);
+        return false;
+    }
+
+    sql =
+        "INSERT INTO " + schema + "data "
+        "(ts_sec, ts_usec, "
+        "phyname, devmac, "
+        "lat, lon, alt, speed, heading, "
+        "datasource, "
+        "type, json) "
+        "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
+
+    r = sqlite3_prepare(db, sql.c_str(), sql.length(), &data_stmt, &data_pz);
+
+    if (r != SQLITE_OK) {
+        _MSG("kis_database_logfile unable to prepare database insert for data in " +
+                ds_dbfile + ":" + std::string(sqlite3_errmsg(db)), MSGFLAG_ERROR);
+        return false;
+    }
+
+    return true;
+}
+
+void kis_database_logfile::finalize_packet_statements() {
+    if (packet_stmt != NULL)
+        sqlite3_finalize(packet_stmt);
+    packet_stmt = NULL;
+
+    if (data_stmt != NULL)
+        sqlite3_finalize(data_stmt);
+    data_stmt = NULL;
+}
+
+bool kis_database_logfile::open_segment() {
+    auto number = segment_number + 1;
+    auto path = kismetdb_segments::segment_path(ds_dbfile, number);
+
+    // Segments are recorded relative to the log so that the log can be moved
+    auto relpath = path;
+    auto slash = relpath.find_last_of('/');
+    if (slash != std::string::npos)
+        relpath = relpath.substr(slash + 1);
+
+    finalize_packet_statements();
+
+    sqlite3_stmt *stmt = NULL;
+    int r;
+
+    r = sqlite3_prepare_v2(db, "ATTACH DATABASE ? AS seg", -1, &stmt, NULL);
+
+    if (r == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, path.data(), path.length(), SQLITE_TRANSIENT);
+        r = sqlite3_step(stmt) == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
+    }
+
+    sqlite3_finalize(stmt);
+    stmt = NULL;
+
+    if (r != SQLITE_OK) {
+        _MSG_ERROR("Unable to open kismetdb log segment '{}': {}", path, sqlite3_errmsg(db));
+        prepare_packet_statements("");
+        return false;
+    }
+
+    if (page_size != 0)
+        sqlite3_exec(db, fmt::format("PRAGMA seg.page_size={}", page_size).c_str(), NULL, NULL, NULL);
+
+    if (mmap_size != 0)
+        sqlite3_exec(db, fmt::format("PRAGMA seg.mmap_size={}", mmap_size).c_str(), NULL, NULL, NULL);
+
+    sqlite3_exec(db, "PRAGMA seg.journal_mode=WAL", NULL, NULL, NULL);
+    sqlite3_exec(db, fmt::format("PRAGMA seg.journal_size_limit={}", wal_limit).c_str(),
+            NULL, NULL, NULL);
+    sqlite3_exec(db, fmt::format("PRAGMA seg.synchronous={}", synchronous_mode).c_str(), 
+            NULL, NULL, NULL);
+
+    bool tables_created = create_packet_tables("seg.");
+
+    // Once exports have asked for the packet indexes, new segments are indexed from the
+    // start; it costs nothing while the tables are empty
+    if (tables_created && packet_index_live)
+        create_packet_indexes(db, "seg.");
+
+    if (tables_created && prepare_packet_statements("seg.")) 
+        r = sqlite3_prepare_v2(db, "INSERT INTO segments (segment, path, first_time, last_time, "
+                "packets, data, closed) VALUES (?, ?, 0, 0, 0, 0, 0)", -1, &stmt, NULL);
+    else
+        r = SQLITE_ERROR;
+
+    if (r == SQLITE_OK) {
+        sqlite3_bind_int(stmt, 1, number);
+        sqlite3_bind_text(stmt, 2, relpath.data(), relpath.length(), SQLITE_TRANSIENT);
+        r = sqlite3_step(stmt) == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
+
+        if (r != SQLITE_OK)
+            _MSG_ERROR("Unable to add kismetdb log segment '{}' to the log: {}", 
+                    path, sqlite3_errmsg(db));
+    }
+
+    sqlite3_finalize(stmt);
+
+    if (r != SQLITE_OK) {
+        finalize_packet_statements();
+        sqlite3_exec(db, "DETACH DATABASE seg", NULL, NULL, NULL);
+        prepare_packet_statements("");
+        return false;
+    }
+
+    segment_page_size = 4096;
+
+    sqlite3_exec(db, "PRAGMA seg.page_size",
+            [] (void *aux, int argc, char **argv, char **) -> int {
+                if (argc > 0 && argv[0] != nullptr)
+                    *((uint64_t *) aux) = string_to_n_dfl<uint64_t>(argv[0], 4096);
+                return 0;
+            }, (void *) &segment_page_size, NULL);
+
+    segment_open = true;
+    segment_number = number;
+    segment_file = path;
+    segment_opened = time(0);
+    segment_first_time = 0;
+    segment_last_time = 0;
+    segment_packets = 0;
+    segment_data = 0;
+
+    segment_datasource_set.clear();
+    segment_device_set.clear();
+    segment_pending_datasources.clear();
+    segment_pending_devices.clear();
+
+    {
+        std::lock_guard<std::mutex> lock(checkpoint_mutex);
+        checkpoint_segment = path;
+    }
+
+    return true;
+}
+
+void kis_database_logfile::close_segment(bool closing_log) {
+    if (!segment_open)
+        return;
+
+    segment_open = false;
+
+    finalize_packet_statements();
+
+    // When the log is closing, the checkpoint thread has already stopped and the segment
+    // can be converted back to a standalone file now; otherwise the checkpoint thread
+    // converts it once it has let go of it
+    if (closing_log)
+        sqlite3_exec(db, "PRAGMA seg.journal_mode=DELETE", NULL, NULL, NULL);
+
+    sqlite3_exec(db, "DETACH DATABASE seg", NULL, NULL, NULL);
+
+    std::lock_guard<std::mutex> lock(checkpoint_mutex);
+
+    checkpoint_segment = "";
+
+    if (!closing_log)
+        checkpoint_closed_segments.push_back(segment_file);
+}
+
+void kis_database_logfile::rotate_segment() {
+    flush_summary();
+    flush_segment_index(true);
+
+    sqlite3_exec(db, "END TRANSACTION", NULL, NULL, NULL);
+
+    close_segment(false);
+
+    if (!open_segment())
+        _MSG_ERROR("Unable to open a new kismetdb log segment; packets will be saved to the "
+                "main log instead.");
+
+    sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL);
+}
+
+bool kis_database_logfile::segment_rotation_due() {
+    if (!segment_open || (segment_packets == 0 && segment_data == 0))
+        return false;
+
+    if (segment_max_age != 0 && time(0) - segment_opened >= segment_max_age)
+        return true;
+
+    // Packets are expired a segment at a time, so don't let a segment cover more
+    // than the packet timeout
+    if (packet_timeout != 0 && time(0) - segment_opened >= packet_timeout)
+        return true;
+
+    if (segment_max_size != 0) {
+        uint64_t page_count = 0;
+
+        sqlite3_exec(db, "PRAGMA seg.page_count",
+                [] (void *aux, int argc, char **argv, char **) -> int {
+                    if (argc > 0 && argv[0] != nullptr)
+                        *((uint64_t *) aux) = string_to_n_dfl<uint64_t>(argv[0], 0);
+                    return 0;
+                }, (void *) &page_count, NULL);
+
+        if (page_count * segment_page_size >= segment_max_size)
+            return true;
+    }
+
+    return false;
+}
+
+void kis_database_logfile::index_segment_row(time_t ts, bool packet, bool data,
+        const std::shared_ptr<const std::string>& datasource,
+        const std::shared_ptr<const std::string>& phyname,
+        const std::shared_ptr<const std::string>& mac1,
+        const std::shared_ptr<const std::string>& mac2,
+        const std::shared_ptr<const std::string>& mac3) {
+
+    if (segment_first_time == 0 || (uint64_t) ts < segment_first_time)
+        segment_first_time = ts;
+
+    if ((uint64_t) ts > segment_last_time)
+        segment_last_time = ts;
+
+    if (packet)
+        segment_packets++;
+
+    if (data)
+        segment_data++;
+
+    if (segment_datasource_set.insert(datasource).second)
+        segment_pending_datasources.push_back(datasource);
+
+    for (const auto& m : {&mac1, &mac2, &mac3}) {
+        if (*m == nullptr)
+            continue;
+
+        auto dev = std::make_pair(phyname, *m);
+
+        if (segment_device_set.insert(dev).second)
+            segment_pending_devices.push_back(dev);
+    }
+}
+
+void kis_database_logfile::flush_segment_index(bool closed) {
+    if (!segment_open)
+        return;
+
+    sqlite3_stmt *stmt = NULL;
+
+    if (segment_pending_datasources.size() > 0 && 
+            sqlite3_prepare_v2(db, "INSERT INTO segment_datasources (segment, datasource) "
+                "VALUES (?, ?)", -1, &stmt, NULL) == SQLITE_OK) {
+        for (const auto& d : segment_pending_datasources) {
+            sqlite3_reset(stmt);
+            sqlite3_bind_int(stmt, 1, segment_number);
+            sqlite3_bind_text(stmt, 2, d->data(), d->length(), SQLITE_STATIC);
+            sqlite3_step(stmt);
+        }
+    }
+
+    sqlite3_finalize(stmt);
+    stmt = NULL;
+
+    if (segment_pending_devices.size() > 0 && 
+            sqlite3_prepare_v2(db, "INSERT INTO segment_devices (segment, phyname, devmac) "
+                "VALUES (?, ?, ?)", -1, &stmt, NULL) == SQLITE_OK) {
+        for (const auto& d : segment_pending_devices) {
+            sqlite3_reset(stmt);
+            sqlite3_bind_int(stmt, 1, segment_number);
+            sqlite3_bind_text(stmt, 2, d.first->data(), d.first->length(), SQLITE_STATIC);
+            sqlite3_bind_text(stmt, 3, d.second->data(), d.second->length(), SQLITE_STATIC);
+            sqlite3_step(stmt);
+        }
+    }
+
+    sqlite3_finalize(stmt);
+    stmt = NULL;
+
+    segment_pending_datasources.clear();
+    segment_pending_devices.clear();
+
+    if (sqlite3_prepare_v2(db, "UPDATE segments SET first_time = ?, last_time = ?, packets = ?, "
+                "data = ?, closed = ? WHERE segment = ?", -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_int64(stmt, 1, segment_first_time);
+        sqlite3_bind_int64(stmt, 2, segment_last_time);
+        sqlite3_bind_int64(stmt, 3, segment_packets);
+        sqlite3_bind_int64(stmt, 4, segment_data);
+        sqlite3_bind_int(stmt, 5, closed);
+        sqlite3_bind_int(stmt, 6, segment_number);
+        sqlite3_step(stmt);
+    }
+
+    sqlite3_finalize(stmt);
+}
+
+void kis_database_logfile::summarize_row(time_t ts, bool packet, bool data, bool has_loc,
+        const std::shared_ptr<const std::string>& datasource) {
+
+    auto& s = summary_pending[datasource];
+
+    if (s.first_time == 0 || (uint64_t) ts < s.first_time)
+        s.first_time = ts;
+
+    if ((uint64_t) ts > s.last_time)
+        s.last_time = ts;
+
+    if (packet) {
+        s.packets++;
+        if (has_loc)
+            s.packets_with_loc++;
+    }
+
+    if (data) {
+        s.data++;
+        if (has_loc)
+            s.data_with_loc++;
+    }
+}
+
+void kis_database_logfile::flush_summary() {
+    if (summary_pending.size() == 0)
+        return;
+
+    // Rows are written to the open segment when there is one, and the pending counts
+    // are always flushed before a segment is closed
+    auto schema = segment_open ? std::string("seg.") : std::string("");
+
+    sqlite3_stmt *insert_stmt = NULL;
+    sqlite3_stmt *update_stmt = NULL;
+
+    auto insert_sql = fmt::format("INSERT INTO {}summary_datasources (datasource, packets, "
+            "packets_with_loc, data, data_with_loc, first_time, last_time) "
+            "VALUES (?, 0, 0, 0, 0, ?, ?)", schema);
+    auto update_sql = fmt::format("UPDATE {}summary_datasources SET packets = packets + ?, "
+            "packets_with_loc = packets_with_loc + ?, data = data + ?, "
+            "data_with_loc = data_with_loc + ?, first_time = min(first_time, ?), "
+            "last_time = max(last_time, ?) WHERE datasource = ?", schema);
+
+    if (sqlite3_prepare_v2(db, insert_sql.c_str(), -1, &insert_stmt, NULL) == SQLITE_OK &&
+            sqlite3_prepare_v2(db, update_sql.c_str(), -1, &update_stmt, NULL) == SQLITE_OK) {
+        for (const auto& p : summary_pending) {
+            const auto& d = p.first;
+            const auto& s = p.second;
+
+            sqlite3_reset(insert_stmt);
+            sqlite3_bind_text(insert_stmt, 1, d->data(), d->length(), SQLITE_STATIC);
+            sqlite3_bind_int64(insert_stmt, 2, s.first_time);
+            sqlite3_bind_int64(insert_stmt, 3, s.last_time);
+            sqlite3_step(insert_stmt);
+
+            sqlite3_reset(update_stmt);
+            sqlite3_bind_int64(update_stmt, 1, s.packets);
+            sqlite3_bind_int64(update_stmt, 2, s.packets_with_loc);
+            sqlite3_bind_int64(update_stmt, 3, s.data);
+            sqlite3_bind_int64(update_stmt, 4, s.data_with_loc);
+            sqlite3_bind_int64(update_stmt, 5, s.first_time);
+            sqlite3_bind_int64(update_stmt, 6, s.last_time);
+            sqlite3_bind_text(update_stmt, 7, d->data(), d->length(), SQLITE_STATIC);
+            sqlite3_step(update_stmt);
+        }
+    }
+
+    sqlite3_finalize(insert_stmt);
+    sqlite3_finalize(update_stmt);
+
+    summary_pending.clear();
+}
+
+bool kis_database_logfile::expire_segments(time_t cutoff) {
+    local_demand_locker dblock(&ds_mutex);
+    db_lock_with_sync_check(dblock, return false);
+
+    if (!db_enabled || !segments_enabled)
+        return false;
+
+    std::vector<kismetdb_segments::segment> segments;
+
+    try {
+        segments = kismetdb_segments::load_manifest(db, ds_dbfile);
+    } catch (const std::runtime_error& e) {
+        _MSG_ERROR("Unable to expire kismetdb log segments: {}", e.what());
+        return segment_open;
+    }
+
+    for (const auto& s : segments) {
+        if (!s.closed || (time_t) s.last_time >= cutoff)
+            continue;
+
+        for (auto t : {"segments", "segment_datasources", "segment_devices"}) 
+            sqlite3_exec(db, fmt::format("DELETE FROM {} WHERE segment = {}", t, s.number).c_str(),
+                    NULL, NULL, NULL);
+
+        // Open readers keep their copy of the segment until they finish
+        for (auto suffix : {"", "-wal", "-shm", "-journal"})
+            unlink((s.path + suffix).c_str());
+    }
+
+    return segment_open;
+}
+
+std::vector<std::shared_ptr<sqlite3>> 
+    kis_database_logfile::open_segment_read_connections(std::shared_ptr<sqlite3> rdb,
+            const kismetdb_segments::segment_filter& filter) {
+
+    std::vector<std::shared_ptr<sqlite3>> ret;
+
+    ret.push_back(rdb);
+
+    if (!segments_enabled)
+        return ret;
+
+    try {
+        for (const auto& s : kismetdb_segments::load_manifest(rdb.get(), ds_dbfile, filter)) {
+            auto sdb = kismetdb_segments::open_segment(s.path);
+
+            // The segment may have been expired since the manifest was read
+            if (sdb == nullptr)
+                continue;
+
+            if (mmap_size != 0)
+                sqlite3_exec(sdb.get(), fmt::format("PRAGMA mmap_size={}", mmap_size).c_str(), 
+                        NULL, NULL, NULL);
+
+            ret.push_back(sdb);
+        }
+    } catch (const std::runtime_error& e) {
+        _MSG_ERROR("Unable to read kismetdb log segments: {}", e.what());
+    }
+
+    return ret;
+}
+
+void kis_database_logfile::index_live_packets() {
+    if (!packet_index_enabled)
+        return;
+
+    local_demand_locker dblock(&ds_mutex);
+    db_lock_with_sync_check(dblock, return);
+
+    if (!db_enabled || packet_index_live)
+        return;
+
+    packet_index_live = true;
+
+    // The indexes are part of the open transaction, so readers see them after the next
+    // commit
+    _MSG_INFO("Indexing packets in the kismetdb log for exports");
+
+    create_packet_indexes(db, "");
+
+    if (segment_open)
+        create_packet_indexes(db, "seg.");
+}
+
+void kis_database_logfile::process_message(std::string in_msg, int in_flags) {
+    if (!db_enabled)
+        return;
+
+    local_demand_locker dblock(&ds_mutex);
+    db_lock_with_sync_check(dblock, return);
+
+    sqlite3_reset(msg_stmt);
+
+    unsigned int spos = 1;
+
+    sqlite3_bind_int64(msg_stmt, spos++, time(0));
+
+    if (gpstracker != nullptr) {
+        auto loc = std::shared_ptr<kis_gps_packinfo>(gpstracker->get_best_location());
+
+        if (loc != nullptr && loc->fix >= 2) {
+            sqlite3_bind_double(msg_stmt, spos++, loc->lat);
+            sqlite3_bind_double(msg_stmt, spos++, loc->lon);
+        } else {
+            sqlite3_bind_double(msg_stmt, spos++, 0);
+            sqlite3_bind_double(msg_stmt, spos++, 0);
+        }
+    } else {
+        sqlite3_bind_double(msg_stmt, spos++, 0);
+        sqlite3_bind_double(msg_stmt, spos++, 0);
+    }
+
+    std::string msgtype;
+
+    if (in_flags & MSGFLAG_INFO)
+        msgtype = "INFO";
+    else if (in_flags & MSGFLAG_ERROR)
+        msgtype = "ERROR";
+    else if (in_flags & MSGFLAG_DEBUG)
+        msgtype = "DEBUG";
+    else if (in_flags & MSGFLAG_FATAL)
+        msgtype = "FATAL";
+
+    sqlite3_bind_text(msg_stmt, spos++, msgtype.c_str(), msgtype.length(), SQLITE_TRANSIENT);
+    sqlite3_bind_text(msg_stmt, spos++, in_msg.c_str(), in_msg.length(), SQLITE_TRANSIENT);
+
+    if (sqlite3_step(msg_stmt) != SQLITE_DONE) {
+        close_log();
+        _MSG_ERROR("Unable to insert message into {}: {}", ds_dbfile, sqlite3_errmsg(db));
+    }
+}
+
+int kis_database_logfile::log_device(std::shared_ptr<kis_tracked_device_base> d) {
+    // We avoid using external mutexes here and try to let sqlite3 handle its own
+    // internal locking state; we don't want a huge device list write to block packet
+    // writes for instance
+    
+    if (!db_enabled)
+        return 0;
+
+    std::string sql;
+
+    std::string phystring;
+    std::string macstring;
+    std::string typestring;
+    std::string keystring;
+
+    if (d == nullptr)
+        return 0;
+
+    if (device_mac_filter->filter(d->get_macaddr(), d->get_phyid()))
+        return 0;
+
+    phystring = d->get_phyname();
+    macstring = d->get_macaddr().mac_to_string();
+    typestring = d->get_type_string();
+    keystring = d->get_key().as_string();
+
+    int spos = 1;
+
+    std::stringstream sstr;
+
+    // serialize the device
+    int r = Globalreg::globalreg->entrytracker->serialize(device_serializer, sstr, d, nullptr);
+   
+    if (r < 0) {
+        _MSG_ERROR("Failure serializing device key {} to the kisdatabaselog", d->get_key());
+        return 0;
+    }
+
+
+    std::string streamstring = sstr.str();
+    std::string compressed;
+
+    {
+        local_demand_locker dblock(&ds_mutex);
+        db_lock_with_sync_check(dblock, return -1);
+
+        sqlite3_reset(device_stmt);
+
+        sqlite3_bind_int64(device_stmt, spos++, d->get_first_time());
+        sqlite3_bind_int64(device_stmt, spos++, d->get_last_time());
+        sqlite3_bind_text(device_stmt, spos++, keystring.c_str(), 
+                keystring.length(), SQLITE_TRANSIENT);
+        sqlite3_bind_text(device_stmt, spos++, phystring.c_str(), 
+                phystring.length(), SQLITE_TRANSIENT);
+        sqlite3_bind_text(device_stmt, spos++, macstring.c_str(), 
+                macstring.length(), SQLITE_TRANSIENT);
+        sqlite3_bind_int(device_stmt, spos++, d->get_signal_data()->get_max_signal());
+
+        if (d->get_tracker_location() != NULL) {
+            sqlite3_bind_double(device_stmt, spos++, 
+                    d->get_location()->get_min_loc()->get_lat());
+            sqlite3_bind_double(device_stmt, spos++,
+                    d->get_location()->get_min_loc()->get_lon());
+            sqlite3_bind_double(device_stmt, spos++,
+                    d->get_location()->get_max_loc()->get_lat());
+            sqlite3_bind_double(device_stmt, spos++,
+                    d->get_location()->get_max_loc()->get_lon());
+            sqlite3_bind_double(device_stmt, spos++,
+                    d->get_location()->get_avg_loc()->get_lat());
+            sqlite3_bind_double(device_stmt, spos++,
+                    d->get_location()->get_avg_loc()->get_lon());
+        } else {
+            // Empty location
+            sqlite3_bind_double(device_stmt, spos++, 0);
+            sqlite3_bind_double(device_stmt, spos++, 0);
+            sqlite3_bind_double(device_stmt, spos++, 0);
+            sqlite3_bind_double(device_stmt, spos++, 0);
+            sqlite3_bind_double(device_stmt, spos++, 0);
+            sqlite3_bind_double(device_stmt, spos++, 0);
+        }
+
+        sqlite3_bind_int64(device_stmt, spos++, d->get_datasize());
+        sqlite3_bind_text(device_stmt, spos++, typestring.c_str(), 
+                typestring.length(), SQLITE_TRANSIENT);
+
+        bind_json_record(device_stmt, spos++, streamstring, compressed, false);
+
+        if (sqlite3_step(device_stmt) != SQLITE_DONE) {
+            _MSG("kis_database_logfile unable to insert device in " +
+                    ds_dbfile + ":" + std::string(sqlite3_errmsg(db)), MSGFLAG_ERROR);
+            close_log();
+            return -1;
+        }
+    }
+
+    // Report what we stored
+    if (compressed.length() > 0)
+        return std::max<int>(1, compressed.length());
+
+    return std::max<int>(1, streamstring.length());
+}
+
+void kis_database_logfile::log_device_pass(size_t num_devices, size_t num_bytes) {
+    devices_logged_rrd->add_sample(num_devices, time(0));
+    device_bytes_rrd->add_sample(num_bytes, time(0));
+}
+
+std::shared_ptr<const std::string> kis_database_logfile::cached_mac_string(const mac_addr& mac) {
+    auto mi = mac_string_cache.find(mac);
+
+    if (mi != mac_string_cache.end())
+        return mi->second;
+
+    // Bound the cache; it's cheap to rebuild
+    if (mac_string_cache.size() > 65536)
+        mac_string_cache.clear();
+
+    auto ms = std::make_shared<const std::string>(mac.mac_to_string());
+    mac_string_cache.emplace(mac, ms);
+
+    return ms;
+}
+
+std::shared_ptr<const std::string> kis_database_logfile::cached_uuid_string(const uuid& in_uuid) {
+    auto ui = uuid_string_cache.find(in_uuid);
+
+    if (ui != uuid_string_cache.end())
+        return ui->second;
+
+    if (uuid_string_cache.size() > 1024)
+        uuid_string_cache.clear();
+
+    auto us = std::make_shared<const std::string>(in_uuid.uuid_to_string());
+    uuid_string_cache.emplace(in_uuid, us);
+
+    return us;
+}
+
+std::shared_ptr<const std::string> kis_database_logfile::cached_phy_string(int phyid) {
+    static const auto unknown_phy = std::make_shared<const std::string>("Unknown");
+
+    auto pi = phy_string_cache.find(phyid);
+
+    if (pi != phy_string_cache.end())
+        return pi->second;
+
+    auto phyh = devicetracker->fetch_phy_handler(phyid);
+
+    if (phyh == nullptr)
+        return unknown_phy;
+
+    auto ps = std::make_shared<const std::string>(phyh->fetch_phy_name());
+    phy_string_cache.emplace(phyid, ps);
+
+    return ps;
+}
+
+std::unique_ptr<kis_database_logfile::db_packet_row>
+    kis_database_logfile::render_packet_row(kis_packet *in_pack) {
+
+    static const auto unknown_phy = std::make_shared<const std::string>("Unknown");
+    static const auto empty_mac = std::make_shared<const std::string>("00:00:00:00:00:00");
+    static const auto empty_uuid = 
+        std::make_shared<const std::string>("00000000-0000-0000-0000-000000000000");
+
+    kis_datachunk *chunk = 
+        (kis_datachunk *) in_pack->fetch(pack_comp_linkframe);
+
+    kis_layer1_packinfo *radioinfo = 
+        (kis_layer1_packinfo *) in_pack->fetch(pack_comp_radiodata);
+
+    kis_gps_packinfo *gpsdata =
+        (kis_gps_packinfo *) in_pack->fetch(pack_comp_gps);
+
+    kis_common_info *commoninfo =
+        (kis_common_info *) in_pack->fetch(pack_comp_common);
+
+    packetchain_comp_datasource *datasrc =
+        (packetchain_comp_datasource *) in_pack->fetch(pack_comp_datasource);
+
+    packet_metablob *metablob =
+        (packet_metablob *) in_pack->fetch(pack_comp_metablob);
+
+    // Only packets with a link frame or a metablob get logged
+    if (chunk == nullptr && metablob == nullptr)
+        return nullptr;
+
+    std::unique_ptr<db_packet_row> row(new db_packet_row());
+
+    row->ts = in_pack->ts;
+
+    if (commoninfo != nullptr) {
+        row->phyname = cached_phy_string(commoninfo->phyid);
+        row->sourcemac = cached_mac_string(commoninfo->source);
+        row->destmac = cached_mac_string(commoninfo->dest);
+        row->transmac = cached_mac_string(commoninfo->transmitter);
+        row->frequency = commoninfo->freq_khz;
+    } else {
+        row->phyname = unknown_phy;
+        row->sourcemac = empty_mac;
+        row->destmac = empty_mac;
+        row->transmac = empty_mac;
+        row->frequency = 0;
+    }
+
+    if (datasrc != nullptr) 
+        row->datasource = cached_uuid_string(datasrc->ref_source->get_source_uuid());
+    else
+        row->datasource = empty_uuid;
+
+    if (gpsdata != nullptr) {
+        row->has_gps = true;
+        row->lat = gpsdata->lat;
+        row->lon = gpsdata->lon;
+        row->alt = gpsdata->alt;
+        row->speed = gpsdata->speed;
+        row->heading = gpsdata->heading;
+    } else {
+        row->has_gps = false;
+        row->lat = row->lon = row->alt = row->speed = row->heading = 0;
+    }
+
+    // Log into the PACKET table if we're a loggable packet (ie, have a link frame)
+    row->has_packet = chunk != nullptr;
+
+    if (chunk != nullptr) {
+        if (radioinfo != nullptr)
+            row->signal = radioinfo->signal_dbm;
+        else
+            row->signal = 0;
+
+        row->dlt = chunk->dlt;
+        row->packet.assign((const char *) chunk->data, chunk->length);
+        row->packet_len = chunk->frame_length();
+        row->error = in_pack->error;
+
+        for (const auto& tag : in_pack->tag_vec) {
+            if (row->tags.length() > 0)
+                row->tags.append(" ");
+            row->tags.append(tag);
+        }
+    }
+
+    // If the packet has a metablob record, log that; if the packet ONLY has meta data we should only get a 'data'
+    // record; if the packet has both, we'll get both a 'packet' and a 'data' record.
+    row->has_data = metablob != nullptr;
+
+    if (metablob != nullptr) {
+        row->data_type = metablob->meta_type;
+        row->data_json = metablob->meta_data;
+    }
+
+    return row;
+}
+
+bool kis_database_logfile::write_packet_row(const db_packet_row& row) {
+    // The row outlives the statement step, so the strings can be bound without copying
+    if (row.has_packet) {
+        sqlite3_reset(packet_stmt);
+
+        int sql_pos = 1;
+
+        sqlite3_bind_int64(packet_stmt, sql_pos++, row.ts.tv_sec);
+        sqlite3_bind_int64(packet_stmt, sql_pos++, row.ts.tv_usec);
+
+        sqlite3_bind_text(packet_stmt, sql_pos++, row.phyname->data(), row.phyname->length(), SQLITE_STATIC);
+        sqlite3_bind_text(packet_stmt, sql_pos++, row.sourcemac->data(), row.sourcemac->length(), SQLITE_STATIC);
+        sqlite3_bind_text(packet_stmt, sql_pos++, row.destmac->data(), row.destmac->length(), SQLITE_STATIC);
+        sqlite3_bind_text(packet_stmt, sql_pos++, row.transmac->data(), row.transmac->length(), SQLITE_STATIC);
+        // Packets are no longer a 1:1 with a device
+        sqlite3_bind_text(packet_stmt, sql_pos++, "0", 1, SQLITE_STATIC);
+        sqlite3_bind_double(packet_stmt, sql_pos++, row.frequency);
+
+        sqlite3_bind_double(packet_stmt, sql_pos++, row.lat);
+        sqlite3_bind_double(packet_stmt, sql_pos++, row.lon);
+        sqlite3_bind_double(packet_stmt, sql_pos++, row.alt);
+        sqlite3_bind_double(packet_stmt, sql_pos++, row.speed);
+        sqlite3_bind_double(packet_stmt, sql_pos++, row.heading);
+
+        sqlite3_bind_int64(packet_stmt, sql_pos++, row.packet_len);
+        sqlite3_bind_int(packet_stmt, sql_pos++, row.signal);
+
+        sqlite3_bind_text(packet_stmt, sql_pos++, row.datasource->data(), row.datasource->length(), SQLITE_STATIC);
+
+        sqlite3_bind_int(packet_stmt, sql_pos++, row.dlt);
+        sqlite3_bind_blob(packet_stmt, sql_pos++, row.packet.data(), row.packet.length(), SQLITE_STATIC);
+
+        sqlite3_bind_int(packet_stmt, sql_pos++, row.error);
+
+        sqlite3_bind_text(packet_stmt, sql_pos++, row.tags.data(), row.tags.length(), SQLITE_STATIC);
+
+        if (sqlite3_step(packet_stmt) != SQLITE_DONE) {
+            _MSG("kis_database_logfile unable to insert packet in " +
+                    ds_dbfile + ":" + std::string(sqlite3_errmsg(db)), MSGFLAG_ERROR);
+            return false;
+        }
+    }
+
+    if (row.has_data) {
+        sqlite3_reset(data_stmt);
+
+        int sql_pos = 1;
+
+        sqlite3_bind_int64(data_stmt, sql_pos++, row.ts.tv_sec);
+        sqlite3_bind_int64(data_stmt, sql_pos++, row.ts.tv_usec);
+
+        sqlite3_bind_text(data_stmt, sql_pos++, row.phyname->data(), row.phyname->length(), SQLITE_STATIC);
+        sqlite3_bind_text(data_stmt, sql_pos++, row.sourcemac->data(), row.sourcemac->length(), SQLITE_STATIC);
+
+        sqlite3_bind_double(data_stmt, sql_pos++, row.lat);
+        sqlite3_bind_double(data_stmt, sql_pos++, row.lon);
+        sqlite3_bind_double(data_stmt, sql_pos++, row.alt);
+        sqlite3_bind_double(data_stmt, sql_pos++, row.speed);
+        sqlite3_bind_double(data_stmt, sql_pos++, row.heading);
+
+        sqlite3_bind_text(data_stmt, sql_pos++, row.datasource->data(), row.datasource->length(), SQLITE_STATIC);
+
+        sqlite3_bind_text(data_stmt, sql_pos++, row.data_type.data(), row.data_type.length(), SQLITE_STATIC);
+        std::string compressed;
+        bind_json_record(data_stmt, sql_pos++, row.data_json, compressed, true);
+
+        if (sqlite3_step(data_stmt) != SQLITE_DONE) {
+            _MSG("kis_database_logfile unable to insert data in " +
+                    ds_dbfile + ":" + std::string(sqlite3_errmsg(db)), MSGFLAG_ERROR);
+            return false;
+        }
+    }
+
+    summarize_row(row.ts.tv_sec, row.has_packet, row.has_data, row.lat != 0 && row.lon != 0,
+            row.datasource);
+
+    if (segment_open) {
+        if (row.has_packet)
+            index_segment_row(row.ts.tv_sec, true, row.has_data, row.datasource, row.phyname,
+                    row.sourcemac, row.destmac, row.transmac);
+        else
+            index_segment_row(row.ts.tv_sec, false, row.has_data, row.datasource, row.phyname,
+                    row.sourcemac, nullptr, nullptr);
+    }
+
+    return true;
+}
+
+int kis_database_logfile::log_packet(kis_packet *in_pack) {
+    if (!db_enabled) {
+        return 0;
+    }
+
+    if (packet_mac_filter->filter_packet(in_pack)) {
+        return 0;
+    }
+
+    auto row = render_packet_row(in_pack);
+
+    if (row == nullptr)
+        return 1;
+
+    if (packet_writer_enabled) {
+        std::unique_lock<std::mutex> lock(packet_writer_mutex);
+
+        if (packet_writer_shutdown)
+            return 0;
+
+        if (packet_writer_queue.size() >= packet_queue_max) {
+            lock.unlock();
+
+            dropped_rows_rrd->add_sample(1, time(0));
+
+            if (time(0) - last_packet_drop_warning > 30) {
+                last_packet_drop_warning = time(0);
+                _MSG_ERROR("The kismetdb log is not keeping up with the packet rate and has started "
+                        "dropping packets from the log; the write queue has a backlog of {} packets.  "
+                        "Usually this happens when the disk you are logging to can not perform "
+                        "adequately.  You can change the queue size with 'kis_log_packet_queue' "
+                        "in kismet_logging.conf.", packet_queue_max);
+            }
+
+            return 0;
+        }
+
+        packet_writer_queue.push_back(std::move(row));
+        auto queue_sz = packet_writer_queue.size();
+
+        lock.unlock();
+
+        packet_queue_rrd->add_sample(queue_sz, time(0));
+
+        // The writer drains the whole queue each time it wakes up, so it only needs to be
+        // woken when the queue was empty
+        if (queue_sz == 1)
+            packet_writer_cv.notify_one();
+
+        return 1;
+    }
+
+    local_demand_locker dblock(&ds_mutex);
+    db_lock_with_sync_check(dblock, return -1);
+
+    if (!write_packet_row(*row)) {
+        close_log();
+        return -1;
+    }
+
+    return 1;
+}
+
+void kis_database_logfile::start_packet_writer() {
+    // Reap the writer of a previous log
+    join_packet_writer();
+
+    {
+        std::lock_guard<std::mutex> lock(packet_writer_mutex);
+        packet_writer_shutdown = false;
+    }
+
+    packet_writer_th = std::thread([this]() {
+        thread_set_process_name("kismetdb");
+        packet_writer();
+    });
+}
+
+void kis_database_logfile::stop_packet_writer() {
+    {
+        std::lock_guard<std::mutex> lock(packet_writer_mutex);
+        packet_writer_shutdown = true;
+    }
+
+    packet_writer_cv.notify_all();
+}
+
+void kis_database_logfile::flush_packet_writer() {
+    std::deque<std::unique_ptr<db_packet_row>> batch;
+
+    {
+        std::lock_guard<std::mutex> lock(packet_writer_mutex);
+        batch.swap(packet_writer_queue);
+    }
+
+    if (!db_enabled)
+        return;
+
+    for (const auto& r : batch) {
+        if (!write_packet_row(*r))
+            break;
+    }
+}
+
+void kis_database_logfile::join_packet_writer() {
+    if (packet_writer_th.joinable())
+        packet_writer_th.join();
 
-    if (device_mac_filter->filter(d->get_macaddr(), d->get_phyid()))
-        return 0;
+    std::lock_guard<std::mutex> lock(packet_writer_mutex);
+    packet_writer_queue.clear();
+}
 
-    phystring = d->get_phyname();
-    macstring = d->get_macaddr().mac_to_string();
-    typestring = d->get_type_string();
-    keystring = d->get_key().as_string();
+void kis_database_logfile::packet_writer() {
+    std::deque<std::unique_ptr<db_packet_row>> batch;
+    size_t uncommitted = 0;
+    auto last_commit = std::chrono::steady_clock::now();
 
-    int spos = 1;
+    // Commit the open transaction and start a new one; caller holds the database lock
+    auto commit = [&]() {
+        auto commit_start = std::chrono::steady_clock::now();
 
-    std::stringstream sstr;
+        in_transaction_sync = true;
 
-    // serialize the device
-    int r = Globalreg::globalreg->entrytracker->serialize("json", sstr, d, nullptr);
-   
-    if (r < 0) {
-        _MSG_ERROR("Failure serializing device key {} to the kisdatabaselog", d->get_key());
-        return 0;
-    }
+        if (segment_rotation_due()) {
+            rotate_segment();
+        } else {
+            flush_summary();
+            flush_segment_index(false);
+            sqlite3_exec(db, "END TRANSACTION", NULL, NULL, NULL);
+            sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL);
+        }
 
+        in_transaction_sync = false;
 
-    std::string streamstring = sstr.str();
+        last_commit = std::chrono::steady_clock::now();
+        uncommitted = 0;
+
+        commit_latency_rrd->add_sample(std::chrono::duration_cast<std::chrono::milliseconds>(last_commit - 
+                    commit_start).count(), time(0));
+    };
+
+    while (true) {
+        bool shutdown;
+        bool pending;
+
+        {
+            std::unique_lock<std::mutex> lock(packet_writer_mutex);
+
+            packet_writer_cv.wait_until(lock, last_commit + commit_interval, [this]() {
+                    return packet_writer_queue.size() > 0 || packet_writer_shutdown;
+                    });
+
+            pending = packet_writer_queue.size() > 0;
+            shutdown = packet_writer_shutdown;
+        }
+
+        // The rows written by closing the log, and the final commit, are handled by
+        // closing the log
+        if (shutdown)
+            break;
+
+        // Other logs write into the same transaction, so commit on the interval even when
+        // no packets have been queued. 
+        bool commit_due = 
+            std::chrono::steady_clock::now() >= last_commit + commit_interval;
+
+        if (!pending && !commit_due)
+            continue;
 
-    {
         local_demand_locker dblock(&ds_mutex);
-        db_lock_with_sync_check(dblock, return -1);
 
-        sqlite3_reset(device_stmt);
+        // Rows stay queued until we hold the database, so that closing the log can
+        // write them itself instead of waiting on us
+        try {
+            dblock.lock();
+        } catch (const std::runtime_error& e) {
+            _MSG_ERROR("The kismetdb log writer could not lock the database within the timeout "
+                    "window for threads ({} seconds).", KIS_THREAD_DEADLOCK_TIMEOUT);
+            continue;
+        }
 
-        sqlite3_bind_int64(device_stmt, spos++, d->get_first_time());
-        sqlite3_bind_int64(device_stmt, spos++, d->get_last_time());
-        sqlite3_bind_text(device_stmt, spos++, keystring.c_str(), 
-                keystring.length(), SQLITE_TRANSIENT);
-        sqlite3_bind_text(device_stmt, spos++, phystring.c_str(), 
-                phystring.length(), SQLITE_TRANSIENT);
-        sqlite3_bind_text(device_stmt, spos++, macstring.c_str(), 
-                macstring.length(), SQLITE_TRANSIENT);
-        sqlite3_bind_int(device_stmt, spos++, d->get_signal_data()->get_max_signal());
+        if (!db_enabled)
+            break;
 
-        if (d->get_tracker_location() != NULL) {
-            sqlite3_bind_double(device_stmt, spos++, 
-                    d->get_location()->get_min_loc()->get_lat());
-            sqlite3_bind_double(device_stmt, spos++,
-                    d->get_location()->get_min_loc()->get_lon());
-            sqlite3_bind_double(device_stmt, spos++,
-                    d->get_location()->get_max_loc()->get_lat());
-            sqlite3_bind_double(device_stmt, spos++,
-                    d->get_location()->get_max_loc()->get_lon());
-            sqlite3_bind_double(device_stmt, spos++,
-                    d->get_location()->get_avg_loc()->get_lat());
-            sqlite3_bind_double(device_stmt, spos++,
-                    d->get_location()->get_avg_loc()->get_lon());
-        } else {
-            // Empty location
-            sqlite3_bind_double(device_stmt, spos++, 0);
-            sqlite3_bind_double(device_stmt, spos++, 0);
-            sqlite3_bind_double(device_stmt, spos++, 0);
-            sqlite3_bind_double(device_stmt, spos++, 0);
-            sqlite3_bind_double(device_stmt, spos++, 0);
-            sqlite3_bind_double(device_stmt, spos++, 0);
+        {
+            std::lock_guard<std::mutex> lock(packet_writer_mutex);
+            batch.swap(packet_writer_queue);
         }
 
-        sqlite3_bind_int64(device_stmt, spos++, d->get_datasize());
-        sqlite3_bind_text(device_stmt, spos++, typestring.c_str(), 
-                typestring.length(), SQLITE_TRANSIENT);
+        for (const auto& r : batch) {
+            if (!write_packet_row(*r)) {
+                // Stop logging packets; the log is closed normally at shutdown
+                db_enabled = false;
+                break;
+            }
+
+            if (++uncommitted >= commit_rows)
+                commit();
+        }
 
-        sqlite3_bind_blob(device_stmt, spos++, streamstring.c_str(), 
-                streamstring.length(), SQLITE_TRANSIENT);
+        batch.clear();
 
-        if (sqlite3_step(device_stmt) != SQLITE_DONE) {
-            _MSG("kis_database_logfile unable to insert device in " +
-                    ds_dbfile + ":" + std::string(sqlite3_errmsg(db)), MSGFLAG_ERROR);
-            close_log();
-            return -1;
+        if (!db_enabled)
+            break;
+
+        if (commit_due)
+            commit();
+    }
+}
+
+bool kis_database_logfile::database_init_connection() {
+    // The page size can only be changed before the database has any content
+    if (page_size != 0)
+        sqlite3_exec(db, fmt::format("PRAGMA page_size={}", page_size).c_str(), NULL, NULL, NULL);
+
+    if (mmap_size != 0)
+        sqlite3_exec(db, fmt::format("PRAGMA mmap_size={}", mmap_size).c_str(), NULL, NULL, NULL);
+
+    // A truncating checkpoint can briefly hold the write lock
+    if (wal_enabled || segments_enabled)
+        sqlite3_busy_timeout(db, 5000);
+
+    return true;
+}
+
+std::shared_ptr<sqlite3> kis_database_logfile::open_read_connection() {
+    if (wal_enabled) {
+        sqlite3 *rdb = nullptr;
+
+        if (sqlite3_open_v2(ds_dbfile.c_str(), &rdb, SQLITE_OPEN_READONLY, NULL) == SQLITE_OK) {
+            sqlite3_busy_timeout(rdb, 1000);
+
+            if (mmap_size != 0)
+                sqlite3_exec(rdb, fmt::format("PRAGMA mmap_size={}", mmap_size).c_str(), 
+                        NULL, NULL, NULL);
+
+            // close_v2 defers the close until any outstanding statements are finalized
+            return std::shared_ptr<sqlite3>(rdb, [](sqlite3 *d) { sqlite3_close_v2(d); });
         }
+
+        _MSG_ERROR("Unable to open a read-only connection to the kismetdb log {}: {}",
+                ds_dbfile, sqlite3_errmsg(rdb));
+        sqlite3_close_v2(rdb);
     }
 
-    return 1;
+    return std::shared_ptr<sqlite3>(db, [](sqlite3 *) { });
 }
 
-int kis_database_logfile::log_packet(kis_packet *in_pack) {
-    if (!db_enabled) {
-        return 0;
+void kis_database_logfile::start_checkpointer() {
+    {
+        std::lock_guard<std::mutex> lock(checkpoint_mutex);
+        checkpoint_shutdown = false;
     }
 
-    std::string phystring;
-    std::string macstring;
-    std::string deststring;
-    std::string transstring;
-    std::string keystring;
-    std::string sourceuuidstring;
-    double frequency;
+    checkpoint_th = std::thread([this]() {
+        thread_set_process_name("kismetdb-ckpt");
+        checkpointer();
+    });
+}
 
-    if (packet_mac_filter->filter_packet(in_pack)) {
-        return 0;
+void kis_database_logfile::stop_checkpointer() {
+    {
+        std::lock_guard<std::mutex> lock(checkpoint_mutex);
+        checkpoint_shutdown = true;
     }
 
-    kis_datachunk *chunk = 
-        (kis_datachunk *) in_pack->fetch(pack_comp_linkframe);
+    checkpoint_cv.notify_all();
 
-    kis_layer1_packinfo *radioinfo = 
-        (kis_layer1_packinfo *) in_pack->fetch(pack_comp_radiodata);
+    if (checkpoint_th.joinable())
+        checkpoint_th.join();
+}
 
-    kis_gps_packinfo *gpsdata =
-        (kis_gps_packinfo *) in_pack->fetch(pack_comp_gps);
+void kis_database_logfile::checkpointer() {
+    sqlite3 *cdb = nullptr;
 
-    kis_common_info *commoninfo =
-        (kis_common_info *) in_pack->fetch(pack_comp_common);
+    if (sqlite3_open_v2(ds_dbfile.c_str(), &cdb, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK) {
+        _MSG_ERROR("Unable to open the kismetdb checkpoint connection to {}: {}; the log "
+                "will only be checkpointed when it is closed.", ds_dbfile, sqlite3_errmsg(cdb));
+        sqlite3_close_v2(cdb);
+        return;
+    }
 
-    packetchain_comp_datasource *datasrc =
-        (packetchain_comp_datasource *) in_pack->fetch(pack_comp_datasource);
+    // Keep the busy wait short; a truncating checkpoint holds off the writer while it
+    // waits for readers to finish
+    sqlite3_busy_timeout(cdb, 100);
 
-    packet_metablob *metablob =
-        (packet_metablob *) in_pack->fetch(pack_comp_metablob);
+    uint64_t db_page_size = 4096;
 
-    kis_phy_handler *phyh = NULL;
+    sqlite3_exec(cdb, "PRAGMA page_size",
+            [] (void *aux, int argc, char **argv, char **) -> int {
+                if (argc > 0 && argv[0] != nullptr)
+                    *((uint64_t *) aux) = string_to_n_dfl<uint64_t>(argv[0], 4096);
+                return 0;
+            }, (void *) &db_page_size, NULL);
 
-    // Packets are no longer a 1:1 with a device
-    keystring = "0";
+    bool warned = false;
 
-    if (commoninfo != NULL) {
-        phyh = devicetracker->fetch_phy_handler(commoninfo->phyid);
-        macstring = commoninfo->source.mac_to_string();
-        deststring = commoninfo->dest.mac_to_string();
-        transstring = commoninfo->transmitter.mac_to_string();
-        frequency = commoninfo->freq_khz;
-    } else {
-        macstring = "00:00:00:00:00:00";
-        deststring = "00:00:00:00:00:00";
-        transstring = "00:00:00:00:00:00";
-        frequency = 0;
-    }
+    // Checkpoint a schema; a long read, such as a pcap export, keeps the WAL from being
+    // reset and lets it grow, so once it is over the limit try to checkpoint and truncate
+    // it completely
+    auto checkpoint = [&](const char *schema, int& wal_frames) {
+        int ckpt_frames = 0;
 
-    if (phyh == NULL)
-        phystring = "Unknown";
-    else
-        phystring = phyh->fetch_phy_name();
+        int r = sqlite3_wal_checkpoint_v2(cdb, schema, SQLITE_CHECKPOINT_PASSIVE, 
+                &wal_frames, &ckpt_frames);
 
+        if (r == SQLITE_OK && wal_limit != 0 && (uint64_t) wal_frames * db_page_size > wal_limit) 
+            r = sqlite3_wal_checkpoint_v2(cdb, schema, SQLITE_CHECKPOINT_TRUNCATE,
+                    &wal_frames, &ckpt_frames);
 
-    if (datasrc != NULL) {
-        sourceuuidstring = datasrc->ref_source->get_source_uuid().uuid_to_string();
-    } else {
-        sourceuuidstring = "00000000-0000-0000-0000-000000000000";
-    }
+        if (r != SQLITE_OK && r != SQLITE_BUSY && r != SQLITE_LOCKED && !warned) {
+            warned = true;
+            _MSG_ERROR("Unable to checkpoint the kismetdb log {}: {}", ds_dbfile, sqlite3_errmsg(cdb));
+        }
+    };
 
-    // Log into the PACKET table if we're a loggable packet (ie, have a link frame)
-    if (chunk != nullptr) {
-        local_demand_locker dblock(&ds_mutex);
-        db_lock_with_sync_check(dblock, return -1);
+    // The open segment, attached to the checkpoint connection
+    std::string attached_segment;
 
-        sqlite3_reset(packet_stmt);
+    std::unique_lock<std::mutex> lock(checkpoint_mutex);
 
-        int sql_pos = 1;
+    while (true) {
+        checkpoint_cv.wait_for(lock, checkpoint_interval, [this]() { return checkpoint_shutdown; });
 
-        sqlite3_bind_int64(packet_stmt, sql_pos++, in_pack->ts.tv_sec);
-        sqlite3_bind_int64(packet_stmt, sql_pos++, in_pack->ts.tv_usec);
-
-        sqlite3_bind_text(packet_stmt, sql_pos++, phystring.c_str(), phystring.length(), SQLITE_TRANSIENT);
-        sqlite3_bind_text(packet_stmt, sql_pos++, macstring.c_str(), macstring.length(), SQLITE_TRANSIENT);
-        sqlite3_bind_text(packet_stmt, sql_pos++, deststring.c_str(), deststring.length(), SQLITE_TRANSIENT);
-        sqlite3_bind_text(packet_stmt, sql_pos++, transstring.c_str(), transstring.length(), SQLITE_TRANSIENT);
-        sqlite3_bind_text(packet_stmt, sql_pos++, keystring.c_str(), keystring.length(), SQLITE_TRANSIENT);
-        sqlite3_bind_double(packet_stmt, sql_pos++, frequency);
-
-        if (gpsdata != NULL) {
-            sqlite3_bind_double(packet_stmt, sql_pos++, gpsdata->lat);
-            sqlite3_bind_double(packet_stmt, sql_pos++, gpsdata->lon);
-            sqlite3_bind_double(packet_stmt, sql_pos++, gpsdata->alt);
-            sqlite3_bind_double(packet_stmt, sql_pos++, gpsdata->speed);
-            sqlite3_bind_double(packet_stmt, sql_pos++, gpsdata->heading);
-        } else {
-            sqlite3_bind_double(packet_stmt, sql_pos++, 0);
-            sqlite3_bind_double(packet_stmt, sql_pos++, 0);
-            sqlite3_bind_double(packet_stmt, sql_pos++, 0);
-            sqlite3_bind_double(packet_stmt, sql_pos++, 0);
-            sqlite3_bind_double(packet_stmt, sql_pos++, 0);
-        }
+        if (checkpoint_shutdown)
+            break;
 
-        sqlite3_bind_int64(packet_stmt, sql_pos++, chunk->length);
+        auto target_segment = checkpoint_segment;
+        std::vector<std::string> closed_segments;
+        closed_segments.swap(checkpoint_closed_segments);
 
-        if (radioinfo != nullptr) {
-            sqlite3_bind_int(packet_stmt, sql_pos++, radioinfo->signal_dbm);
-        } else {
-            sqlite3_bind_int(packet_stmt, sql_pos++, 0);
-        }
+        lock.unlock();
+
+        if (attached_segment != target_segment) {
+            if (attached_segment.length() > 0)
+                sqlite3_exec(cdb, "DETACH DATABASE seg", NULL, NULL, NULL);
 
-        sqlite3_bind_text(packet_stmt, sql_pos++, sourceuuidstring.c_str(), 
-                sourceuuidstring.length(), SQLITE_TRANSIENT);
+            attached_segment = "";
 
-        sqlite3_bind_int(packet_stmt, sql_pos++, chunk->dlt);
-        sqlite3_bind_blob(packet_stmt, sql_pos++, (const char *) chunk->data, chunk->length, 0);
+            sqlite3_stmt *stmt = NULL;
 
-        sqlite3_bind_int(packet_stmt, sql_pos++, in_pack->error);
+            if (target_segment.length() > 0 &&
+                    sqlite3_prepare_v2(cdb, "ATTACH DATABASE ? AS seg", -1, &stmt, NULL) == SQLITE_OK) {
+                sqlite3_bind_text(stmt, 1, target_segment.data(), target_segment.length(), 
+                        SQLITE_TRANSIENT);
 
-        std::stringstream tagstream;
-        bool space_needed = false;
+                if (sqlite3_step(stmt) == SQLITE_DONE)
+                    attached_segment = target_segment;
+            }
 
-        for (auto tag : in_pack->tag_vec) {
-            if (space_needed)
-                tagstream << " ";
-            space_needed = true;
-            tagstream << tag;
+            sqlite3_finalize(stmt);
         }
 
-        auto str = tagstream.str();
-        sqlite3_bind_text(packet_stmt, sql_pos++, str.c_str(), tagstream.str().length(), SQLITE_TRANSIENT);
+        for (const auto& c : closed_segments)
+            finalize_closed_segment(c, packet_index_enabled);
 
-        if (sqlite3_step(packet_stmt) != SQLITE_DONE) {
-            _MSG("kis_database_logfile unable to insert packet in " +
-                    ds_dbfile + ":" + std::string(sqlite3_errmsg(db)), MSGFLAG_ERROR);
-            close_log();
-            return -1;
-        }
+        int wal_frames = 0, seg_wal_frames = 0;
+
+        if (wal_enabled)
+            checkpoint("main", wal_frames);
+
+        if (attached_segment.length() > 0)
+            checkpoint("seg", seg_wal_frames);
+
+        wal_size_rrd->add_sample(std::max(wal_frames, 0) + std::max(seg_wal_frames, 0), time(0));
+
+        lock.lock();
     }
 
-    // If the packet has a metablob record, log that; if the packet ONLY has meta data we should only get a 'data'
-    // record; if the packet has both, we'll get both a 'packet' and a 'data' record.
-    if (metablob != nullptr) {
-        mac_addr smac("00:00:00:00:00:00");
-        uuid puuid;
+    lock.unlock();
 
-        if (commoninfo != nullptr)
-            smac = commoninfo->source;
+    sqlite3_close_v2(cdb);
+}
 
-        if (datasrc != nullptr) 
-            puuid = datasrc->ref_source->get_source_uuid();
+void kis_database_logfile::bind_json_record(sqlite3_stmt *stmt, int pos, const std::string& json,
+        std::string& compressed, bool as_text) {
 
-        log_data(gpsdata, in_pack->ts, phystring, smac, puuid,
-                metablob->meta_type, metablob->meta_data);
+    if (compress_records) {
+        try {
+            compressed = kismetdb_blob::compress(json, compression_dict, compress_level);
+            sqlite3_bind_blob(stmt, pos, compressed.data(), compressed.length(), SQLITE_STATIC);
+            return;
+        } catch (const std::runtime_error& e) {
+            _MSG_ERROR("Unable to compress kismetdb record, storing it uncompressed: {}", e.what());
+        }
     }
 
-    return 1;
+    if (as_text)
+        sqlite3_bind_text(stmt, pos, json.data(), json.length(), SQLITE_STATIC);
+    else
+        sqlite3_bind_blob(stmt, pos, json.data(), json.length(), SQLITE_STATIC);
 }
 
 int kis_database_logfile::log_data(kis_gps_packinfo *gps, struct timeval tv, 
@@ -1178,7 +2485,8 @@ int kis_database_logfile::log_data(kis_gps_packinfo *gps, struct timeval tv,
         sqlite3_bind_text(data_stmt, sql_pos++, uuidstring.c_str(), uuidstring.length(), SQLITE_TRANSIENT);
 
         sqlite3_bind_text(data_stmt, sql_pos++, type.data(), type.length(), SQLITE_TRANSIENT);
-        sqlite3_bind_text(data_stmt, sql_pos++, json.data(), json.length(), SQLITE_TRANSIENT);
+        std::string compressed;
+        bind_json_record(data_stmt, sql_pos++, json, compressed, true);
 
         if (sqlite3_step(data_stmt) != SQLITE_DONE) {
             _MSG("kis_database_logfile unable to insert data in " +
@@ -1186,6 +2494,16 @@ int kis_database_logfile::log_data(kis_gps_packinfo *gps, struct timeval tv,
             close_log();
             return -1;
         }
+
+        auto uuidptr = std::make_shared<const std::string>(uuidstring);
+
+        summarize_row(tv.tv_sec, false, true, gps != NULL && gps->lat != 0 && gps->lon != 0,
+                uuidptr);
+
+        if (segment_open)
+            index_segment_row(tv.tv_sec, false, true, uuidptr,
+                    std::make_shared<const std::string>(phystring),
+                    std::make_shared<const std::string>(macstring), nullptr, nullptr);
     }
 
     return 1;
@@ -1239,7 +2557,8 @@ int kis_database_logfile::log_datasource(shared_tracker_element in_datasource) {
         sqlite3_bind_text(datasource_stmt, 4, namestring.data(), namestring.length(), SQLITE_TRANSIENT);
         sqlite3_bind_text(datasource_stmt, 5, intfstring.data(), intfstring.length(), SQLITE_TRANSIENT);
 
-        sqlite3_bind_blob(datasource_stmt, 6, jsonstring.data(), jsonstring.length(), SQLITE_TRANSIENT);
+        std::string compressed;
+        bind_json_record(datasource_stmt, 6, jsonstring, compressed, false);
 
         if (sqlite3_step(datasource_stmt) != SQLITE_DONE) {
             _MSG("kis_database_logfile unable to insert datasource in " +
@@ -1291,7 +2610,8 @@ int kis_database_logfile::log_alert(std::shared_ptr<tracked_alert> in_alert) {
         }
 
         sqlite3_bind_text(alert_stmt, 7, headerstring.c_str(), headerstring.length(), SQLITE_TRANSIENT);
-        sqlite3_bind_blob(alert_stmt, 8, jsonstring.data(), jsonstring.length(), SQLITE_TRANSIENT);
+        std::string compressed;
+        bind_json_record(alert_stmt, 8, jsonstring, compressed, false);
 
         if (sqlite3_step(alert_stmt) != SQLITE_DONE) {
             _MSG("kis_database_logfile unable to insert alert in " +
@@ -1339,7 +2659,8 @@ int kis_database_logfile::log_snapshot(kis_gps_packinfo *gps, struct timeval tv,
     }
 
     sqlite3_bind_text(snapshot_stmt, 5, snaptype.c_str(), snaptype.length(), SQLITE_TRANSIENT);
-    sqlite3_bind_text(snapshot_stmt, 6, json.data(), json.length(), SQLITE_TRANSIENT);
+    std::string compressed;
+    bind_json_record(snapshot_stmt, 6, json, compressed, true);
 
     if (sqlite3_step(snapshot_stmt) != SQLITE_DONE) {
         _MSG("kis_database_logfile unable to insert snapshot in " +
@@ -1372,6 +2693,101 @@ bool kis_database_logfile::httpd_verify_path(const char *path, const char *metho
     return false;
 }
 
+// Filters on the indexed text columns use equality unless they're a LIKE pattern, so that
+// sqlite can use the packet indexes; LIKE ignores case, and these are always logged in
+// upper case
+static void append_packet_match(kissqlite3::query& query, const std::string& field,
+        const std::string& value) {
+    using namespace kissqlite3;
+
+    if (value.find('%') != std::string::npos)
+        query.append_where(AND, _WHERE(field, LIKE, value));
+    else
+        query.append_where(AND, _WHERE(field, EQ, str_upper(value)));
+}
+
+// Stream the packets matching a query from each database in turn.  The rowids of the 
+// matching packets are collected first, which only reads the indexes when they cover the
+// filter, then each packet is fetched with a single reused statement, so no read is held
+// open while the stream waits on the client and the log writer is never blocked.
+static void stream_database_packets(kissqlite3::query& query, 
+        const std::vector<std::shared_ptr<sqlite3>>& dbs, unsigned long limit,
+        pcap_stream_database *dbrb) {
+    using namespace kissqlite3;
+
+    unsigned long num_packets = 0;
+    std::vector<sqlite3_int64> rowids;
+
+    for (const auto& sdb : dbs) {
+        if (limit != 0 && num_packets >= limit)
+            return;
+
+        rowids.clear();
+
+        query.db = sdb.get();
+
+        for (auto r : query) {
+            rowids.push_back(sqlite3_column_int64(r.get(), 0));
+
+            if (limit != 0 && num_packets + rowids.size() >= limit)
+                break;
+        }
+
+        // Release the read
+        query.stmt.reset();
+
+        sqlite3_stmt *stmt = NULL;
+
+        if (sqlite3_prepare_v2(sdb.get(), "SELECT ts_sec, ts_usec, datasource, dlt, packet, "
+                    "packet_len FROM packets WHERE rowid = ?", -1, &stmt, NULL) != SQLITE_OK) {
+            sqlite3_finalize(stmt);
+            continue;
+        }
+
+        uint64_t ts_sec, ts_usec;
+        unsigned int dlt;
+        size_t packet_len;
+        std::string datasource, packet;
+
+        for (auto rowid : rowids) {
+            sqlite3_bind_int64(stmt, 1, rowid);
+
+            // Packets may have been expired since the rowids were collected
+            bool found = sqlite3_step(stmt) == SQLITE_ROW;
+
+            if (found) {
+                ts_sec = sqlite3_column_int64(stmt, 0);
+                ts_usec = sqlite3_column_int64(stmt, 1);
+                dlt = sqlite3_column_int(stmt, 3);
+
+                auto ds_text = (const char *) sqlite3_column_text(stmt, 2);
+                datasource.assign(ds_text == nullptr ? "" : ds_text, sqlite3_column_bytes(stmt, 2));
+
+                auto packet_blob = (const char *) sqlite3_column_blob(stmt, 4);
+                packet.assign(packet_blob == nullptr ? "" : packet_blob, 
+                        sqlite3_column_bytes(stmt, 4));
+
+                packet_len = sqlite3_column_int64(stmt, 5);
+            }
+
+            sqlite3_reset(stmt);
+
+            if (!found)
+                continue;
+
+            if (dbrb->pcapng_write_database_packet(ts_sec, ts_usec, datasource, 
+                        dlt, packet, packet_len) < 0) {
+                sqlite3_finalize(stmt);
+                return;
+            }
+
+            num_packets++;
+        }
+
+        sqlite3_finalize(stmt);
+    }
+}
+
 KIS_MHD_RETURN kis_database_logfile::httpd_create_stream_response(kis_net_httpd *httpd,
             kis_net_httpd_connection *connection,
             const char *url, const char *method, const char *upload_data,
@@ -1394,24 +2810,35 @@ KIS_MHD_RETURN kis_database_logfile::httpd_create_stream_response(kis_net_httpd
         }
 
         using namespace kissqlite3;
-        auto query = _SELECT(db, "packets", {"ts_sec", "ts_usec", "datasource", "dlt", "packet"});
+
+        index_live_packets();
+
+        auto rdb = open_read_connection();
+        auto query = _SELECT(rdb.get(), "packets", {"rowid"});
+
+        // Segments which can't contain any matching packets are skipped entirely
+        kismetdb_segments::segment_filter seg_filter;
+        unsigned long limit = 0;
 
         try {
-            if (connection->has_cached_variable("timestamp_start"))
-                query.append_where(AND, _WHERE("ts_sec", GE, 
-                            connection->variable_cache_as<uint64_t>("timestamp_start")));
+            if (connection->has_cached_variable("timestamp_start")) {
+                seg_filter.time_start = connection->variable_cache_as<uint64_t>("timestamp_start");
+                query.append_where(AND, _WHERE("ts_sec", GE, seg_filter.time_start));
+            }
 
-            if (connection->has_cached_variable("timestamp_end"))
-                query.append_where(AND, _WHERE("ts_sec", LE,
-                            connection->variable_cache_as<uint64_t>("timestamp_end")));
+            if (connection->has_cached_variable("timestamp_end")) {
+                seg_filter.time_end = connection->variable_cache_as<uint64_t>("timestamp_end");
+                query.append_where(AND, _WHERE("ts_sec", LE, seg_filter.time_end));
+            }
 
-            if (connection->has_cached_variable("datasource"))
-                query.append_where(AND, _WHERE("datasource", LIKE,
-                            connection->variable_cache_as<std::string>("datasource")));
+            if (connection->has_cached_variable("datasource")) {
+                seg_filter.datasources.push_back(connection->variable_cache_as<std::string>("datasource"));
+                append_packet_match(query, "datasource", seg_filter.datasources.back());
+            }
 
             if (connection->has_cached_variable("device_id"))
-                query.append_where(AND, _WHERE("devkey", LIKE,
-                            connection->variable_cache_as<std::string>("device_id")));
+                append_packet_match(query, "devkey", 
+                        connection->variable_cache_as<std::string>("device_id"));
 
             if (connection->has_cached_variable("dlt"))
                 query.append_where(AND, _WHERE("dlt", EQ,
@@ -1445,17 +2872,20 @@ KIS_MHD_RETURN kis_database_logfile::httpd_create_stream_response(kis_net_httpd
                 query.append_where(AND, _WHERE("signal", LE, 
                             connection->variable_cache_as<unsigned int>("signal_max")));
 
-            if (connection->has_cached_variable("address_source")) 
-                query.append_where(AND, _WHERE("sourcemac", LIKE, 
-                            connection->variable_cache_as<std::string>("address_source")));
+            if (connection->has_cached_variable("address_source")) {
+                seg_filter.devmacs.push_back(connection->variable_cache_as<std::string>("address_source"));
+                append_packet_match(query, "sourcemac", seg_filter.devmacs.back());
+            }
 
-            if (connection->has_cached_variable("address_dest")) 
-                query.append_where(AND, _WHERE("destmac", LIKE, 
-                            connection->variable_cache_as<std::string>("address_dest")));
+            if (connection->has_cached_variable("address_dest")) {
+                seg_filter.devmacs.push_back(connection->variable_cache_as<std::string>("address_dest"));
+                append_packet_match(query, "destmac", seg_filter.devmacs.back());
+            }
 
-            if (connection->has_cached_variable("address_trans")) 
-                query.append_where(AND, _WHERE("transmac", LIKE, 
-                            connection->variable_cache_as<std::string>("address_trans")));
+            if (connection->has_cached_variable("address_trans")) {
+                seg_filter.devmacs.push_back(connection->variable_cache_as<std::string>("address_trans"));
+                append_packet_match(query, "transmac", seg_filter.devmacs.back());
+            }
 
             if (connection->has_cached_variable("location_lat_min"))
                 query.append_where(AND, _WHERE("lat", GE, 
@@ -1481,8 +2911,10 @@ KIS_MHD_RETURN kis_database_logfile::httpd_create_stream_response(kis_net_httpd
                 query.append_where(AND, _WHERE("packet_len", LE, 
                             connection->variable_cache_as<long int>("size_max")));
 
-            if (connection->has_cached_variable("limit"))
-                query.append_clause(LIMIT, connection->variable_cache_as<unsigned long>("limit"));
+            if (connection->has_cached_variable("limit")) {
+                limit = connection->variable_cache_as<unsigned long>("limit");
+                query.append_clause(LIMIT, limit);
+            }
 
         } catch (const std::exception& e) {
             connection->httpcode = 500;
@@ -1507,7 +2939,7 @@ KIS_MHD_RETURN kis_database_logfile::httpd_create_stream_response(kis_net_httpd
 
         // Get the list of all the interfaces we know about in the database and push them into the
         // pcapng handler
-        auto datasource_query = _SELECT(db, "datasources", {"uuid", "name", "interface"});
+        auto datasource_query = _SELECT(rdb.get(), "datasources", {"uuid", "name", "interface"});
 
         for (auto ds : datasource_query)  {
             dbrb->add_database_interface(sqlite3_column_as<std::string>(ds, 0),
@@ -1517,16 +2949,7 @@ KIS_MHD_RETURN kis_database_logfile::httpd_create_stream_response(kis_net_httpd
 
         // Database handler registers itself as timing out so this should be OK to just blitz through
         // now, we'll block as necessary
-        for (auto p : query) {
-            if (dbrb->pcapng_write_database_packet(
-                        sqlite3_column_as<std::uint64_t>(p, 0),
-                        sqlite3_column_as<std::uint64_t>(p, 1),
-                        sqlite3_column_as<std::string>(p, 2),
-                        sqlite3_column_as<unsigned int>(p, 3),
-                        sqlite3_column_as<std::string>(p, 4)) < 0) {
-                return MHD_YES;
-            }
-        }
+        stream_database_packets(query, open_segment_read_connections(rdb, seg_filter), limit, dbrb);
     }
 
     return MHD_YES;
@@ -1587,24 +3010,35 @@ KIS_MHD_RETURN kis_database_logfile::httpd_post_complete(kis_net_httpd_connectio
     }
 
     using namespace kissqlite3;
-    auto query = _SELECT(db, "packets", {"ts_sec", "ts_usec", "datasource", "dlt", "packet"});
+
+    index_live_packets();
+
+    auto rdb = open_read_connection();
+    auto query = _SELECT(rdb.get(), "packets", {"rowid"});
+
+    // Segments which can't contain any matching packets are skipped entirely
+    kismetdb_segments::segment_filter seg_filter;
+    unsigned long limit = 0;
 
     if (!filterdata.isNull()) {
         try {
-            if (!filterdata["timestamp_start"].isNull())
-                query.append_where(AND, 
-                        _WHERE("ts_sec", GE, filterdata["timestamp_start"].asUInt64()));
+            if (!filterdata["timestamp_start"].isNull()) {
+                seg_filter.time_start = filterdata["timestamp_start"].asUInt64();
+                query.append_where(AND, _WHERE("ts_sec", GE, seg_filter.time_start));
+            }
 
-            if (!filterdata["timestamp_end"].isNull()) 
-                query.append_where(AND, 
-                        _WHERE("ts_sec", LE, filterdata["timestamp_end"].asUInt64()));
+            if (!filterdata["timestamp_end"].isNull()) {
+                seg_filter.time_end = filterdata["timestamp_end"].asUInt64();
+                query.append_where(AND, _WHERE("ts_sec", LE, seg_filter.time_end));
+            }
 
-            if (!filterdata["datasource"].isNull())
-                query.append_where(AND, 
-                        _WHERE("datasource", LIKE, filterdata["datasource"].asString()));
+            if (!filterdata["datasource"].isNull()) {
+                seg_filter.datasources.push_back(filterdata["datasource"].asString());
+                append_packet_match(query, "datasource", seg_filter.datasources.back());
+            }
 
             if (!filterdata["device_id"].isNull())
-                query.append_where(AND, _WHERE("devkey", LIKE, filterdata["device_id"].asString()));
+                append_packet_match(query, "devkey", filterdata["device_id"].asString());
 
             if (!filterdata["dlt"].isNull())
                 query.append_where(AND, _WHERE("dlt", EQ, filterdata["dlt"].asInt()));
@@ -1632,17 +3066,20 @@ KIS_MHD_RETURN kis_database_logfile::httpd_post_complete(kis_net_httpd_connectio
             if (!filterdata["signal_max"].isNull())
                 query.append_where(AND, _WHERE("signal", LE, filterdata["signal_max"].asInt()));
 
-            if (!filterdata["address_source"].isNull())
-                query.append_where(AND, 
-                        _WHERE("sourcemac", LIKE, filterdata["address_source"].asString()));
+            if (!filterdata["address_source"].isNull()) {
+                seg_filter.devmacs.push_back(filterdata["address_source"].asString());
+                append_packet_match(query, "sourcemac", seg_filter.devmacs.back());
+            }
 
-            if (!filterdata["address_dest"].isNull())
-                query.append_where(AND, 
-                        _WHERE("destmac", LIKE, filterdata["address_dest"].asString()));
+            if (!filterdata["address_dest"].isNull()) {
+                seg_filter.devmacs.push_back(filterdata["address_dest"].asString());
+                append_packet_match(query, "destmac", seg_filter.devmacs.back());
+            }
 
-            if (!filterdata["address_trans"].isNull())
-                query.append_where(AND, 
-                        _WHERE("transmac", LIKE, filterdata["address_trans"].asString()));
+            if (!filterdata["address_trans"].isNull()) {
+                seg_filter.devmacs.push_back(filterdata["address_trans"].asString());
+                append_packet_match(query, "transmac", seg_filter.devmacs.back());
+            }
 
             if (!filterdata["location_lat_min"].isNull())
                 query.append_where(AND, 
@@ -1666,8 +3103,10 @@ KIS_MHD_RETURN kis_database_logfile::httpd_post_complete(kis_net_httpd_connectio
             if (!filterdata["size_max"].isNull())
                 query.append_where(AND, _WHERE("packet_len", LE, filterdata["size_max"].asUInt64()));
 
-            if (!filterdata["limit"].isNull())
-                query.append_clause(LIMIT, filterdata["limit"].asUInt());
+            if (!filterdata["limit"].isNull()) {
+                limit = filterdata["limit"].asUInt();
+                query.append_clause(LIMIT, limit);
+            }
 
         } catch (const std::exception& e) {
             auto saux = (kis_net_httpd_buffer_stream_aux *) concls->custom_extension;
@@ -1716,7 +3155,7 @@ KIS_MHD_RETURN kis_database_logfile::httpd_post_complete(kis_net_httpd_connectio
 
     // Get the list of all the interfaces we know about in the database and push them into the
     // pcapng handler
-    auto datasource_query = _SELECT(db, "datasources", {"uuid", "name", "interface"});
+    auto datasource_query = _SELECT(rdb.get(), "datasources", {"uuid", "name", "interface"});
 
     for (auto ds : datasource_query)  {
         dbrb->add_database_interface(sqlite3_column_as<std::string>(ds, 0),
@@ -1726,16 +3165,7 @@ KIS_MHD_RETURN kis_database_logfile::httpd_post_complete(kis_net_httpd_connectio
 
     // Database handler registers itself as timing out so this should be OK to just blitz through
     // now, we'll block as necessary
-    for (auto p : query) {
-        if (dbrb->pcapng_write_database_packet(
-                    sqlite3_column_as<std::uint64_t>(p, 0),
-                    sqlite3_column_as<std::uint64_t>(p, 1),
-                    sqlite3_column_as<std::string>(p, 2),
-                    sqlite3_column_as<unsigned int>(p, 3),
-                    sqlite3_column_as<std::string>(p, 4)) < 0) {
-            return MHD_YES;
-        }
-    }
+    stream_database_packets(query, open_segment_read_connections(rdb, seg_filter), limit, dbrb);
 
     return MHD_YES;
 }
@@ -1752,9 +3182,41 @@ unsigned int kis_database_logfile::packet_drop_endpoint_handler(std::ostream& os
     }
 
     try {
+        auto drop_before = json["drop_before"].asUInt64();
+
         auto drop_query = 
-            _DELETE(db, "packets", _WHERE("ts_sec", LE, json["drop_before"].asUInt64()));
+            _DELETE(db, "packets", _WHERE("ts_sec", LE, drop_before));
+
+        // Drop the segments which end before the cutoff, and remove the packets from the
+        // segments which overlap it
+        if (segments_enabled) {
+            expire_segments(drop_before + 1);
+
+            local_demand_locker dblock(&ds_mutex);
+            db_lock_with_sync_check(dblock, return 500);
+
+            for (const auto& s : kismetdb_segments::load_manifest(db, ds_dbfile)) {
+                if (s.first_time > drop_before)
+                    continue;
+
+                auto delete_sql = fmt::format("DELETE FROM {}packets WHERE ts_sec <= {}", 
+                        segment_open && s.number == segment_number ? "seg." : "", drop_before);
+
+                if (segment_open && s.number == segment_number) {
+                    sqlite3_exec(db, delete_sql.c_str(), NULL, NULL, NULL);
+                    continue;
+                }
+
+                sqlite3 *sdb = nullptr;
+
+                if (sqlite3_open_v2(s.path.c_str(), &sdb, SQLITE_OPEN_READWRITE, NULL) == SQLITE_OK) {
+                    sqlite3_busy_timeout(sdb, 1000);
+                    sqlite3_exec(sdb, delete_sql.c_str(), NULL, NULL, NULL);
+                }
 
+                sqlite3_close_v2(sdb);
+            }
+        }
     } catch (const std::exception& e) {
         ostream << e.what() << "\n";
         return 400;
@@ -1795,7 +3257,50 @@ unsigned int kis_database_logfile::make_poi_endp_handler(std::ostream& ostream,
 }
 
 std::shared_ptr<tracker_element> kis_database_logfile::list_poi_endp_handler() {
-    return std::make_shared<tracker_element_vector>();
+    using namespace kissqlite3;
+
+    auto ret = std::make_shared<tracker_element_vector>();
+
+    if (db == nullptr || !db_enabled)
+        return ret;
+
+    auto rdb = open_read_connection();
+
+    try {
+        auto query = _SELECT(rdb.get(), "snapshots", {"ts_sec", "ts_usec", "lat", "lon", "json"},
+                _WHERE("snaptype", EQ, "POI"));
+
+        for (auto p : query) {
+            auto poi = std::make_shared<tracker_element_string_map>();
+
+            auto ts_sec = std::make_shared<tracker_element_uint64>();
+            ts_sec->set(sqlite3_column_as<std::uint64_t>(p, 0));
+            poi->insert("ts_sec", ts_sec);
+
+            auto ts_usec = std::make_shared<tracker_element_uint64>();
+            ts_usec->set(sqlite3_column_as<std::uint64_t>(p, 1));
+            poi->insert("ts_usec", ts_usec);
+
+            auto lat = std::make_shared<tracker_element_double>();
+            lat->set(sqlite3_column_as<double>(p, 2));
+            poi->insert("lat", lat);
+
+            auto lon = std::make_shared<tracker_element_double>();
+            lon->set(sqlite3_column_as<double>(p, 3));
+            poi->insert("lon", lon);
+
+            auto data = std::make_shared<tracker_element_string>();
+            data->set(kismetdb_blob::decompress(sqlite3_column_as<std::string>(p, 4), 
+                        compression_dict));
+            poi->insert("data", data);
+
+            ret->push_back(poi);
+        }
+    } catch (const std::exception& e) {
+        _MSG_ERROR("Unable to list POIs from the kismetdb log: {}", e.what());
+    }
+
+    return ret;
 }
 
 pcap_stream_database::pcap_stream_database(global_registry *in_globalreg,
@@ -1828,7 +3333,8 @@ void pcap_stream_database::add_database_interface(const std::string& in_uuid, co
 }
 
 int pcap_stream_database::pcapng_write_database_packet(uint64_t time_s, uint64_t time_us,
-        const std::string& interface_uuid, unsigned int dlt, const std::string& data) {
+        const std::string& interface_uuid, unsigned int dlt, const std::string& data,
+        size_t original_len) {
 
     auto pcap_intf_i = db_uuid_intf_map.find(interface_uuid);
 
@@ -1864,6 +3370,6 @@ int pcap_stream_database::pcapng_write_database_packet(uint64_t time_s, uint64_t
     ts.tv_sec = time_s;
     ts.tv_usec = time_us;
 
-    return pcapng_write_packet(ng_interface_id, &ts, blocks);
+    return pcapng_write_packet(ng_interface_id, &ts, blocks, original_len);
 }
 
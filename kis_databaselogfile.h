@@ -38,8 +38,16 @@
 #include "config.h"
 
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <string>
+#include <thread>
+#include <unordered_map>
 
 #include "globalregistry.h"
 #include "kis_mutex.h"
@@ -49,7 +57,10 @@
 #include "logtracker.h"
 #include "packetchain.h"
 #include "pcapng_stream_ringbuf.h"
+#include "kismetdb_segments.h"
+#include "kismetdb_summary.h"
 #include "sqlite3_cpp11.h"
+#include "trackedrrd.h"
 #include "class_filter.h"
 #include "packet_filter.h"
 #include "messagebus.h"
@@ -90,9 +101,13 @@ public:
 
     virtual int database_upgrade_db() override;
 
-    // Log a vector of multiple devices, replacing any old device records
+    // Log a device, replacing any old device record; returns the size of the
+    // stored device record, 0 if the device was not logged, or negative on error
     virtual int log_device(std::shared_ptr<kis_tracked_device_base> in_device);
 
+    // Record the totals of a device logging pass
+    virtual void log_device_pass(size_t num_devices, size_t num_bytes);
+
     // Device logs are non-streaming; we need to know the last time we generated
     // device logs so that we can update just the logs we need.
     virtual time_t get_last_device_log_ts() { return last_device_log; }
@@ -208,6 +223,254 @@ protected:
     kis_recursive_timed_mutex transaction_mutex;
     int transaction_timer;
 
+    // A packet (and/or packet metadata) row, fully rendered on the packet thread so
+    // that the writer thread only has to bind and insert it.  MAC, UUID, and phy
+    // strings are shared from the render caches.
+    struct db_packet_row {
+        struct timeval ts;
+
+        std::shared_ptr<const std::string> phyname;
+        std::shared_ptr<const std::string> sourcemac;
+        std::shared_ptr<const std::string> destmac;
+        std::shared_ptr<const std::string> transmac;
+        std::shared_ptr<const std::string> datasource;
+
+        double frequency;
+
+        bool has_gps;
+        double lat, lon, alt, speed, heading;
+
+        // Packet table record
+        bool has_packet;
+        int signal;
+        unsigned int dlt;
+        std::string packet;
+        unsigned int packet_len;
+        int error;
+        std::string tags;
+
+        // Data table record, from the packet metablob
+        bool has_data;
+        std::string data_type;
+        std::string data_json;
+    };
+
+    // Build a row from a packet; called from the packet thread only
+    std::unique_ptr<db_packet_row> render_packet_row(kis_packet *in_pack);
+
+    // Insert a row; caller must hold the database lock
+    bool write_packet_row(const db_packet_row& row);
+
+    // Cached string renderings, only touched by the packet thread
+    std::shared_ptr<const std::string> cached_mac_string(const mac_addr& mac);
+    std::shared_ptr<const std::string> cached_uuid_string(const uuid& in_uuid);
+    std::shared_ptr<const std::string> cached_phy_string(int phyid);
+
+    std::unordered_map<mac_addr, std::shared_ptr<const std::string>> mac_string_cache;
+    std::unordered_map<uuid, std::shared_ptr<const std::string>> uuid_string_cache;
+    std::unordered_map<int, std::shared_ptr<const std::string>> phy_string_cache;
+
+    // Packet writer thread; when enabled the packet path only renders and queues rows,
+    // and the writer thread inserts them and performs group commits of the whole
+    // database transaction once enough rows have been written or the commit interval
+    // has passed.  When the queue is full, rows are dropped instead of stalling the
+    // packet chain.
+    bool packet_writer_enabled;
+    size_t packet_queue_max;
+    size_t commit_rows;
+    std::chrono::milliseconds commit_interval;
+
+    std::thread packet_writer_th;
+    std::mutex packet_writer_mutex;
+    std::condition_variable packet_writer_cv;
+    std::deque<std::unique_ptr<db_packet_row>> packet_writer_queue;
+    bool packet_writer_shutdown;
+    time_t last_packet_drop_warning;
+
+    void packet_writer();
+    void start_packet_writer();
+
+    // Tell the writer to exit; this doesn't wait for it, since it may be waiting for
+    // the database lock the caller holds
+    void stop_packet_writer();
+
+    // Write the rows left in the queue; caller holds the database lock
+    void flush_packet_writer();
+
+    // Wait for a stopped writer to exit; caller must not hold the database lock
+    void join_packet_writer();
+
+    int packet_queue_rrd_id, commit_latency_rrd_id, dropped_rows_rrd_id;
+    std::shared_ptr<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>> packet_queue_rrd;
+    std::shared_ptr<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>> commit_latency_rrd;
+    std::shared_ptr<kis_tracked_rrd<>> dropped_rows_rrd;
+
+    // Journal and connection tuning.  In WAL mode the logging connection never
+    // checkpoints; a background thread checkpoints from its own connection and resets
+    // the WAL when it grows past the limit, and readers use their own read-only
+    // connections so that they never block the writer.
+    bool wal_enabled;
+    std::string synchronous_mode;
+    unsigned int page_size;
+    uint64_t mmap_size;
+    uint64_t wal_limit;
+    std::chrono::seconds checkpoint_interval;
+
+    virtual bool database_init_connection() override;
+
+    // Open a read-only connection to the log; when the log is not in WAL mode this
+    // falls back to the logging connection
+    std::shared_ptr<sqlite3> open_read_connection();
+
+    std::thread checkpoint_th;
+    std::mutex checkpoint_mutex;
+    std::condition_variable checkpoint_cv;
+    bool checkpoint_shutdown;
+
+    void checkpointer();
+    void start_checkpointer();
+    void stop_checkpointer();
+
+    int wal_size_rrd_id;
+    std::shared_ptr<kis_tracked_rrd<kis_tracked_rrd_extreme_aggregator>> wal_size_rrd;
+
+    // Segments closed by the logging connection, for the checkpoint thread to detach
+    // and convert back to standalone files, and the segment it should checkpoint;
+    // protected by the checkpoint mutex
+    std::string checkpoint_segment;
+    std::vector<std::string> checkpoint_closed_segments;
+
+    // Segment rotation; see kismetdb_segments.h.  The open segment is attached to the
+    // logging connection as the 'seg' schema and the packet and data statements insert
+    // into it.  Segments are always in WAL mode and are checkpointed by the checkpoint
+    // thread.  Segment state is protected by the database lock.
+    bool segments_enabled;
+    uint64_t segment_max_size;
+    unsigned int segment_max_age;
+
+    bool segment_open;
+    unsigned int segment_number;
+    std::string segment_file;
+    time_t segment_opened;
+    uint64_t segment_page_size;
+    uint64_t segment_first_time, segment_last_time;
+    uint64_t segment_packets, segment_data;
+
+    // Content of the open segment, and what has not been written to the manifest yet
+    struct segment_string_less {
+        bool operator()(const std::shared_ptr<const std::string>& a,
+                const std::shared_ptr<const std::string>& b) const {
+            return *a < *b;
+        }
+
+        bool operator()(const std::pair<std::shared_ptr<const std::string>, std::shared_ptr<const std::string>>& a,
+                const std::pair<std::shared_ptr<const std::string>, std::shared_ptr<const std::string>>& b) const {
+            int c = a.first->compare(*b.first);
+
+            if (c != 0)
+                return c < 0;
+
+            return *a.second < *b.second;
+        }
+    };
+
+    std::set<std::shared_ptr<const std::string>, segment_string_less> segment_datasource_set;
+    std::set<std::pair<std::shared_ptr<const std::string>, std::shared_ptr<const std::string>>, 
+        segment_string_less> segment_device_set;
+    std::vector<std::shared_ptr<const std::string>> segment_pending_datasources;
+    std::vector<std::pair<std::shared_ptr<const std::string>, std::shared_ptr<const std::string>>> 
+        segment_pending_devices;
+
+    // Packets and data written since the last commit, by datasource, which have not been
+    // added to the summary tables yet; see kismetdb_summary.h.  Protected by the
+    // database lock.
+    struct summary_counts {
+        summary_counts() :
+            packets {0},
+            packets_with_loc {0},
+            data {0},
+            data_with_loc {0},
+            first_time {0},
+            last_time {0} { }
+
+        uint64_t packets, packets_with_loc;
+        uint64_t data, data_with_loc;
+        uint64_t first_time, last_time;
+    };
+
+    std::map<std::shared_ptr<const std::string>, summary_counts, segment_string_less> summary_pending;
+
+    // Record a row written to the packets or data tables
+    void summarize_row(time_t ts, bool packet, bool data, bool has_loc,
+            const std::shared_ptr<const std::string>& datasource);
+
+    // Add the pending counts to the summary of the schema they were written to; caller
+    // must hold the database lock and be in a transaction
+    void flush_summary();
+
+    // Create the packets and data tables, and prepare their insert statements, in a schema
+    bool create_packet_tables(const std::string& schema);
+    bool prepare_packet_statements(const std::string& schema);
+    void finalize_packet_statements();
+
+    // Open the next segment; caller must hold the database lock and not be in a transaction
+    bool open_segment();
+    // Close the open segment; caller must hold the database lock and not be in a transaction
+    void close_segment(bool closing_log);
+    // Start a new segment; caller must hold the database lock and be in a transaction
+    void rotate_segment();
+    bool segment_rotation_due();
+
+    // Record a row written to the open segment
+    void index_segment_row(time_t ts, bool packet, bool data,
+            const std::shared_ptr<const std::string>& datasource,
+            const std::shared_ptr<const std::string>& phyname,
+            const std::shared_ptr<const std::string>& mac1,
+            const std::shared_ptr<const std::string>& mac2,
+            const std::shared_ptr<const std::string>& mac3);
+
+    // Write the index of the open segment to the manifest; caller must hold the database
+    // lock and be in a transaction
+    void flush_segment_index(bool closed);
+
+    // Drop closed segments which end before the cutoff; returns true if packets are
+    // currently being saved to a segment
+    bool expire_segments(time_t cutoff);
+
+    // Read connections to the segments matching a filter, following the main log
+    std::vector<std::shared_ptr<sqlite3>> open_segment_read_connections(std::shared_ptr<sqlite3> rdb,
+            const kismetdb_segments::segment_filter& filter);
+
+    // Indexes on the packets table for filtered pcap exports.  Closed logs and segments
+    // are indexed when they are closed; the packets being logged are only indexed once
+    // the first export asks for them, after which sqlite keeps the indexes current.
+    // packet_index_live is protected by the database lock.
+    bool packet_index_enabled;
+    bool packet_index_live;
+
+    // Index the packets being logged, if packet indexes are enabled
+    void index_live_packets();
+
+    // Serializer for device records, json or storagemsgpack
+    std::string device_serializer;
+
+    // JSON record compression; see kismetdb_blob.h
+    bool compress_records;
+    int compress_level;
+    std::string compression_dict;
+
+    // Bind a JSON record, compressing it if enabled.  The record and the compressed
+    // buffer are bound without copying, and must last until the statement is stepped.
+    void bind_json_record(sqlite3_stmt *stmt, int pos, const std::string& json,
+            std::string& compressed, bool as_text);
+
+    int devices_logged_rrd_id, device_bytes_rrd_id;
+    std::shared_ptr<kis_tracked_rrd<>> devices_logged_rrd;
+    std::shared_ptr<kis_tracked_rrd<>> device_bytes_rrd;
+
+    std::shared_ptr<tracker_element_map> writer_stats_map;
+    std::shared_ptr<kis_net_httpd_simple_tracked_endpoint> writer_stats_endp;
+
     // Packet time limit
     unsigned int packet_timeout;
     int packet_timeout_timer;
@@ -307,7 +570,8 @@ public:
     // than the numerical lookup but we need to search by UUID regardless and for many single-source feeds
     // the lookup will be a single compare
     virtual int pcapng_write_database_packet(uint64_t time_s, uint64_t time_us,
-            const std::string& interface_uuid, unsigned int dlt, const std::string& data);
+            const std::string& interface_uuid, unsigned int dlt, const std::string& data,
+            size_t original_len = 0);
 
     // Populate the interface list with all the interfaces from the database, we'll
     // assign pcapng IDs to them as they get used so only included interfaces will show up
@@ -78,6 +78,8 @@ kis_datasource::kis_datasource(shared_datasource_builder in_builder, std::shared
 
     quiet_errors = 0;
 
+    set_source_hop_mode("fixed");
+
     set_int_source_running(false);
 }
 
@@ -288,6 +290,25 @@ void kis_datasource::set_channel(std::string in_channel, unsigned int in_transac
     send_configure_channel(in_channel, in_transaction, in_cb);
 }
 
+void kis_datasource::set_capture_filter(unsigned int in_dlt, 
+        const std::vector<kis_bpf_insn>& in_program, unsigned int in_transaction,
+        configure_callback_t in_cb) {
+    local_locker lock(ext_mutex);
+
+    auto len = in_program.size();
+
+    send_configure_filter(in_dlt, in_program, in_transaction,
+            [this, len, in_cb](unsigned int transaction, bool success, std::string msg) {
+                {
+                    local_locker lock(ext_mutex);
+                    source_capture_filter_len->set(success ? len : 0);
+                }
+
+                if (in_cb != NULL)
+                    in_cb(transaction, success, msg);
+            });
+}
+
 void kis_datasource::set_channel_hop(double in_rate, std::vector<std::string> in_chans,
         bool in_shuffle, unsigned int in_offt, unsigned int in_transaction, 
         configure_callback_t in_cb) {
@@ -341,16 +362,48 @@ void kis_datasource::set_channel_hop(double in_rate,
     }
 
     // Generate the command and send it
-    send_configure_channel_hop(in_rate, in_chans, in_shuffle, in_offt, 
+    send_configure_channel_hop(in_rate, in_chans, std::vector<double>(), in_shuffle, 
+            in_offt, in_transaction, in_cb);
+}
+
+void kis_datasource::set_channel_hop_dwell(double in_rate, 
+        std::shared_ptr<tracker_element_vector> in_chans,
+        const std::vector<double>& in_dwell, bool in_shuffle, unsigned int in_offt, 
+        unsigned int in_transaction, configure_callback_t in_cb) {
+    local_locker lock(ext_mutex);
+
+    if (!get_source_builder()->get_tune_capable()) {
+        if (in_cb != NULL) {
+            in_cb(in_transaction, false, "Driver not capable of changing channel");
+        }
+        return;
+    }
+
+    if (!get_source_builder()->get_hop_capable()) {
+        if (in_cb != NULL) {
+            in_cb(in_transaction, false, "Driver not capable of channel hopping");
+        }
+        return;
+    }
+
+    // Dwell only makes sense for the whole list
+    if (in_dwell.size() != 0 && in_dwell.size() != in_chans->size()) {
+        if (in_cb != NULL) {
+            in_cb(in_transaction, false, "Channel dwell list does not match the channel list");
+        }
+        return;
+    }
+
+    send_configure_channel_hop(in_rate, in_chans, in_dwell, in_shuffle, in_offt, 
             in_transaction, in_cb);
 }
 
 void kis_datasource::set_channel_hop_rate(double in_rate, unsigned int in_transaction,
         configure_callback_t in_cb) {
     // Don't bother checking if we can set channel since we're just calling a function
-    // that already checks that
-    set_channel_hop(in_rate, get_source_hop_vec(), get_source_hop_shuffle(),
-            get_source_hop_offset(), in_transaction, in_cb);
+    // that already checks that; keep the dwell of each channel
+    set_channel_hop_dwell(in_rate, get_source_hop_vec(), get_source_hop_dwell_vec()->get(),
+            get_source_hop_shuffle(), get_source_hop_offset(), in_transaction, in_cb);
 }
 
 void kis_datasource::set_channel_hop_list(std::vector<std::string> in_chans,
@@ -360,8 +413,153 @@ void kis_datasource::set_channel_hop_list(std::vector<std::string> in_chans,
             get_source_hop_offset(), in_transaction, in_cb);
 }
 
+void kis_datasource::count_hop_packet(const std::string& in_channel, double in_freq_khz) {
+    auto counts = std::atomic_load(&hop_counts);
+
+    if (counts == nullptr)
+        return;
+
+    if (in_channel.length() != 0) {
+        auto ci = counts->chan_map.find(in_channel);
+
+        if (ci != counts->chan_map.end()) {
+            counts->counts[ci->second].fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    if (in_freq_khz != 0) {
+        auto fi = counts->freq_map.find(in_freq_khz);
+
+        if (fi != counts->freq_map.end())
+            counts->counts[fi->second].fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void kis_datasource::fold_hop_packets() {
+    local_locker lock(ext_mutex);
+
+    auto counts = std::atomic_load(&hop_counts);
+
+    if (counts == nullptr)
+        return;
+
+    for (size_t i = 0; i < counts->channels.size(); i++) {
+        auto n = counts->counts[i].exchange(0, std::memory_order_relaxed);
+
+        if (n != 0)
+            counts->channels[i]->inc_packets(n);
+    }
+}
+
+void kis_datasource::update_hop_stats(double in_elapsed) {
+    local_locker lock(ext_mutex);
+
+    fold_hop_packets();
+
+    if (!get_source_running() || !get_source_hopping() || hop_stats_chan_map.size() == 0)
+        return;
+
+    double total_dwell = 0;
+
+    for (auto hi : hop_stats_chan_map)
+        total_dwell += hi.second->get_dwell();
+
+    if (total_dwell <= 0)
+        return;
+
+    for (auto hi : hop_stats_chan_map) {
+        auto hc = hi.second;
+
+        hc->set_dwell_time(hc->get_dwell_time() + 
+                (in_elapsed * hc->get_dwell() / total_dwell));
+
+        if (hc->get_dwell_time() > 0)
+            hc->set_packet_rate(hc->get_packets() / hc->get_dwell_time());
+    }
+}
+
+void kis_datasource::rebuild_hop_stats() {
+    local_locker lock(ext_mutex);
+
+    // Keep what was counted against the old hop list
+    fold_hop_packets();
+
+    auto old_chan_map = hop_stats_chan_map;
+
+    hop_stats_chan_map.clear();
+    source_hop_stats->clear();
+
+    auto counts = std::make_shared<hop_packet_counts>(source_hop_vec->size());
+    size_t num_counts = 0;
+
+    for (size_t i = 0; i < source_hop_vec->size(); i++) {
+        auto chan = get_tracker_value<std::string>(source_hop_vec->at(i));
+
+        if (hop_stats_chan_map.find(chan) != hop_stats_chan_map.end())
+            continue;
+
+        std::shared_ptr<kis_datasource_hop_channel> hc;
+
+        auto oi = old_chan_map.find(chan);
+        if (oi != old_chan_map.end()) {
+            hc = oi->second;
+        } else {
+            hc = std::make_shared<kis_datasource_hop_channel>(hop_stats_entry_id);
+            hc->set_channel(chan);
+        }
+
+        if (source_hop_dwell_vec->size() == source_hop_vec->size())
+            hc->set_dwell(source_hop_dwell_vec->at(i));
+        else
+            hc->set_dwell(1);
+
+        hop_stats_chan_map[chan] = hc;
+        source_hop_stats->insert(chan, hc);
+
+        counts->channels[num_counts] = hc;
+        counts->chan_map[chan] = num_counts;
+
+        auto freq = hop_channel_freq_khz(chan);
+        if (freq != 0 && counts->freq_map.find(freq) == counts->freq_map.end())
+            counts->freq_map[freq] = num_counts;
+
+        num_counts++;
+    }
+
+    // Duplicate channels leave unused slots at the end, which nothing maps to
+    std::atomic_store(&hop_counts, counts);
+}
+
+double kis_datasource::hop_channel_freq_khz(const std::string& in_channel) {
+    auto dlt = get_source_dlt();
+
+    if (dlt != KDLT_IEEE802_11 && dlt != KDLT_RADIOTAP && dlt != KDLT_PPI)
+        return 0;
+
+    // Channels are named by number or frequency, optionally followed by the
+    // width (6HT40+, 36VHT80, 5180W10)
+    unsigned int c = 0;
+    if (sscanf(in_channel.c_str(), "%u", &c) != 1)
+        return 0;
+
+    if (c >= 1000)
+        return c * 1000.0;
+
+    if (c == 14)
+        return 2484000;
+
+    if (c >= 1 && c <= 13)
+        return (2407 + (c * 5)) * 1000.0;
+
+    if (c >= 32 && c <= 177)
+        return (5000 + (c * 5)) * 1000.0;
+
+    return 0;
+}
+
 void kis_datasource::connect_remote(std::shared_ptr<buffer_handler_generic> in_ringbuf,
-        std::string in_definition, open_callback_t in_cb) {
+        std::string in_definition, bool in_transport, open_callback_t in_cb) {
     local_locker lock(ext_mutex);
 
     // We can't reconnect failed interfaces that are remote
@@ -375,7 +573,7 @@ void kis_datasource::connect_remote(std::shared_ptr<buffer_handler_generic> in_r
         timetracker->remove_timer(error_timer_id);
 
     // Connect the buffer
-    connect_buffer(in_ringbuf);
+    connect_buffer(in_ringbuf, in_transport);
 
     // Reset the state
     set_int_source_running(true);
@@ -690,6 +888,9 @@ bool kis_datasource::dispatch_rx_packet(std::shared_ptr<KismetExternal::Command>
     } else if (c->command() == "KDSWARNINGREPORT") {
         handle_packet_warning_report(c->seqno(), c->content());
         return true;
+    } else if (c->command() == "KDSSTATSREPORT") {
+        handle_packet_stats_report(c->seqno(), c->content());
+        return true;
     }
 
     return false;
@@ -1116,14 +1317,25 @@ void kis_datasource::handle_packet_configure_report(uint32_t in_seqno, const std
             auto chanstr = std::make_shared<tracker_element_string>(channel_entry_id, c);
             source_hop_vec->push_back(chanstr);
         }
+
+        source_hop_dwell_vec->clear();
+
+        if (report.hopping().dwell_size() == report.hopping().channels_size()) {
+            for (auto d : report.hopping().dwell()) 
+                source_hop_dwell_vec->push_back(d);
+        }
+
+        rebuild_hop_stats();
     }
 
     // Get the sequence number and look up our command
     uint32_t seq = report.success().seqno();
+    bool fatal_failure = true;
     auto ci = command_ack_map.find(seq);
     if (ci != command_ack_map.end()) {
         auto cb = ci->second->configure_cb;
         auto transaction = ci->second->transaction;
+        fatal_failure = ci->second->fatal_failure;
         command_ack_map.erase(ci);
 
         if (cb != nullptr) {
@@ -1133,7 +1345,7 @@ void kis_datasource::handle_packet_configure_report(uint32_t in_seqno, const std
         }
     }
 
-    if (!report.success().success()) {
+    if (!report.success().success() && fatal_failure) {
         trigger_error(msg);
         set_int_source_error_reason(msg);
     }
@@ -1187,6 +1399,10 @@ void kis_datasource::handle_packet_data_report(uint32_t in_seqno, const std::str
         datachunk->copy_data((const uint8_t *) report.packet().data().data(), 
                 report.packet().data().length());
 
+        // Sources which truncate packets report the original size
+        if (report.packet().size() > datachunk->length)
+            datachunk->original_length = report.packet().size();
+
         packet->insert(pack_comp_linkframe, datachunk);
     }
 
@@ -1277,6 +1493,69 @@ void kis_datasource::handle_packet_warning_report(uint32_t in_seqno, const std::
     set_int_source_warning(report.warning());
 }
 
+void kis_datasource::handle_packet_stats_report(uint32_t in_seqno, const std::string& in_content) {
+    local_locker lock(ext_mutex);
+
+    KismetDatasource::StatsReport report;
+
+    if (!report.ParseFromString(in_content)) {
+        _MSG(std::string("Kismet datasource driver ") + get_source_builder()->get_source_type() + 
+                std::string(" could not parse the stats report, something is wrong with "
+                    "the remote capture tool"), MSGFLAG_ERROR);
+        trigger_error("Invalid KDSSTATSREPORT");
+        return;
+    }
+
+    if (report.has_kernel_packets())
+        source_num_kernel_packets->set(report.kernel_packets());
+
+    if (report.has_kernel_drops())
+        source_num_kernel_drops->set(report.kernel_drops());
+
+    if (report.has_replay_target_speed())
+        source_replay_target_speed->set(report.replay_target_speed());
+
+    if (report.has_replay_speed())
+        source_replay_speed->set(report.replay_speed());
+
+    if (report.has_replay_target_pps())
+        source_replay_target_pps->set(report.replay_target_pps());
+
+    if (report.has_replay_pps())
+        source_replay_pps->set(report.replay_pps());
+}
+
+void kis_datasource::handle_transport_block(size_t in_raw_sz, size_t in_wire_sz, 
+        uint32_t in_latency_us) {
+    local_locker lock(ext_mutex);
+
+    // zlib is the only compression currently negotiated
+    if (source_remote_blocks->get() == 0)
+        source_remote_compression->set("zlib");
+
+    (*source_remote_blocks) += 1;
+    (*source_remote_raw_bytes) += in_raw_sz;
+    (*source_remote_wire_bytes) += in_wire_sz;
+
+    if (source_remote_raw_bytes->get() > source_remote_wire_bytes->get())
+        source_remote_bytes_saved->set(source_remote_raw_bytes->get() - 
+                source_remote_wire_bytes->get());
+    else
+        source_remote_bytes_saved->set(0);
+
+    source_remote_compression_ratio->set((double) source_remote_raw_bytes->get() / 
+            (double) source_remote_wire_bytes->get());
+
+    // Smoothed block latency, in milliseconds
+    double latency_ms = (double) in_latency_us / 1000;
+
+    if (source_remote_blocks->get() == 1)
+        source_remote_block_latency->set(latency_ms);
+    else
+        source_remote_block_latency->set(source_remote_block_latency->get() * 0.9 +
+                latency_ms * 0.1);
+}
+
 kis_layer1_packinfo *kis_datasource::handle_sub_signal(KismetDatasource::SubSignal in_sig) {
     // Extract l1 info from a KV pair so we can add it to a packet
     
@@ -1440,6 +1719,7 @@ unsigned int kis_datasource::send_configure_channel(std::string in_chan,
 
 unsigned int kis_datasource::send_configure_channel_hop(double in_rate, 
         std::shared_ptr<tracker_element_vector> in_chans,
+        const std::vector<double>& in_dwell,
         bool in_shuffle, unsigned int in_offt,
         unsigned int in_transaction,
         configure_callback_t in_cb) {
@@ -1464,6 +1744,10 @@ unsigned int kis_datasource::send_configure_channel_hop(double in_rate,
         ch->add_channels(get_tracker_value<std::string>(chi));
     }
 
+    for (auto d : in_dwell) {
+        ch->add_dwell(d);
+    }
+
     o.set_allocated_hopping(ch);
 
     c->set_content(o.SerializeAsString());
@@ -1486,6 +1770,56 @@ unsigned int kis_datasource::send_configure_channel_hop(double in_rate,
     return seqno;
 }
 
+unsigned int kis_datasource::send_configure_filter(unsigned int in_dlt,
+        const std::vector<kis_bpf_insn>& in_program, unsigned int in_transaction,
+        configure_callback_t in_cb) {
+
+    local_locker lock(ext_mutex);
+
+    std::shared_ptr<tracked_command> cmd;
+    uint32_t seqno;
+
+    std::shared_ptr<KismetExternal::Command> c(new KismetExternal::Command());
+
+    c->set_command("KDSCONFIGURE");
+
+    KismetDatasource::Configure o;
+    KismetDatasource::SubFilter *f = new KismetDatasource::SubFilter();
+
+    f->set_dlt(in_dlt);
+
+    for (const auto& i : in_program) {
+        auto pi = f->add_program();
+        pi->set_code(i.code);
+        pi->set_jt(i.jt);
+        pi->set_jf(i.jf);
+        pi->set_k(i.k);
+    }
+
+    o.set_allocated_filter(f);
+
+    c->set_content(o.SerializeAsString());
+
+    seqno = send_packet(c);
+
+    if (seqno == 0) {
+        if (in_cb != NULL) {
+            in_cb(in_transaction, false, "unable to generate command frame");
+        }
+
+        return 0;
+    }
+
+    // Sources which can't apply a filter keep running, and Kismet filters for them
+    cmd.reset(new tracked_command(in_transaction, seqno, this));
+    cmd->configure_cb = in_cb;
+    cmd->fatal_failure = false;
+
+    command_ack_map.insert(std::make_pair(seqno, cmd));
+
+    return seqno;
+}
+
 unsigned int kis_datasource::send_list_interfaces(unsigned int in_transaction, list_callback_t in_cb) {
     local_locker lock(ext_mutex);
 
@@ -1572,6 +1906,17 @@ void kis_datasource::register_fields() {
     register_field("kismet.datasource.hop_shuffle_skip", 
             "Number of channels skipped by source during hop shuffling", 
             &source_hop_shuffle_skip);
+    register_field("kismet.datasource.hop_dwell", 
+            "Dwell multiplier of each hop channel, if not hopping at a fixed rate",
+            &source_hop_dwell_vec);
+    register_field("kismet.datasource.hop_mode", 
+            "Hop scheduling mode (fixed or adaptive)", &source_hop_mode);
+    register_field("kismet.datasource.hop_stats", 
+            "Dwell time and captured packets per hop channel", &source_hop_stats);
+    hop_stats_entry_id =
+        register_field("kismet.datasource.hop_stats_entry",
+                tracker_element_factory<kis_datasource_hop_channel>(),
+                "Hop channel statistics");
 
     register_field("kismet.datasource.error", "Source is in error state", &source_error);
     register_field("kismet.datasource.error_reason", 
@@ -1582,6 +1927,56 @@ void kis_datasource::register_fields() {
     register_field("kismet.datasource.num_error_packets", 
             "Number of invalid/error packets seen by source",
             &source_num_error_packets);
+    register_field("kismet.datasource.num_kernel_packets",
+            "Number of packets received by the kernel, if reported by the capture tool",
+            &source_num_kernel_packets);
+    register_field("kismet.datasource.num_kernel_drops",
+            "Number of packets dropped by the kernel before the capture tool could read them, "
+            "if reported by the capture tool",
+            &source_num_kernel_drops);
+
+    register_field("kismet.datasource.replay_target_speed",
+            "Requested replay speed relative to the original capture (0 for as fast as "
+            "possible), if replaying a saved capture",
+            &source_replay_target_speed);
+    register_field("kismet.datasource.replay_speed",
+            "Achieved replay speed relative to the original capture, if replaying a saved "
+            "capture",
+            &source_replay_speed);
+    register_field("kismet.datasource.replay_target_pps",
+            "Requested replay packet rate (0 for unlimited), if replaying a saved capture",
+            &source_replay_target_pps);
+    register_field("kismet.datasource.replay_pps",
+            "Achieved replay packet rate, if replaying a saved capture",
+            &source_replay_pps);
+
+    register_field("kismet.datasource.remote_compression",
+            "Compression used by the remote capture connection, if any",
+            &source_remote_compression);
+    register_field("kismet.datasource.remote_blocks",
+            "Number of compressed blocks received from the remote capture",
+            &source_remote_blocks);
+    register_field("kismet.datasource.remote_raw_bytes",
+            "Uncompressed size of the compressed blocks received from the remote capture",
+            &source_remote_raw_bytes);
+    register_field("kismet.datasource.remote_wire_bytes",
+            "Size of the compressed blocks received from the remote capture",
+            &source_remote_wire_bytes);
+    register_field("kismet.datasource.remote_bytes_saved",
+            "Bytes saved by compressing the remote capture connection",
+            &source_remote_bytes_saved);
+    register_field("kismet.datasource.remote_compression_ratio",
+            "Compression ratio of the remote capture connection",
+            &source_remote_compression_ratio);
+    register_field("kismet.datasource.remote_block_latency",
+            "Recent average time, in milliseconds, the remote capture held packets before "
+            "sending a compressed block",
+            &source_remote_block_latency);
+
+    register_field("kismet.datasource.capture_filter_len",
+            "Number of instructions in the capture filter applied by the capture tool, "
+            "0 if none", 
+            &source_capture_filter_len);
 
     packet_rate_rrd_id = 
         register_dynamic_field("kismet.datasource.packets_rrd", 
@@ -1725,8 +2120,9 @@ void kis_datasource::handle_source_error() {
 
                             if (get_source_hopping()) {
                                 // Reset the channel hop if we're hopping
-                                set_channel_hop(get_source_hop_rate(),
+                                set_channel_hop_dwell(get_source_hop_rate(),
                                         get_source_hop_vec(),
+                                        get_source_hop_dwell_vec()->get(),
                                         get_source_hop_shuffle(),
                                         get_source_hop_offset(),
                                         0, NULL);
@@ -21,7 +21,9 @@
 
 #include "config.h"
 
+#include <atomic>
 #include <functional>
+#include <unordered_map>
 
 #include "globalregistry.h"
 #include "kis_mutex.h"
@@ -34,6 +36,7 @@
 #include "packetchain.h"
 #include "entrytracker.h"
 #include "kis_external.h"
+#include "kis_bpf.h"
 
 #include "protobuf_cpp/kismet.pb.h"
 #include "protobuf_cpp/datasource.pb.h"
@@ -49,6 +52,9 @@ typedef std::shared_ptr<kis_datasource_interface> shared_interface;
 // Simple keyed object derived from the low-level C protocol
 class kis_datasource_cap_keyed_object;
 
+// Per-channel hopping statistics
+class kis_datasource_hop_channel;
+
 class datasource_tracker;
 class kis_datasource;
 
@@ -281,14 +287,40 @@ public:
     // hop+vector but we simplify the API for callers
     virtual void set_channel_hop_list(std::vector<std::string> in_chans, 
             unsigned int in_transaction, configure_callback_t in_cb);
+    // Set the channel hop rate and list with a dwell multiplier for each channel;
+    // an empty dwell list hops at the fixed rate.  Capture tools which predate
+    // per-channel dwell ignore it and hop at the fixed rate.
+    virtual void set_channel_hop_dwell(double in_rate, 
+            std::shared_ptr<tracker_element_vector> in_chans,
+            const std::vector<double>& in_dwell, bool in_shuffle, unsigned int in_offt, 
+            unsigned int in_transaction, configure_callback_t in_cb);
+
+    // Count a packet against the hop channel it was seen on, by channel name or
+    // frequency; this is called for every packet and does not lock the source
+    void count_hop_packet(const std::string& in_channel, double in_freq_khz);
+
+    // Add the time spent hopping since the last update to the per-channel dwell
+    // statistics; the capture tool doesn't report when it tunes, so the time is
+    // split by the dwell assigned to each channel
+    void update_hop_stats(double in_elapsed);
 
+    // Frequency of a hop channel, in kHz, for sources which capture 802.11; 0 if
+    // it can't be worked out from the channel name
+    double hop_channel_freq_khz(const std::string& in_channel);
+
+
+    // Apply a classic BPF capture filter in the capture tool, compiled for the DLT the
+    // source reported; an empty program removes the filter
+    virtual void set_capture_filter(unsigned int in_dlt, const std::vector<kis_bpf_insn>& in_program,
+            unsigned int in_transaction, configure_callback_t in_cb);
 
     // Connect an interface to a pre-existing buffer (such as from a TCP server
     // connection); This doesn't require async because we're just binding the
     // interface; anything we do with the buffer is itself async in the
-    // future however
+    // future however.  in_transport is set when the remote capture negotiated
+    // compressed blocks.
     virtual void connect_remote(std::shared_ptr<buffer_handler_generic> in_ringbuf,
-            std::string in_definition, open_callback_t in_cb);
+            std::string in_definition, bool in_transport, open_callback_t in_cb);
 
 
     // close the source
@@ -348,6 +380,9 @@ public:
     __ProxyGetMS(source_hop_shuffle, uint8_t, bool, source_hop_shuffle, ext_mutex);
     __ProxyGetMS(source_hop_shuffle_skip, uint32_t, uint32_t, source_hop_shuffle_skip, ext_mutex);
     __ProxyTrackableMS(source_hop_vec, tracker_element_vector, source_hop_vec, ext_mutex);
+    __ProxyTrackableMS(source_hop_dwell_vec, tracker_element_vector_double, source_hop_dwell_vec, ext_mutex);
+    __ProxyMS(source_hop_mode, std::string, std::string, std::string, source_hop_mode, ext_mutex);
+    __ProxyTrackableMS(source_hop_stats, tracker_element_string_map, source_hop_stats, ext_mutex);
 
     __ProxyGetMS(source_running, uint8_t, bool, source_running, ext_mutex);
 
@@ -360,6 +395,24 @@ public:
     __ProxyMS(source_num_error_packets, uint64_t, uint64_t, uint64_t, source_num_error_packets, ext_mutex);
     __ProxyIncDecMS(Msource_num_error_packets, uint64_t, uint64_t, source_num_error_packets, ext_mutex);
 
+    __ProxyGetMS(source_num_kernel_packets, uint64_t, uint64_t, source_num_kernel_packets, ext_mutex);
+    __ProxyGetMS(source_num_kernel_drops, uint64_t, uint64_t, source_num_kernel_drops, ext_mutex);
+
+    __ProxyGetMS(source_replay_target_speed, double, double, source_replay_target_speed, ext_mutex);
+    __ProxyGetMS(source_replay_speed, double, double, source_replay_speed, ext_mutex);
+    __ProxyGetMS(source_replay_target_pps, double, double, source_replay_target_pps, ext_mutex);
+    __ProxyGetMS(source_replay_pps, double, double, source_replay_pps, ext_mutex);
+
+    __ProxyGetMS(source_remote_compression, std::string, std::string, source_remote_compression, ext_mutex);
+    __ProxyGetMS(source_remote_blocks, uint64_t, uint64_t, source_remote_blocks, ext_mutex);
+    __ProxyGetMS(source_remote_raw_bytes, uint64_t, uint64_t, source_remote_raw_bytes, ext_mutex);
+    __ProxyGetMS(source_remote_wire_bytes, uint64_t, uint64_t, source_remote_wire_bytes, ext_mutex);
+    __ProxyGetMS(source_remote_bytes_saved, uint64_t, uint64_t, source_remote_bytes_saved, ext_mutex);
+    __ProxyGetMS(source_remote_compression_ratio, double, double, source_remote_compression_ratio, ext_mutex);
+    __ProxyGetMS(source_remote_block_latency, double, double, source_remote_block_latency, ext_mutex);
+
+    __ProxyGetMS(source_capture_filter_len, uint32_t, uint32_t, source_capture_filter_len, ext_mutex);
+
     __ProxyDynamicTrackableMS(source_packet_rrd, kis_tracked_minute_rrd<>, 
             packet_rate_rrd, packet_rate_rrd_id, ext_mutex);
 
@@ -454,6 +507,7 @@ protected:
             transaction = in_trans;
             command_seq = in_seq;
             command_time = time(0);
+            fatal_failure = true;
 
             timetracker = 
                 Globalreg::fetch_mandatory_global_as<time_tracker>();
@@ -482,6 +536,9 @@ protected:
         time_t command_time;
         std::atomic<int> timer_id;
 
+        // Does a failure put the source in an error state
+        bool fatal_failure;
+
         // Callbacks
         list_callback_t list_cb;
         probe_callback_t probe_cb;
@@ -515,6 +572,11 @@ protected:
     virtual void handle_packet_opensource_report(uint32_t in_seqno, const std::string& in_packet);
     virtual void handle_packet_probesource_report(uint32_t in_seqno, const std::string& in_packet);
     virtual void handle_packet_warning_report(uint32_t in_seqno, const std::string& in_packet);
+    virtual void handle_packet_stats_report(uint32_t in_seqno, const std::string& in_packet);
+
+    // Compressed transport statistics for remote sources
+    virtual void handle_transport_block(size_t in_raw_sz, size_t in_wire_sz,
+            uint32_t in_latency_us) override;
 
     // Handle injecting packets into the packet chain after the data report has been received
     // and processed.  Subclasses can override this to manipulate packet content.
@@ -524,8 +586,12 @@ protected:
             configure_callback_t in_cb);
     virtual unsigned int send_configure_channel_hop(double in_rate,
             std::shared_ptr<tracker_element_vector> in_chans,
+            const std::vector<double>& in_dwell,
             bool in_shuffle, unsigned int in_offt, unsigned int in_transaction,
             configure_callback_t in_cb);
+    virtual unsigned int send_configure_filter(unsigned int in_dlt,
+            const std::vector<kis_bpf_insn>& in_program, unsigned int in_transaction,
+            configure_callback_t in_cb);
     virtual unsigned int send_list_interfaces(unsigned int in_transaction, list_callback_t in_cb);
     virtual unsigned int send_open_source(std::string in_definition, unsigned int in_transaction, 
             open_callback_t in_cb);
@@ -622,9 +688,65 @@ protected:
     std::shared_ptr<tracker_element_uint8> source_hop_shuffle;
     std::shared_ptr<tracker_element_uint32> source_hop_shuffle_skip;
 
+    // Dwell multiplier per hop channel, as reported by the capture tool; empty
+    // when hopping at a fixed rate
+    std::shared_ptr<tracker_element_vector_double> source_hop_dwell_vec;
+
+    // Hop scheduling mode, 'fixed' or 'adaptive'
+    std::shared_ptr<tracker_element_string> source_hop_mode;
+
+    // Dwell and captured packets per hop channel
+    std::shared_ptr<tracker_element_string_map> source_hop_stats;
+    int hop_stats_entry_id;
+    std::unordered_map<std::string, std::shared_ptr<kis_datasource_hop_channel>> hop_stats_chan_map;
+
+    // Packets are counted per hop channel from the packet chain without taking the
+    // source lock; the lookup tables are replaced, never modified, when the hop list
+    // changes, and the counts are folded into the hop stats under the source lock
+    struct hop_packet_counts {
+        hop_packet_counts(size_t in_sz) :
+            channels(in_sz),
+            counts(in_sz) { }
+
+        std::unordered_map<std::string, size_t> chan_map;
+        std::unordered_map<double, size_t> freq_map;
+        std::vector<std::shared_ptr<kis_datasource_hop_channel>> channels;
+        std::vector<std::atomic<uint64_t>> counts;
+    };
+    std::shared_ptr<hop_packet_counts> hop_counts;
+
+    // Rebuild the hop statistics for the current hop list, keeping the counts of
+    // channels which are still in it
+    void rebuild_hop_stats();
+
+    // Add the packets counted since the last fold to the hop stats
+    void fold_hop_packets();
+
     std::shared_ptr<tracker_element_uint64> source_num_packets;
     std::shared_ptr<tracker_element_uint64> source_num_error_packets;
 
+    // Capture statistics reported by the capture tool, when it has them
+    std::shared_ptr<tracker_element_uint64> source_num_kernel_packets;
+    std::shared_ptr<tracker_element_uint64> source_num_kernel_drops;
+
+    // Replay rate reported by sources replaying saved captures
+    std::shared_ptr<tracker_element_double> source_replay_target_speed;
+    std::shared_ptr<tracker_element_double> source_replay_speed;
+    std::shared_ptr<tracker_element_double> source_replay_target_pps;
+    std::shared_ptr<tracker_element_double> source_replay_pps;
+
+    // Compressed transport statistics, when a remote source sends compressed blocks
+    std::shared_ptr<tracker_element_string> source_remote_compression;
+    std::shared_ptr<tracker_element_uint64> source_remote_blocks;
+    std::shared_ptr<tracker_element_uint64> source_remote_raw_bytes;
+    std::shared_ptr<tracker_element_uint64> source_remote_wire_bytes;
+    std::shared_ptr<tracker_element_uint64> source_remote_bytes_saved;
+    std::shared_ptr<tracker_element_double> source_remote_compression_ratio;
+    std::shared_ptr<tracker_element_double> source_remote_block_latency;
+
+    // Length of the capture filter applied by the capture tool, if any
+    std::shared_ptr<tracker_element_uint32> source_capture_filter_len;
+
     int packet_rate_rrd_id;
     std::shared_ptr<kis_tracked_minute_rrd<>> packet_rate_rrd;
 
@@ -834,6 +956,77 @@ protected:
 
 };
 
+// kis_datasource_hop_channel
+// Time spent on a hop channel and the packets captured there, so the achieved dwell
+// can be compared with what the channel yields
+
+class kis_datasource_hop_channel : public tracker_component {
+public:
+    kis_datasource_hop_channel() :
+        tracker_component(0) {
+        register_fields();
+        reserve_fields(NULL);
+    }
+
+    kis_datasource_hop_channel(int in_id) :
+        tracker_component(in_id) {
+        register_fields();
+        reserve_fields(NULL);
+    }
+
+    kis_datasource_hop_channel(int in_id, std::shared_ptr<tracker_element_map> e) :
+        tracker_component(in_id) {
+        register_fields();
+        reserve_fields(e);
+    }
+
+    virtual ~kis_datasource_hop_channel() { };
+
+    virtual uint32_t get_signature() const override {
+        return adler32_checksum("kis_datasource_hop_channel");
+    }
+
+    virtual std::unique_ptr<tracker_element> clone_type() override {
+        using this_t = std::remove_pointer<decltype(this)>::type;
+        auto dup = std::unique_ptr<this_t>(new this_t());
+        return std::move(dup);
+    }
+
+    virtual std::unique_ptr<tracker_element> clone_type(int in_id) override {
+        using this_t = std::remove_pointer<decltype(this)>::type;
+        auto dup = std::unique_ptr<this_t>(new this_t(in_id));
+        return std::move(dup);
+    }
+
+    __Proxy(channel, std::string, std::string, std::string, channel);
+    __Proxy(dwell, double, double, double, dwell);
+    __Proxy(dwell_time, double, double, double, dwell_time);
+    __Proxy(packets, uint64_t, uint64_t, uint64_t, packets);
+    __ProxyIncDec(packets, uint64_t, uint64_t, packets);
+    __Proxy(packet_rate, double, double, double, packet_rate);
+
+protected:
+    virtual void register_fields() override {
+        tracker_component::register_fields();
+
+        register_field("kismet.datasource.hop_channel.channel", "Channel", &channel);
+        register_field("kismet.datasource.hop_channel.dwell", 
+                "Dwell multiplier of this channel", &dwell);
+        register_field("kismet.datasource.hop_channel.dwell_time", 
+                "Estimated time spent on this channel, in seconds", &dwell_time);
+        register_field("kismet.datasource.hop_channel.packets", 
+                "Packets captured on this channel", &packets);
+        register_field("kismet.datasource.hop_channel.packet_rate", 
+                "Packets captured per second spent on this channel", &packet_rate);
+    }
+
+    std::shared_ptr<tracker_element_string> channel;
+    std::shared_ptr<tracker_element_double> dwell;
+    std::shared_ptr<tracker_element_double> dwell_time;
+    std::shared_ptr<tracker_element_uint64> packets;
+    std::shared_ptr<tracker_element_double> packet_rate;
+};
+
 // Packet chain component; we need to use a raw pointer here but it only exists
 // for the lifetime of the packet being processed
 class packetchain_comp_datasource : public packet_component {
@@ -270,6 +270,12 @@ int kis_dlt_ppi::handle_packet(kis_packet *in_pack) {
     if (applyfcs)
         applyfcs = 4;
 
+    // A frame truncated by the capture source lost the FCS with the payload
+    unsigned int original_fcs = applyfcs;
+
+    if (linkchunk->truncated())
+        applyfcs = 0;
+
     decapchunk = new kis_datachunk;
 
     decapchunk->dlt = ppi_dlt;
@@ -280,6 +286,9 @@ int kis_dlt_ppi::handle_packet(kis_packet *in_pack) {
                 (uint32_t) MAX_PACKET_LEN),
             false);
 
+    if (linkchunk->truncated() && linkchunk->original_length > ph_len + original_fcs)
+        decapchunk->original_length = linkchunk->original_length - ph_len - original_fcs;
+
     if (radioheader != NULL)
         in_pack->insert(pack_comp_radiodata, radioheader);
     in_pack->insert(pack_comp_decap, decapchunk);
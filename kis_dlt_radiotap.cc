@@ -421,6 +421,13 @@ int kis_dlt_radiotap::handle_packet(kis_packet *in_pack) {
         record_num++;
     }
 
+    // A frame truncated by the capture source lost the FCS with the payload
+    unsigned int original_fcs = fcs_cut;
+
+    if (linkchunk->truncated()) {
+        fcs_cut = 0;
+    }
+
 	if (EXTRACT_LE_16BITS(&(hdr->it_len)) + fcs_cut > (int) linkchunk->length) {
 		/*
 		_MSG("Pcap Radiotap converter got corrupted Radiotap frame, not "
@@ -435,6 +442,12 @@ int kis_dlt_radiotap::handle_packet(kis_packet *in_pack) {
             (linkchunk->length - EXTRACT_LE_16BITS(&(hdr->it_len)) - 
              fcs_cut), false);
 
+    if (linkchunk->truncated() && 
+            linkchunk->original_length > EXTRACT_LE_16BITS(&(hdr->it_len)) + original_fcs) {
+        decapchunk->original_length = linkchunk->original_length - 
+            EXTRACT_LE_16BITS(&(hdr->it_len)) - original_fcs;
+    }
+
 	in_pack->insert(pack_comp_radiodata, radioheader);
 	in_pack->insert(pack_comp_decap, decapchunk);
 
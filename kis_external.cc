@@ -19,6 +19,8 @@
 #include <memory>
 #include <sys/stat.h>
 
+#include <zlib.h>
+
 #include "configfile.h"
 
 #include "json_adapter.h"
@@ -35,6 +37,7 @@
 kis_external_interface::kis_external_interface() :
     buffer_interface(),
     kis_net_httpd_chain_stream_handler(),
+    transport_negotiated {false},
     ext_mutex {std::make_shared<kis_recursive_timed_mutex>()},
     timetracker {Globalreg::fetch_mandatory_global_as<time_tracker>()},
     seqno {0},
@@ -49,6 +52,7 @@ kis_external_interface::kis_external_interface() :
 kis_external_interface::kis_external_interface(std::shared_ptr<kis_recursive_timed_mutex> mutex) :
     buffer_interface(),
     kis_net_httpd_chain_stream_handler(),
+    transport_negotiated {false},
     ext_mutex {mutex != nullptr ? mutex : std::make_shared<kis_recursive_timed_mutex>()},
     timetracker {Globalreg::fetch_mandatory_global_as<time_tracker>()},
     seqno {0},
@@ -91,9 +95,11 @@ kis_external_interface::~kis_external_interface() {
 
 }
 
-void kis_external_interface::connect_buffer(std::shared_ptr<buffer_handler_generic> in_ringbuf) {
+void kis_external_interface::connect_buffer(std::shared_ptr<buffer_handler_generic> in_ringbuf,
+        bool in_transport) {
     local_locker lock(ext_mutex);
 
+    transport_negotiated = in_transport;
     ringbuf_handler = in_ringbuf;
     ext_mutex = in_ringbuf->get_mutex();
     ringbuf_handler->set_read_buffer_interface(this);
@@ -167,6 +173,141 @@ void kis_external_interface::buffer_available(size_t in_amt) {
             return;
         }
 
+        // Compressed blocks of frames from remote capture tools
+        if (kis_ntoh32(frame->signature) == KIS_EXTERNAL_BLOCK_SIG) {
+            auto block = reinterpret_cast<kismet_external_block_t *>(frame);
+
+            if (!transport_negotiated) {
+                ringbuf_handler->peek_free_read_buffer_data(frame);
+
+                _MSG("Kismet external interface got a compressed block from a capture "
+                        "tool which did not negotiate compression", MSGFLAG_ERROR);
+                trigger_error("compressed block without negotiated compression");
+
+                return;
+            }
+
+            if (buffamt < sizeof(kismet_external_block_t)) {
+                ringbuf_handler->peek_free_read_buffer_data(frame);
+                return;
+            }
+
+            data_sz = kis_ntoh32(block->data_sz);
+            frame_sz = data_sz + sizeof(kismet_external_block_t);
+
+            if ((long int) frame_sz >= ringbuf_handler->get_read_buffer_size()) {
+                ringbuf_handler->peek_free_read_buffer_data(frame);
+
+                _MSG_ERROR("Kismet external interface got a compressed block which is too "
+                        "large to be processed ({} / {}), make sure the remote capture "
+                        "block size is smaller than the tcp_buffer_kb buffer.", frame_sz,
+                        ringbuf_handler->get_read_buffer_size());
+                trigger_error("Compressed block too large for buffer");
+
+                return;
+            }
+
+            if (frame_sz > buffamt) {
+                ringbuf_handler->peek_free_read_buffer_data(frame);
+                return;
+            }
+
+            data_checksum = adler32_checksum((const char *) block->data, data_sz);
+
+            if (data_checksum != kis_ntoh32(block->data_checksum)) {
+                ringbuf_handler->peek_free_read_buffer_data(frame);
+
+                _MSG("Kismet external interface got compressed block with invalid checksum",
+                        MSGFLAG_ERROR);
+                trigger_error("compressed block has invalid checksum");
+
+                return;
+            }
+
+            std::vector<std::shared_ptr<KismetExternal::Command>> cmds;
+            std::vector<mux_frame_ref> mux_frames;
+            auto raw_sz = kis_ntoh32(block->raw_sz);
+            auto latency_us = kis_ntoh32(block->latency_us);
+
+            if (!unpack_block(block->data, data_sz, raw_sz, cmds, mux_frames)) {
+                ringbuf_handler->peek_free_read_buffer_data(frame);
+
+                _MSG("Kismet external interface could not interpret the frames in a "
+                        "compressed block", MSGFLAG_ERROR);
+                trigger_error("unparsable compressed block");
+
+                return;
+            }
+
+            ringbuf_handler->peek_free_read_buffer_data(frame);
+            ringbuf_handler->consume_read_buffer_data(frame_sz);
+
+            handle_transport_block(raw_sz, frame_sz, latency_us);
+
+            lock.unlock();
+
+            for (auto c : cmds)
+                dispatch_rx_packet(c);
+
+            // Only this thread decompresses into the block buffer, so the frames stay 
+            // put without the lock
+            for (auto m : mux_frames) {
+                if (!handle_mux_frame(m.stream, block_buf.data() + m.offset, m.len)) {
+                    _MSG_ERROR("Kismet external interface got an unexpected multiplexed frame");
+                    trigger_error("unexpected multiplexed frame");
+                    return;
+                }
+            }
+
+            lock.lock();
+
+            continue;
+        }
+
+        // Frames of one stream of a multiplexed connection; these have no checksum
+        // of their own because the frames inside them do
+        if (kis_ntoh32(frame->signature) == KIS_EXTERNAL_MUX_SIG) {
+            auto mux = reinterpret_cast<kismet_external_mux_frame_t *>(frame);
+
+            data_sz = kis_ntoh32(mux->data_sz);
+            frame_sz = data_sz + sizeof(kismet_external_mux_frame_t);
+
+            if ((long int) frame_sz >= ringbuf_handler->get_read_buffer_size()) {
+                ringbuf_handler->peek_free_read_buffer_data(frame);
+
+                _MSG_ERROR("Kismet external interface got a multiplexed frame which is too "
+                        "large to be processed ({} / {})", frame_sz,
+                        ringbuf_handler->get_read_buffer_size());
+                trigger_error("Multiplexed frame too large for buffer");
+
+                return;
+            }
+
+            if (frame_sz > buffamt) {
+                ringbuf_handler->peek_free_read_buffer_data(frame);
+                return;
+            }
+
+            auto stream = kis_ntoh32(mux->stream);
+
+            mux_buf.assign(mux->data, mux->data + data_sz);
+
+            ringbuf_handler->peek_free_read_buffer_data(frame);
+            ringbuf_handler->consume_read_buffer_data(frame_sz);
+
+            lock.unlock();
+
+            if (!handle_mux_frame(stream, mux_buf.data(), data_sz)) {
+                _MSG_ERROR("Kismet external interface got an unexpected multiplexed frame");
+                trigger_error("unexpected multiplexed frame");
+                return;
+            }
+
+            lock.lock();
+
+            continue;
+        }
+
         // Check the frame signature
         if (kis_ntoh32(frame->signature) != KIS_EXTERNAL_PROTO_SIG) {
             ringbuf_handler->peek_free_read_buffer_data(frame);
@@ -247,6 +388,61 @@ void kis_external_interface::buffer_available(size_t in_amt) {
     }
 }
 
+bool kis_external_interface::unpack_block(const uint8_t *in_data, size_t in_data_sz,
+        size_t in_raw_sz, std::vector<std::shared_ptr<KismetExternal::Command>>& ret,
+        std::vector<mux_frame_ref>& ret_mux) {
+    if (in_raw_sz == 0 || in_raw_sz > KIS_EXTERNAL_BLOCK_MAX)
+        return false;
+
+    if (block_buf.size() < in_raw_sz)
+        block_buf.resize(in_raw_sz);
+
+    uLongf raw_sz = in_raw_sz;
+
+    if (uncompress(block_buf.data(), &raw_sz, in_data, in_data_sz) != Z_OK || raw_sz != in_raw_sz)
+        return false;
+
+    // The zlib stream is already checksummed, so the frames inside aren't checked again
+    size_t pos = 0;
+
+    while (pos < raw_sz) {
+        if (raw_sz - pos < sizeof(kismet_external_frame_t))
+            return false;
+
+        auto frame = reinterpret_cast<kismet_external_frame_t *>(block_buf.data() + pos);
+
+        size_t data_sz = kis_ntoh32(frame->data_sz);
+
+        if (data_sz > raw_sz - pos - sizeof(kismet_external_frame_t))
+            return false;
+
+        // Multiplexed frames have a header the same size as a plain frame
+        if (kis_ntoh32(frame->signature) == KIS_EXTERNAL_MUX_SIG) {
+            auto mux = reinterpret_cast<kismet_external_mux_frame_t *>(frame);
+
+            ret_mux.push_back(mux_frame_ref{kis_ntoh32(mux->stream), 
+                    pos + sizeof(kismet_external_mux_frame_t), data_sz});
+
+            pos += sizeof(kismet_external_mux_frame_t) + data_sz;
+            continue;
+        }
+
+        if (kis_ntoh32(frame->signature) != KIS_EXTERNAL_PROTO_SIG)
+            return false;
+
+        auto cmd = std::make_shared<KismetExternal::Command>();
+
+        if (!cmd->ParseFromArray(frame->data, data_sz))
+            return false;
+
+        ret.push_back(cmd);
+
+        pos += sizeof(kismet_external_frame_t) + data_sz;
+    }
+
+    return true;
+}
+
 void kis_external_interface::buffer_error(std::string in_error) {
     // Try to read anything left in the buffer in case we're exiting w/ pending valid data
     buffer_available(0);
@@ -64,8 +64,10 @@ public:
     kis_external_interface(std::shared_ptr<kis_recursive_timed_mutex> mutex);
     virtual ~kis_external_interface();
 
-    // Connect an existing buffer, such as a TCP socket or IPC pipe
-    virtual void connect_buffer(std::shared_ptr<buffer_handler_generic> in_ringbuf);
+    // Connect an existing buffer, such as a TCP socket or IPC pipe; in_transport is set 
+    // when compressed blocks were negotiated with the other end of the buffer
+    virtual void connect_buffer(std::shared_ptr<buffer_handler_generic> in_ringbuf,
+            bool in_transport = false);
 
     // Trigger an error condition and call all the related functions
     virtual void trigger_error(std::string reason);
@@ -128,6 +130,40 @@ protected:
     // Central packet dispatch handler
     virtual bool dispatch_rx_packet(std::shared_ptr<KismetExternal::Command> c);
 
+    // Multiplexed frames unpacked from a block, by position in the block buffer
+    struct mux_frame_ref {
+        uint32_t stream;
+        size_t offset;
+        size_t len;
+    };
+
+    // Decompress a block of frames from a remote capture and parse the commands in it
+    bool unpack_block(const uint8_t *in_data, size_t in_data_sz, size_t in_raw_sz,
+            std::vector<std::shared_ptr<KismetExternal::Command>>& ret,
+            std::vector<mux_frame_ref>& ret_mux);
+
+    // Called with the ext_mutex held for each compressed block received, with the size
+    // of the frames it held and the size it took on the wire
+    virtual void handle_transport_block(size_t in_raw_sz, size_t in_wire_sz,
+            uint32_t in_latency_us) { }
+
+    // Decompression buffer for compressed blocks
+    std::vector<uint8_t> block_buf;
+
+    // Was the compressed transport negotiated with the capture tool?  Blocks from 
+    // anything else are a protocol error
+    bool transport_negotiated;
+
+    // Called without the ext_mutex held for the frames of a stream of a multiplexed remote 
+    // capture connection; only the multiplexer accepts them, everything else treats them
+    // as a protocol error
+    virtual bool handle_mux_frame(uint32_t in_stream, const uint8_t *in_data, size_t in_data_sz) {
+        return false;
+    }
+
+    // Copy of the multiplexed frame being handled
+    std::vector<uint8_t> mux_buf;
+
     // Generic msg proxy
     virtual void handle_msg_proxy(const std::string& msg, const int msgtype); 
 
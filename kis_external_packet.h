@@ -44,5 +44,49 @@ struct kismet_external_frame {
 } __attribute__((packed));
 typedef struct kismet_external_frame kismet_external_frame_t;
 
+#define KIS_EXTERNAL_BLOCK_SIG    0xDECAFBAC
+
+/* Largest uncompressed block either side will accept */
+#define KIS_EXTERNAL_BLOCK_MAX    (1024 * 1024 * 4)
+
+/* Compressed block of frames, sent by remote capture tools once Kismet has
+ * enabled compression with a KDSTRANSPORT command.  The payload is a zlib stream
+ * of one or more complete kismet_external_frame records, back to back. */
+struct kismet_external_block {
+    /* Fixed Start-of-block signature, big endian */
+    uint32_t signature;
+    /* Basic adler32 checksum of the compressed data */
+    uint32_t data_checksum;
+    /* Size of the compressed data */
+    uint32_t data_sz;
+    /* Size of the frames once uncompressed */
+    uint32_t raw_sz;
+    /* Time the oldest frame in the block waited to be sent, in microseconds */
+    uint32_t latency_us;
+    /* Compressed frames */
+    uint8_t data[0];
+} __attribute__((packed));
+typedef struct kismet_external_block kismet_external_block_t;
+
+#define KIS_EXTERNAL_MUX_SIG      0xDECAFBAE
+
+/* Frames of one source on a multiplexed remote capture connection, which carries
+ * several sources after the capture tool sends a KDSMUX command.  The header is the
+ * same size as a kismet_external_frame, with the data size in the same place, so 
+ * multiplexed frames can be put in compressed blocks.  The payload is the next part
+ * of the byte stream of the source, which the receiver reassembles into frames; 
+ * an empty payload closes the stream. */
+struct kismet_external_mux_frame {
+    /* Fixed Start-of-frame signature, big endian */
+    uint32_t signature;
+    /* Stream the data belongs to, assigned by the capture tool */
+    uint32_t stream;
+    /* Size of the data */
+    uint32_t data_sz;
+    /* Data of the stream */
+    uint8_t data[0];
+} __attribute__((packed));
+typedef struct kismet_external_mux_frame kismet_external_mux_frame_t;
+
 #endif
 
@@ -18,40 +18,219 @@
 
 #include "config.h"
 
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include <algorithm>
+#include <fstream>
+
+#include "configfile.h"
+#include "json_adapter.h"
 #include "kis_pcapnglogfile.h"
+#include "messagebus.h"
+#include "timetracker.h"
 
 kis_pcapng_logfile::kis_pcapng_logfile(shared_log_builder in_builder) :
     kis_logfile(in_builder) {
 
     pcapng_stream = NULL;
-    pcapng_file = NULL;
+    pcapng_block_file = NULL;
+
+    rotate_enabled = false;
+    rotate_size = 0;
+    rotate_age = 0;
+    rotate_timer_id = -1;
+    segment_opened = 0;
+
+    compress_level = 6;
+    compress_shutdown = false;
+
+    stats_bytes_id =
+        Globalreg::globalreg->entrytracker->register_field("kismet.pcapng.writer.bytes",
+                tracker_element_factory<tracker_element_uint64>(),
+                "bytes written to the pcapng log");
+    stats_blocks_id =
+        Globalreg::globalreg->entrytracker->register_field("kismet.pcapng.writer.blocks",
+                tracker_element_factory<tracker_element_uint64>(),
+                "blocks written to the pcapng log");
+    stats_queued_id =
+        Globalreg::globalreg->entrytracker->register_field("kismet.pcapng.writer.queued_blocks",
+                tracker_element_factory<tracker_element_uint64>(),
+                "full blocks waiting to be written");
+    stats_stalls_id =
+        Globalreg::globalreg->entrytracker->register_field("kismet.pcapng.writer.stalls",
+                tracker_element_factory<tracker_element_uint64>(),
+                "times packet logging waited for a free block");
+    stats_stall_ms_id =
+        Globalreg::globalreg->entrytracker->register_field("kismet.pcapng.writer.stall_ms",
+                tracker_element_factory<tracker_element_uint64>(),
+                "total time packet logging waited for a free block (ms)");
+    stats_errors_id =
+        Globalreg::globalreg->entrytracker->register_field("kismet.pcapng.writer.write_errors",
+                tracker_element_factory<tracker_element_uint64>(),
+                "failed block writes");
+    stats_direct_id =
+        Globalreg::globalreg->entrytracker->register_field("kismet.pcapng.writer.direct_io",
+                tracker_element_factory<tracker_element_uint8>(),
+                "blocks are written with direct IO");
 }
 
 kis_pcapng_logfile::~kis_pcapng_logfile() {
     close_log();
 }
 
+std::shared_ptr<buffer_handler_generic> kis_pcapng_logfile::open_file(const std::string& in_path,
+        threaded_file_write_buffer **block_file) {
+    *block_file = NULL;
+
+    if (!Globalreg::globalreg->kismet_config->fetch_opt_bool("pcapng_log_writer", false)) {
+        auto pcapng_file = new file_write_buffer(in_path, 16384);
+        return std::make_shared<buffer_handler<file_write_buffer>>(nullptr, pcapng_file);
+    }
+
+    auto block_kb = 
+        Globalreg::globalreg->kismet_config->fetch_opt_uint("pcapng_log_block_kb", 4096);
+    auto num_blocks =
+        Globalreg::globalreg->kismet_config->fetch_opt_uint("pcapng_log_blocks", 2);
+    auto direct =
+        Globalreg::globalreg->kismet_config->fetch_opt_bool("pcapng_log_direct_io", false);
+    auto flush_ms =
+        Globalreg::globalreg->kismet_config->fetch_opt_uint("pcapng_log_flush_ms", 1000);
+
+    *block_file = 
+        new threaded_file_write_buffer(in_path, (size_t) block_kb * 1024, num_blocks,
+                direct, std::chrono::milliseconds(std::max(10U, flush_ms)));
+
+    return std::make_shared<buffer_handler<threaded_file_write_buffer>>(nullptr, *block_file);
+}
+
 bool kis_pcapng_logfile::open_log(std::string in_path) {
     local_locker lock(&log_mutex);
 
     set_int_log_path(in_path);
 
-    // Try to open the logfile for writing as a buffer
+    auto rotate_mb =
+        Globalreg::globalreg->kismet_config->fetch_opt_uint("pcapng_log_rotate_mb", 0);
+    auto rotate_sec =
+        Globalreg::globalreg->kismet_config->fetch_opt_uint("pcapng_log_rotate_sec", 0);
+
+    rotate_size = (uint64_t) rotate_mb * 1024 * 1024;
+    rotate_age = rotate_sec;
+    rotate_enabled = rotate_size != 0 || rotate_age != 0;
+
+    compress_type = 
+        Globalreg::globalreg->kismet_config->fetch_opt_dfl("pcapng_log_compress", "none");
+    compress_level = 
+        Globalreg::globalreg->kismet_config->fetch_opt_int("pcapng_log_compress_level", 6);
+    compress_level = std::min(9, std::max(1, compress_level));
+
+    if (compress_type == "none" || compress_type == "false") {
+        compress_type = "";
+    } else if (compress_type != "gzip") {
+        _MSG_ERROR("Unknown pcapng_log_compress type '{}', pcapng log segments will be "
+                "compressed with gzip.", compress_type);
+        compress_type = "gzip";
+    }
+
+    auto path = in_path;
+
+    if (rotate_enabled) {
+        segment_base = in_path;
+
+        if (segment_base.length() > 7 && 
+                segment_base.substr(segment_base.length() - 7) == ".pcapng")
+            segment_base = segment_base.substr(0, segment_base.length() - 7);
+
+        manifest_path = segment_base + ".manifest.json";
+
+        {
+            std::lock_guard<std::mutex> lk(segment_mutex);
+            segments.clear();
+        }
+
+        path = segment_path(1);
+    }
+
+    // Try to open the logfile for writing as a buffer, and make a buffer handler stub to
+    // write to our file
     try {
-        pcapng_file = new file_write_buffer(in_path, 16384);
+        bufferhandler = open_file(path, &pcapng_block_file);
     } catch (std::exception& e) {
-        _MSG("Failed to open pcapng dump file '" + in_path + "': " +
+        _MSG("Failed to open pcapng dump file '" + path + "': " +
                 e.what(), MSGFLAG_ERROR);
         return false;
     }
 
-    // Make a buffer handler stub to write to our file
-    bufferhandler.reset(new buffer_handler<file_write_buffer>(NULL, pcapng_file));
+    if (pcapng_block_file != NULL) {
+        if (Globalreg::globalreg->kismet_config->fetch_opt_bool("pcapng_log_direct_io", false) &&
+                !pcapng_block_file->get_direct())
+            _MSG_INFO("The filesystem holding pcapng log '{}' does not support direct IO; "
+                    "using buffered IO instead.", path);
+
+        _MSG_INFO("Writing pcapng log in {} blocks of {}KB from a writer thread{}", 
+                std::max(2U, Globalreg::globalreg->kismet_config->fetch_opt_uint("pcapng_log_blocks", 2)),
+                pcapng_block_file->get_block_size() / 1024, 
+                pcapng_block_file->get_direct() ? " with direct IO" : "");
+
+        writer_stats_endp =
+            std::make_shared<kis_net_httpd_simple_tracked_endpoint>("/logging/pcapng/writer_stats",
+                    [this]() -> std::shared_ptr<tracker_element> { return writer_stats(); },
+                    &log_mutex);
+    }
 
     // Generate the pcap stream itself
     pcapng_stream = new pcap_stream_packetchain(Globalreg::globalreg, bufferhandler, NULL, NULL);
 
-    _MSG("Opened pcapng log file '" + in_path + "'", MSGFLAG_INFO);
+    if (rotate_enabled) {
+        segment_opened = time(0);
+
+        {
+            std::lock_guard<std::mutex> lk(segment_mutex);
+            segments.push_back(pcapng_segment {1, path, segment_opened, segment_opened, 
+                    0, false, ""});
+            write_manifest();
+        }
+
+        if (compress_type.length() > 0) {
+            compress_shutdown = false;
+            compress_thread = std::thread([this]() { compressor(); });
+        }
+
+        auto timetracker = 
+            Globalreg::fetch_mandatory_global_as<time_tracker>("TIMETRACKER");
+
+        rotate_timer_id = 
+            timetracker->register_timer(SERVER_TIMESLICES_SEC, NULL, 1, [this](int) -> int {
+                local_locker lock(&log_mutex);
+
+                if (pcapng_stream == NULL || bufferhandler == nullptr)
+                    return 1;
+
+                if ((rotate_size != 0 && 
+                            (uint64_t) bufferhandler->get_write_buffer_used() >= rotate_size) ||
+                        (rotate_age != 0 && time(0) - segment_opened >= rotate_age))
+                    rotate_segment();
+
+                return 1;
+            });
+
+        set_int_log_path(manifest_path);
+
+        _MSG_INFO("Opened rotating pcapng log '{}', starting a new segment every {}{}{}",
+                manifest_path, 
+                rotate_mb != 0 ? fmt::format("{}MB", rotate_mb) : "",
+                rotate_mb != 0 && rotate_sec != 0 ? " or " : "",
+                rotate_sec != 0 ? fmt::format("{} seconds", rotate_sec) : "");
+    } else {
+        _MSG("Opened pcapng log file '" + in_path + "'", MSGFLAG_INFO);
+    }
 
     set_int_log_open(true);
 
@@ -63,13 +242,307 @@ void kis_pcapng_logfile::close_log() {
 
     set_int_log_open(false);
 
+    if (rotate_timer_id >= 0) {
+        auto timetracker = 
+            Globalreg::fetch_global_as<time_tracker>("TIMETRACKER");
+        if (timetracker != nullptr)
+            timetracker->remove_timer(rotate_timer_id);
+        rotate_timer_id = -1;
+    }
+
     if (pcapng_stream != NULL) {
         pcapng_stream->stop_stream("Log closing");
         delete(pcapng_stream);
         pcapng_stream = NULL;
     }
 
+    writer_stats_endp.reset();
+
+    // Releasing the handler flushes and closes the file
+    auto had_file = bufferhandler != nullptr;
     bufferhandler.reset();
-    pcapng_file = NULL;
+    pcapng_block_file = NULL;
+
+    if (rotate_enabled && had_file)
+        close_segment();
+
+    // Finish compressing the closed segments before the log is considered closed
+    if (compress_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lk(compress_mutex);
+            compress_shutdown = true;
+        }
+
+        compress_cv.notify_one();
+        compress_thread.join();
+    }
+}
+
+std::string kis_pcapng_logfile::segment_path(unsigned int number) {
+    return fmt::format("{}-{:06}.pcapng", segment_base, number);
+}
+
+void kis_pcapng_logfile::write_manifest() {
+    // Segments are listed relative to the manifest
+    auto relative = [this](const std::string& path) -> std::string {
+        auto slash = manifest_path.find_last_of('/');
+
+        if (slash != std::string::npos && path.compare(0, slash + 1, manifest_path, 0, slash + 1) == 0)
+            return path.substr(slash + 1);
+
+        return path;
+    };
+
+    auto tmp_path = manifest_path + ".tmp";
+
+    std::ofstream ofs(tmp_path, std::ios::out | std::ios::trunc);
+
+    if (!ofs.is_open()) {
+        _MSG_ERROR("Unable to write pcapng log manifest '{}': {}", tmp_path, 
+                kis_strerror_r(errno));
+        return;
+    }
+
+    ofs << "{\n    \"segments\": [";
+
+    bool first = true;
+
+    for (const auto& s : segments) {
+        ofs << (first ? "\n" : ",\n");
+        first = false;
+
+        ofs << fmt::format("        {{\"segment\": {}, \"file\": \"{}\", \"first_time\": {}, "
+                "\"last_time\": {}, \"bytes\": {}, \"closed\": {}, \"compression\": \"{}\"}}",
+                s.number, json_adapter::sanitize_string(relative(s.path)), 
+                s.first_time, s.last_time, s.bytes, s.closed ? "true" : "false",
+                s.compression.length() > 0 ? s.compression : "none");
+    }
+
+    ofs << "\n    ]\n}\n";
+    ofs.close();
+
+    if (ofs.fail() || rename(tmp_path.c_str(), manifest_path.c_str()) < 0) {
+        _MSG_ERROR("Unable to write pcapng log manifest '{}': {}", manifest_path,
+                kis_strerror_r(errno));
+        unlink(tmp_path.c_str());
+    }
+}
+
+bool kis_pcapng_logfile::rotate_segment() {
+    unsigned int number;
+
+    {
+        std::lock_guard<std::mutex> lk(segment_mutex);
+        number = segments.back().number + 1;
+    }
+
+    auto path = segment_path(number);
+
+    std::shared_ptr<buffer_handler_generic> next_handler;
+    threaded_file_write_buffer *next_block_file;
+
+    try {
+        next_handler = open_file(path, &next_block_file);
+    } catch (std::exception& e) {
+        _MSG_ERROR("Failed to open the next pcapng log segment '{}', continuing to write "
+                "the current segment: {}", path, e.what());
+        // Don't retry every second
+        segment_opened = time(0);
+        return false;
+    }
+
+    // Packets go to the new segment from here on
+    pcapng_stream->replace_handler(next_handler);
+
+    // Releasing the old handler flushes and closes the previous segment
+    bufferhandler = next_handler;
+    pcapng_block_file = next_block_file;
+
+    close_segment();
+
+    segment_opened = time(0);
+
+    {
+        std::lock_guard<std::mutex> lk(segment_mutex);
+        segments.push_back(pcapng_segment {number, path, segment_opened, segment_opened, 
+                0, false, ""});
+        write_manifest();
+    }
+
+    return true;
+}
+
+void kis_pcapng_logfile::close_segment() {
+    unsigned int number;
+
+    {
+        std::lock_guard<std::mutex> lk(segment_mutex);
+
+        if (segments.size() == 0)
+            return;
+
+        auto& s = segments.back();
+
+        struct stat st;
+        if (stat(s.path.c_str(), &st) == 0)
+            s.bytes = st.st_size;
+
+        s.last_time = time(0);
+        s.closed = true;
+        number = s.number;
+
+        write_manifest();
+    }
+
+    if (compress_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lk(compress_mutex);
+            compress_queue.push_back(number);
+        }
+
+        compress_cv.notify_one();
+    }
+}
+
+void kis_pcapng_logfile::compressor() {
+#ifdef __linux__
+    // Compression should only use otherwise idle CPU and disk time, so that it never
+    // competes with capture
+    auto tid = syscall(SYS_gettid);
+
+    setpriority(PRIO_PROCESS, tid, 19);
+
+#ifdef SYS_ioprio_set
+    // IOPRIO_WHO_PROCESS, IOPRIO_CLASS_IDLE
+    syscall(SYS_ioprio_set, 1, tid, 3 << 13);
+#endif
+#endif
+
+    while (true) {
+        unsigned int number;
+
+        {
+            std::unique_lock<std::mutex> lk(compress_mutex);
+
+            compress_cv.wait(lk, [this]() { 
+                return compress_queue.size() > 0 || compress_shutdown; 
+            });
+
+            // Drain the queue before shutting down
+            if (compress_queue.size() == 0)
+                return;
+
+            number = compress_queue.front();
+            compress_queue.pop_front();
+        }
+
+        std::string path;
+
+        {
+            std::lock_guard<std::mutex> lk(segment_mutex);
+
+            for (const auto& s : segments) {
+                if (s.number == number) {
+                    path = s.path;
+                    break;
+                }
+            }
+        }
+
+        if (path.length() == 0)
+            continue;
+
+        auto out_path = path + ".gz";
+
+        if (!compress_file(path, out_path))
+            continue;
+
+        unlink(path.c_str());
+
+        std::lock_guard<std::mutex> lk(segment_mutex);
+
+        for (auto& s : segments) {
+            if (s.number == number) {
+                s.path = out_path;
+                s.compression = compress_type;
+                break;
+            }
+        }
+
+        write_manifest();
+    }
+}
+
+bool kis_pcapng_logfile::compress_file(const std::string& in_path, const std::string& out_path) {
+    auto tmp_path = out_path + ".tmp";
+
+    FILE *in_f = fopen(in_path.c_str(), "rb");
+
+    if (in_f == NULL) {
+        _MSG_ERROR("Unable to compress pcapng log segment '{}': {}", in_path,
+                kis_strerror_r(errno));
+        return false;
+    }
+
+    auto out_f = gzopen(tmp_path.c_str(), fmt::format("wb{}", compress_level).c_str());
+
+    if (out_f == NULL) {
+        _MSG_ERROR("Unable to compress pcapng log segment '{}', could not open '{}': {}", 
+                in_path, tmp_path, kis_strerror_r(errno));
+        fclose(in_f);
+        return false;
+    }
+
+    std::vector<char> buf(1024 * 1024);
+    size_t len;
+    bool ok = true;
+
+    while ((len = fread(buf.data(), 1, buf.size(), in_f)) > 0) {
+        if (gzwrite(out_f, buf.data(), len) != (int) len) {
+            ok = false;
+            break;
+        }
+    }
+
+    if (ferror(in_f))
+        ok = false;
+
+    fclose(in_f);
+
+    if (gzclose(out_f) != Z_OK)
+        ok = false;
+
+    if (!ok || rename(tmp_path.c_str(), out_path.c_str()) < 0) {
+        _MSG_ERROR("Unable to compress pcapng log segment '{}', keeping it uncompressed.",
+                in_path);
+        unlink(tmp_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+std::shared_ptr<tracker_element> kis_pcapng_logfile::writer_stats() {
+    auto ret = std::make_shared<tracker_element_map>();
+
+    if (pcapng_block_file == NULL)
+        return ret;
+
+    ret->insert(std::make_shared<tracker_element_uint64>(stats_bytes_id, 
+                pcapng_block_file->get_bytes_written()));
+    ret->insert(std::make_shared<tracker_element_uint64>(stats_blocks_id, 
+                pcapng_block_file->get_blocks_written()));
+    ret->insert(std::make_shared<tracker_element_uint64>(stats_queued_id, 
+                pcapng_block_file->get_blocks_queued()));
+    ret->insert(std::make_shared<tracker_element_uint64>(stats_stalls_id, 
+                pcapng_block_file->get_stalls()));
+    ret->insert(std::make_shared<tracker_element_uint64>(stats_stall_ms_id, 
+                pcapng_block_file->get_stall_usec() / 1000));
+    ret->insert(std::make_shared<tracker_element_uint64>(stats_errors_id, 
+                pcapng_block_file->get_write_errors()));
+    ret->insert(std::make_shared<tracker_element_uint8>(stats_direct_id, 
+                pcapng_block_file->get_direct()));
+
+    return ret;
 }
 
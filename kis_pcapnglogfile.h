@@ -21,11 +21,18 @@
 
 #include "config.h"
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include "globalregistry.h"
 #include "logtracker.h"
 
 #include "pcapng_stream_ringbuf.h"
 #include "filewritebuf.h"
+#include "kis_net_microhttpd.h"
 
 class kis_pcapng_logfile : public kis_logfile {
 public:
@@ -37,8 +44,72 @@ public:
 
 protected:
     pcap_stream_packetchain *pcapng_stream;
-    std::shared_ptr<buffer_handler<file_write_buffer> > bufferhandler;
-    file_write_buffer *pcapng_file;
+    std::shared_ptr<buffer_handler_generic> bufferhandler;
+
+    // Threaded block writer, when enabled; owned by the buffer handler
+    threaded_file_write_buffer *pcapng_block_file;
+
+    int stats_bytes_id, stats_blocks_id, stats_queued_id, stats_stalls_id, 
+        stats_stall_ms_id, stats_errors_id, stats_direct_id;
+    std::shared_ptr<kis_net_httpd_simple_tracked_endpoint> writer_stats_endp;
+
+    std::shared_ptr<tracker_element> writer_stats();
+
+    // Open a file and the buffer handler which writes it; sets the block writer when
+    // the threaded writer is enabled.  Throws on failure.
+    std::shared_ptr<buffer_handler_generic> open_file(const std::string& in_path,
+            threaded_file_write_buffer **block_file);
+
+    // Rotating logs are written to numbered segments (Kismet-...-000001.pcapng, etc),
+    // and a new segment is started when the current one grows past the size or age 
+    // limit.  Closed segments are compressed by a background thread, and the manifest
+    // (Kismet-....manifest.json) lists the time range and file of every segment.
+    struct pcapng_segment {
+        unsigned int number;
+        std::string path;
+        time_t first_time;
+        time_t last_time;
+        uint64_t bytes;
+        bool closed;
+        std::string compression;
+    };
+
+    bool rotate_enabled;
+    uint64_t rotate_size;
+    time_t rotate_age;
+    int rotate_timer_id;
+
+    std::string segment_base;
+    std::string manifest_path;
+    time_t segment_opened;
+
+    // Segments are shared with the compression thread
+    std::mutex segment_mutex;
+    std::vector<pcapng_segment> segments;
+
+    std::string segment_path(unsigned int number);
+
+    // Write the manifest; caller holds the segment mutex
+    void write_manifest();
+
+    // Start the next segment; caller holds the log mutex
+    bool rotate_segment();
+
+    // Record the final size of the current segment once the file has been closed, 
+    // and queue it for compression
+    void close_segment();
+
+    std::string compress_type;
+    int compress_level;
+
+    std::thread compress_thread;
+    std::mutex compress_mutex;
+    std::condition_variable compress_cv;
+    std::deque<unsigned int> compress_queue;
+    bool compress_shutdown;
+
+    void compressor();
+    bool compress_file(const std::string& in_path, const std::string& out_path);
 };
 
 class pcapng_logfile_builder : public kis_logfile_builder {
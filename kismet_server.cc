@@ -63,6 +63,7 @@
 #include "kis_datasource.h"
 #include "datasourcetracker.h"
 #include "datasource_pcapfile.h"
+#include "datasource_offline.h"
 #include "datasource_kismetdb.h"
 #include "datasource_linux_wifi.h"
 #include "datasource_linux_bluetooth.h"
@@ -80,6 +81,7 @@
 #include "datasource_virtual.h"
 #include "datasource_dot11_scan.h"
 #include "datasource_bluetooth_scan.h"
+#include "datasource_tzsp.h"
 
 #include "logtracker.h"
 #include "kis_ppilogfile.h"
@@ -116,6 +118,7 @@
 #include "manuf.h"
 #include "entrytracker.h"
 #include "json_adapter.h"
+#include "msgpack_adapter.h"
 
 #ifndef exec_name
 char *exec_name;
@@ -791,6 +794,9 @@ int main(int argc, char *argv[], char *envp[]) {
     entrytracker->register_serializer("itjson", std::make_shared<it_json_adapter::serializer>());
     entrytracker->register_serializer("prettyjson", std::make_shared<pretty_json_adapter::serializer>());
     entrytracker->register_serializer("storagejson", std::make_shared<storage_json_adapter::serializer>());
+    entrytracker->register_serializer("msgpack", std::make_shared<msgpack_adapter::serializer>());
+    entrytracker->register_serializer("idmsgpack", std::make_shared<msgpack_adapter::id_serializer>());
+    entrytracker->register_serializer("storagemsgpack", std::make_shared<msgpack_adapter::storage_serializer>());
 
     entrytracker->register_serializer("jcmd", std::make_shared<json_adapter::serializer>());
     entrytracker->register_serializer("cmd", std::make_shared<json_adapter::serializer>());
@@ -908,6 +914,7 @@ int main(int argc, char *argv[], char *envp[]) {
 
     // Add the datasources
     datasourcetracker->register_datasource(shared_datasource_builder(new datasource_pcapfile_builder()));
+    datasourcetracker->register_datasource(shared_datasource_builder(new datasource_offline_builder()));
     datasourcetracker->register_datasource(shared_datasource_builder(new datasource_kismetdb_builder()));
     datasourcetracker->register_datasource(shared_datasource_builder(new datasource_linux_wifi_builder()));
     datasourcetracker->register_datasource(shared_datasource_builder(new datasource_linux_bluetooth_builder()));
@@ -940,6 +947,9 @@ int main(int argc, char *argv[], char *envp[]) {
 	dot11_scan_source::create_dot11_scan_source();
     bluetooth_scan_source::create_bluetooth_scan_source();
 
+    // Create the TZSP listener, if enabled
+    tzsp_source::create_tzsp_source();
+
     std::shared_ptr<plugin_tracker> plugintracker;
 
     // Start the plugin handler
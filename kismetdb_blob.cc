@@ -0,0 +1,604 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <zlib.h>
+
+#include <cmath>
+
+#include "kismetdb_blob.h"
+
+namespace {
+
+// zlib only looks back 32k, so only the end of a larger dictionary would be used
+const size_t max_dictionary_sz = 32768;
+
+// Compression streams are expensive to set up, so each thread keeps one and resets it
+// for every record
+struct deflate_state {
+    deflate_state() :
+        level {-1},
+        initialized {false} {
+        memset(&zs, 0, sizeof(zs));
+    }
+
+    ~deflate_state() {
+        if (initialized)
+            deflateEnd(&zs);
+    }
+
+    z_stream zs;
+    int level;
+    bool initialized;
+};
+
+thread_local deflate_state thread_deflate;
+
+
+// Reads storage MessagePack records (see msgpack_adapter.h) back as the JSON the json
+// serializer writes, so the log tools don't need to know which format was logged
+class storage_msgpack_reader {
+public:
+    storage_msgpack_reader(const std::string& in) :
+        data {in},
+        pos {0} { }
+
+    std::string to_json() {
+        std::string out;
+        element(out);
+
+        if (pos != data.length())
+            throw std::runtime_error("trailing data after msgpack record");
+
+        return out;
+    }
+
+protected:
+    const std::string& data;
+    size_t pos;
+
+    uint8_t peek() {
+        if (pos >= data.length())
+            throw std::runtime_error("truncated msgpack record");
+        return (uint8_t) data[pos];
+    }
+
+    uint8_t next() {
+        auto r = peek();
+        pos++;
+        return r;
+    }
+
+    uint64_t read_be(unsigned int len) {
+        uint64_t v = 0;
+
+        for (unsigned int i = 0; i < len; i++)
+            v = (v << 8) | next();
+
+        return v;
+    }
+
+    std::string read_bytes(size_t len) {
+        if (data.length() - pos < len)
+            throw std::runtime_error("truncated msgpack record");
+
+        auto r = data.substr(pos, len);
+        pos += len;
+        return r;
+    }
+
+    bool next_is_array() {
+        auto b = peek();
+        return (b & 0xf0) == 0x90 || b == 0xdc || b == 0xdd;
+    }
+
+    size_t array_header() {
+        auto b = next();
+
+        if ((b & 0xf0) == 0x90)
+            return b & 0x0f;
+        if (b == 0xdc)
+            return read_be(2);
+        if (b == 0xdd)
+            return read_be(4);
+
+        throw std::runtime_error("expected msgpack array");
+    }
+
+    std::string string() {
+        auto b = next();
+
+        if ((b & 0xe0) == 0xa0)
+            return read_bytes(b & 0x1f);
+        if (b == 0xd9)
+            return read_bytes(read_be(1));
+        if (b == 0xda)
+            return read_bytes(read_be(2));
+        if (b == 0xdb)
+            return read_bytes(read_be(4));
+
+        throw std::runtime_error("expected msgpack string");
+    }
+
+    static void quote(std::string& out, const std::string& s) {
+        char hbuf[8];
+
+        out += '"';
+
+        for (auto c : s) {
+            switch (c) {
+                case '"':
+                    out += "\\\"";
+                    break;
+                case '\\':
+                    out += "\\\\";
+                    break;
+                case '\b':
+                    out += "\\b";
+                    break;
+                case '\f':
+                    out += "\\f";
+                    break;
+                case '\n':
+                    out += "\\n";
+                    break;
+                case '\r':
+                    out += "\\r";
+                    break;
+                case '\t':
+                    out += "\\t";
+                    break;
+                default:
+                    if ((uint8_t) c <= 0x1f) {
+                        snprintf(hbuf, sizeof(hbuf), "\\u%04x", (unsigned int) c);
+                        out += hbuf;
+                    } else {
+                        out += c;
+                    }
+                    break;
+            }
+        }
+
+        out += '"';
+    }
+
+    static void number(std::string& out, double d) {
+        char nbuf[64];
+
+        if (std::isnan(d) || std::isinf(d)) {
+            out += "0";
+            return;
+        }
+
+        if (floor(d) == d)
+            snprintf(nbuf, sizeof(nbuf), "%.0f", d);
+        else
+            snprintf(nbuf, sizeof(nbuf), "%f", d);
+
+        out += nbuf;
+    }
+
+    void ext(std::string& out, int8_t type, size_t len) {
+        auto b = read_bytes(len);
+        auto u = (const uint8_t *) b.data();
+        char ebuf[64];
+
+        if (type == 1 && len == 6) {
+            snprintf(ebuf, sizeof(ebuf), "\"%02X:%02X:%02X:%02X:%02X:%02X\"",
+                    u[0], u[1], u[2], u[3], u[4], u[5]);
+        } else if (type == 2 && len == 16) {
+            snprintf(ebuf, sizeof(ebuf), 
+                    "\"%02X%02X%02X%02X-%02X%02X-%02X%02X-%02X%02X-%02X%02X%02X%02X%02X%02X\"",
+                    u[0], u[1], u[2], u[3], u[4], u[5], u[6], u[7], u[8], u[9],
+                    u[10], u[11], u[12], u[13], u[14], u[15]);
+        } else if (type == 3 && len == 16) {
+            // Device keys are written as the hex of the keys in network order
+            uint64_t spkey, dkey;
+            memcpy(&spkey, u, 8);
+            memcpy(&dkey, u + 8, 8);
+            snprintf(ebuf, sizeof(ebuf), "\"%02llX_%llX\"", 
+                    (unsigned long long) spkey, (unsigned long long) dkey);
+        } else {
+            throw std::runtime_error("unknown msgpack extension type");
+        }
+
+        out += ebuf;
+    }
+
+    // Any plain value
+    void value(std::string& out) {
+        auto b = next();
+        char nbuf[32];
+
+        if (b <= 0x7f) {
+            snprintf(nbuf, sizeof(nbuf), "%u", b);
+            out += nbuf;
+        } else if (b >= 0xe0) {
+            snprintf(nbuf, sizeof(nbuf), "%d", (int) (int8_t) b);
+            out += nbuf;
+        } else if ((b & 0xe0) == 0xa0 || (b >= 0xd9 && b <= 0xdb)) {
+            pos--;
+            quote(out, string());
+        } else if ((b & 0xf0) == 0x90 || b == 0xdc || b == 0xdd) {
+            pos--;
+            auto sz = array_header();
+
+            out += "[";
+            for (size_t i = 0; i < sz; i++) {
+                if (i != 0)
+                    out += ",";
+                value(out);
+            }
+            out += "]";
+        } else if ((b & 0xf0) == 0x80 || b == 0xde || b == 0xdf) {
+            size_t sz = (b & 0xf0) == 0x80 ? (b & 0x0f) : read_be(b == 0xde ? 2 : 4);
+
+            out += "{";
+            for (size_t i = 0; i < sz; i++) {
+                if (i != 0)
+                    out += ",";
+                key(out);
+                out += ":";
+                value(out);
+            }
+            out += "}";
+        } else {
+            uint64_t u;
+            float f;
+            double d;
+
+            switch (b) {
+                case 0xc0:
+                    out += "0";
+                    break;
+                case 0xc2:
+                    out += "false";
+                    break;
+                case 0xc3:
+                    out += "true";
+                    break;
+                case 0xc4:
+                case 0xc5:
+                case 0xc6: {
+                    auto bin = read_bytes(read_be(1 << (b - 0xc4)));
+
+                    out += "\"";
+                    for (auto c : bin) {
+                        snprintf(nbuf, sizeof(nbuf), "%02X", (uint8_t) c);
+                        out += nbuf;
+                    }
+                    out += "\"";
+                    break;
+                }
+                case 0xc7:
+                    u = read_be(1);
+                    ext(out, (int8_t) next(), u);
+                    break;
+                case 0xc8:
+                    u = read_be(2);
+                    ext(out, (int8_t) next(), u);
+                    break;
+                case 0xc9:
+                    u = read_be(4);
+                    ext(out, (int8_t) next(), u);
+                    break;
+                case 0xd4:
+                case 0xd5:
+                case 0xd6:
+                case 0xd7:
+                case 0xd8:
+                    u = 1 << (b - 0xd4);
+                    ext(out, (int8_t) next(), u);
+                    break;
+                case 0xca:
+                    u = read_be(4);
+                    memcpy(&f, &u, sizeof(f));
+                    number(out, f);
+                    break;
+                case 0xcb:
+                    u = read_be(8);
+                    memcpy(&d, &u, sizeof(d));
+                    number(out, d);
+                    break;
+                case 0xcc:
+                case 0xcd:
+                case 0xce:
+                case 0xcf:
+                    snprintf(nbuf, sizeof(nbuf), "%llu", 
+                            (unsigned long long) read_be(1 << (b - 0xcc)));
+                    out += nbuf;
+                    break;
+                case 0xd0:
+                    snprintf(nbuf, sizeof(nbuf), "%lld", (long long) (int8_t) read_be(1));
+                    out += nbuf;
+                    break;
+                case 0xd1:
+                    snprintf(nbuf, sizeof(nbuf), "%lld", (long long) (int16_t) read_be(2));
+                    out += nbuf;
+                    break;
+                case 0xd2:
+                    snprintf(nbuf, sizeof(nbuf), "%lld", (long long) (int32_t) read_be(4));
+                    out += nbuf;
+                    break;
+                case 0xd3:
+                    snprintf(nbuf, sizeof(nbuf), "%lld", (long long) (int64_t) read_be(8));
+                    out += nbuf;
+                    break;
+                default:
+                    throw std::runtime_error("invalid msgpack type");
+            }
+        }
+    }
+
+    // JSON keys are always strings
+    void key(std::string& out) {
+        std::string k;
+        value(k);
+
+        if (k.length() > 0 && k[0] == '"')
+            out += k;
+        else
+            quote(out, k);
+    }
+
+    // A tagged element; containers of elements hold tagged elements, while everything 
+    // else is a plain value
+    void element(std::string& out) {
+        if (peek() == 0xc0) {
+            pos++;
+            out += "0";
+            return;
+        }
+
+        if (array_header() != 3)
+            throw std::runtime_error("invalid msgpack storage element");
+
+        string();
+        auto type = string();
+
+        if (type == "tracker_vector") {
+            auto sz = array_header();
+
+            out += "[";
+            for (size_t i = 0; i < sz; i++) {
+                if (i != 0)
+                    out += ",";
+                element(out);
+            }
+            out += "]";
+        } else if (type == "tracker_map" || type == "tracker_int_map" || 
+                type == "tracker_mac_map" || type == "tracker_string_map" ||
+                type == "tracker_double_map" || type == "tracker_hashkey_map" ||
+                type == "tracker_key_map") {
+            if (next_is_array()) {
+                // Maps serialized as a vector of their values, or of their keys
+                auto sz = array_header();
+
+                out += "[";
+                for (size_t i = 0; i < sz; i++) {
+                    if (i != 0)
+                        out += ",";
+
+                    if (next_is_array() || peek() == 0xc0)
+                        element(out);
+                    else
+                        value(out);
+                }
+                out += "]";
+            } else {
+                auto b = next();
+
+                if ((b & 0xf0) != 0x80 && b != 0xde && b != 0xdf)
+                    throw std::runtime_error("expected msgpack map");
+
+                size_t sz = (b & 0xf0) == 0x80 ? (b & 0x0f) : read_be(b == 0xde ? 2 : 4);
+
+                out += "{";
+                for (size_t i = 0; i < sz; i++) {
+                    if (i != 0)
+                        out += ",";
+                    key(out);
+                    out += ":";
+                    element(out);
+                }
+                out += "}";
+            }
+        } else {
+            value(out);
+        }
+    }
+};
+
+}
+
+namespace kismetdb_blob {
+
+std::string build_dictionary(const std::vector<std::string>& field_names) {
+    std::string dict;
+
+    // zlib matches the end of the dictionary most cheaply, so it gets the start of the list
+    for (auto fi = field_names.rbegin(); fi != field_names.rend(); ++fi) {
+        dict.append("\"");
+        dict.append(*fi);
+        dict.append("\": ");
+    }
+
+    if (dict.length() > max_dictionary_sz)
+        dict.erase(0, dict.length() - max_dictionary_sz);
+
+    return dict;
+}
+
+std::string compress(const std::string& in, const std::string& dictionary, int level) {
+    auto& state = thread_deflate;
+
+    if (!state.initialized || state.level != level) {
+        if (state.initialized)
+            deflateEnd(&state.zs);
+
+        memset(&state.zs, 0, sizeof(state.zs));
+        state.initialized = false;
+
+        if (deflateInit(&state.zs, level) != Z_OK)
+            throw std::runtime_error("unable to initialize zlib compression");
+
+        state.initialized = true;
+        state.level = level;
+    } else {
+        deflateReset(&state.zs);
+    }
+
+    if (dictionary.length() > 0) {
+        if (deflateSetDictionary(&state.zs, (const Bytef *) dictionary.data(),
+                    dictionary.length()) != Z_OK)
+            throw std::runtime_error("unable to set zlib compression dictionary");
+    }
+
+    std::string out;
+    out.resize(deflateBound(&state.zs, in.length()));
+
+    state.zs.next_in = (Bytef *) in.data();
+    state.zs.avail_in = in.length();
+    state.zs.next_out = (Bytef *) &out[0];
+    state.zs.avail_out = out.length();
+
+    if (deflate(&state.zs, Z_FINISH) != Z_STREAM_END)
+        throw std::runtime_error("unable to compress record");
+
+    out.resize(state.zs.total_out);
+
+    return out;
+}
+
+bool is_compressed(const std::string& in) {
+    // A zlib stream with the default 32k window starts with 0x78, and the header
+    // is a multiple of 31; JSON can never start with 'x'
+    if (in.length() < 2)
+        return false;
+
+    auto cmf = (uint8_t) in[0];
+    auto flg = (uint8_t) in[1];
+
+    return cmf == 0x78 && ((cmf << 8) | flg) % 31 == 0;
+}
+
+bool is_storage_msgpack(const std::string& in) {
+    // Storage msgpack records are a 3-element array, which JSON and zlib never start with
+    return in.length() > 0 && (uint8_t) in[0] == 0x93;
+}
+
+std::string storage_msgpack_to_json(const std::string& in) {
+    storage_msgpack_reader reader(in);
+    return reader.to_json();
+}
+
+std::string decompress(const std::string& in, const std::string& dictionary) {
+    if (!is_compressed(in)) {
+        if (is_storage_msgpack(in))
+            return storage_msgpack_to_json(in);
+
+        return in;
+    }
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+
+    if (inflateInit(&zs) != Z_OK)
+        throw std::runtime_error("unable to initialize zlib decompression");
+
+    std::string out;
+    out.resize(in.length() * 4);
+
+    zs.next_in = (Bytef *) in.data();
+    zs.avail_in = in.length();
+
+    int r;
+
+    while (true) {
+        zs.next_out = (Bytef *) &out[zs.total_out];
+        zs.avail_out = out.length() - zs.total_out;
+
+        r = inflate(&zs, Z_NO_FLUSH);
+
+        if (r == Z_NEED_DICT) {
+            if (dictionary.length() == 0 ||
+                    inflateSetDictionary(&zs, (const Bytef *) dictionary.data(),
+                        dictionary.length()) != Z_OK) {
+                inflateEnd(&zs);
+                throw std::runtime_error("compressed record needs a dictionary which does "
+                        "not match the log");
+            }
+
+            continue;
+        }
+
+        if (r == Z_STREAM_END)
+            break;
+
+        if (r == Z_BUF_ERROR || (r == Z_OK && zs.avail_out == 0)) {
+            if (zs.avail_in == 0 && zs.avail_out != 0) {
+                inflateEnd(&zs);
+                throw std::runtime_error("truncated compressed record");
+            }
+
+            out.resize(out.length() * 2);
+            continue;
+        }
+
+        if (r != Z_OK) {
+            inflateEnd(&zs);
+            throw std::runtime_error("corrupt compressed record");
+        }
+    }
+
+    out.resize(zs.total_out);
+    inflateEnd(&zs);
+
+    if (is_storage_msgpack(out))
+        return storage_msgpack_to_json(out);
+
+    return out;
+}
+
+std::string load_dictionary(sqlite3 *db) {
+    sqlite3_stmt *stmt = nullptr;
+    std::string dict;
+
+    // Logs written before compression support don't have the column at all
+    if (sqlite3_prepare_v2(db, "SELECT compression_dict FROM KISMET", -1, &stmt, nullptr) != SQLITE_OK)
+        return dict;
+
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        auto blob = (const char *) sqlite3_column_blob(stmt, 0);
+        auto len = sqlite3_column_bytes(stmt, 0);
+
+        if (blob != nullptr && len > 0)
+            dict.assign(blob, len);
+    }
+
+    sqlite3_finalize(stmt);
+
+    return dict;
+}
+
+}
+
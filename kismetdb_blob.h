@@ -0,0 +1,79 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __KISMETDB_BLOB_H__
+#define __KISMETDB_BLOB_H__
+
+#include "config.h"
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sqlite3.h>
+
+// Compressed JSON blobs in kismetdb logs
+//
+// When blob compression is enabled, the JSON records in the devices, data, datasources,
+// alerts, and snapshots tables are stored as zlib streams compressed against a preset
+// dictionary built from the names of the tracked fields Kismet had registered when
+// the log was opened.  The dictionary is stored in the compression_dict column of
+// the KISMET table.
+//
+// Compressed and plain records can be told apart by the first byte; JSON never
+// starts with the zlib header, so readers can call decompress() on every record
+// and get plain records back unchanged.
+//
+// Device records may also be logged as storage msgpack instead of JSON; decompress()
+// converts them back to JSON, so readers don't need to handle both.
+//
+// This is shared with the log tools, and must not depend on the rest of the server.
+namespace kismetdb_blob {
+
+// Build a preset dictionary from a list of field names.  The server passes the fields in
+// entry tracker registration order, not by frequency; names earlier in the list are
+// placed nearer the end of the dictionary, where zlib matches them most cheaply, and are
+// kept when the dictionary is trimmed to the zlib window
+std::string build_dictionary(const std::vector<std::string>& field_names);
+
+// Compress a record with the dictionary; level is a zlib level, 1-9
+std::string compress(const std::string& in, const std::string& dictionary, int level);
+
+// Is this record compressed?
+bool is_compressed(const std::string& in);
+
+// Is this record in the storage msgpack format (see msgpack_adapter.h) instead of JSON?
+bool is_storage_msgpack(const std::string& in);
+
+// Convert a storage msgpack record to the JSON the json serializer would have written;
+// throws std::runtime_error if the record is malformed
+std::string storage_msgpack_to_json(const std::string& in);
+
+// Return the decompressed record, or the record itself if it is not compressed, with
+// msgpack records converted to JSON; throws std::runtime_error if a compressed record 
+// can not be decompressed
+std::string decompress(const std::string& in, const std::string& dictionary);
+
+// Load the compression dictionary from the KISMET table of a log; returns an empty
+// dictionary for logs which were written without compression
+std::string load_dictionary(sqlite3 *db);
+
+}
+
+#endif
+
@@ -0,0 +1,222 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+
+#include "kismetdb_segments.h"
+
+namespace kismetdb_segments {
+
+const char *manifest_schema_sql =
+    "CREATE TABLE segments ("
+    "segment INT, " // Segment number
+    "path TEXT, " // Segment file, relative to the log
+    "first_time INT, " // Time range of records in the segment
+    "last_time INT, "
+    "packets INT, " // Number of packet and data records
+    "data INT, "
+    "closed INT, " // Segment is complete
+    "UNIQUE(segment) ON CONFLICT REPLACE); "
+
+    "CREATE TABLE segment_datasources ("
+    "segment INT, "
+    "datasource TEXT, " // UUID of data source
+    "UNIQUE(segment, datasource) ON CONFLICT IGNORE); "
+
+    "CREATE TABLE segment_devices ("
+    "segment INT, "
+    "phyname TEXT, "
+    "devmac TEXT, "
+    "UNIQUE(segment, phyname, devmac) ON CONFLICT IGNORE)";
+
+std::string segment_path(const std::string& log_path, unsigned int number) {
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".segment-%06u", number);
+    return log_path + suffix;
+}
+
+std::string resolve_path(const std::string& log_path, const std::string& segment_path) {
+    if (segment_path.length() > 0 && segment_path[0] == '/')
+        return segment_path;
+
+    auto slash = log_path.find_last_of('/');
+
+    if (slash == std::string::npos)
+        return segment_path;
+
+    return log_path.substr(0, slash + 1) + segment_path;
+}
+
+bool has_segments(sqlite3 *db) {
+    sqlite3_stmt *stmt = nullptr;
+    bool ret = false;
+
+    if (sqlite3_prepare_v2(db, "SELECT name FROM sqlite_master WHERE type = 'table' AND "
+                "name = 'segments'", -1, &stmt, nullptr) != SQLITE_OK)
+        return false;
+
+    ret = sqlite3_step(stmt) == SQLITE_ROW;
+
+    sqlite3_finalize(stmt);
+
+    return ret;
+}
+
+std::vector<segment> load_manifest(sqlite3 *db, const std::string& log_path,
+        const segment_filter& filter) {
+    std::vector<segment> ret;
+
+    if (!has_segments(db))
+        return ret;
+
+    std::string sql =
+        "SELECT segment, path, first_time, last_time, packets, data, closed FROM segments "
+        "WHERE (closed = 0 OR (1";
+
+    if (filter.time_start != 0)
+        sql += " AND last_time >= ?";
+
+    if (filter.time_end != 0)
+        sql += " AND first_time <= ?";
+
+    if (filter.datasources.size() > 0) {
+        sql += " AND segment IN (SELECT segment FROM segment_datasources WHERE ";
+
+        for (size_t i = 0; i < filter.datasources.size(); i++) {
+            if (i != 0)
+                sql += " OR ";
+            sql += "datasource LIKE ?";
+        }
+
+        sql += ")";
+    }
+
+    for (size_t i = 0; i < filter.devmacs.size(); i++)
+        sql += " AND segment IN (SELECT segment FROM segment_devices WHERE devmac LIKE ?)";
+
+    sql += ")) ORDER BY segment";
+
+    sqlite3_stmt *stmt = nullptr;
+
+    if (sqlite3_prepare_v2(db, sql.c_str(), sql.length(), &stmt, nullptr) != SQLITE_OK)
+        throw std::runtime_error("unable to load kismetdb segment manifest: " +
+                std::string(sqlite3_errmsg(db)));
+
+    int pos = 1;
+
+    if (filter.time_start != 0)
+        sqlite3_bind_int64(stmt, pos++, filter.time_start);
+
+    if (filter.time_end != 0)
+        sqlite3_bind_int64(stmt, pos++, filter.time_end);
+
+    for (const auto& d : filter.datasources)
+        sqlite3_bind_text(stmt, pos++, d.data(), d.length(), SQLITE_TRANSIENT);
+
+    for (const auto& m : filter.devmacs)
+        sqlite3_bind_text(stmt, pos++, m.data(), m.length(), SQLITE_TRANSIENT);
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        segment s;
+
+        s.number = sqlite3_column_int(stmt, 0);
+
+        auto path = (const char *) sqlite3_column_text(stmt, 1);
+        s.path = resolve_path(log_path, path == nullptr ? "" : path);
+
+        s.first_time = sqlite3_column_int64(stmt, 2);
+        s.last_time = sqlite3_column_int64(stmt, 3);
+        s.packets = sqlite3_column_int64(stmt, 4);
+        s.data = sqlite3_column_int64(stmt, 5);
+        s.closed = sqlite3_column_int(stmt, 6) != 0;
+
+        ret.push_back(s);
+    }
+
+    sqlite3_finalize(stmt);
+
+    return ret;
+}
+
+std::shared_ptr<sqlite3> open_segment(const std::string& path) {
+    sqlite3 *sdb = nullptr;
+
+    if (sqlite3_open_v2(path.c_str(), &sdb, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+        sqlite3_close_v2(sdb);
+        return nullptr;
+    }
+
+    // The open segment of a running log may be briefly locked by a commit
+    sqlite3_busy_timeout(sdb, 1000);
+
+    return std::shared_ptr<sqlite3>(sdb, [](sqlite3 *d) { sqlite3_close_v2(d); });
+}
+
+void segmented_log::open(sqlite3 *in_db, const std::string& in_log_path) {
+    db = in_db;
+    log_path = in_log_path;
+
+    dbs.clear();
+    numbers.clear();
+
+    dbs.push_back(std::shared_ptr<sqlite3>(db, [](sqlite3 *) { }));
+
+    for (const auto& s : load_manifest(db, log_path)) {
+        auto sdb = open_segment(s.path);
+
+        if (sdb == nullptr)
+            throw std::runtime_error("unable to open kismetdb segment " + s.path);
+
+        dbs.push_back(sdb);
+        numbers.push_back(s.number);
+    }
+}
+
+std::vector<std::shared_ptr<sqlite3>> segmented_log::select(const segment_filter& filter) const {
+    if (numbers.size() == 0)
+        return dbs;
+
+    std::vector<std::shared_ptr<sqlite3>> ret;
+
+    ret.push_back(dbs[0]);
+
+    for (const auto& s : load_manifest(db, log_path, filter)) {
+        auto ni = std::lower_bound(numbers.begin(), numbers.end(), s.number);
+
+        if (ni != numbers.end() && *ni == s.number)
+            ret.push_back(dbs[1 + (ni - numbers.begin())]);
+    }
+
+    return ret;
+}
+
+uint64_t sum(const kissqlite3::query& in_query, const std::vector<std::shared_ptr<sqlite3>>& dbs) {
+    uint64_t ret = 0;
+
+    for (auto r : query_chain(in_query, dbs))
+        ret += sqlite3_column_int64(r.get(), 0);
+
+    return ret;
+}
+
+}
+
@@ -0,0 +1,215 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __KISMETDB_SEGMENTS_H__
+#define __KISMETDB_SEGMENTS_H__
+
+#include "config.h"
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sqlite3.h>
+
+#include "sqlite3_cpp11.h"
+
+// Segmented kismetdb logs
+//
+// When segment rotation is enabled, the packets and data tables of a kismetdb log are
+// written to a series of segment files alongside the log instead of the log itself.
+// Each segment holds only the packets and data tables, with the same schema as the
+// main log; a new segment is started when the current one grows past the size or age
+// limit, and expiring old packets drops whole segments.
+//
+// The main log keeps the manifest of segments:
+//
+// segments              segment number, path relative to the log, time range, record
+//                       counts, and if the segment has been closed
+// segment_datasources   datasource UUIDs seen in each segment
+// segment_devices       phyname and MAC addresses seen in each segment
+//
+// The manifest of an open segment is only updated when the log is committed, so open
+// segments are always included when selecting segments.
+//
+// This is shared with the log tools, and must not depend on the rest of the server.
+namespace kismetdb_segments {
+
+struct segment {
+    unsigned int number;
+    std::string path;
+    uint64_t first_time;
+    uint64_t last_time;
+    uint64_t packets;
+    uint64_t data;
+    bool closed;
+};
+
+// Select segments by time and content; empty fields match everything.  Datasources and
+// MAC addresses are sqlite LIKE patterns; a segment must match any of the datasources,
+// and all of the MAC addresses.
+struct segment_filter {
+    segment_filter() :
+        time_start {0},
+        time_end {0} { }
+
+    uint64_t time_start;
+    uint64_t time_end;
+    std::vector<std::string> datasources;
+    std::vector<std::string> devmacs;
+};
+
+// Manifest tables, created in the main log when segments are enabled
+extern const char *manifest_schema_sql;
+
+// Path of a new segment of a log
+std::string segment_path(const std::string& log_path, unsigned int number);
+
+// Resolve a segment path from the manifest relative to the directory of the log
+std::string resolve_path(const std::string& log_path, const std::string& segment_path);
+
+// Does this log have a segment manifest?
+bool has_segments(sqlite3 *db);
+
+// Load the manifest of a log, in segment order, with resolved paths; returns an empty
+// list for logs without segments
+std::vector<segment> load_manifest(sqlite3 *db, const std::string& log_path,
+        const segment_filter& filter = segment_filter());
+
+// Open a segment read-only; returns nullptr if the segment can not be opened
+std::shared_ptr<sqlite3> open_segment(const std::string& path);
+
+// A log and all of its segments, for running queries over the whole log
+class segmented_log {
+public:
+    segmented_log() :
+        db {nullptr} { }
+
+    // Open the segments of a log; the log connection is not owned.  Throws 
+    // std::runtime_error if a segment in the manifest can not be opened.
+    void open(sqlite3 *in_db, const std::string& in_log_path);
+
+    // The main log followed by all of the segments
+    const std::vector<std::shared_ptr<sqlite3>>& all() const {
+        return dbs;
+    }
+
+    // The main log followed by the segments matching a filter
+    std::vector<std::shared_ptr<sqlite3>> select(const segment_filter& filter) const;
+
+    size_t num_segments() const {
+        return numbers.size();
+    }
+
+protected:
+    sqlite3 *db;
+    std::string log_path;
+
+    std::vector<std::shared_ptr<sqlite3>> dbs;
+    // Segment numbers of dbs[1...]
+    std::vector<unsigned int> numbers;
+};
+
+// Run a query against a list of databases in turn, as if it were a single result
+//
+// for (auto r : query_chain(_SELECT(db, "packets", {...}), dbs)) { ... }
+//
+// A LIMIT clause in the query applies to each database separately.
+class query_chain {
+public:
+    query_chain(const kissqlite3::query& in_query,
+            const std::vector<std::shared_ptr<sqlite3>>& in_dbs) :
+        query {in_query},
+        dbs {in_dbs} { }
+
+    class iterator {
+    public:
+        iterator() :
+            chain {nullptr},
+            pos {0} { }
+
+        iterator(query_chain *in_chain) :
+            chain {in_chain},
+            pos {0} {
+            next_db();
+        }
+
+        iterator& operator++() {
+            ++cur;
+
+            if (cur == chain->query.end()) {
+                pos++;
+                next_db();
+            }
+
+            return *this;
+        }
+
+        bool operator==(const iterator& i) {
+            return (chain == nullptr) == (i.chain == nullptr);
+        }
+
+        bool operator!=(const iterator& i) {
+            return (chain == nullptr) != (i.chain == nullptr);
+        }
+
+        std::shared_ptr<sqlite3_stmt> operator*() {
+            return *cur;
+        }
+
+    protected:
+        void next_db() {
+            while (pos < chain->dbs.size()) {
+                chain->query.db = chain->dbs[pos].get();
+                cur = chain->query.begin();
+
+                if (cur != chain->query.end())
+                    return;
+
+                pos++;
+            }
+
+            chain = nullptr;
+        }
+
+        query_chain *chain;
+        size_t pos;
+        kissqlite3::sqlite3_stmt_iterator cur;
+    };
+
+    iterator begin() {
+        return iterator(this);
+    }
+
+    iterator end() {
+        return iterator();
+    }
+
+protected:
+    kissqlite3::query query;
+    std::vector<std::shared_ptr<sqlite3>> dbs;
+};
+
+// Sum the first column of a query, such as a count(*), across a list of databases
+uint64_t sum(const kissqlite3::query& in_query, const std::vector<std::shared_ptr<sqlite3>>& dbs);
+
+}
+
+#endif
+
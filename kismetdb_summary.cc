@@ -0,0 +1,197 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include "kismetdb_summary.h"
+
+namespace kismetdb_summary {
+
+std::string packet_schema_sql(const std::string& schema) {
+    // Triggers live in the same schema as their table and can only refer to tables
+    // in it, so the table names inside them are not qualified
+    return
+        "CREATE TABLE " + schema + "summary_datasources ("
+        "datasource TEXT, " // UUID of data source
+        "packets INT, " // Number of packets, and how many have a location
+        "packets_with_loc INT, "
+        "data INT, " // Number of data records, and how many have a location
+        "data_with_loc INT, "
+        "first_time INT, " // Time range of records
+        "last_time INT, "
+        "UNIQUE(datasource) ON CONFLICT IGNORE); "
+
+        "CREATE TRIGGER " + schema + "summary_packets_delete AFTER DELETE ON packets "
+        "BEGIN "
+        "UPDATE summary_datasources SET packets = packets - 1, "
+        "packets_with_loc = packets_with_loc - (OLD.lat != 0 AND OLD.lon != 0) "
+        "WHERE datasource = OLD.datasource; "
+        "END; "
+
+        "CREATE TRIGGER " + schema + "summary_data_delete AFTER DELETE ON data "
+        "BEGIN "
+        "UPDATE summary_datasources SET data = data - 1, "
+        "data_with_loc = data_with_loc - (OLD.lat != 0 AND OLD.lon != 0) "
+        "WHERE datasource = OLD.datasource; "
+        "END";
+}
+
+// Devices are written far less often than packets, and are replaced each time they 
+// change, so they are counted as they are inserted; the devices table is unique on
+// phyname and devmac, so checking for an existing record is an index lookup.  Records
+// replaced by a new version of the device do not fire the delete trigger.
+const char *device_schema_sql =
+    "CREATE TABLE summary_phys ("
+    "phyname TEXT, "
+    "devices INT, " // Number of devices
+    "first_time INT, " // Time range devices were seen in
+    "last_time INT, "
+    "min_lat REAL, " // Bounding rectangle of device locations, NULL if none
+    "min_lon REAL, "
+    "max_lat REAL, "
+    "max_lon REAL, "
+    "UNIQUE(phyname) ON CONFLICT IGNORE); "
+
+    "CREATE TRIGGER summary_devices_insert BEFORE INSERT ON devices "
+    "BEGIN "
+    "INSERT INTO summary_phys (phyname, devices, first_time, last_time) "
+    "VALUES (NEW.phyname, 0, NEW.first_time, NEW.last_time); "
+
+    "UPDATE summary_phys SET "
+    "devices = devices + NOT EXISTS (SELECT 1 FROM devices WHERE "
+    "phyname = NEW.phyname AND devmac = NEW.devmac), "
+    "first_time = min(first_time, NEW.first_time), "
+    "last_time = max(last_time, NEW.last_time) "
+    "WHERE phyname = NEW.phyname; "
+
+    "UPDATE summary_phys SET "
+    "min_lat = min(coalesce(min_lat, NEW.min_lat), NEW.min_lat), "
+    "min_lon = min(coalesce(min_lon, NEW.min_lon), NEW.min_lon), "
+    "max_lat = max(coalesce(max_lat, NEW.max_lat), NEW.max_lat), "
+    "max_lon = max(coalesce(max_lon, NEW.max_lon), NEW.max_lon) "
+    "WHERE phyname = NEW.phyname AND NEW.min_lat != 0 AND NEW.min_lon != 0 AND "
+    "NEW.max_lat != 0 AND NEW.max_lon != 0; "
+    "END; "
+
+    "CREATE TRIGGER summary_devices_delete AFTER DELETE ON devices "
+    "BEGIN "
+    "UPDATE summary_phys SET devices = devices - 1 WHERE phyname = OLD.phyname; "
+    "END";
+
+static bool has_table(sqlite3 *db, const char *table) {
+    sqlite3_stmt *stmt = nullptr;
+    bool ret = false;
+
+    if (sqlite3_prepare_v2(db, "SELECT name FROM sqlite_master WHERE type = 'table' AND "
+                "name = ?", -1, &stmt, nullptr) != SQLITE_OK)
+        return false;
+
+    sqlite3_bind_text(stmt, 1, table, -1, SQLITE_STATIC);
+
+    ret = sqlite3_step(stmt) == SQLITE_ROW;
+
+    sqlite3_finalize(stmt);
+
+    return ret;
+}
+
+bool has_summary(sqlite3 *db) {
+    return has_table(db, "summary_phys");
+}
+
+bool load_datasources(const std::vector<std::shared_ptr<sqlite3>>& dbs,
+        std::map<std::string, datasource_summary>& datasources) {
+
+    datasources.clear();
+
+    for (const auto& db : dbs) {
+        if (!has_table(db.get(), "summary_datasources"))
+            return false;
+    }
+
+    for (const auto& db : dbs) {
+        sqlite3_stmt *stmt = nullptr;
+
+        if (sqlite3_prepare_v2(db.get(), "SELECT datasource, packets, packets_with_loc, data, "
+                    "data_with_loc, first_time, last_time FROM summary_datasources", 
+                    -1, &stmt, nullptr) != SQLITE_OK)
+            return false;
+
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            auto uuid = (const char *) sqlite3_column_text(stmt, 0);
+            auto& s = datasources[uuid == nullptr ? "" : uuid];
+
+            s.packets += sqlite3_column_int64(stmt, 1);
+            s.packets_with_loc += sqlite3_column_int64(stmt, 2);
+            s.data += sqlite3_column_int64(stmt, 3);
+            s.data_with_loc += sqlite3_column_int64(stmt, 4);
+
+            uint64_t first_time = sqlite3_column_int64(stmt, 5);
+            uint64_t last_time = sqlite3_column_int64(stmt, 6);
+
+            if (s.first_time == 0 || first_time < s.first_time)
+                s.first_time = first_time;
+
+            if (last_time > s.last_time)
+                s.last_time = last_time;
+        }
+
+        sqlite3_finalize(stmt);
+    }
+
+    return true;
+}
+
+bool load_phys(sqlite3 *db, std::vector<phy_summary>& phys) {
+    phys.clear();
+
+    if (!has_summary(db))
+        return false;
+
+    sqlite3_stmt *stmt = nullptr;
+
+    if (sqlite3_prepare_v2(db, "SELECT phyname, devices, first_time, last_time, "
+                "coalesce(min_lat, 0), coalesce(min_lon, 0), coalesce(max_lat, 0), "
+                "coalesce(max_lon, 0) FROM summary_phys ORDER BY phyname", 
+                -1, &stmt, nullptr) != SQLITE_OK)
+        return false;
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        phy_summary s;
+
+        auto phyname = (const char *) sqlite3_column_text(stmt, 0);
+        s.phyname = phyname == nullptr ? "" : phyname;
+
+        s.devices = sqlite3_column_int64(stmt, 1);
+        s.first_time = sqlite3_column_int64(stmt, 2);
+        s.last_time = sqlite3_column_int64(stmt, 3);
+        s.min_lat = sqlite3_column_double(stmt, 4);
+        s.min_lon = sqlite3_column_double(stmt, 5);
+        s.max_lat = sqlite3_column_double(stmt, 6);
+        s.max_lon = sqlite3_column_double(stmt, 7);
+
+        phys.push_back(s);
+    }
+
+    sqlite3_finalize(stmt);
+
+    return true;
+}
+
+}
+
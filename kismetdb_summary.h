@@ -0,0 +1,112 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __KISMETDB_SUMMARY_H__
+#define __KISMETDB_SUMMARY_H__
+
+#include "config.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sqlite3.h>
+
+// Summary tables of kismetdb logs
+//
+// Counting the packets or finding the time range of a multi-gigabyte log means reading
+// every row; instead the log keeps running totals as it is written:
+//
+// summary_datasources   packet and data records by datasource UUID, how many of them
+//                       have a location, and the time range they cover
+// summary_phys          devices by phy, the time range they were seen in, and the 
+//                       bounding box of their locations
+//
+// The server adds the packets and data it writes to summary_datasources when it
+// commits the log; each segment keeps its own summary_datasources for the packets and
+// data it holds, so dropping a segment drops its totals as well.  summary_phys is kept
+// by triggers on the devices table.  Deleting packets, data, or devices (such as when
+// they time out) is subtracted from the totals by triggers, but the time ranges and
+// bounding boxes are not shrunk.
+//
+// Logs written before the summary tables were added do not have them, and must be 
+// counted the slow way.
+//
+// This is shared with the log tools, and must not depend on the rest of the server.
+namespace kismetdb_summary {
+
+struct datasource_summary {
+    datasource_summary() :
+        packets {0},
+        packets_with_loc {0},
+        data {0},
+        data_with_loc {0},
+        first_time {0},
+        last_time {0} { }
+
+    uint64_t packets;
+    uint64_t packets_with_loc;
+    uint64_t data;
+    uint64_t data_with_loc;
+    uint64_t first_time;
+    uint64_t last_time;
+};
+
+struct phy_summary {
+    phy_summary() :
+        devices {0},
+        first_time {0},
+        last_time {0},
+        min_lat {0},
+        min_lon {0},
+        max_lat {0},
+        max_lon {0} { }
+
+    std::string phyname;
+    uint64_t devices;
+    uint64_t first_time;
+    uint64_t last_time;
+
+    // All 0 when no device has a location
+    double min_lat, min_lon, max_lat, max_lon;
+};
+
+// Summary of the packets and data tables, created in the main log and every segment
+// alongside the tables themselves; schema is empty or an attached schema name with
+// the trailing '.'
+std::string packet_schema_sql(const std::string& schema);
+
+// Summary of the devices table, created in the main log
+extern const char *device_schema_sql;
+
+// Does this log have summary tables?
+bool has_summary(sqlite3 *db);
+
+// Load the summaries of packets and data by datasource from the log and each of its
+// segments, combined; returns false if any of them were written without summaries
+bool load_datasources(const std::vector<std::shared_ptr<sqlite3>>& dbs,
+        std::map<std::string, datasource_summary>& datasources);
+
+// Load the device summary by phy; returns false if the log has no summaries
+bool load_phys(sqlite3 *db, std::vector<phy_summary>& phys);
+
+}
+
+#endif
+
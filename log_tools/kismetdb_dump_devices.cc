@@ -38,6 +38,7 @@
 
 #include "fmt.h"
 #include "json/json.h"
+#include "kismetdb_blob.h"
 #include "sqlite3_cpp11.h"
 
 void print_help(char *argv) {
@@ -199,6 +200,9 @@ int main(int argc, char *argv[]) {
 
     using namespace kissqlite3;
 
+    // Records may be compressed against a dictionary stored in the log
+    auto compression_dict = kismetdb_blob::load_dictionary(db);
+
     int db_version = 0;
     unsigned long n_devices_db = 0L;
 
@@ -266,9 +270,9 @@ int main(int argc, char *argv[]) {
 
         }
 
-        auto json = sqlite3_column_as<std::string>(d, 0);
-
         try {
+            auto json = kismetdb_blob::decompress(sqlite3_column_as<std::string>(d, 0), compression_dict);
+
             std::stringstream ss(json);
 
             Json::Value parsed_json;
@@ -0,0 +1,101 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <stdio.h>
+
+#include "fmt.h"
+#include "kismetdb_pipeline.h"
+
+namespace kismetdb_pipeline {
+
+void tune_reader(sqlite3 *db, unsigned int mmap_mb, unsigned int cache_mb) {
+    // Failures only cost speed, so they're ignored
+    auto pragmas = fmt::format("PRAGMA mmap_size={}; PRAGMA cache_size=-{}; PRAGMA temp_store=MEMORY",
+            (uint64_t) mmap_mb * 1024 * 1024, (uint64_t) cache_mb * 1024);
+
+    sqlite3_exec(db, pragmas.c_str(), nullptr, nullptr, nullptr);
+}
+
+std::shared_ptr<sqlite3> open_reader(const std::string& path) {
+    sqlite3 *db = nullptr;
+
+    if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+        sqlite3_close_v2(db);
+        return nullptr;
+    }
+
+    tune_reader(db);
+
+    return std::shared_ptr<sqlite3>(db, [](sqlite3 *d) { sqlite3_close_v2(d); });
+}
+
+unsigned int default_jobs() {
+    auto n = std::thread::hardware_concurrency();
+
+    if (n == 0)
+        return 1;
+
+    return n;
+}
+
+progress::progress(const std::string& in_what, uint64_t in_total, bool in_enabled) :
+    what {in_what},
+    total {in_total},
+    count {0},
+    enabled {in_enabled},
+    start {std::chrono::steady_clock::now()},
+    last_report {start} { }
+
+void progress::update(uint64_t in_count) {
+    count = in_count;
+
+    if (!enabled)
+        return;
+
+    auto now = std::chrono::steady_clock::now();
+
+    if (now - last_report < std::chrono::seconds(1))
+        return;
+
+    report(now);
+}
+
+void progress::finish() {
+    if (!enabled)
+        return;
+
+    report(std::chrono::steady_clock::now());
+}
+
+void progress::report(std::chrono::steady_clock::time_point now) {
+    last_report = now;
+
+    auto elapsed = std::chrono::duration<double>(now - start).count();
+    auto rate = elapsed > 0 ? count / elapsed : 0;
+
+    if (total > 0)
+        fmt::print(stderr, "* {}% processed {} of {} {}, {:.0f} {}/sec\n",
+                (int) (((double) count / (double) total) * 100), count, total, what, rate, what);
+    else
+        fmt::print(stderr, "* Processed {} {}, {:.0f} {}/sec\n", count, what, rate, what);
+}
+
+}
+
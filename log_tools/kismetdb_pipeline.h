@@ -0,0 +1,275 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __KISMETDB_PIPELINE_H__
+#define __KISMETDB_PIPELINE_H__
+
+#include "config.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sqlite3.h>
+
+// Parallel conversion of kismetdb logs
+//
+// The log tools convert a log in three stages:  a reader thread pulls batches of
+// rows from the log, a pool of worker threads decodes and formats each batch (parsing
+// device JSON, filtering locations, building output records), and the calling thread
+// writes the finished batches in the original order of the log, so the output is the
+// same no matter how many workers are used.
+//
+// Workers which need to query the log themselves must use their own connection from
+// open_reader(); sqlite connections can not be shared between threads.
+namespace kismetdb_pipeline {
+
+// Tune a connection for a large sequential read with memory-mapped IO and a larger
+// page cache
+void tune_reader(sqlite3 *db, unsigned int mmap_mb = 1024, unsigned int cache_mb = 256);
+
+// Open a tuned read-only connection to a log; returns nullptr if the log can not
+// be opened
+std::shared_ptr<sqlite3> open_reader(const std::string& path);
+
+// Default number of workers, one per CPU
+unsigned int default_jobs();
+
+// Report progress and throughput to stderr, at most once a second
+class progress {
+public:
+    progress(const std::string& in_what, uint64_t in_total, bool in_enabled);
+
+    // Update the number of records processed; called from the writer
+    void update(uint64_t in_count);
+
+    // Final summary
+    void finish();
+
+protected:
+    void report(std::chrono::steady_clock::time_point now);
+
+    std::string what;
+    uint64_t total;
+    uint64_t count;
+    bool enabled;
+
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point last_report;
+};
+
+// Run a conversion; the reader appends up to max records to a batch and returns the
+// number added, or 0 when the log is finished.  The worker (given its worker number,
+// from 0 to jobs - 1) turns a batch of input records into output records, and the
+// writer is called with the output of each batch, in order.
+//
+// With a single job everything runs on the calling thread.  An exception thrown by
+// any stage stops the conversion and is rethrown to the caller.
+template <typename In, typename Out>
+void run(unsigned int jobs, size_t batch_sz,
+        std::function<size_t (std::vector<In>&, size_t)> reader,
+        std::function<void (unsigned int, std::vector<In>&, std::vector<Out>&)> worker,
+        std::function<void (std::vector<Out>&)> writer) {
+
+    if (jobs <= 1) {
+        std::vector<In> in;
+        std::vector<Out> out;
+
+        while (true) {
+            in.clear();
+            out.clear();
+
+            if (reader(in, batch_sz) == 0)
+                break;
+
+            worker(0, in, out);
+            writer(out);
+        }
+
+        return;
+    }
+
+    struct batch {
+        uint64_t seq;
+        std::vector<In> in;
+        std::vector<Out> out;
+    };
+
+    std::mutex mutex;
+    std::condition_variable read_cv, work_cv, write_cv;
+
+    std::deque<std::unique_ptr<batch>> work_queue;
+    std::map<uint64_t, std::unique_ptr<batch>> done_map;
+
+    // Limit how far the reader can get ahead of the writer
+    const size_t max_in_flight = jobs * 4;
+    size_t in_flight = 0;
+
+    uint64_t num_read = 0;
+    bool read_done = false;
+    bool abort = false;
+    std::exception_ptr error;
+
+    auto fail = [&](std::exception_ptr e) {
+        std::lock_guard<std::mutex> lk(mutex);
+
+        if (error == nullptr)
+            error = e;
+
+        abort = true;
+
+        read_cv.notify_all();
+        work_cv.notify_all();
+        write_cv.notify_all();
+    };
+
+    std::thread read_thread([&]() {
+        try {
+            while (true) {
+                {
+                    std::unique_lock<std::mutex> lk(mutex);
+                    read_cv.wait(lk, [&]() { return in_flight < max_in_flight || abort; });
+
+                    if (abort)
+                        break;
+                }
+
+                auto b = std::unique_ptr<batch>(new batch());
+
+                if (reader(b->in, batch_sz) == 0)
+                    break;
+
+                std::lock_guard<std::mutex> lk(mutex);
+                b->seq = num_read++;
+                in_flight++;
+                work_queue.push_back(std::move(b));
+                work_cv.notify_one();
+            }
+        } catch (...) {
+            fail(std::current_exception());
+        }
+
+        std::lock_guard<std::mutex> lk(mutex);
+        read_done = true;
+        work_cv.notify_all();
+        write_cv.notify_all();
+    });
+
+    std::vector<std::thread> work_threads;
+
+    for (unsigned int n = 0; n < jobs; n++) {
+        work_threads.push_back(std::thread([&, n]() {
+            while (true) {
+                std::unique_ptr<batch> b;
+
+                {
+                    std::unique_lock<std::mutex> lk(mutex);
+                    work_cv.wait(lk, [&]() {
+                        return work_queue.size() > 0 || read_done || abort;
+                    });
+
+                    if (abort || work_queue.size() == 0)
+                        return;
+
+                    b = std::move(work_queue.front());
+                    work_queue.pop_front();
+                }
+
+                try {
+                    worker(n, b->in, b->out);
+                } catch (...) {
+                    fail(std::current_exception());
+                    return;
+                }
+
+                b->in.clear();
+                b->in.shrink_to_fit();
+
+                std::lock_guard<std::mutex> lk(mutex);
+                auto seq = b->seq;
+                done_map[seq] = std::move(b);
+                write_cv.notify_one();
+            }
+        }));
+    }
+
+    uint64_t next_seq = 0;
+
+    while (true) {
+        std::unique_ptr<batch> b;
+
+        {
+            std::unique_lock<std::mutex> lk(mutex);
+            write_cv.wait(lk, [&]() {
+                return done_map.find(next_seq) != done_map.end() || abort ||
+                    (read_done && next_seq == num_read);
+            });
+
+            if (abort)
+                break;
+
+            auto bi = done_map.find(next_seq);
+
+            if (bi == done_map.end())
+                break;
+
+            b = std::move(bi->second);
+            done_map.erase(bi);
+        }
+
+        try {
+            writer(b->out);
+        } catch (...) {
+            fail(std::current_exception());
+            break;
+        }
+
+        std::lock_guard<std::mutex> lk(mutex);
+        in_flight--;
+        next_seq++;
+        read_cv.notify_one();
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(mutex);
+        abort = true;
+        read_cv.notify_all();
+        work_cv.notify_all();
+    }
+
+    read_thread.join();
+
+    for (auto& t : work_threads)
+        t.join();
+
+    if (error != nullptr)
+        std::rethrow_exception(error);
+}
+
+}
+
+#endif
+
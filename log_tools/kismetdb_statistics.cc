@@ -18,6 +18,7 @@
 
 #include "config.h"
 
+#include <chrono>
 #include <map>
 #include <iomanip>
 #include <ctime>
@@ -37,6 +38,9 @@
 
 #include "getopt.h"
 #include "json/json.h"
+#include "kismetdb_blob.h"
+#include "kismetdb_segments.h"
+#include "kismetdb_summary.h"
 #include "sqlite3_cpp11.h"
 #include "fmt.h"
 #include "packet_ieee80211.h"
@@ -65,7 +69,8 @@ void print_help(char *argv) {
     printf("usage: %s [OPTION]\n", argv);
     printf(" -i, --in [filename]          Input kismetdb file\n"
            " -s, --skip-clean             Don't clean (sql vacuum) input database\n"
-           " -j, --json                   Dump stats as a JSON dictionary");
+           " -j, --json                   Dump stats as a JSON dictionary\n"
+           " -c, --compression            Measure the storage size of the JSON records");
 }
 
 int main(int argc, char *argv[]) {
@@ -73,6 +78,7 @@ int main(int argc, char *argv[]) {
         { "in", required_argument, 0, 'i' },
         { "skip-clean", no_argument, 0, 's' },
         { "json", no_argument, 0, 'j' },
+        { "compression", no_argument, 0, 'c' },
         { "help", no_argument, 0, 'h' },
         { 0, 0, 0, 0 }
     };
@@ -84,6 +90,7 @@ int main(int argc, char *argv[]) {
     std::string in_fname;
     bool skipclean = false;
     bool outputjson = false;
+    bool blobstats = false;
     Json::Value root;
 
     int sql_r = 0;
@@ -94,7 +101,7 @@ int main(int argc, char *argv[]) {
 
     while (1) {
         int r = getopt_long(argc, argv, 
-                            "-hi:sj", longopt, &option_idx);
+                            "-hi:sjc", longopt, &option_idx);
         if (r < 0) break;
 
         if (r == 'h') {
@@ -106,6 +113,8 @@ int main(int argc, char *argv[]) {
             skipclean = true;
         } else if (r == 'j') {
             outputjson = true;
+        } else if (r == 'c') {
+            blobstats = true;
         }
     }
 
@@ -148,6 +157,9 @@ int main(int argc, char *argv[]) {
 
     using namespace kissqlite3;
 
+    // Records may be compressed against a dictionary stored in the log
+    auto compression_dict = kismetdb_blob::load_dictionary(db);
+
     if (outputjson)
         root["file"] = in_fname;
 
@@ -164,33 +176,86 @@ int main(int argc, char *argv[]) {
             fmt::print("\n");
         }
 
+        // Packets and data may be split across log segments
+        kismetdb_segments::segmented_log segments;
+        segments.open(db, in_fname);
+        auto log_dbs = segments.all();
+
+        // Newer logs keep summary tables, so the totals don't need to read every
+        // packet; older logs are counted the slow way
+        std::map<std::string, kismetdb_summary::datasource_summary> ds_summary;
+        std::vector<kismetdb_summary::phy_summary> phy_summary;
+
+        bool have_summary = kismetdb_summary::load_datasources(log_dbs, ds_summary) &&
+            kismetdb_summary::load_phys(db, phy_summary);
+
         // Get the total counts
-        auto npackets_q = _SELECT(db, "packets", 
-                {"count(*), sum(case when (lat != 0 and lon != 0) then 1 else 0 end)"});
-        auto npackets_ret = npackets_q.run();
-        auto n_total_packets_db = sqlite3_column_as<unsigned long>(*npackets_ret, 0);
-        auto n_packets_with_loc = sqlite3_column_as<unsigned long>(*npackets_ret, 1);
-
-        auto ndata_q = _SELECT(db, "data",
-                {"count(*), sum(case when(lat != 0 and lon != 0) then 1 else 0 end)"});
-        auto ndata_ret = ndata_q.run();
-        auto n_total_data_db = sqlite3_column_as<unsigned long>(*ndata_ret, 0);
-        auto n_data_with_loc = sqlite3_column_as<unsigned long>(*ndata_ret, 1);
+        unsigned long n_total_packets_db = 0, n_packets_with_loc = 0;
+        unsigned long n_total_data_db = 0, n_data_with_loc = 0;
+
+        if (have_summary) {
+            for (const auto& ds : ds_summary) {
+                n_total_packets_db += ds.second.packets;
+                n_packets_with_loc += ds.second.packets_with_loc;
+                n_total_data_db += ds.second.data;
+                n_data_with_loc += ds.second.data_with_loc;
+            }
+        } else {
+            auto npackets_q = _SELECT(db, "packets", 
+                    {"count(*), sum(case when (lat != 0 and lon != 0) then 1 else 0 end)"});
+
+            for (auto p : kismetdb_segments::query_chain(npackets_q, log_dbs)) {
+                n_total_packets_db += sqlite3_column_as<unsigned long>(p, 0);
+                n_packets_with_loc += sqlite3_column_as<unsigned long>(p, 1);
+            }
+
+            auto ndata_q = _SELECT(db, "data",
+                    {"count(*), sum(case when(lat != 0 and lon != 0) then 1 else 0 end)"});
+
+            for (auto d : kismetdb_segments::query_chain(ndata_q, log_dbs)) {
+                n_total_data_db += sqlite3_column_as<unsigned long>(d, 0);
+                n_data_with_loc += sqlite3_column_as<unsigned long>(d, 1);
+            }
+        }
 
         if (outputjson) {
             root["packets"] = (uint64_t) n_total_packets_db;
             root["data_packets"] = (uint64_t) n_total_data_db;
+            root["segments"] = (uint64_t) segments.num_segments();
+            root["summary_tables"] = have_summary;
         } else {
             fmt::print("  Packets: {}\n", n_total_packets_db);
             fmt::print("  Non-packet data: {}\n", n_total_data_db);
+            if (segments.num_segments() > 0)
+                fmt::print("  Log segments: {}\n", segments.num_segments());
             fmt::print("\n");
         }
        
-        auto ndevices_q = _SELECT(db, "devices", {"count(*)", "min(first_time)", "max(last_time)"});
-        auto ndevices_ret = ndevices_q.run();
-        auto n_total_devices = sqlite3_column_as<unsigned long>(*ndevices_ret, 0);
-        auto min_time = sqlite3_column_as<time_t>(*ndevices_ret, 1);
-        auto max_time = sqlite3_column_as<time_t>(*ndevices_ret, 2);
+        unsigned long n_total_devices = 0;
+        time_t min_time = 0, max_time = 0;
+
+        if (have_summary) {
+            for (const auto& phy : phy_summary) {
+                // Phys whose devices have all expired keep their time range
+                if (phy.devices == 0)
+                    continue;
+
+                n_total_devices += phy.devices;
+
+                if (min_time == 0 || (time_t) phy.first_time < min_time)
+                    min_time = phy.first_time;
+
+                if ((time_t) phy.last_time > max_time)
+                    max_time = phy.last_time;
+            }
+        } else {
+            auto ndevices_q = _SELECT(db, "devices", {"count(*)", "min(first_time)", "max(last_time)"});
+            auto ndevices_ret = ndevices_q.run();
+            n_total_devices = sqlite3_column_as<unsigned long>(*ndevices_ret, 0);
+            min_time = sqlite3_column_as<time_t>(*ndevices_ret, 1);
+            max_time = sqlite3_column_as<time_t>(*ndevices_ret, 2);
+        }
+
         struct tm min_tm, max_tm;
 
         gmtime_r(&min_time, &min_tm);
@@ -207,6 +272,23 @@ int main(int argc, char *argv[]) {
                     std::put_time(&max_tm, "%Y-%m-%d %H:%M:%S"), max_time);
         }
 
+        if (have_summary) {
+            Json::Value phy_root;
+
+            for (const auto& phy : phy_summary) {
+                if (phy.devices == 0)
+                    continue;
+
+                if (outputjson)
+                    phy_root[phy.phyname] = (uint64_t) phy.devices;
+                else
+                    fmt::print("    {:<24} {} devices\n", phy.phyname, phy.devices);
+            }
+
+            if (outputjson)
+                root["phy_devices"] = phy_root;
+        }
+
         auto n_sources_q = _SELECT(db, "datasources", {"count(*)"});
         auto n_sources_q_ret = n_sources_q.run();
 
@@ -242,7 +324,7 @@ int main(int argc, char *argv[]) {
             }
 
             Json::Value json;
-            std::stringstream ss(sqlite3_column_as<std::string>(*i, 5));
+            std::stringstream ss(kismetdb_blob::decompress(sqlite3_column_as<std::string>(*i, 5), compression_dict));
 
             ss >> json;
 
@@ -255,6 +337,22 @@ int main(int argc, char *argv[]) {
                 fmt::print("      Packets: {}\n", json["kismet.datasource.num_packets"].asDouble());
             }
 
+            // Packets actually in the log, which may be fewer than the source saw
+            auto dsi = ds_summary.find(sqlite3_column_as<std::string>(*i, 0));
+
+            if (dsi != ds_summary.end()) {
+                if (outputjson) {
+                    ds_root["logged_packets"] = (uint64_t) dsi->second.packets;
+                    ds_root["logged_data"] = (uint64_t) dsi->second.data;
+                    ds_root["logged_first_time"] = (uint64_t) dsi->second.first_time;
+                    ds_root["logged_last_time"] = (uint64_t) dsi->second.last_time;
+                } else {
+                    fmt::print("      Logged packets: {}, data: {}, from {} to {}\n",
+                            dsi->second.packets, dsi->second.data,
+                            dsi->second.first_time, dsi->second.last_time);
+                }
+            }
+
             if (json["kismet.datasource.hopping"].asInt()) {
                 if (outputjson) {
                     ds_root["hop_rate"] = json["kismet.datasource.hop_rate"];
@@ -317,21 +415,41 @@ int main(int argc, char *argv[]) {
                     AND,
                     "max_lon", NEQ, 0));
 
-        double min_lat, min_lon, max_lat, max_lon;
+        double min_lat = 0, min_lon = 0, max_lat = 0, max_lon = 0;
 
-        try {
-            auto range_q_ret = range_q.run();
+        if (have_summary) {
+            bool first = true;
 
-            min_lat = sqlite3_column_as<double>(*range_q_ret, 0);
-            min_lon = sqlite3_column_as<double>(*range_q_ret, 1);
-            max_lat = sqlite3_column_as<double>(*range_q_ret, 2);
-            max_lon = sqlite3_column_as<double>(*range_q_ret, 3);
+            for (const auto& phy : phy_summary) {
+                if (phy.min_lat == 0 || phy.min_lon == 0 || phy.max_lat == 0 || phy.max_lon == 0)
+                    continue;
 
-        } catch (const std::exception& e) {
-            min_lat = 0;
-            max_lat = 0;
-            min_lon = 0;
-            max_lon = 0;
+                if (first || phy.min_lat < min_lat)
+                    min_lat = phy.min_lat;
+                if (first || phy.min_lon < min_lon)
+                    min_lon = phy.min_lon;
+                if (first || phy.max_lat > max_lat)
+                    max_lat = phy.max_lat;
+                if (first || phy.max_lon > max_lon)
+                    max_lon = phy.max_lon;
+
+                first = false;
+            }
+        } else {
+            try {
+                auto range_q_ret = range_q.run();
+
+                min_lat = sqlite3_column_as<double>(*range_q_ret, 0);
+                min_lon = sqlite3_column_as<double>(*range_q_ret, 1);
+                max_lat = sqlite3_column_as<double>(*range_q_ret, 2);
+                max_lon = sqlite3_column_as<double>(*range_q_ret, 3);
+
+            } catch (const std::exception& e) {
+                min_lat = 0;
+                max_lat = 0;
+                min_lon = 0;
+                max_lon = 0;
+            }
         }
 
         if (min_lat == 0 || min_lon == 0 || max_lat == 0 || max_lon == 0) {
@@ -392,6 +510,69 @@ int main(int argc, char *argv[]) {
             fmt::print("\n");
         }
 
+        if (blobstats) {
+            // Compare the stored size of the JSON records to the size of the JSON itself,
+            // and time reading and decoding them
+            const std::vector<std::pair<std::string, std::string>> blob_tables = {
+                {"devices", "device"},
+                {"data", "json"},
+                {"datasources", "json"},
+                {"alerts", "json"},
+                {"snapshots", "json"},
+            };
+
+            Json::Value blob_root;
+
+            if (outputjson)
+                blob_root["compressed"] = compression_dict.length() > 0;
+            else
+                fmt::print("  JSON records ({}):\n", 
+                        compression_dict.length() > 0 ? "compressed" : "uncompressed");
+
+            for (const auto& t : blob_tables) {
+                uint64_t n_records = 0, stored_sz = 0, json_sz = 0;
+                auto start = std::chrono::steady_clock::now();
+
+                auto blob_q = _SELECT(db, t.first, {t.second});
+
+                // Only the data table is split into segments
+                std::vector<std::shared_ptr<sqlite3>> blob_dbs;
+                if (t.first == "data")
+                    blob_dbs = log_dbs;
+                else
+                    blob_dbs.push_back(log_dbs[0]);
+
+                for (auto b : kismetdb_segments::query_chain(blob_q, blob_dbs)) {
+                    auto stored = sqlite3_column_as<std::string>(b, 0);
+
+                    n_records++;
+                    stored_sz += stored.length();
+                    json_sz += kismetdb_blob::decompress(stored, compression_dict).length();
+                }
+
+                auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                double mbs = secs > 0 ? (json_sz / (1024.0f * 1024.0f)) / secs : 0;
+
+                if (outputjson) {
+                    Json::Value table_root;
+                    table_root["records"] = (uint64_t) n_records;
+                    table_root["stored_bytes"] = (uint64_t) stored_sz;
+                    table_root["json_bytes"] = (uint64_t) json_sz;
+                    table_root["read_mb_sec"] = mbs;
+                    blob_root[t.first] = table_root;
+                } else {
+                    fmt::print("    {:<12} {} records, {} bytes stored, {} bytes JSON ({:.1f}%), "
+                            "read at {:.1f} MB/s\n", t.first, n_records, stored_sz, json_sz,
+                            json_sz > 0 ? (stored_sz * 100.0f) / json_sz : 0, mbs);
+                }
+            }
+
+            if (outputjson)
+                root["json_records"] = blob_root;
+            else
+                fmt::print("\n");
+        }
+
 
     } catch (const std::exception& e) {
         fmt::print(stderr, "ERROR:  Could not get database information from '{}': {}\n", in_fname, e.what());
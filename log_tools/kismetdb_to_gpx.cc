@@ -41,6 +41,9 @@
 
 #include "getopt.h"
 #include "json/json.h"
+#include "kismetdb_blob.h"
+#include "kismetdb_pipeline.h"
+#include "kismetdb_segments.h"
 #include "sqlite3_cpp11.h"
 #include "fmt.h"
 #include "packet_ieee80211.h"
@@ -188,6 +191,7 @@ void print_help(char *argv) {
     printf(" -i, --in [filename]          Input kismetdb file\n"
            " -o, --out [filename]         Output GPX file\n"
            " -f, --force                  Force writing to the target file, even if it exists.\n"
+           " -j, --jobs [n]               Number of worker threads, defaults to one per CPU\n"
            " -v, --verbose                Verbose output\n"
            " -s, --skip-clean             Don't clean (sql vacuum) input database\n"
            " -e, --exclude lat,lon,dist   Exclude records within 'dist' *meters* of the lat,lon\n"
@@ -208,6 +212,7 @@ int main(int argc, char *argv[]) {
         { "skip-clean", no_argument, 0, 's' },
         { "exclude", required_argument, 0, 'e'},
         { "basic-location", no_argument, 0, 'B'},
+        { "jobs", required_argument, 0, 'j'},
         { 0, 0, 0, 0 }
     };
 
@@ -231,9 +236,11 @@ int main(int argc, char *argv[]) {
 
     struct stat statbuf;
 
+    unsigned int jobs = kismetdb_pipeline::default_jobs();
+
     while (1) {
         int r = getopt_long(argc, argv, 
-                            "-hi:o:r:c:e:vfs", 
+                            "-hi:o:r:c:e:j:vfs", 
                             longopt, &option_idx);
         if (r < 0) break;
 
@@ -261,6 +268,11 @@ int main(int argc, char *argv[]) {
             exclusion_zones.push_back(std::make_tuple(lat, lon, distance));
         } else if (r == 'B') {
             basiclocation = true;
+        } else if (r == 'j') {
+            if (sscanf(optarg, "%u", &jobs) != 1 || jobs == 0) {
+                fmt::print(stderr, "ERROR:  Expected a number of jobs.\n");
+                exit(1);
+            }
         }
     }
 
@@ -319,6 +331,9 @@ int main(int argc, char *argv[]) {
 
     using namespace kissqlite3;
 
+    // Records may be compressed against a dictionary stored in the log
+    auto compression_dict = kismetdb_blob::load_dictionary(db);
+
     int db_version = 0;
     long int n_total_packets_db = 0L;
     long int n_packets_db = 0L;
@@ -326,6 +341,8 @@ int main(int argc, char *argv[]) {
     long int n_devices_gps_db = 0L;
     long int n_data_gps_db = 0L;
 
+    kismetdb_segments::segmented_log segments;
+
     try {
         // Get the version
         auto version_query = _SELECT(db, "KISMET", {"db_version"});
@@ -340,27 +357,23 @@ int main(int argc, char *argv[]) {
         if (verbose)
             fmt::print(stderr, "* Found KismetDB version {}\n", db_version);
 
+        // Packets and data may be split across log segments
+        segments.open(db, in_fname);
+
+        if (verbose && segments.num_segments() > 0)
+            fmt::print(stderr, "* Found {} log segments\n", segments.num_segments());
+
         // Get the total counts
         auto npackets_q = _SELECT(db, "packets", 
                 {"count(*), sum(case when (sourcemac != '00:00:00:00:00:00' "
                 "and lat != 0 and lon != 0) then 1 else 0 end)"});
-        auto npackets_ret = npackets_q.begin();
-        if (npackets_ret == npackets_q.end()) {
-            fmt::print(stderr, "ERROR:  Unable to fetch packet count.\n");
-            sqlite3_close(db);
-            exit(1);
+        for (auto p : kismetdb_segments::query_chain(npackets_q, segments.all())) {
+            n_total_packets_db += sqlite3_column_as<unsigned long>(p, 0);
+            n_packets_db += sqlite3_column_as<unsigned long>(p, 1);
         }
-        n_total_packets_db = sqlite3_column_as<unsigned long>(*npackets_ret, 0);
-        n_packets_db = sqlite3_column_as<unsigned long>(*npackets_ret, 1);
 
         auto ndata_q = _SELECT(db, "data", {"count(*)"}, _WHERE("lat", NEQ, 0, AND, "lon", NEQ, 0));
-        auto ndata_ret = ndata_q.begin();
-        if (npackets_ret == npackets_q.end()) {
-            fmt::print(stderr, "ERROR:  Unable to fetch data count.\n");
-            sqlite3_close(db);
-            exit(1);
-        }
-        n_data_gps_db = sqlite3_column_as<unsigned long>(*ndata_ret, 0);
+        n_data_gps_db = kismetdb_segments::sum(ndata_q, segments.all());
 
         auto ndevices_q = _SELECT(db, "devices", {"count(*)"});
         auto ndevices_ret = ndevices_q.begin();
@@ -460,9 +473,11 @@ int main(int argc, char *argv[]) {
             }
 
             Json::Value json;
-            std::stringstream ss(sqlite3_column_as<std::string>(d, 6));
+            std::stringstream ss;
 
             try {
+                ss.str(kismetdb_blob::decompress(sqlite3_column_as<std::string>(d, 6), compression_dict));
+
                 ss >> json;
 
                 if (avg_lat == 0 || avg_lon == 0)
@@ -483,10 +498,43 @@ int main(int argc, char *argv[]) {
 
         }
     } else {
-        auto basic_q = 
-            _SELECT(db, "devices", {"phyname", "devmac", "device"});
+        // Devices are located in parallel; each worker averages the packets and data of
+        // a device from its own connection to the log
+        struct worker_log {
+            std::shared_ptr<sqlite3> db;
+            kismetdb_segments::segmented_log segments;
+        };
 
-        for (auto d : basic_q) {
+        std::vector<std::unique_ptr<worker_log>> worker_logs;
+
+        try {
+            for (unsigned int j = 0; j < jobs; j++) {
+                auto wl = std::unique_ptr<worker_log>(new worker_log());
+
+                wl->db = kismetdb_pipeline::open_reader(in_fname);
+
+                if (wl->db == nullptr)
+                    throw std::runtime_error("unable to open the log");
+
+                wl->segments.open(wl->db.get(), in_fname);
+
+                for (const auto& sdb : wl->segments.all())
+                    kismetdb_pipeline::tune_reader(sdb.get());
+
+                worker_logs.push_back(std::move(wl));
+            }
+        } catch (const std::exception& e) {
+            fmt::print(stderr, "ERROR:  Could not open '{}' for reading: {}\n", in_fname, e.what());
+            exit(1);
+        }
+
+        struct device_row {
+            std::string phyname;
+            std::string devmac;
+            std::string device;
+        };
+
+        auto locate_device = [&](worker_log& wl, const device_row& row, gpx_waypoint& pl) -> bool {
             // Prep the packet list for different kismetdb versions
             std::list<std::string> packet_fields;
 
@@ -496,32 +544,38 @@ int main(int argc, char *argv[]) {
                 packet_fields = std::list<std::string>{"lat", "lon", "alt"};
             }
 
-            auto phyname = sqlite3_column_as<std::string>(d, 0);
-            auto devmac = sqlite3_column_as<std::string>(d, 1);
+            auto phyname = row.phyname;
+            auto devmac = row.devmac;
             Json::Value json;
 
-            std::stringstream ss(sqlite3_column_as<std::string>(d, 2));
-
-            gpx_waypoint pl;
+            std::stringstream ss;
 
             try {
+                ss.str(kismetdb_blob::decompress(row.device, compression_dict));
+
                 ss >> json;
                 pl.name = json["kismet.device.base.commonname"].asString();
             } catch (const std::exception& e) {
                 fmt::print(stderr, "WARNING:  Could not process device info for '{}', skipping\n", json);
-                continue;
+                return false;
             }
 
             pl.avg_alt = 0;
             pl.avg_lat = 0;
             pl.avg_lon = 0;
             pl.avg_2d_num = 0;
-            pl.avg_alt = 0;
+            pl.avg_alt_num = 0;
+            pl.alt = 0;
+
+            // Only look in the segments which saw this device
+            kismetdb_segments::segment_filter dev_filter;
+            dev_filter.devmacs.push_back(devmac);
+            auto dev_dbs = wl.segments.select(dev_filter);
 
-            auto packet_q = _SELECT(db, "packets", packet_fields,
+            auto packet_q = _SELECT(wl.db.get(), "packets", packet_fields,
                     _WHERE("sourcemac", EQ, devmac, AND, "phyname", EQ, phyname, AND, "lat", NEQ, 0, AND, "lon", NEQ, 0));
 
-            for (auto p : packet_q) {
+            for (auto p : kismetdb_segments::query_chain(packet_q, dev_dbs)) {
                 double lat, lon, alt;
 
                 // Handle the different versions
@@ -561,10 +615,10 @@ int main(int argc, char *argv[]) {
                 }
             }
 
-            auto data_q = _SELECT(db, "data", packet_fields,
+            auto data_q = _SELECT(wl.db.get(), "data", packet_fields,
                     _WHERE("devmac", EQ, devmac, AND, "phyname", EQ, phyname, AND, "lat", NEQ, 0, AND, "lon", NEQ, 0));
 
-            for (auto p : data_q) {
+            for (auto p : kismetdb_segments::query_chain(data_q, dev_dbs)) {
                 double lat, lon, alt;
 
                 // Handle the different versions
@@ -606,7 +660,7 @@ int main(int argc, char *argv[]) {
 
             if (pl.avg_2d_num == 0) {
                 fmt::print(stderr, "WARNING:  No packets with GPS info for '{}', skipping\n", pl.name);
-                continue;
+                return false;
             }
 
             pl.lat = pl.avg_lat / pl.avg_2d_num;
@@ -615,9 +669,55 @@ int main(int argc, char *argv[]) {
             if (pl.avg_alt_num)
                 pl.alt = pl.avg_alt / pl.avg_alt_num;
 
-            waypoint_vec.push_back(pl);
+            return true;
+        };
+
+        auto basic_q = 
+            _SELECT(db, "devices", {"phyname", "devmac", "device"});
+        auto basic_iter = basic_q.begin();
+
+        unsigned long n_processed = 0;
+        kismetdb_pipeline::progress progress("devices", n_devices_db, verbose);
+
+        try {
+            kismetdb_pipeline::run<device_row, std::pair<bool, gpx_waypoint>>(jobs, 16,
+                [&](std::vector<device_row>& batch, size_t max) -> size_t {
+                    while (batch.size() < max && basic_iter != basic_q.end()) {
+                        auto d = *basic_iter;
+
+                        batch.push_back(device_row {sqlite3_column_as<std::string>(d, 0),
+                                sqlite3_column_as<std::string>(d, 1),
+                                sqlite3_column_as<std::string>(d, 2)});
+
+                        ++basic_iter;
+                    }
+
+                    return batch.size();
+                },
+                [&](unsigned int worker, std::vector<device_row>& batch,
+                        std::vector<std::pair<bool, gpx_waypoint>>& out) {
+                    for (const auto& row : batch) {
+                        gpx_waypoint pl;
+                        auto usable = locate_device(*worker_logs[worker], row, pl);
+                        out.push_back(std::make_pair(usable, pl));
+                    }
+                },
+                [&](std::vector<std::pair<bool, gpx_waypoint>>& out) {
+                    for (const auto& o : out) {
+                        if (o.first)
+                            waypoint_vec.push_back(o.second);
+                    }
+
+                    n_processed += out.size();
+                    progress.update(n_processed);
+                });
+        } catch (const std::exception& e) {
+            fmt::print(stderr, "ERROR:  Failed to locate devices in '{}': {}\n", in_fname, e.what());
+            exit(1);
         }
 
+        progress.finish();
+
         fmt::print(ofile, 
                 "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
                 "<gpx version=\"1.0\">\n"
@@ -23,6 +23,7 @@
 
 #include "config.h"
 
+#include <algorithm>
 #include <map>
 #include <iomanip>
 #include <ctime>
@@ -43,6 +44,8 @@
 #include "fmt.h"
 #include "getopt.h"
 #include "json/json.h"
+#include "kismetdb_pipeline.h"
+#include "kismetdb_segments.h"
 #include "packet_ieee80211.h"
 #include "pcapng.h"
 #include "sqlite3_cpp11.h"
@@ -105,16 +108,22 @@ public:
     std::vector<int> dlts;
 };
 
-std::vector<int> get_dlts_per_datasouce(sqlite3 *db, const std::string& uuid) {
+std::vector<int> get_dlts_per_datasouce(const std::vector<std::shared_ptr<sqlite3>>& dbs,
+        const std::string& uuid) {
     using namespace kissqlite3;
 
     std::vector<int> ret;
 
-    auto npackets_q = _SELECT(db, "packets", 
+    auto npackets_q = _SELECT(dbs[0].get(), "packets", 
             {"distinct dlt"}, _WHERE("datasource", EQ, uuid));
 
-    for (auto i : npackets_q) 
-        ret.push_back(sqlite3_column_as<int>(i, 0));
+    // Each segment reports its own distinct DLTs
+    for (auto i : kismetdb_segments::query_chain(npackets_q, dbs)) {
+        auto dlt = sqlite3_column_as<int>(i, 0);
+
+        if (std::find(ret.begin(), ret.end(), dlt) == ret.end())
+            ret.push_back(dlt);
+    }
 
     return ret;
 }
@@ -592,6 +601,22 @@ int main(int argc, char *argv[]) {
         exit(0);
     }
 
+    // Packets may be split across log segments
+    kismetdb_segments::segmented_log segments;
+    std::vector<std::shared_ptr<sqlite3>> log_dbs;
+
+    try {
+        segments.open(db, in_fname);
+        log_dbs = segments.all();
+
+        if (verbose && segments.num_segments() > 0)
+            fmt::print(stderr, "* Found {} log segments\n", segments.num_segments());
+    } catch (const std::exception& e) {
+        fmt::print(stderr, "ERROR:  Could not open the log segments of '{}': {}\n", in_fname, e.what());
+        sqlite3_close(db);
+        exit(1);
+    }
+
     try {
         if (verbose)
             fmt::print(stderr, "* Collecting info about datasources...\n");
@@ -607,20 +632,18 @@ int main(int argc, char *argv[]) {
             dbsource->name = sqlite3_column_as<std::string>(q, 3);
             dbsource->interface = sqlite3_column_as<std::string>(q, 4);
 
+            // Only look in the segments this source logged to
+            kismetdb_segments::segment_filter source_filter;
+            source_filter.datasources.push_back(dbsource->uuid);
+            auto source_dbs = segments.select(source_filter);
+
             // Get the total counts
             auto npackets_q = _SELECT(db, "packets", 
                     {"count(*)"}, 
                     _WHERE("datasource", EQ, dbsource->uuid));
-            auto npackets_ret = npackets_q.begin();
-            if (npackets_ret == npackets_q.end()) {
-                fmt::print(stderr, "ERROR:  Unable to fetch packet count for datasource {} {} ({}).\n",
-                        dbsource->uuid, dbsource->name, dbsource->interface);
-                sqlite3_close(db);
-                exit(1);
-            }
-            dbsource->num_packets = sqlite3_column_as<unsigned long>(*npackets_ret, 0);
+            dbsource->num_packets = kismetdb_segments::sum(npackets_q, source_dbs);
 
-            dbsource->dlts = get_dlts_per_datasouce(db, dbsource->uuid);
+            dbsource->dlts = get_dlts_per_datasouce(source_dbs, dbsource->uuid);
 
             interface_vec.push_back(dbsource);
         }
@@ -740,174 +763,221 @@ int main(int argc, char *argv[]) {
             {"ts_sec", "ts_usec", "dlt", "datasource", "packet", "tags"},
             packet_filter_q);
 
-    try {
-        for (auto pkt : packets_q) {
-            auto ts_sec = sqlite3_column_as<unsigned long>(pkt, 0);
-            auto ts_usec = sqlite3_column_as<unsigned long>(pkt, 1);
-            auto pkt_dlt = sqlite3_column_as<unsigned int>(pkt, 2);
-            auto datasource = sqlite3_column_as<std::string>(pkt, 3);
-            auto bytes = sqlite3_column_as<std::string>(pkt, 4);
-            auto tags = sqlite3_column_as<std::string>(pkt, 5);
-
-            if (!pcapng) {
-                std::shared_ptr<log_file> log_interface;
-
-                if (split_interface) {
-                    auto log_index = per_interface_logs.find(datasource);
-
-                    if (log_index == per_interface_logs.end()) {
-                        log_interface = std::make_shared<log_file>();
-                        per_interface_logs[datasource] = log_interface;
-                    } else {
-                        log_interface = log_index->second;
-                    }
+    struct pcap_packet {
+        unsigned long ts_sec;
+        unsigned long ts_usec;
+        unsigned int pkt_dlt;
+        std::string datasource;
+        std::string bytes;
+        std::string tags;
+    };
 
-                } else {
-                    log_interface = single_log;
-                }
+    for (const auto& ldb : log_dbs)
+        kismetdb_pipeline::tune_reader(ldb.get());
 
-                if (log_interface->file == nullptr) {
-                    int file_dlt = dlt;
+    auto packet_chain = kismetdb_segments::query_chain(packets_q, log_dbs);
+    auto packet_iter = packet_chain.begin();
 
-                    if (file_dlt < 0)
-                        file_dlt = pkt_dlt;
+    unsigned long n_packets = 0;
+    kismetdb_pipeline::progress progress("packets", 0, verbose);
 
-                    auto fname = out_fname;
+    try {
+        // Packets don't need any decoding, so a single worker is enough to read the 
+        // log ahead of the writer
+        kismetdb_pipeline::run<pcap_packet, pcap_packet>(2, 1024,
+            [&](std::vector<pcap_packet>& batch, size_t max) -> size_t {
+                while (batch.size() < max && packet_iter != packet_chain.end()) {
+                    auto pkt = *packet_iter;
+
+                    batch.push_back(pcap_packet {
+                            sqlite3_column_as<unsigned long>(pkt, 0),
+                            sqlite3_column_as<unsigned long>(pkt, 1),
+                            sqlite3_column_as<unsigned int>(pkt, 2),
+                            sqlite3_column_as<std::string>(pkt, 3),
+                            sqlite3_column_as<std::string>(pkt, 4),
+                            sqlite3_column_as<std::string>(pkt, 5)});
+
+                    ++packet_iter;
+                }
 
-                    if (split_interface)
-                        fname = fmt::format("{}-{}", fname, datasource);
+                return batch.size();
+            },
+            [](unsigned int, std::vector<pcap_packet>& batch, std::vector<pcap_packet>& out) {
+                out.swap(batch);
+            },
+            [&](std::vector<pcap_packet>& out) {
+                for (const auto& pkt : out) {
+                    const auto& ts_sec = pkt.ts_sec;
+                    const auto& ts_usec = pkt.ts_usec;
+                    const auto& pkt_dlt = pkt.pkt_dlt;
+                    const auto& datasource = pkt.datasource;
+                    const auto& bytes = pkt.bytes;
+                    const auto& tags = pkt.tags;
+
+                    if (!pcapng) {
+                        std::shared_ptr<log_file> log_interface;
+
+                        if (split_interface) {
+                            auto log_index = per_interface_logs.find(datasource);
+
+                            if (log_index == per_interface_logs.end()) {
+                                log_interface = std::make_shared<log_file>();
+                                per_interface_logs[datasource] = log_interface;
+                            } else {
+                                log_interface = log_index->second;
+                            }
+
+                        } else {
+                            log_interface = single_log;
+                        }
 
-                    if (split_packets || split_size) {
-                        fname = fmt::format("{}-{:06}", fname, log_interface->number);
-                        log_interface->number++;
-                    }
+                        if (log_interface->file == nullptr) {
+                            int file_dlt = dlt;
 
-                    if (verbose)
-                        fmt::print(stderr, "* Opening legacy pcap file {}\n", fname);
+                            if (file_dlt < 0)
+                                file_dlt = pkt_dlt;
 
-                    log_interface->name = fname;
+                            auto fname = out_fname;
 
-                    log_interface->file = open_pcap_file(fname, force, file_dlt);
-                }
+                            if (split_interface)
+                                fname = fmt::format("{}-{}", fname, datasource);
 
-                write_pcap_packet(log_interface->file, bytes, ts_sec, ts_usec);
-
-                log_interface->sz += bytes.size();
-                log_interface->count++;
-
-                if (split_packets && log_interface->count >= split_packets) {
-                    if (verbose)
-                        fmt::print(stderr, "* Closing pcap file {} after {} packets\n",
-                                log_interface->name, log_interface->count);
-
-                    fclose(log_interface->file);
-                    log_interface->file = nullptr;
-                    log_interface->count = 0;
-                } else if (split_size && log_interface->sz >= split_size * 1024) {
-                    if (verbose)
-                        fmt::print(stderr, "* Closing pcap file {} after {}kb\n",
-                                log_interface->name, log_interface->sz / 1024);
-                    fclose(log_interface->file);
-                    log_interface->file = nullptr;
-                    log_interface->sz = 0;
-                }
-            } else {
-                // pcapng
+                            if (split_packets || split_size) {
+                                fname = fmt::format("{}-{:06}", fname, log_interface->number);
+                                log_interface->number++;
+                            }
+
+                            if (verbose)
+                                fmt::print(stderr, "* Opening legacy pcap file {}\n", fname);
 
-                std::shared_ptr<log_file> log_interface;
+                            log_interface->name = fname;
 
-                if (split_interface) {
-                    auto log_index = per_interface_logs.find(datasource);
+                            log_interface->file = open_pcap_file(fname, force, file_dlt);
+                        }
 
-                    if (log_index == per_interface_logs.end()) {
-                        log_interface = std::make_shared<log_file>();
-                        per_interface_logs[datasource] = log_interface;
+                        write_pcap_packet(log_interface->file, bytes, ts_sec, ts_usec);
+
+                        log_interface->sz += bytes.size();
+                        log_interface->count++;
+
+                        if (split_packets && log_interface->count >= split_packets) {
+                            if (verbose)
+                                fmt::print(stderr, "* Closing pcap file {} after {} packets\n",
+                                        log_interface->name, log_interface->count);
+
+                            fclose(log_interface->file);
+                            log_interface->file = nullptr;
+                            log_interface->count = 0;
+                        } else if (split_size && log_interface->sz >= split_size * 1024) {
+                            if (verbose)
+                                fmt::print(stderr, "* Closing pcap file {} after {}kb\n",
+                                        log_interface->name, log_interface->sz / 1024);
+                            fclose(log_interface->file);
+                            log_interface->file = nullptr;
+                            log_interface->sz = 0;
+                        }
                     } else {
-                        log_interface = log_index->second;
-                    }
+                        // pcapng
 
-                } else {
-                    log_interface = single_log;
-                }
+                        std::shared_ptr<log_file> log_interface;
 
-                if (log_interface->file == nullptr) {
-                    int file_dlt = dlt;
+                        if (split_interface) {
+                            auto log_index = per_interface_logs.find(datasource);
 
-                    if (file_dlt < 0)
-                        file_dlt = pkt_dlt;
+                            if (log_index == per_interface_logs.end()) {
+                                log_interface = std::make_shared<log_file>();
+                                per_interface_logs[datasource] = log_interface;
+                            } else {
+                                log_interface = log_index->second;
+                            }
 
-                    auto fname = out_fname;
+                        } else {
+                            log_interface = single_log;
+                        }
 
-                    if (split_interface)
-                        fname = fmt::format("{}-{}", fname, datasource);
+                        if (log_interface->file == nullptr) {
+                            int file_dlt = dlt;
 
-                    if (split_packets || split_size) {
-                        fname = fmt::format("{}-{:06}", fname, log_interface->number);
-                        log_interface->number++;
-                    }
+                            if (file_dlt < 0)
+                                file_dlt = pkt_dlt;
 
-                    if (verbose)
-                        fmt::print(stderr, "* Opening pcapng file {}\n", fname);
+                            auto fname = out_fname;
 
-                    log_interface->name = fname;
+                            if (split_interface)
+                                fname = fmt::format("{}-{}", fname, datasource);
 
-                    log_interface->file = open_pcapng_file(fname, force);
-                }
+                            if (split_packets || split_size) {
+                                fname = fmt::format("{}-{:06}", fname, log_interface->number);
+                                log_interface->number++;
+                            }
 
-                auto source_combo = fmt::format("{}-{}", datasource, pkt_dlt);
-                auto source_key = log_interface->ng_interface_map.find(source_combo);
-                unsigned int ngindex = 0;
+                            if (verbose)
+                                fmt::print(stderr, "* Opening pcapng file {}\n", fname);
 
-                if (source_key == log_interface->ng_interface_map.end()) {
-                    std::shared_ptr<db_interface> dbinterface;
+                            log_interface->name = fname;
 
-                    for (auto dbi : interface_vec) {
-                        if (dbi->uuid == datasource) {
-                            auto desc = fmt::format("Kismet datasource {} ({} - {})",
-                                    dbi->name, dbi->interface, dbi->definition);
-                            ngindex = log_interface->ng_interface_map.size();
+                            log_interface->file = open_pcapng_file(fname, force);
+                        }
 
-                            log_interface->ng_interface_map[source_combo] = ngindex;
+                        auto source_combo = fmt::format("{}-{}", datasource, pkt_dlt);
+                        auto source_key = log_interface->ng_interface_map.find(source_combo);
+                        unsigned int ngindex = 0;
 
-                            write_pcapng_interface(log_interface->file, ngindex,
-                                    dbi->interface, pkt_dlt, desc);
+                        if (source_key == log_interface->ng_interface_map.end()) {
+                            std::shared_ptr<db_interface> dbinterface;
 
-                            break;
+                            for (auto dbi : interface_vec) {
+                                if (dbi->uuid == datasource) {
+                                    auto desc = fmt::format("Kismet datasource {} ({} - {})",
+                                            dbi->name, dbi->interface, dbi->definition);
+                                    ngindex = log_interface->ng_interface_map.size();
+
+                                    log_interface->ng_interface_map[source_combo] = ngindex;
+
+                                    write_pcapng_interface(log_interface->file, ngindex,
+                                            dbi->interface, pkt_dlt, desc);
+
+                                    break;
+                                }
+                            }
+                        } else {
+                            ngindex = source_key->second;
                         }
-                    }
-                } else {
-                    ngindex = source_key->second;
-                }
 
-                write_pcapng_packet(log_interface->file, bytes, ts_sec, ts_usec, tags, ngindex);
-
-                log_interface->sz += bytes.size();
-                log_interface->count++;
-
-                if (split_packets && log_interface->count >= split_packets) {
-                    if (verbose)
-                        fmt::print(stderr, "* Closing pcapng file {} after {} packets\n",
-                                log_interface->name, log_interface->count);
-
-                    fclose(log_interface->file);
-                    log_interface->file = nullptr;
-                    log_interface->count = 0;
-                } else if (split_size && log_interface->sz >= split_size * 1024) {
-                    if (verbose)
-                        fmt::print(stderr, "* Closing pcap file {} after {}kb\n",
-                                log_interface->name, log_interface->sz / 1024);
-                    fclose(log_interface->file);
-                    log_interface->file = nullptr;
-                    log_interface->sz = 0;
+                        write_pcapng_packet(log_interface->file, bytes, ts_sec, ts_usec, tags, ngindex);
+
+                        log_interface->sz += bytes.size();
+                        log_interface->count++;
+
+                        if (split_packets && log_interface->count >= split_packets) {
+                            if (verbose)
+                                fmt::print(stderr, "* Closing pcapng file {} after {} packets\n",
+                                        log_interface->name, log_interface->count);
+
+                            fclose(log_interface->file);
+                            log_interface->file = nullptr;
+                            log_interface->count = 0;
+                        } else if (split_size && log_interface->sz >= split_size * 1024) {
+                            if (verbose)
+                                fmt::print(stderr, "* Closing pcap file {} after {}kb\n",
+                                        log_interface->name, log_interface->sz / 1024);
+                            fclose(log_interface->file);
+                            log_interface->file = nullptr;
+                            log_interface->sz = 0;
+                        }
+                    }
                 }
-            }
 
-        }
+                n_packets += out.size();
+                progress.update(n_packets);
+            });
     } catch (const std::exception& e) {
         fmt::print(stderr, "*ERROR: Failed to extract and write packets: {}\n", e.what());
         exit(0);
     }
 
+    progress.finish();
+
     sqlite3_close(db);
 
     return 0;
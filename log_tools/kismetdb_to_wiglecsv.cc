@@ -23,6 +23,7 @@
 
 #include "config.h"
 
+#include <atomic>
 #include <map>
 #include <iomanip>
 #include <ctime>
@@ -42,6 +43,9 @@
 
 #include "getopt.h"
 #include "json/json.h"
+#include "kismetdb_blob.h"
+#include "kismetdb_pipeline.h"
+#include "kismetdb_segments.h"
 #include "sqlite3_cpp11.h"
 #include "fmt.h"
 #include "packet_ieee80211.h"
@@ -165,6 +169,7 @@ void print_help(char *argv) {
            " -r, --rate-limit [rate]      Limit updated records to one update per [rate] seconds\n"
            "                              per device\n"
            " -c, --cache-limit [limit]    Maximum number of device to cache, defaults to 1000.\n"
+           " -j, --jobs [n]               Number of worker threads, defaults to one per CPU\n"
            " -v, --verbose                Verbose output\n"
            " -s, --skip-clean             Don't clean (sql vacuum) input database\n"
            " -e, --exclude lat,lon,dist   Exclude records within 'dist' *meters* of the lat,lon\n"
@@ -183,6 +188,7 @@ int main(int argc, char *argv[]) {
         { "rate-limit", required_argument, 0, 'r'},
         { "cache-limit", required_argument, 0, 'c'},
         { "exclude", required_argument, 0, 'e'},
+        { "jobs", required_argument, 0, 'j'},
         { 0, 0, 0, 0 }
     };
 
@@ -207,10 +213,11 @@ int main(int argc, char *argv[]) {
 
     unsigned int rate_limit = 0;
     unsigned int cache_limit = 1000;
+    unsigned int jobs = kismetdb_pipeline::default_jobs();
 
     while (1) {
         int r = getopt_long(argc, argv, 
-                            "-hi:o:r:c:e:vfs", 
+                            "-hi:o:r:c:e:j:vfs", 
                             longopt, &option_idx);
         if (r < 0) break;
 
@@ -246,6 +253,11 @@ int main(int argc, char *argv[]) {
             }
 
             exclusion_zones.push_back(std::make_tuple(lat, lon, distance));
+        } else if (r == 'j') {
+            if (sscanf(optarg, "%u", &jobs) != 1 || jobs == 0) {
+                fmt::print(stderr, "ERROR:  Expected a number of jobs.\n");
+                exit(1);
+            }
         }
     }
 
@@ -304,11 +316,16 @@ int main(int argc, char *argv[]) {
 
     using namespace kissqlite3;
 
+    // Records may be compressed against a dictionary stored in the log
+    auto compression_dict = kismetdb_blob::load_dictionary(db);
+
     int db_version = 0;
     long int n_total_packets_db = 0L;
     long int n_packets_db = 0L;
     long int n_devices_db = 0L;
 
+    kismetdb_segments::segmented_log segments;
+
     try {
         // Get the version
         auto version_query = _SELECT(db, "KISMET", {"db_version"});
@@ -323,18 +340,20 @@ int main(int argc, char *argv[]) {
         if (verbose)
             fmt::print(stderr, "* Found KismetDB version {}\n", db_version);
 
+        // Packets may be split across log segments
+        segments.open(db, in_fname);
+
+        if (verbose && segments.num_segments() > 0)
+            fmt::print(stderr, "* Found {} log segments\n", segments.num_segments());
+
         // Get the total counts
         auto npackets_q = _SELECT(db, "packets", 
                 {"count(*), sum(case when (sourcemac != '00:00:00:00:00:00' "
                 "and lat != 0 and lon != 0) then 1 else 0 end)"});
-        auto npackets_ret = npackets_q.begin();
-        if (npackets_ret == npackets_q.end()) {
-            fmt::print(stderr, "ERROR:  Unable to fetch packet count.\n");
-            sqlite3_close(db);
-            exit(1);
+        for (auto p : kismetdb_segments::query_chain(npackets_q, segments.all())) {
+            n_total_packets_db += sqlite3_column_as<unsigned long>(p, 0);
+            n_packets_db += sqlite3_column_as<unsigned long>(p, 1);
         }
-        n_total_packets_db = sqlite3_column_as<unsigned long>(*npackets_ret, 0);
-        n_packets_db = sqlite3_column_as<unsigned long>(*npackets_ret, 1);
 
         auto ndevices_q = _SELECT(db, "devices", {"count(*)"});
         auto ndevices_ret = ndevices_q.begin();
@@ -371,25 +390,35 @@ int main(int argc, char *argv[]) {
     }
 
     // Define a simple cache; we don't need to use a proper kismet macaddr here, just operate
-    // on it as a string
+    // on it as a string.  The cache is shared by the workers; devices which can't be
+    // used are cached too, so that they're only looked up once.
     class cache_obj {
     public:
+        cache_obj() :
+            usable{false} { }
+
         cache_obj(std::string t, std::string s, std::string c) :
             first_time{t},
             name{s},
             crypto{c},
-            last_time_sec{0} { }
+            usable{true} { }
 
         std::string first_time;
         std::string name;
         std::string crypto;
-        uint64_t last_time_sec;
+        bool usable;
     };
 
-    std::map<std::string, cache_obj *> device_cache_map;
+    std::map<std::string, std::shared_ptr<cache_obj>> device_cache_map;
+    std::mutex device_cache_mutex;
+    std::atomic<unsigned long> n_cache_cleans{0};
+
+    // The rate limit depends on the order of the packets, so it's tracked by the writer
+    std::map<std::string, uint64_t> device_last_time_map;
 
     if (verbose) 
-        fmt::print(stderr, "* Starting to process file, max device cache {}\n", cache_limit);
+        fmt::print(stderr, "* Starting to process file, max device cache {}, {} jobs\n", 
+                cache_limit, jobs);
 
     // CSV headers
     fmt::print(ofile, "WigleWifi-1.4,appRelease=20190201,model=Kismet,release=2019.02.01.{},"
@@ -413,186 +442,262 @@ int main(int argc, char *argv[]) {
                 AND,
                 "lon", NEQ, 0));
 
+    for (const auto& sdb : segments.all())
+        kismetdb_pipeline::tune_reader(sdb.get());
+
+    // Each worker looks up devices with its own connection
+    std::vector<std::shared_ptr<sqlite3>> worker_dbs;
+
+    for (unsigned int j = 0; j < jobs; j++) {
+        auto wdb = kismetdb_pipeline::open_reader(in_fname);
+
+        if (wdb == nullptr) {
+            fmt::print(stderr, "ERROR:  Unable to open '{}' for reading\n", in_fname);
+            exit(1);
+        }
+
+        worker_dbs.push_back(wdb);
+    }
+
+    struct wigle_packet {
+        uint64_t ts;
+        std::string sourcemac;
+        std::string phy;
+        double lat, lon, alt;
+        int signal;
+        double channel;
+    };
+
+    struct wigle_record {
+        uint64_t ts;
+        std::string sourcemac;
+        // Empty if the record was discarded
+        std::string line;
+        bool excluded;
+    };
+
     unsigned long n_logs = 0;
     unsigned long n_saved = 0;
     unsigned long n_discarded_logs_rate = 0;
     unsigned long n_discarded_logs_zones = 0;
-    unsigned long n_division = (n_packets_db / 20);
 
-    if (n_division <= 0)
-        n_division = 1;
+    kismetdb_pipeline::progress progress("records", n_packets_db, verbose);
 
-    for (auto p : query) {
-        // Brute-force cache maintenance; if we're full at the start of the 
-        // processing loop, nuke the ENTIRE cache and rebuild it; this is
-        // cleaner than constantly re-sorting it.
-        if (device_cache_map.size() >= cache_limit) {
-            if (verbose)
-                fmt::print(stderr, "* Cleaning cache...\n");
+    auto packet_chain = kismetdb_segments::query_chain(query, segments.all());
+    auto packet_iter = packet_chain.begin();
 
-            for (auto i : device_cache_map) {
-                delete(i.second);
-            }
+    try {
+        kismetdb_pipeline::run<wigle_packet, wigle_record>(jobs, 4096,
+            [&](std::vector<wigle_packet>& batch, size_t max) -> size_t {
+                while (batch.size() < max && packet_iter != packet_chain.end()) {
+                    auto p = *packet_iter;
+                    wigle_packet wp;
+
+                    wp.ts = sqlite3_column_as<std::uint64_t>(p, 0);
+                    wp.sourcemac = sqlite3_column_as<std::string>(p, 1);
+                    wp.phy = sqlite3_column_as<std::string>(p, 2);
+                    wp.signal = sqlite3_column_as<int>(p, 5);
+                    wp.channel = sqlite3_column_as<double>(p, 6);
+                    wp.alt = 0;
+
+                    // Handle the different versions
+                    if (db_version < 5) {
+                        wp.lat = sqlite3_column_as<double>(p, 3) / 100000;
+                        wp.lon = sqlite3_column_as<double>(p, 4) / 100000;
+                    } else {
+                        wp.lat = sqlite3_column_as<double>(p, 3);
+                        wp.lon = sqlite3_column_as<double>(p, 4);
+                        wp.alt = sqlite3_column_as<double>(p, 7);
+                    }
 
-            device_cache_map.clear();
-        }
+                    batch.push_back(wp);
 
-        n_logs++;
-        if (n_logs % n_division == 0 && verbose)
-            std::cerr << 
-                fmt::format("* {}%% processed {} records, {} discarded from rate limiting, {} discarded from exclusion zones, {} cached",
-                    (int) (((float) n_logs / (float) n_packets_db) * 100) + 1, 
-                    n_logs, n_discarded_logs_rate, n_discarded_logs_zones, device_cache_map.size()) << std::endl;
+                    ++packet_iter;
+                }
 
-        auto ts = sqlite3_column_as<std::uint64_t>(p, 0);
-        auto sourcemac = sqlite3_column_as<std::string>(p, 1);
-        auto phy = sqlite3_column_as<std::string>(p, 2);
+                return batch.size();
+            },
+            [&](unsigned int worker, std::vector<wigle_packet>& batch, 
+                    std::vector<wigle_record>& out) {
+                for (const auto& wp : batch) {
+                    wigle_record rec;
+                    rec.ts = wp.ts;
+                    rec.sourcemac = wp.sourcemac;
+                    rec.excluded = false;
+
+                    // Check to see if we lie in any exclusion zones
+                    for (auto ez : exclusion_zones) {
+                        if (distance_meters(wp.lat, wp.lon, std::get<0>(ez), std::get<1>(ez)) <= std::get<2>(ez)) {
+                            rec.excluded = true;
+                            break;
+                        }
+                    }
 
-        auto lat = 0.0f, lon = 0.0f, alt = 0.0f, spd = 0.0f;
+                    if (rec.excluded) {
+                        out.push_back(rec);
+                        continue;
+                    }
 
-        auto signal = sqlite3_column_as<int>(p, 5);
-        auto channel = sqlite3_column_as<double>(p, 6);
+                    std::shared_ptr<cache_obj> cached;
 
-        auto crypt = std::string{""};
+                    {
+                        std::lock_guard<std::mutex> lk(device_cache_mutex);
+                        auto ci = device_cache_map.find(wp.sourcemac);
+                        if (ci != device_cache_map.end())
+                            cached = ci->second;
+                    }
 
-        // Handle the different versions
-        if (db_version < 5) {
-            lat = sqlite3_column_as<double>(p, 3) / 100000;
-            lon = sqlite3_column_as<double>(p, 4) / 100000;
-        } else {
-            lat = sqlite3_column_as<double>(p, 3);
-            lon = sqlite3_column_as<double>(p, 4);
-            alt = sqlite3_column_as<double>(p, 7);
-            spd = sqlite3_column_as<double>(p, 8);
-        }
+                    if (cached == nullptr) {
+                        cached = std::make_shared<cache_obj>();
 
-        auto ci = device_cache_map.find(sourcemac);
-        cache_obj *cached = nullptr;
+                        auto dev_query = _SELECT(worker_dbs[worker].get(), "devices", {"device"},
+                                _WHERE("devmac", EQ, wp.sourcemac,
+                                    AND,
+                                    "phyname", EQ, wp.phy));
 
-        if (ci != device_cache_map.end()) {
-            cached = ci->second;
-        } else {
-            auto dev_query = _SELECT(db, "devices", {"device"},
-                    _WHERE("devmac", EQ, sourcemac,
-                        AND,
-                        "phyname", EQ, phy));
+                        auto dev = dev_query.begin();
 
-            auto dev = dev_query.begin();
+                        if (dev != dev_query.end()) {
+                            Json::Value json;
+                            std::stringstream ss;
 
-            if (dev == dev_query.end()) {
-                // printf("Could not find device record for %s\n", sqlite3_column_as<std::string>(p, 0).c_str());
-                continue;
-            }
+                            try {
+                                ss.str(kismetdb_blob::decompress(sqlite3_column_as<std::string>(*dev, 0), compression_dict));
 
-            // Check to see if we lie in any exclusion zones
-            bool violates_exclusion = false;
-            for (auto ez : exclusion_zones) {
-                if (distance_meters(lat, lon, std::get<0>(ez), std::get<1>(ez)) <= std::get<2>(ez)) {
-                    violates_exclusion = true;
-                    break;
-                }
-            }
+                                ss >> json;
 
-            if (violates_exclusion) {
-                n_discarded_logs_zones++;
-                continue;
-            }
+                                auto timestamp = json["kismet.device.base.first_time"].asUInt64();
+                                auto name = std::string{""};
+                                auto crypt = std::string{""};
+                                auto type = json["kismet.device.base.type"].asString();
+                                bool usable = true;
 
-            Json::Value json;
-            std::stringstream ss(sqlite3_column_as<std::string>(*dev, 0));
+                                if (wp.phy == "IEEE802.11") {
+                                    if (type != "Wi-Fi AP")
+                                        usable = false;
 
-            try {
-                ss >> json;
+                                    if (json["dot11.device"]["dot11.device.last_beaconed_ssid"].isString()) {
+                                        name = MungeForCSV(json["dot11.device"]["dot11.device.last_beaconed_ssid"].asString());
+                                    } else if (json["dot11.device"]["dot11.device.last_beaconed_ssid_record"]["dot11.advertisedssid.ssid"].isString()) {
+                                        name = MungeForCSV(json["dot11.device"]["dot11.device.last_beaconed_ssid_record"]["dot11.advertisedssid.ssid"].asString());
+                                    } else {
+                                        name = "";
+                                    }
 
-                auto timestamp = json["kismet.device.base.first_time"].asUInt64();
-                auto name = std::string{""};
-                auto crypt = std::string{""};
-                auto type = json["kismet.device.base.type"].asString();
+                                    // Handle the aliased ssid_record for modern info
+                                    if (!json["dot11.device"]["dot11.device.last_beaconed_ssid_record"].isNull()) {
+                                        crypt = WifiCryptToString(json["dot11.device"]["dot11.device.last_beaconed_ssid_record"]["dot11.advertisedssid.crypt_set"].asUInt64());
+                                    } else {
+                                        auto last_ssid_key = 
+                                            json["dot11.device"]["dot11.device.last_beaconed_ssid_checksum"].asUInt64();
+                                        std::stringstream ss;
 
-                if (phy == "IEEE802.11") {
-                    if (type != "Wi-Fi AP")
-                        continue;
+                                        ss << last_ssid_key;
 
-                    if (json["dot11.device"]["dot11.device.last_beaconed_ssid"].isString()) {
-                        name = MungeForCSV(json["dot11.device"]["dot11.device.last_beaconed_ssid"].asString());
-                    } else if (!json["dot11.device"]["dot11.device.last_beaconed_ssid_record"].isNull()) {
-                        name = MungeForCSV(json["dot11.device"]["dot11.device.last_beaconed_ssid_record"]["dot11.advertisedssid.ssid"].asString());
-                    } else {
-                        name = "";
-                    }
-                    if (json["dot11.device"]["dot11.device.last_beaconed_ssid"].isString()) {
-                        name = MungeForCSV(json["dot11.device"]["dot11.device.last_beaconed_ssid"].asString());
-                    } else if (json["dot11.device"]["dot11.device.last_beaconed_ssid_record"]["dot11.advertisedssid.ssid"].isString()) {
-                        name = MungeForCSV(json["dot11.device"]["dot11.device.last_beaconed_ssid_record"]["dot11.advertisedssid.ssid"].asString());
-                    } else {
-                        name = "";
-                    }
+                                        crypt = WifiCryptToString(json["dot11.device"]["dot11.device.advertised_ssid_map"][ss.str()]["dot11.advertisedssid.crypt_set"].asUInt64());
+                                    }
 
-                    // Handle the aliased ssid_record for modern info
-                    if (!json["dot11.device"]["dot11.device.last_beaconed_ssid_record"].isNull()) {
-                        crypt = WifiCryptToString(json["dot11.device"]["dot11.device.last_beaconed_ssid_record"]["dot11.advertisedssid.crypt_set"].asUInt64());
-                    } else {
-                        auto last_ssid_key = 
-                            json["dot11.device"]["dot11.device.last_beaconed_ssid_checksum"].asUInt64();
-                        std::stringstream ss;
+                                    crypt += "[ESS]";
+
+                                }
+
+                                if (usable) {
+                                    std::time_t timet(timestamp);
+                                    std::tm tm;
+                                    std::stringstream ts;
+
+                                    gmtime_r(&timet, &tm);
+
+                                    ts << std::put_time(&tm, "%Y-%m-%d %H:%M:%S");
+
+                                    cached = std::make_shared<cache_obj>(ts.str(), name, crypt);
+                                }
+                            } catch (const std::exception& e) {
+                                std::cerr << 
+                                    fmt::format("WARNING:  Could not process device info for {}/{}, skipping", wp.sourcemac, wp.phy) << std::endl;
+                            }
+                        }
 
-                        ss << last_ssid_key;
+                        // Brute-force cache maintenance; if we're full, nuke the ENTIRE 
+                        // cache and rebuild it; this is cleaner than constantly re-sorting it.
+                        std::lock_guard<std::mutex> lk(device_cache_mutex);
 
-                        crypt = WifiCryptToString(json["dot11.device"]["dot11.device.advertised_ssid_map"][ss.str()]["dot11.advertisedssid.crypt_set"].asUInt64());
+                        if (device_cache_map.size() >= cache_limit) {
+                            device_cache_map.clear();
+                            n_cache_cleans++;
+                        }
+
+                        device_cache_map[wp.sourcemac] = cached;
                     }
 
-                    crypt += "[ESS]";
+                    if (!cached->usable) {
+                        out.push_back(rec);
+                        continue;
+                    }
 
-                }
+                    auto channel = wp.channel;
 
-                std::time_t timet(timestamp);
-                std::tm tm;
-                std::stringstream ts;
+                    if (wp.phy == "IEEE802.11")
+                        channel = FrequencyToWifiChannel(channel);
 
-                gmtime_r(&timet, &tm);
+                    // printf("MAC,SSID,AuthMode,FirstSeen,Channel,RSSI,CurrentLatitude,CurrentLongitude,AltitudeMeters,AccuracyMeters,Type\n");
 
-                ts << std::put_time(&tm, "%Y-%m-%d %H:%M:%S");
+                    rec.line = fmt::format("{},{},{},{},{},{},{:3.10f},{:3.10f},{:f},0,{}\n",
+                            wp.sourcemac,
+                            cached->name,
+                            cached->crypto,
+                            cached->first_time,
+                            (int) channel,
+                            wp.signal,
+                            wp.lat, wp.lon, wp.alt,
+                            "WIFI");
 
-                cached = new cache_obj{ts.str(), name, crypt};
+                    out.push_back(rec);
+                }
+            },
+            [&](std::vector<wigle_record>& out) {
+                for (const auto& rec : out) {
+                    n_logs++;
 
-                device_cache_map[sourcemac] = cached;
+                    if (rec.excluded) {
+                        n_discarded_logs_zones++;
+                        continue;
+                    }
 
-            } catch (const std::exception& e) {
-                std::cerr << 
-                    fmt::format("WARNING:  Could not process device info for {}/{}, skipping", sourcemac, phy) << std::endl;
-            }
-        }
+                    if (rec.line.length() == 0)
+                        continue;
 
-        if (cached == nullptr)
-            continue;
+                    // Rate throttle
+                    if (device_last_time_map.size() >= cache_limit)
+                        device_last_time_map.clear();
 
-        // Rate throttle
-        if (rate_limit != 0 && cached->last_time_sec != 0) {
-            if (cached->last_time_sec + rate_limit < ts) {
-                n_discarded_logs_rate++;
-                continue;
-            }
-        } 
-        cached->last_time_sec = ts;
+                    auto& last_time_sec = device_last_time_map[rec.sourcemac];
 
-        if (phy == "IEEE802.11")
-            channel = FrequencyToWifiChannel(channel);
+                    if (rate_limit != 0 && last_time_sec != 0) {
+                        if (last_time_sec + rate_limit < rec.ts) {
+                            n_discarded_logs_rate++;
+                            continue;
+                        }
+                    } 
+                    last_time_sec = rec.ts;
 
-        // printf("MAC,SSID,AuthMode,FirstSeen,Channel,RSSI,CurrentLatitude,CurrentLongitude,AltitudeMeters,AccuracyMeters,Type\n");
+                    fputs(rec.line.c_str(), ofile);
 
-        fmt::print(ofile, "{},{},{},{},{},{},{:3.10f},{:3.10f},{:f},0,{}\n",
-                sourcemac,
-                cached->name,
-                cached->crypto,
-                cached->first_time,
-                (int) channel,
-                signal,
-                lat, lon, alt,
-                "WIFI");
+                    n_saved++;
+                }
 
-        n_saved++;
+                progress.update(n_logs);
+            });
+    } catch (const std::exception& e) {
+        fmt::print(stderr, "ERROR:  Failed to convert '{}': {}\n", in_fname, e.what());
+        exit(1);
     }
 
+    progress.finish();
+
+    if (verbose && n_cache_cleans > 0)
+        fmt::print(stderr, "* Cleaned device cache {} times\n", n_cache_cleans.load());
+
     if (ofile != stdout) {
         fclose(ofile);
 
@@ -0,0 +1,429 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <string.h>
+#include <string>
+
+#include "globalregistry.h"
+#include "trackedelement.h"
+#include "macaddr.h"
+#include "entrytracker.h"
+#include "uuid.h"
+#include "devicetracker_component.h"
+#include "msgpack_adapter.h"
+
+namespace {
+
+// Write the low 'len' bytes of a value, big-endian
+void pack_be(std::ostream& stream, uint64_t v, unsigned int len) {
+    char buf[8];
+
+    for (unsigned int i = 0; i < len; i++)
+        buf[i] = (v >> ((len - i - 1) * 8)) & 0xFF;
+
+    stream.write(buf, len);
+}
+
+void pack_nil(std::ostream& stream) {
+    stream.put((char) 0xc0);
+}
+
+void pack_uint(std::ostream& stream, uint64_t v) {
+    if (v < 0x80) {
+        stream.put((char) v);
+    } else if (v <= 0xFF) {
+        stream.put((char) 0xcc);
+        pack_be(stream, v, 1);
+    } else if (v <= 0xFFFF) {
+        stream.put((char) 0xcd);
+        pack_be(stream, v, 2);
+    } else if (v <= 0xFFFFFFFF) {
+        stream.put((char) 0xce);
+        pack_be(stream, v, 4);
+    } else {
+        stream.put((char) 0xcf);
+        pack_be(stream, v, 8);
+    }
+}
+
+void pack_int(std::ostream& stream, int64_t v) {
+    if (v >= 0) {
+        pack_uint(stream, v);
+    } else if (v >= -32) {
+        stream.put((char) (v & 0xFF));
+    } else if (v >= INT8_MIN) {
+        stream.put((char) 0xd0);
+        pack_be(stream, v, 1);
+    } else if (v >= INT16_MIN) {
+        stream.put((char) 0xd1);
+        pack_be(stream, v, 2);
+    } else if (v >= INT32_MIN) {
+        stream.put((char) 0xd2);
+        pack_be(stream, v, 4);
+    } else {
+        stream.put((char) 0xd3);
+        pack_be(stream, v, 8);
+    }
+}
+
+void pack_float(std::ostream& stream, float v) {
+    uint32_t u;
+    memcpy(&u, &v, sizeof(u));
+
+    stream.put((char) 0xca);
+    pack_be(stream, u, 4);
+}
+
+void pack_double(std::ostream& stream, double v) {
+    uint64_t u;
+    memcpy(&u, &v, sizeof(u));
+
+    stream.put((char) 0xcb);
+    pack_be(stream, u, 8);
+}
+
+void pack_str(std::ostream& stream, const std::string& s) {
+    auto len = s.length();
+
+    if (len < 32) {
+        stream.put((char) (0xa0 | len));
+    } else if (len <= 0xFF) {
+        stream.put((char) 0xd9);
+        pack_be(stream, len, 1);
+    } else if (len <= 0xFFFF) {
+        stream.put((char) 0xda);
+        pack_be(stream, len, 2);
+    } else {
+        stream.put((char) 0xdb);
+        pack_be(stream, len, 4);
+    }
+
+    stream.write(s.data(), len);
+}
+
+void pack_bin(std::ostream& stream, const std::string& s) {
+    auto len = s.length();
+
+    if (len <= 0xFF) {
+        stream.put((char) 0xc4);
+        pack_be(stream, len, 1);
+    } else if (len <= 0xFFFF) {
+        stream.put((char) 0xc5);
+        pack_be(stream, len, 2);
+    } else {
+        stream.put((char) 0xc6);
+        pack_be(stream, len, 4);
+    }
+
+    stream.write(s.data(), len);
+}
+
+void pack_array_header(std::ostream& stream, size_t sz) {
+    if (sz < 16) {
+        stream.put((char) (0x90 | sz));
+    } else if (sz <= 0xFFFF) {
+        stream.put((char) 0xdc);
+        pack_be(stream, sz, 2);
+    } else {
+        stream.put((char) 0xdd);
+        pack_be(stream, sz, 4);
+    }
+}
+
+void pack_map_header(std::ostream& stream, size_t sz) {
+    if (sz < 16) {
+        stream.put((char) (0x80 | sz));
+    } else if (sz <= 0xFFFF) {
+        stream.put((char) 0xde);
+        pack_be(stream, sz, 2);
+    } else {
+        stream.put((char) 0xdf);
+        pack_be(stream, sz, 4);
+    }
+}
+
+void pack_mac(std::ostream& stream, const mac_addr& mac) {
+    // 6 bytes has no fixext form
+    stream.put((char) 0xc7);
+    stream.put((char) 6);
+    stream.put((char) msgpack_adapter::ext_mac_addr);
+    pack_be(stream, mac.longmac, 6);
+}
+
+void pack_uuid(std::ostream& stream, const uuid& u) {
+    stream.put((char) 0xd8);
+    stream.put((char) msgpack_adapter::ext_uuid);
+    pack_be(stream, u.time_low, 4);
+    pack_be(stream, u.time_mid, 2);
+    pack_be(stream, u.time_hi, 2);
+    pack_be(stream, u.clock_seq, 2);
+    pack_be(stream, u.node, 6);
+}
+
+void pack_key(std::ostream& stream, const device_key& k) {
+    stream.put((char) 0xd8);
+    stream.put((char) msgpack_adapter::ext_device_key);
+    pack_be(stream, k.get_spkey(), 8);
+    pack_be(stream, k.get_dkey(), 8);
+}
+
+void pack_elem(std::ostream& stream, shared_tracker_element e,
+        std::shared_ptr<tracker_element_serializer::rename_map> name_map, bool field_ids,
+        bool storage);
+
+// Pack a map of tracked elements with an arbitrary key type; the key packer is called with
+// each map entry.  Null entries are skipped unless only the keys are being packed, matching
+// the JSON adapter
+template<typename M, typename KF>
+void pack_elem_map(std::ostream& stream, std::shared_ptr<M> m,
+        std::shared_ptr<tracker_element_serializer::rename_map> name_map, bool field_ids,
+        bool storage, KF key_packer) {
+    auto as_vector = m->as_vector();
+    auto as_key_vector = m->as_key_vector();
+
+    size_t sz = 0;
+    for (const auto& i : *m) {
+        if (i.second != nullptr || as_key_vector)
+            sz++;
+    }
+
+    if (as_vector || as_key_vector)
+        pack_array_header(stream, sz);
+    else
+        pack_map_header(stream, sz);
+
+    for (const auto& i : *m) {
+        if (i.second == nullptr && !as_key_vector)
+            continue;
+
+        if (!as_vector)
+            key_packer(i);
+
+        if (!as_key_vector)
+            pack_elem(stream, i.second, name_map, field_ids, storage);
+    }
+}
+
+void pack_elem(std::ostream& stream, shared_tracker_element e,
+        std::shared_ptr<tracker_element_serializer::rename_map> name_map, bool field_ids,
+        bool storage) {
+
+    if (e == nullptr) {
+        pack_nil(stream);
+        return;
+    }
+
+    serializer_scope s(e, name_map);
+
+    if (e->get_type() == tracker_type::tracker_alias) {
+        // Storage records don't keep aliases at all, the same as storagejson
+        if (storage) {
+            pack_nil(stream);
+            return;
+        }
+
+        // Otherwise remap as the aliased element
+        e = std::static_pointer_cast<tracker_element_alias>(e)->get();
+        if (e == nullptr) {
+            pack_nil(stream);
+            return;
+        }
+    }
+
+    // Storage records tag every element with its name and type
+    if (storage) {
+        pack_array_header(stream, 3);
+        pack_str(stream, Globalreg::globalreg->entrytracker->get_field_name(e->get_id()));
+        pack_str(stream, tracker_element::type_to_typestring(e->get_type()));
+    }
+
+    switch (e->get_type()) {
+        case tracker_type::tracker_string:
+            pack_str(stream, get_tracker_value<std::string>(e));
+            break;
+        case tracker_type::tracker_int8:
+            pack_int(stream, get_tracker_value<int8_t>(e));
+            break;
+        case tracker_type::tracker_uint8:
+            pack_uint(stream, get_tracker_value<uint8_t>(e));
+            break;
+        case tracker_type::tracker_int16:
+            pack_int(stream, get_tracker_value<int16_t>(e));
+            break;
+        case tracker_type::tracker_uint16:
+            pack_uint(stream, get_tracker_value<uint16_t>(e));
+            break;
+        case tracker_type::tracker_int32:
+            pack_int(stream, get_tracker_value<int32_t>(e));
+            break;
+        case tracker_type::tracker_uint32:
+            pack_uint(stream, get_tracker_value<uint32_t>(e));
+            break;
+        case tracker_type::tracker_int64:
+            pack_int(stream, get_tracker_value<int64_t>(e));
+            break;
+        case tracker_type::tracker_uint64:
+            pack_uint(stream, get_tracker_value<uint64_t>(e));
+            break;
+        case tracker_type::tracker_float:
+            pack_float(stream, get_tracker_value<float>(e));
+            break;
+        case tracker_type::tracker_double:
+            pack_double(stream, get_tracker_value<double>(e));
+            break;
+        case tracker_type::tracker_mac_addr:
+            pack_mac(stream, get_tracker_value<mac_addr>(e));
+            break;
+        case tracker_type::tracker_uuid:
+            pack_uuid(stream, get_tracker_value<uuid>(e));
+            break;
+        case tracker_type::tracker_key:
+            pack_key(stream, get_tracker_value<device_key>(e));
+            break;
+        case tracker_type::tracker_byte_array:
+            pack_bin(stream, std::static_pointer_cast<tracker_element_byte_array>(e)->get());
+            break;
+        case tracker_type::tracker_vector: {
+            auto v = std::static_pointer_cast<tracker_element_vector>(e);
+
+            size_t sz = 0;
+            for (const auto& i : *v) {
+                if (i != nullptr)
+                    sz++;
+            }
+
+            pack_array_header(stream, sz);
+
+            for (const auto& i : *v) {
+                if (i == nullptr)
+                    continue;
+
+                pack_elem(stream, i, name_map, field_ids, storage);
+            }
+
+            break;
+        }
+        case tracker_type::tracker_vector_double: {
+            auto v = std::static_pointer_cast<tracker_element_vector_double>(e);
+
+            pack_array_header(stream, v->size());
+            for (const auto& i : *v)
+                pack_double(stream, i);
+
+            break;
+        }
+        case tracker_type::tracker_vector_string: {
+            auto v = std::static_pointer_cast<tracker_element_vector_string>(e);
+
+            pack_array_header(stream, v->size());
+            for (const auto& i : *v)
+                pack_str(stream, i);
+
+            break;
+        }
+        case tracker_type::tracker_map:
+            pack_elem_map(stream, std::static_pointer_cast<tracker_element_map>(e), name_map, field_ids, storage,
+                    [&stream, &name_map, field_ids](const tracker_element_map::pair& i) {
+                        const auto& v = i.second;
+
+                        if (name_map != nullptr && v != nullptr) {
+                            auto nmi = name_map->find(v);
+                            if (nmi != name_map->end() && nmi->second->rename.length() != 0) {
+                                pack_str(stream, nmi->second->rename);
+                                return;
+                            }
+                        }
+
+                        if (field_ids) {
+                            pack_int(stream, i.first);
+                            return;
+                        }
+
+                        std::string tname;
+
+                        if (v == nullptr || (tname = v->get_local_name()) == "")
+                            tname = Globalreg::globalreg->entrytracker->get_field_name(i.first);
+
+                        pack_str(stream, tname);
+                    });
+            break;
+        case tracker_type::tracker_int_map:
+            pack_elem_map(stream, std::static_pointer_cast<tracker_element_int_map>(e), name_map, field_ids, storage,
+                    [&stream](const auto& i) { pack_int(stream, i.first); });
+            break;
+        case tracker_type::tracker_mac_map:
+            pack_elem_map(stream, std::static_pointer_cast<tracker_element_mac_map>(e), name_map, field_ids, storage,
+                    [&stream](const auto& i) { pack_mac(stream, i.first); });
+            break;
+        case tracker_type::tracker_string_map:
+            pack_elem_map(stream, std::static_pointer_cast<tracker_element_string_map>(e), name_map, field_ids, storage,
+                    [&stream](const auto& i) { pack_str(stream, i.first); });
+            break;
+        case tracker_type::tracker_double_map:
+            pack_elem_map(stream, std::static_pointer_cast<tracker_element_double_map>(e), name_map, field_ids, storage,
+                    [&stream](const auto& i) { pack_double(stream, i.first); });
+            break;
+        case tracker_type::tracker_hashkey_map:
+            pack_elem_map(stream, std::static_pointer_cast<tracker_element_hashkey_map>(e), name_map, field_ids, storage,
+                    [&stream](const auto& i) { pack_uint(stream, i.first); });
+            break;
+        case tracker_type::tracker_key_map:
+            pack_elem_map(stream, std::static_pointer_cast<tracker_element_device_key_map>(e), name_map, field_ids, storage,
+                    [&stream](const auto& i) { pack_key(stream, i.first); });
+            break;
+        case tracker_type::tracker_double_map_double: {
+            auto m = std::static_pointer_cast<tracker_element_double_map_double>(e);
+            auto as_vector = m->as_vector();
+            auto as_key_vector = m->as_key_vector();
+
+            if (as_vector || as_key_vector)
+                pack_array_header(stream, m->size());
+            else
+                pack_map_header(stream, m->size());
+
+            for (const auto& i : *m) {
+                if (!as_vector)
+                    pack_double(stream, i.first);
+
+                if (!as_key_vector)
+                    pack_double(stream, i.second);
+            }
+
+            break;
+        }
+        default:
+            pack_nil(stream);
+            break;
+    }
+}
+
+}
+
+void msgpack_adapter::pack(std::ostream &stream, shared_tracker_element e,
+        std::shared_ptr<tracker_element_serializer::rename_map> name_map,
+        bool field_ids) {
+    pack_elem(stream, e, name_map, field_ids, false);
+}
+
+void msgpack_adapter::storage_pack(std::ostream &stream, shared_tracker_element e,
+        std::shared_ptr<tracker_element_serializer::rename_map> name_map) {
+    pack_elem(stream, e, name_map, false, true);
+}
+
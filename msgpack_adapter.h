@@ -0,0 +1,102 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __MSGPACK_ADAPTER_H__
+#define __MSGPACK_ADAPTER_H__
+
+#include "config.h"
+
+#include "globalregistry.h"
+#include "trackedelement.h"
+#include "devicetracker_component.h"
+
+// MessagePack serialization adapter; forms the same structure as the JSON adapter,
+// but numbers are packed as native binary integers and floats instead of being
+// formatted as text, and byte arrays are packed as binary blobs.
+//
+// Kismet-specific types are packed as MessagePack extension types:
+//
+//   ext 1, 6 bytes   MAC address, network byte order (the mask is not included)
+//   ext 2, 16 bytes  UUID, as the 16 bytes of the standard string form
+//   ext 3, 16 bytes  Device key, big-endian phy/source key followed by device key
+//
+// Maps keyed by MAC, UUID or device key use the same extension types for their keys;
+// int and double maps use native integer and float keys.
+namespace msgpack_adapter {
+
+const int8_t ext_mac_addr = 1;
+const int8_t ext_uuid = 2;
+const int8_t ext_device_key = 3;
+
+// When field_ids is set, tracked fields in a map are keyed by their numeric field ID
+// instead of their name; renamed fields are always keyed by their rename.  Field IDs
+// are assigned at runtime and are only valid for the instance of Kismet which generated
+// them, see /system/tracked_fields.html
+void pack(std::ostream &stream, shared_tracker_element e,
+        std::shared_ptr<tracker_element_serializer::rename_map> name_map = nullptr,
+        bool field_ids = false);
+
+// Storage variant, for records which are kept and read back later, such as device 
+// records in the kismetdb log.  Like the storagejson adapter, every element is tagged
+// with its field name and type; each element is packed as a 3-element array of
+// [name, type, data], where containers hold tagged elements in turn.  Fields are always
+// keyed by name, since field IDs don't survive a restart.
+void storage_pack(std::ostream &stream, shared_tracker_element e,
+        std::shared_ptr<tracker_element_serializer::rename_map> name_map = nullptr);
+
+class serializer : public tracker_element_serializer {
+public:
+    serializer() :
+        tracker_element_serializer() { }
+
+    virtual int serialize(shared_tracker_element in_elem, std::ostream &stream,
+            std::shared_ptr<rename_map> name_map = nullptr) override {
+        pack(stream, in_elem, name_map);
+        return 0;
+    }
+};
+
+// Compact variant keyed by field ID
+class id_serializer : public tracker_element_serializer {
+public:
+    id_serializer() :
+        tracker_element_serializer() { }
+
+    virtual int serialize(shared_tracker_element in_elem, std::ostream &stream,
+            std::shared_ptr<rename_map> name_map = nullptr) override {
+        pack(stream, in_elem, name_map, true);
+        return 0;
+    }
+};
+
+class storage_serializer : public tracker_element_serializer {
+public:
+    storage_serializer() :
+        tracker_element_serializer() { }
+
+    virtual int serialize(shared_tracker_element in_elem, std::ostream &stream,
+            std::shared_ptr<rename_map> name_map = nullptr) override {
+        storage_pack(stream, in_elem, name_map);
+        return 0;
+    }
+};
+
+}
+
+#endif
+
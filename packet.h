@@ -48,9 +48,11 @@
 // Maximum length of a frame
 #define MAX_PACKET_LEN			8192
 
-// Same as defined in libpcap/system, but we need to know the basic dot11 DLT
+// Same as defined in libpcap/system, but we need to know the basic dot11 DLTs
 // even when we don't have pcap
 #define KDLT_IEEE802_11			105
+#define KDLT_RADIOTAP			127
+#define KDLT_PPI				192
 
 // High-level packet component so that we can provide our own destructors
 class packet_component {
@@ -194,6 +196,9 @@ class kis_datachunk : public packet_component {
 public:
     uint8_t *data;
     unsigned int length;
+    // Length of the frame before the capture source truncated it; the same as
+    // length unless the frame was truncated
+    unsigned int original_length;
     int dlt;
     uint16_t source_id;
     bool self_data;
@@ -203,6 +208,7 @@ public:
         self_data = true; // We assume for now we have our own data alloc
         data = NULL;
         length = 0;
+        original_length = 0;
         source_id = 0;
     }
 
@@ -228,6 +234,7 @@ public:
         }
 
         length = in_length;
+        original_length = in_length;
     }
 
     virtual void copy_data(const uint8_t *in_data, unsigned int in_length) {
@@ -239,7 +246,16 @@ public:
         self_data = true;
 
         length = in_length;
+        original_length = in_length;
+    }
+
+    bool truncated() const {
+        return original_length > length;
+    }
 
+    // Length of the frame as it was seen by the capture
+    unsigned int frame_length() const {
+        return original_length > length ? original_length : length;
     }
 };
 
@@ -66,6 +66,7 @@ packet_filter::packet_filter(const std::string& in_id, const std::string& in_des
 int packet_filter::default_set_endp_handler(std::ostream& stream, const Json::Value& json) {
     try {
         set_filter_default(json["default"].asBool());
+        filter_changed();
         stream << "Default filter: " << get_filter_default() << "\n";
         return 200;
     } catch (const std::exception& e) {
@@ -84,6 +85,18 @@ void packet_filter::build_self_content(std::shared_ptr<tracker_element_map> cont
     content->insert(filter_default);
 }
 
+void packet_filter::filter_changed() {
+    auto eventbus = Globalreg::fetch_global_as<event_bus>();
+
+    if (eventbus == nullptr)
+        return;
+
+    auto evt = eventbus->get_eventbus_event(event_packet_filter_changed());
+    evt->get_event_content()->insert(event_packet_filter_changed(), 
+            std::make_shared<tracker_element_string>(get_filter_id()));
+    eventbus->publish(evt);
+}
+
 bool packet_filter::filterstring_to_bool(const std::string& str) {
     auto cstr = str_lower(str);
 
@@ -326,6 +339,8 @@ void packet_filter_mac_addr::set_filter(mac_addr in_mac, const std::string& in_p
             unknown_phy_mac_filter_map[in_phy].filter_other[in_mac] = value;
         else if (in_block == "any")
             unknown_phy_mac_filter_map[in_phy].filter_any[in_mac] = value;
+
+        filter_changed();
         return;
 	}
 
@@ -340,6 +355,8 @@ void packet_filter_mac_addr::set_filter(mac_addr in_mac, const std::string& in_p
         phy_mac_filter_map[phy->fetch_phy_id()].filter_other[in_mac] = value;
     else if (in_block == "any")
         phy_mac_filter_map[phy->fetch_phy_id()].filter_any[in_mac] = value;
+
+    filter_changed();
 }
 
 void packet_filter_mac_addr::remove_filter(mac_addr in_mac, const std::string& in_phy, const std::string& in_block) {
@@ -409,6 +426,8 @@ void packet_filter_mac_addr::remove_filter(mac_addr in_mac, const std::string& i
             if (k != unknown_phy_mac_filter_map[in_phy].filter_any.end())
                 unknown_phy_mac_filter_map[in_phy].filter_any.erase(k);
         }
+
+        filter_changed();
         return;
 	}
 
@@ -433,6 +452,8 @@ void packet_filter_mac_addr::remove_filter(mac_addr in_mac, const std::string& i
         if (k != phy_mac_filter_map[phy->fetch_phy_id()].filter_any.end())
             phy_mac_filter_map[phy->fetch_phy_id()].filter_any.erase(k);
     }
+
+    filter_changed();
 }
 
 unsigned int packet_filter_mac_addr::edit_endp_handler(std::ostream& stream, 
@@ -573,6 +594,186 @@ bool packet_filter_mac_addr::filter_packet(kis_packet *packet) {
     return get_filter_default();
 }
 
+bool packet_filter_mac_addr::compile_dot11_bpf(kis_bpf_program& prog, 
+        kis_bpf_program::label in_next) {
+    local_locker l(&mutex);
+
+    const struct phy_filter_group *group = nullptr;
+
+    auto phy = devicetracker->fetch_phy_handler_by_name("IEEE802.11");
+
+    if (phy != nullptr) {
+        auto gi = phy_mac_filter_map.find(phy->fetch_phy_id());
+
+        if (gi != phy_mac_filter_map.end())
+            group = &gi->second;
+    }
+
+    auto verdict = [&prog, in_next](bool reject) {
+        if (reject)
+            prog.stmt(kis_bpf::ret | kis_bpf::k, 0);
+        else
+            prog.jump_always(in_next);
+    };
+
+    // Without any 802.11 addresses every frame gets the default
+    if (group == nullptr) {
+        verdict(get_filter_default());
+        return true;
+    }
+
+    // Masked addresses are found by the ordering of the map, which we can't reproduce
+    for (auto m : {&group->filter_source, &group->filter_dest, &group->filter_network,
+            &group->filter_other, &group->filter_any}) {
+        for (const auto& mi : *m) {
+            if ((mi.first.longmask & 0xFFFFFFFFFFFFULL) != 0xFFFFFFFFFFFFULL)
+                return false;
+        }
+    }
+
+    // Scratch memory for the frame control flags and the source, destination, and
+    // network addresses, as the upper 4 and lower 2 bytes of each
+    const unsigned int m_flags = 1, m_source = 2, m_dest = 4, m_network = 6;
+
+    auto undecided = prog.new_label();
+    auto mgmt = prog.new_label();
+    auto data = prog.new_label();
+    auto mgmt_addrs = prog.new_label();
+    auto adhoc = prog.new_label();
+    auto adhoc_zero_net = prog.new_label();
+    auto adhoc_addrs = prog.new_label();
+    auto to_ds = prog.new_label();
+    auto from_ds = prog.new_label();
+    auto lookup = prog.new_label();
+    auto have_addrs = prog.new_label();
+
+    // Frames too short to hold the third address are left to the server
+    prog.stmt(kis_bpf::ld | kis_bpf::w | kis_bpf::mem, 0);
+    prog.stmt(kis_bpf::alu | kis_bpf::op_add | kis_bpf::k, 22);
+    prog.stmt(kis_bpf::misc | kis_bpf::tax);
+    prog.stmt(kis_bpf::ld | kis_bpf::w | kis_bpf::len);
+    prog.jump(kis_bpf::jge | kis_bpf::x, 0, have_addrs, kis_bpf_program::next);
+    prog.jump_always(in_next);
+    prog.place(have_addrs);
+    prog.stmt(kis_bpf::ldx | kis_bpf::w | kis_bpf::mem, 0);
+
+    prog.stmt(kis_bpf::ld | kis_bpf::b | kis_bpf::ind, 1);
+    prog.stmt(kis_bpf::alu | kis_bpf::op_and | kis_bpf::k, 0x03);
+    prog.stmt(kis_bpf::st, m_flags);
+
+    // Only management and data frames have the addresses where the dissector expects
+    // them; control frames are left to the server
+    prog.stmt(kis_bpf::ld | kis_bpf::b | kis_bpf::ind, 0);
+    prog.stmt(kis_bpf::alu | kis_bpf::op_and | kis_bpf::k, 0x0c);
+    prog.jump(kis_bpf::jeq | kis_bpf::k, 0x00, mgmt, kis_bpf_program::next);
+    prog.jump(kis_bpf::jeq | kis_bpf::k, 0x08, data, undecided);
+
+    // Management subtypes the dissector doesn't know
+    prog.place(mgmt);
+    prog.stmt(kis_bpf::ld | kis_bpf::b | kis_bpf::ind, 0);
+    prog.stmt(kis_bpf::alu | kis_bpf::op_and | kis_bpf::k, 0xf0);
+    prog.jump(kis_bpf::jeq | kis_bpf::k, 0x60, undecided, kis_bpf_program::next);
+    prog.jump(kis_bpf::jeq | kis_bpf::k, 0x70, undecided, kis_bpf_program::next);
+    prog.jump(kis_bpf::jeq | kis_bpf::k, 0xf0, undecided, mgmt_addrs);
+
+    // Data subtypes the dissector doesn't know, and WDS frames
+    prog.place(data);
+    prog.stmt(kis_bpf::ld | kis_bpf::b | kis_bpf::ind, 0);
+    prog.stmt(kis_bpf::alu | kis_bpf::op_and | kis_bpf::k, 0xf0);
+    prog.jump(kis_bpf::jeq | kis_bpf::k, 0x70, undecided, kis_bpf_program::next);
+    prog.jump(kis_bpf::jeq | kis_bpf::k, 0xd0, undecided, kis_bpf_program::next);
+    prog.stmt(kis_bpf::ld | kis_bpf::w | kis_bpf::mem, m_flags);
+    prog.jump(kis_bpf::jeq | kis_bpf::k, 0, adhoc, kis_bpf_program::next);
+    prog.jump(kis_bpf::jeq | kis_bpf::k, 1, to_ds, kis_bpf_program::next);
+    prog.jump(kis_bpf::jeq | kis_bpf::k, 2, from_ds, undecided);
+
+    prog.place(undecided);
+    prog.jump_always(in_next);
+
+    auto copy_addrs = [&](unsigned int source_offt, unsigned int dest_offt, 
+            unsigned int network_offt) {
+        for (auto a : {std::make_pair(source_offt, m_source), std::make_pair(dest_offt, m_dest),
+                std::make_pair(network_offt, m_network)}) {
+            prog.stmt(kis_bpf::ld | kis_bpf::w | kis_bpf::ind, a.first);
+            prog.stmt(kis_bpf::st, a.second);
+            prog.stmt(kis_bpf::ld | kis_bpf::h | kis_bpf::ind, a.first + 4);
+            prog.stmt(kis_bpf::st, a.second + 1);
+        }
+
+        prog.jump_always(lookup);
+    };
+
+    prog.place(mgmt_addrs);
+    copy_addrs(10, 4, 16);
+
+    // Ad-hoc data uses the source as the network when the BSSID is empty
+    prog.place(adhoc);
+    prog.stmt(kis_bpf::ld | kis_bpf::w | kis_bpf::ind, 16);
+    prog.jump(kis_bpf::jeq | kis_bpf::k, 0, kis_bpf_program::next, adhoc_addrs);
+    prog.stmt(kis_bpf::ld | kis_bpf::h | kis_bpf::ind, 20);
+    prog.jump(kis_bpf::jeq | kis_bpf::k, 0, adhoc_zero_net, adhoc_addrs);
+
+    prog.place(adhoc_addrs);
+    copy_addrs(10, 4, 16);
+
+    prog.place(adhoc_zero_net);
+    copy_addrs(10, 4, 10);
+
+    prog.place(to_ds);
+    copy_addrs(10, 16, 4);
+
+    prog.place(from_ds);
+    copy_addrs(16, 4, 10);
+
+    // Match in the same order as filter_packet; the first match decides
+    prog.place(lookup);
+
+    auto match = [&](const std::map<mac_addr, bool>& in_map, unsigned int in_slot) {
+        for (const auto& mi : in_map) {
+            auto miss = prog.new_label();
+
+            prog.stmt(kis_bpf::ld | kis_bpf::w | kis_bpf::mem, in_slot);
+            prog.jump(kis_bpf::jeq | kis_bpf::k, (uint32_t) (mi.first.longmac >> 16), 
+                    kis_bpf_program::next, miss);
+            prog.stmt(kis_bpf::ld | kis_bpf::w | kis_bpf::mem, in_slot + 1);
+            prog.jump(kis_bpf::jeq | kis_bpf::k, (uint32_t) (mi.first.longmac & 0xFFFF), 
+                    kis_bpf_program::next, miss);
+            verdict(mi.second);
+            prog.place(miss);
+        }
+    };
+
+    // Management and data frames never have a transmitter address, so an empty address
+    // always matches it and ends the lookup
+    auto match_empty = [&](const std::map<mac_addr, bool>& in_map) -> bool {
+        auto ei = in_map.find(mac_addr(0));
+
+        if (ei == in_map.end())
+            return false;
+
+        verdict(ei->second);
+        return true;
+    };
+
+    match(group->filter_source, m_source);
+    match(group->filter_dest, m_dest);
+    match(group->filter_network, m_network);
+
+    if (match_empty(group->filter_other))
+        return true;
+
+    match(group->filter_any, m_source);
+    match(group->filter_any, m_dest);
+    match(group->filter_any, m_network);
+
+    if (match_empty(group->filter_any))
+        return true;
+
+    verdict(get_filter_default());
+
+    return true;
+}
+
 std::shared_ptr<tracker_element_map> packet_filter_mac_addr::self_endp_handler() {
     auto ret = std::make_shared<tracker_element_map>();
     build_self_content(ret);
@@ -586,3 +787,234 @@ void packet_filter_mac_addr::build_self_content(std::shared_ptr<tracker_element_
 }
 
 
+
+packet_filter_dot11_type::packet_filter_dot11_type(const std::string& in_id, 
+        const std::string& in_description) :
+    packet_filter(in_id, in_description, "dot11_type") {
+
+    register_fields();
+    reserve_fields(nullptr);
+
+    frame_edit_endp =
+        std::make_shared<kis_net_httpd_simple_post_endpoint>(
+                fmt::format("{}/dot11/set_filter", base_uri),
+                [this](std::ostream& stream, const std::string& uri,
+                    const Json::Value& json,
+                    kis_net_httpd_connection::variable_cache_map& variable_cache) -> unsigned int {
+                    return edit_endp_handler(stream, json);
+                }, &mutex);
+
+    frame_remove_endp =
+        std::make_shared<kis_net_httpd_simple_post_endpoint>(
+                fmt::format("{}/dot11/remove_filter", base_uri),
+                [this](std::ostream& stream, const std::string& uri,
+                    const Json::Value& json,
+                    kis_net_httpd_connection::variable_cache_map& variable_cache) -> unsigned int {
+                    return remove_endp_handler(stream, json);
+                }, &mutex);
+
+    auto packetchain = Globalreg::fetch_mandatory_global_as<packet_chain>();
+    pack_comp_decap = packetchain->register_packet_component("DECAP");
+    pack_comp_linkframe = packetchain->register_packet_component("LINKFRAME");
+}
+
+void packet_filter_dot11_type::parse_frame(const std::string& in_frame, uint8_t& out_fc,
+        uint8_t& out_mask, std::string& out_name) {
+    static const std::vector<std::string> type_names = 
+        {"management", "control", "data", "extension"};
+
+    auto toks = str_tokenize(str_lower(in_frame), "/");
+
+    if (toks.size() < 1 || toks.size() > 2)
+        throw std::runtime_error(fmt::format("Expected a frame type or type/subtype, got '{}'",
+                    kishttpd::escape_html(in_frame)));
+
+    unsigned int type = type_names.size();
+
+    for (unsigned int t = 0; t < type_names.size(); t++) {
+        if (toks[0] == type_names[t] || 
+                (toks[0] == "mgmt" && t == 0) || (toks[0] == "ctrl" && t == 1)) {
+            type = t;
+            break;
+        }
+    }
+
+    if (type == type_names.size()) {
+        if (sscanf(toks[0].c_str(), "%u", &type) != 1 || type >= type_names.size())
+            throw std::runtime_error(fmt::format("Unknown 802.11 frame type '{}'",
+                        kishttpd::escape_html(toks[0])));
+    }
+
+    out_fc = type << 2;
+    out_mask = 0x0c;
+    out_name = type_names[type];
+
+    if (toks.size() == 1)
+        return;
+
+    unsigned int subtype;
+
+    if (sscanf(toks[1].c_str(), "%u", &subtype) != 1 || subtype > 15)
+        throw std::runtime_error(fmt::format("Invalid 802.11 frame subtype '{}'",
+                    kishttpd::escape_html(toks[1])));
+
+    out_fc |= subtype << 4;
+    out_mask = 0xfc;
+    out_name = fmt::format("{}/{}", out_name, subtype);
+}
+
+void packet_filter_dot11_type::set_filter(const std::string& in_frame, bool value) {
+    local_locker l(&mutex);
+
+    uint8_t fc, mask;
+    std::string name;
+
+    parse_frame(in_frame, fc, mask, name);
+
+    if (mask == 0xfc)
+        subtype_filter_map[fc] = value;
+    else
+        type_filter_map[fc] = value;
+
+    auto tracked_value = std::make_shared<tracker_element_uint8>(filter_sub_value_id);
+    tracked_value->set(value);
+    filter_frames->replace(name, tracked_value);
+
+    filter_changed();
+}
+
+void packet_filter_dot11_type::remove_filter(const std::string& in_frame) {
+    local_locker l(&mutex);
+
+    uint8_t fc, mask;
+    std::string name;
+
+    parse_frame(in_frame, fc, mask, name);
+
+    if (mask == 0xfc)
+        subtype_filter_map.erase(fc);
+    else
+        type_filter_map.erase(fc);
+
+    auto tracked_key = filter_frames->find(name);
+    if (tracked_key != filter_frames->end())
+        filter_frames->erase(tracked_key);
+
+    filter_changed();
+}
+
+unsigned int packet_filter_dot11_type::edit_endp_handler(std::ostream& stream, 
+        const Json::Value& json) {
+    try {
+        auto filter = json["filter"];
+
+        if (!filter.isObject()) {
+            stream << "Expected 'filter' to be a dictionary\n";
+            return 500;
+        }
+
+        for (const auto& i : filter.getMemberNames())
+            set_filter(i, filter[i].asBool());
+
+        stream << "set filter\n";
+        return 200;
+    } catch (const std::exception& e) {
+        stream << "Error handling request: " << e.what() << "\n";
+        return 500;
+    }
+
+    stream << "Unhandled request\n";
+    return 500;
+}
+
+unsigned int packet_filter_dot11_type::remove_endp_handler(std::ostream& stream, 
+        const Json::Value& json) {
+    try {
+        auto filter = json["filter"];
+
+        if (!filter.isArray()) {
+            stream << "Expected 'filter' to be an array\n";
+            return 500;
+        }
+
+        for (auto i : filter)
+            remove_filter(i.asString());
+
+        stream << "Removed filter\n";
+        return 200;
+    } catch (const std::exception& e) {
+        stream << "Error handling request: " << e.what() << "\n";
+        return 500;
+    }
+
+    stream << "Unhandled request\n";
+    return 500;
+}
+
+bool packet_filter_dot11_type::filter_packet(kis_packet *packet) {
+    auto chunk = packet->fetch<kis_datachunk>(pack_comp_decap);
+
+    if (chunk == nullptr)
+        chunk = packet->fetch<kis_datachunk>(pack_comp_linkframe);
+
+    if (chunk == nullptr || chunk->dlt != KDLT_IEEE802_11 || chunk->length < 2)
+        return false;
+
+    auto si = subtype_filter_map.find(chunk->data[0] & 0xfc);
+    if (si != subtype_filter_map.end())
+        return si->second;
+
+    auto ti = type_filter_map.find(chunk->data[0] & 0x0c);
+    if (ti != type_filter_map.end())
+        return ti->second;
+
+    return get_filter_default();
+}
+
+bool packet_filter_dot11_type::compile_dot11_bpf(kis_bpf_program& prog, 
+        kis_bpf_program::label in_next) {
+    local_locker l(&mutex);
+
+    auto match = [&prog, in_next](const std::map<uint8_t, bool>& in_map) {
+        for (const auto& fi : in_map) {
+            auto miss = prog.new_label();
+
+            prog.jump(kis_bpf::jeq | kis_bpf::k, fi.first, kis_bpf_program::next, miss);
+
+            if (fi.second)
+                prog.stmt(kis_bpf::ret | kis_bpf::k, 0);
+            else
+                prog.jump_always(in_next);
+
+            prog.place(miss);
+        }
+    };
+
+    prog.stmt(kis_bpf::ldx | kis_bpf::w | kis_bpf::mem, 0);
+    prog.stmt(kis_bpf::ld | kis_bpf::b | kis_bpf::ind, 0);
+    prog.stmt(kis_bpf::alu | kis_bpf::op_and | kis_bpf::k, 0xfc);
+    match(subtype_filter_map);
+
+    prog.stmt(kis_bpf::alu | kis_bpf::op_and | kis_bpf::k, 0x0c);
+    match(type_filter_map);
+
+    if (get_filter_default())
+        prog.stmt(kis_bpf::ret | kis_bpf::k, 0);
+    else
+        prog.jump_always(in_next);
+
+    return true;
+}
+
+std::shared_ptr<tracker_element_map> packet_filter_dot11_type::self_endp_handler() {
+    auto ret = std::make_shared<tracker_element_map>();
+    build_self_content(ret);
+    return ret;
+}
+
+void packet_filter_dot11_type::build_self_content(std::shared_ptr<tracker_element_map> content) { 
+    packet_filter::build_self_content(content);
+
+    content->insert(filter_frames);
+}
+
@@ -16,12 +16,16 @@
     Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
+#ifndef __PACKET_FILTER_H__
+#define __PACKET_FILTER_H__
+
 #include "config.h"
 
 #include "packetchain.h"
 #include "packet.h"
 #include "trackedcomponent.h"
 #include "eventbus.h"
+#include "kis_bpf.h"
 
 // Common packet filter mechanism which can be used in multiple locations;
 // implements basic default behavior, filtering by address, and REST endpoints.
@@ -45,9 +49,26 @@ public:
 
     virtual bool filter_packet(kis_packet *packet) = 0;
 
+    // Compile the filter to a classic BPF fragment for 802.11 captures, so the capture
+    // source can drop packets before they're sent to Kismet.  On entry the X register
+    // and M[0] hold the offset of the 802.11 header, and at least 2 bytes of the header
+    // are present; the fragment rejects the packet with 'ret #0' or continues at in_next,
+    // and may only reject packets filter_packet would reject.  Returns false if the
+    // filter can't be expressed.
+    virtual bool compile_dot11_bpf(kis_bpf_program& prog, kis_bpf_program::label in_next) {
+        return false;
+    }
+
+    // Published when the filter terms change; the content holds the filter id
+    static std::string event_packet_filter_changed() {
+        return "PACKET_FILTER_CHANGED";
+    }
+
 protected:
     bool filterstring_to_bool(const std::string& str);
 
+    void filter_changed();
+
     __ProxySet(filter_id, std::string, std::string, filter_id);
     __ProxySet(filter_description, std::string, std::string, filter_description);
     __ProxySet(filter_type, std::string, std::string, filter_type);
@@ -95,6 +116,9 @@ public:
 
     virtual bool filter_packet(kis_packet *packet) override;
 
+    // Only the IEEE802.11 phy filters apply; masked addresses can't be compiled
+    virtual bool compile_dot11_bpf(kis_bpf_program& prog, kis_bpf_program::label in_next) override;
+
     // We use strings for blocks here for maximum flexibility in the future since
     // *adding* a filter should be a relatively non-realtime task
     virtual void set_filter(mac_addr in_mac, const std::string& in_phy,
@@ -181,3 +205,65 @@ protected:
     virtual void build_self_content(std::shared_ptr<tracker_element_map> content) override;
 };
 
+
+// 802.11 frame type filter.
+// Filters match a frame type and subtype, or every subtype of a type, and are true
+// (filter/reject packet) or false (pass packet).  A type and subtype match is used
+// before a type match, and frames not matched by either are passed to the default
+// filter term.  Packets which aren't 802.11 frames are always passed.
+class packet_filter_dot11_type : public packet_filter {
+public:
+    packet_filter_dot11_type(const std::string& in_id, const std::string& in_description);
+    virtual ~packet_filter_dot11_type() { }
+
+    virtual bool filter_packet(kis_packet *packet) override;
+
+    virtual bool compile_dot11_bpf(kis_bpf_program& prog, kis_bpf_program::label in_next) override;
+
+    // Frames are 'type' or 'type/subtype', where the type is 'management', 'control',
+    // 'data', 'extension', or a number, and the subtype is a number
+    virtual void set_filter(const std::string& in_frame, bool value);
+    virtual void remove_filter(const std::string& in_frame);
+
+protected:
+    virtual void register_fields() override {
+        packet_filter::register_fields();
+
+        register_field("kismet.packetfilter.dot11.frames",
+                "802.11 frame type filters", &filter_frames);
+
+        filter_sub_value_id =
+            register_field("kismet.packetfilter.dot11.value",
+                    tracker_element_factory<tracker_element_uint8>(),
+                    "Filter value");
+    }
+
+    // Parse a frame string to the frame control bits it matches, and the mask of the
+    // bits to compare
+    void parse_frame(const std::string& in_frame, uint8_t& out_fc, uint8_t& out_mask,
+            std::string& out_name);
+
+    unsigned int pack_comp_decap, pack_comp_linkframe;
+
+    int filter_sub_value_id;
+
+    // Externally exposed tracked table
+    std::shared_ptr<tracker_element_string_map> filter_frames;
+
+    // Frame control bits to filter values; type and subtype matches are keyed on the
+    // type and subtype bits of the first frame control byte, type matches on the type bits
+    std::map<uint8_t, bool> subtype_filter_map;
+    std::map<uint8_t, bool> type_filter_map;
+
+    std::shared_ptr<kis_net_httpd_simple_post_endpoint> frame_edit_endp;
+    unsigned int edit_endp_handler(std::ostream& stream, const Json::Value& json);
+
+    std::shared_ptr<kis_net_httpd_simple_post_endpoint> frame_remove_endp;
+    unsigned int remove_endp_handler(std::ostream& stream, const Json::Value& json);
+
+    virtual std::shared_ptr<tracker_element_map> self_endp_handler() override;
+    virtual void build_self_content(std::shared_ptr<tracker_element_map> content) override;
+};
+
+#endif
+
@@ -51,6 +51,8 @@ packet_chain::packet_chain() {
     last_packet_queue_user_warning = 0;
     last_packet_drop_user_warning = 0;
 
+    packetqueue_space_waiters = 0;
+
     packet_queue_warning = 
         Globalreg::globalreg->kismet_config->fetch_opt_uint("packet_log_warning", 0);
     packet_queue_drop =
@@ -258,6 +260,9 @@ void packet_chain::packet_queue_processor() {
             packet = packet_queue.front();
             packet_queue.pop();
 
+            if (packetqueue_space_waiters > 0)
+                packetqueue_space_cv.notify_all();
+
             // Lock the chain mutexes until we're done processing this packet
             local_locker chainl(&packetchain_mutex);
 
@@ -392,6 +397,67 @@ int packet_chain::process_packet(kis_packet *in_pack) {
     return 1;
 }
 
+size_t packet_chain::process_packets(std::vector<kis_packet *>& in_packs, 
+        std::function<bool ()> in_cancel) {
+    std::unique_lock<std::mutex> lock(packetqueue_cv_mutex);
+    size_t queued = 0;
+
+    if (in_packs.size() == 0)
+        return 0;
+
+    if (packet_queue_drop != 0) {
+        // Wait until the whole batch fits, or at least until the queue is empty for
+        // batches larger than the limit
+        auto has_room = [&]() -> bool {
+            return packet_queue.size() == 0 || 
+                packet_queue.size() + in_packs.size() <= packet_queue_drop;
+        };
+
+        auto stopping = [&]() -> bool {
+            return packetchain_shutdown || Globalreg::globalreg->spindown ||
+                Globalreg::globalreg->fatal_condition || Globalreg::globalreg->complete;
+        };
+
+        if (in_cancel != nullptr) {
+            packetqueue_space_waiters++;
+
+            while (!has_room() && !stopping() && !in_cancel())
+                packetqueue_space_cv.wait_for(lock, std::chrono::milliseconds(100));
+
+            packetqueue_space_waiters--;
+        }
+
+        if (!has_room() || stopping()) {
+            lock.unlock();
+
+            if (!stopping())
+                packet_drop_rrd->add_sample(in_packs.size(), time(0));
+
+            for (auto p : in_packs)
+                destroy_packet(p);
+
+            in_packs.clear();
+
+            return 0;
+        }
+    }
+
+    for (auto p : in_packs) {
+        packet_queue.push(p);
+        queued++;
+    }
+
+    packet_queue_rrd->add_sample(packet_queue.size(), time(0));
+
+    lock.unlock();
+
+    in_packs.clear();
+
+    packetqueue_cv.notify_all();
+
+    return queued;
+}
+
 void packet_chain::destroy_packet(kis_packet *in_pack) {
 
 	delete in_pack;
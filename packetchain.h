@@ -114,6 +114,14 @@ public:
     kis_packet *generate_packet();
     // Inject a packet into the chain
     int process_packet(kis_packet *in_pack);
+    // Inject a batch of packets into the chain, taking the queue lock once.  Without a
+    // cancel function, the batch is dropped if the queue is over the backlog limit, as
+    // with process_packet.  With one, we wait for room in the queue instead (for 
+    // sources which must not lose packets, such as offline files), until the cancel
+    // function returns true.  Packets which aren't queued are destroyed, and the 
+    // batch is cleared.  Returns the number of packets queued.
+    size_t process_packets(std::vector<kis_packet *>& in_packs, 
+            std::function<bool ()> in_cancel = nullptr);
     // Destroy a packet at the end of its life
     void destroy_packet(kis_packet *in_pack);
  
@@ -166,6 +174,10 @@ protected:
     std::mutex packetqueue_cv_mutex;
     std::condition_variable packetqueue_cv;
 
+    // Sources waiting for room in the queue
+    std::condition_variable packetqueue_space_cv;
+    unsigned int packetqueue_space_waiters;
+
     std::queue<kis_packet *> packet_queue;
     bool packetchain_shutdown;
 
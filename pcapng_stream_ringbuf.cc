@@ -91,6 +91,29 @@ void pcap_stream_ringbuf::stop_stream(std::string in_reason) {
     buffer_available_locker.unlock(-1);
 }
 
+void pcap_stream_ringbuf::replace_handler(std::shared_ptr<buffer_handler_generic> in_handler) {
+    local_locker lg(packet_mutex);
+
+    if (block_for_buffer) {
+        handler->set_read_buffer_drain_cb(nullptr);
+
+        in_handler->set_read_buffer_drain_cb([this](size_t) {
+            local_locker l(&required_bytes_mutex);
+            if (locker_required_bytes != 0 && handler->get_write_buffer_available() > locker_required_bytes) {
+                buffer_available_locker.unlock(1);
+                locker_required_bytes = 0;
+            }
+        });
+    }
+
+    handler = in_handler;
+
+    // Interfaces are re-declared as packets arrive in the new section
+    datasource_id_map.clear();
+
+    pcapng_make_shb("", "", "Kismet");
+}
+
 ssize_t pcap_stream_ringbuf::buffer_available() {
     if (handler != nullptr) 
         return handler->get_write_buffer_available();
@@ -333,7 +356,7 @@ int pcap_stream_ringbuf::pcapng_make_idb(unsigned int in_sourcenumber,
 }
 
 int pcap_stream_ringbuf::pcapng_write_packet(unsigned int in_sourcenumber, 
-        struct timeval *in_tv, std::vector<data_block> in_blocks) {
+        struct timeval *in_tv, std::vector<data_block> in_blocks, size_t in_original_len) {
     local_locker lg(packet_mutex);
 
     uint8_t *retbuf;
@@ -398,7 +421,7 @@ int pcap_stream_ringbuf::pcapng_write_packet(unsigned int in_sourcenumber,
     epb->timestamp_low = conv_ts;
 
     epb->captured_length = aggregate_block_sz;
-    epb->original_length = aggregate_block_sz;
+    epb->original_length = std::max(aggregate_block_sz, in_original_len);
 
     // Write the header to the ringbuf
     write_sz = handler->commit_write_buffer_data(retbuf, buf_sz);
@@ -513,7 +536,8 @@ int pcap_stream_ringbuf::pcapng_write_packet(kis_packet *in_packet, kis_datachun
     std::vector<data_block> blocks;
     blocks.push_back(data_block(in_data->data, in_data->length));
 
-    return pcapng_write_packet(ng_interface_id, &(in_packet->ts), blocks);
+    return pcapng_write_packet(ng_interface_id, &(in_packet->ts), blocks, 
+            in_data->frame_length());
 }
 
 // Handle a packet from the chain; given the accept_cb and selector_cb we
@@ -65,6 +65,11 @@ public:
 
     virtual void stop_stream(std::string in_reason);
 
+    // Switch to writing a new buffer, such as the next file of a rotating log; the new
+    // buffer starts with its own section and interface headers.  Packets are never split
+    // between buffers.
+    virtual void replace_handler(std::shared_ptr<buffer_handler_generic> in_handler);
+
     struct data_block {
         data_block(uint8_t *in_d, size_t in_l) {
             data = in_d;
@@ -93,9 +98,10 @@ protected:
     virtual int pcapng_write_packet(kis_packet *in_packet, kis_datachunk *in_data);
 
     // Low-level packet logging; accepts a vector of blocks to minimize the copying
-    // needed to append custom headers
+    // needed to append custom headers.  The original length is recorded when the 
+    // packet was truncated by the capture source, otherwise it's the length of the blocks
     virtual int pcapng_write_packet(unsigned int in_sourcenumber, struct timeval *in_tv,
-            std::vector<data_block> in_blocks);
+            std::vector<data_block> in_blocks, size_t in_original_len = 0);
 
     virtual void handle_packet(kis_packet *in_packet);
 
@@ -1041,7 +1041,8 @@ int kis_80211_phy::packet_dot11_dissector(kis_packet *in_pack) {
             }
         }
 
-        int datasize = chunk->length - packinfo->header_offset;
+        // Count the whole frame even if the capture source only sent the headers
+        int datasize = chunk->frame_length() - packinfo->header_offset;
         if (datasize > 0) {
             packinfo->datasize = datasize;
             common->datasize = datasize;
@@ -2318,6 +2319,10 @@ kis_datachunk *kis_80211_phy::DecryptWEP(dot11_packinfo *in_packinfo,
     if (in_chunk->dlt != KDLT_IEEE802_11)
         return NULL;
 
+    // Can't decrypt a frame the capture source truncated
+    if (in_chunk->truncated())
+        return NULL;
+
     // printf("debug - decryptwep size len %u offt %u\n", in_chunk->length, in_packinfo->header_offset);
     // Bail on size check
     if (in_chunk->length < in_packinfo->header_offset ||
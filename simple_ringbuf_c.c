@@ -26,6 +26,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+
+#ifdef SYS_LINUX
+#include <sys/eventfd.h>
+#endif
 
 #ifdef USE_MMAP_RBUF
 #include <sys/mman.h>
@@ -115,12 +122,194 @@ kis_simple_ringbuf_t *kis_simple_ringbuf_create(size_t size) {
     rb->free_peek = 0;
     rb->free_commit = 0;
 
+    rb->spsc = 0;
+    rb->spsc_head = 0;
+    rb->spsc_tail = 0;
+    rb->spsc_writer_waiting = 0;
+    rb->data_fd[0] = rb->data_fd[1] = -1;
+    rb->space_fd[0] = rb->space_fd[1] = -1;
+
     return rb;
 }
 
+/* Wakeup descriptors for spsc buffers; an eventfd is both ends of the pair */
+static int rb_wake_open(int fds[2]) {
+#ifdef SYS_LINUX
+    fds[0] = fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (fds[0] < 0)
+        return -1;
+#else
+    if (pipe(fds) < 0)
+        return -1;
+
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL, 0) | O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL, 0) | O_NONBLOCK);
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+#endif
+
+    return 1;
+}
+
+static void rb_wake_close(int fds[2]) {
+    if (fds[0] >= 0)
+        close(fds[0]);
+
+    if (fds[1] >= 0 && fds[1] != fds[0])
+        close(fds[1]);
+
+    fds[0] = fds[1] = -1;
+}
+
+static void rb_wake_signal(int fds[2]) {
+    uint64_t one = 1;
+    ssize_t r;
+
+    /* A full pipe or eventfd is already signalled */
+#ifdef SYS_LINUX
+    r = write(fds[1], &one, sizeof(uint64_t));
+#else
+    r = write(fds[1], &one, 1);
+#endif
+
+    (void) r;
+}
+
+static void rb_wake_clear(int fds[2]) {
+    uint8_t buf[64];
+
+    while (read(fds[0], buf, sizeof(buf)) > 0)
+        ;
+}
+
+kis_simple_ringbuf_t *kis_simple_ringbuf_create_spsc(size_t size) {
+    kis_simple_ringbuf_t *rb = kis_simple_ringbuf_create(size);
+
+    if (rb == NULL)
+        return NULL;
+
+    rb->spsc = 1;
+
+    if (rb_wake_open(rb->data_fd) < 0 || rb_wake_open(rb->space_fd) < 0) {
+        kis_simple_ringbuf_free(rb);
+        return NULL;
+    }
+
+    return rb;
+}
+
+int kis_simple_ringbuf_data_fd(kis_simple_ringbuf_t *ringbuf) {
+    return ringbuf->data_fd[0];
+}
+
+void kis_simple_ringbuf_data_clear(kis_simple_ringbuf_t *ringbuf) {
+    rb_wake_clear(ringbuf->data_fd);
+}
+
+int kis_simple_ringbuf_wait_space(kis_simple_ringbuf_t *ringbuf, size_t size, int timeout_ms) {
+    struct pollfd pfd;
+
+    /* Announce that we're waiting before checking for space, so the consumer either
+     * sees the flag after it reads, or we see the space it freed */
+    __atomic_store_n(&ringbuf->spsc_writer_waiting, 1, __ATOMIC_SEQ_CST);
+
+    if (kis_simple_ringbuf_available(ringbuf) >= size) {
+        __atomic_store_n(&ringbuf->spsc_writer_waiting, 0, __ATOMIC_SEQ_CST);
+        return 1;
+    }
+
+    pfd.fd = ringbuf->space_fd[0];
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    if (poll(&pfd, 1, timeout_ms) > 0)
+        rb_wake_clear(ringbuf->space_fd);
+
+    __atomic_store_n(&ringbuf->spsc_writer_waiting, 0, __ATOMIC_SEQ_CST);
+
+    return kis_simple_ringbuf_available(ringbuf) >= size;
+}
+
+/* Copy in or out of a spsc buffer at an absolute position, wrapping as needed */
+static void rb_spsc_copy_in(kis_simple_ringbuf_t *ringbuf, size_t pos, 
+        const void *data, size_t length) {
+    size_t start = pos % ringbuf->buffer_sz;
+    size_t chunk_a = ringbuf->buffer_sz - start;
+
+    if (chunk_a >= length) {
+        memcpy(ringbuf->buffer + start, data, length);
+    } else {
+        memcpy(ringbuf->buffer + start, data, chunk_a);
+        memcpy(ringbuf->buffer, (const uint8_t *) data + chunk_a, length - chunk_a);
+    }
+}
+
+static void rb_spsc_copy_out(kis_simple_ringbuf_t *ringbuf, size_t pos, 
+        void *ptr, size_t length) {
+    size_t start = pos % ringbuf->buffer_sz;
+    size_t chunk_a = ringbuf->buffer_sz - start;
+
+    if (chunk_a >= length) {
+        memcpy(ptr, ringbuf->buffer + start, length);
+    } else {
+        memcpy(ptr, ringbuf->buffer + start, chunk_a);
+        memcpy((uint8_t *) ptr + chunk_a, ringbuf->buffer, length - chunk_a);
+    }
+}
+
+static size_t rb_spsc_write(kis_simple_ringbuf_t *ringbuf, void *data, size_t length) {
+    /* Only we move the head; the acquire on the tail keeps us from overwriting data
+     * the consumer hasn't finished copying out */
+    size_t head = ringbuf->spsc_head;
+    size_t tail = __atomic_load_n(&ringbuf->spsc_tail, __ATOMIC_ACQUIRE);
+
+    if (ringbuf->buffer_sz - (head - tail) < length)
+        return 0;
+
+    rb_spsc_copy_in(ringbuf, head, data, length);
+
+    __atomic_store_n(&ringbuf->spsc_head, head + length, __ATOMIC_SEQ_CST);
+
+    /* Wake the consumer if the buffer was empty; if it wasn't, the consumer hasn't
+     * finished with the older data and will see ours when it checks again */
+    if (head == __atomic_load_n(&ringbuf->spsc_tail, __ATOMIC_SEQ_CST))
+        rb_wake_signal(ringbuf->data_fd);
+
+    return length;
+}
+
+static size_t rb_spsc_read(kis_simple_ringbuf_t *ringbuf, void *ptr, size_t size, 
+        int consume) {
+    size_t tail = ringbuf->spsc_tail;
+    size_t head = __atomic_load_n(&ringbuf->spsc_head, __ATOMIC_ACQUIRE);
+    size_t opsize = head - tail;
+
+    if (opsize > size)
+        opsize = size;
+
+    if (opsize == 0)
+        return 0;
+
+    if (ptr != NULL)
+        rb_spsc_copy_out(ringbuf, tail, ptr, opsize);
+
+    if (consume) {
+        __atomic_store_n(&ringbuf->spsc_tail, tail + opsize, __ATOMIC_SEQ_CST);
+
+        if (__atomic_load_n(&ringbuf->spsc_writer_waiting, __ATOMIC_SEQ_CST))
+            rb_wake_signal(ringbuf->space_fd);
+    }
+
+    return opsize;
+}
+
 /* Destroy a ring buffer
  */
 void kis_simple_ringbuf_free(kis_simple_ringbuf_t *ringbuf) {
+    rb_wake_close(ringbuf->data_fd);
+    rb_wake_close(ringbuf->space_fd);
+
 #ifdef USE_MMAP_RBUF
     munmap(ringbuf->mmap_region1, ringbuf->buffer_sz);
     munmap(ringbuf->mmap_region0, ringbuf->buffer_sz);
@@ -137,17 +326,29 @@ void kis_simple_ringbuf_free(kis_simple_ringbuf_t *ringbuf) {
 void kis_simple_ringbuf_clear(kis_simple_ringbuf_t *ringbuf) {
     ringbuf->start_pos = 0;
     ringbuf->length = 0;
+
+    if (ringbuf->spsc) {
+        __atomic_store_n(&ringbuf->spsc_tail, 
+                __atomic_load_n(&ringbuf->spsc_head, __ATOMIC_ACQUIRE), __ATOMIC_SEQ_CST);
+        rb_wake_clear(ringbuf->data_fd);
+    }
 }
 
 /* Get available space
  */
 size_t kis_simple_ringbuf_available(kis_simple_ringbuf_t *ringbuf) {
-    return ringbuf->buffer_sz - ringbuf->length;
+    return ringbuf->buffer_sz - kis_simple_ringbuf_used(ringbuf);
 }
 
 /* Get used space
  */
 size_t kis_simple_ringbuf_used(kis_simple_ringbuf_t *ringbuf) {
+    if (ringbuf->spsc) {
+        /* Read the tail first; the head can only move further ahead of it */
+        size_t tail = __atomic_load_n(&ringbuf->spsc_tail, __ATOMIC_SEQ_CST);
+        return __atomic_load_n(&ringbuf->spsc_head, __ATOMIC_SEQ_CST) - tail;
+    }
+
     return ringbuf->length;
 }
 
@@ -165,6 +366,9 @@ size_t kis_simple_ringbuf_write(kis_simple_ringbuf_t *ringbuf,
         void *data, size_t length) {
     size_t copy_start;
 
+    if (ringbuf->spsc)
+        return rb_spsc_write(ringbuf, data, length);
+
     if (kis_simple_ringbuf_available(ringbuf) < length)
         return 0;
 
@@ -312,6 +516,9 @@ void kis_simple_ringbuf_reserve_free(kis_simple_ringbuf_t *ringbuf, void *data)
  */
 size_t kis_simple_ringbuf_read(kis_simple_ringbuf_t *ringbuf, void *ptr, 
         size_t size) {
+    if (ringbuf->spsc)
+        return rb_spsc_read(ringbuf, ptr, size, 1);
+
     /* Start with how much we have available - no matter what was
      * requested, we can't read more than this */
     size_t opsize = kis_simple_ringbuf_used(ringbuf);
@@ -371,6 +578,9 @@ size_t kis_simple_ringbuf_read(kis_simple_ringbuf_t *ringbuf, void *ptr,
  */
 size_t kis_simple_ringbuf_peek(kis_simple_ringbuf_t *ringbuf, void *ptr, 
         size_t size) {
+    if (ringbuf->spsc)
+        return rb_spsc_read(ringbuf, ptr, size, 0);
+
     /* Start with how much we have available - no matter what was
      * requested, we can't read more than this */
     size_t opsize = kis_simple_ringbuf_used(ringbuf);
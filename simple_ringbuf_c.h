@@ -42,6 +42,14 @@ struct kis_simple_ringbuf {
     int mid_peek, mid_commit; /* Are we in a peek or reserve? */
     int free_peek, free_commit; /* Do we need to free the peek or reserved buffers */
 
+    /* Single-producer single-consumer mode; see kis_simple_ringbuf_create_spsc */
+    int spsc;
+    size_t spsc_head; /* Total written, only advanced by the producer */
+    size_t spsc_tail; /* Total read, only advanced by the consumer */
+    int spsc_writer_waiting; /* Producer is waiting for space */
+    int data_fd[2]; /* Readable when data is written to an empty buffer */
+    int space_fd[2]; /* Readable when data is read while the producer waits */
+
 #ifdef USE_MMAP_RBUF
     void *mmap_region0;
     void *mmap_region1;
@@ -57,11 +65,44 @@ typedef struct kis_simple_ringbuf kis_simple_ringbuf_t;
  */
 kis_simple_ringbuf_t *kis_simple_ringbuf_create(size_t size);
 
+/* Allocate a lock-free single-producer single-consumer ring buffer
+ *
+ * One thread may write to the buffer while another reads from it, without any
+ * locking.  kis_simple_ringbuf_write, _available, _used, and _size may be called by
+ * the producer, and _read, _peek, _used, and _size by the consumer; reserve/commit
+ * and zero-copy peeks are not supported.  If there is more than one producer, the
+ * producers must be serialized with a lock of their own.
+ *
+ * The consumer can wait for data by selecting on kis_simple_ringbuf_data_fd, which
+ * becomes readable when data is written to an empty buffer, and the producer can 
+ * wait for space with kis_simple_ringbuf_wait_space.  These use an eventfd on Linux
+ * and a pipe elsewhere.
+ *
+ * Returns NULL if allocation failed
+ */
+kis_simple_ringbuf_t *kis_simple_ringbuf_create_spsc(size_t size);
+
+/* Descriptor the consumer of a spsc buffer can select on to be woken when data
+ * arrives in an empty buffer
+ */
+int kis_simple_ringbuf_data_fd(kis_simple_ringbuf_t *ringbuf);
+
+/* Clear the data descriptor; the consumer must do this before checking for data
+ */
+void kis_simple_ringbuf_data_clear(kis_simple_ringbuf_t *ringbuf);
+
+/* Wait, as the producer of a spsc buffer, until at least size bytes are free or 
+ * timeout_ms passes.
+ *
+ * Returns 1 if there is enough space, 0 if the wait timed out
+ */
+int kis_simple_ringbuf_wait_space(kis_simple_ringbuf_t *ringbuf, size_t size, int timeout_ms);
+
 /* Destroy a ring buffer
  */
 void kis_simple_ringbuf_free(kis_simple_ringbuf_t *ringbuf);
 
-/* Clear ring buffer
+/* Clear ring buffer; a spsc buffer may only be cleared while the producer is idle
  */
 void kis_simple_ringbuf_clear(kis_simple_ringbuf_t *ringbuf);
 
@@ -22,7 +22,10 @@
 #include "timetracker.h"
 
 udp_dgram_server::udp_dgram_server() :
-    packet {nullptr},
+    max_packet {0},
+    batch_sz {1},
+    socket_drops {0},
+    last_ovfl {0},
     server_fd {-1},
     timeout_id {-1} {
 
@@ -48,17 +51,53 @@ void udp_dgram_server::set_timeout_connection_cb(std::function<void (uint32_t, s
     timeout_cb = in_cb;
 }
 
+void udp_dgram_server::set_datagram_cb(std::function<void (uint32_t, const struct sockaddr_in *, const char *, size_t)> in_cb) {
+    local_locker l(&udp_mutex, "udp_dgram_server::set_datagram_cb");
+    datagram_cb = in_cb;
+}
+
+void udp_dgram_server::set_batch_cb(std::function<void (uint64_t)> in_cb) {
+    local_locker l(&udp_mutex, "udp_dgram_server::set_batch_cb");
+    batch_cb = in_cb;
+}
+
 int udp_dgram_server::configure_server(short int in_port, const std::string& in_bindaddress,
         const std::vector<std::string>& in_filtervec, std::chrono::seconds in_timeout,
-        size_t in_max_packet, size_t in_wbuf_sz) {
+        size_t in_max_packet, size_t in_wbuf_sz, size_t in_rcvbuf_sz, unsigned int in_batch) {
     local_locker l(&udp_mutex, "udp_dgram_server::configure_server");
 
     max_packet = in_max_packet;
 
-    if (packet != nullptr)
-        delete[] packet;
+    batch_sz = in_batch;
+    if (batch_sz < 1)
+        batch_sz = 1;
+
+    slot_data.resize(max_packet * batch_sz);
+    slot_addr.resize(batch_sz);
+    slot_addr_len.resize(batch_sz);
+    slot_len.resize(batch_sz);
+
+#ifdef MSG_WAITFORONE
+    slot_control_sz = CMSG_SPACE(sizeof(uint32_t));
+
+    slot_msg.resize(batch_sz);
+    slot_iov.resize(batch_sz);
+    slot_control.resize(slot_control_sz * batch_sz);
+
+    for (unsigned int i = 0; i < batch_sz; i++) {
+        slot_iov[i].iov_base = &slot_data[i * max_packet];
+        slot_iov[i].iov_len = max_packet;
+
+        memset(&slot_msg[i], 0, sizeof(struct mmsghdr));
+        slot_msg[i].msg_hdr.msg_name = &slot_addr[i];
+        slot_msg[i].msg_hdr.msg_iov = &slot_iov[i];
+        slot_msg[i].msg_hdr.msg_iovlen = 1;
+        slot_msg[i].msg_hdr.msg_control = &slot_control[i * slot_control_sz];
+    }
+#endif
 
-    packet = new char[max_packet];
+    socket_drops = 0;
+    last_ovfl = 0;
 
     port = in_port;
     timeout = in_timeout;
@@ -106,19 +145,44 @@ int udp_dgram_server::configure_server(short int in_port, const std::string& in_
     fcntl(server_fd, F_SETFL, fcntl(server_fd, F_GETFL, 0) | O_CLOEXEC);
 #endif
 
+    // A larger socket buffer absorbs bursts between polls; the system may cap it, so
+    // report what we actually got
+    if (in_rcvbuf_sz > 0) {
+        int rcvbuf = in_rcvbuf_sz;
+        socklen_t rcvbuf_len = sizeof(rcvbuf);
+
+        if (setsockopt(server_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) < 0) {
+            _MSG_ERROR("Unable to set the receive buffer of the UDP server for port {} to {} "
+                    "bytes: {}", in_port, in_rcvbuf_sz, kis_strerror_r(errno));
+        } else if (getsockopt(server_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &rcvbuf_len) == 0 &&
+                (size_t) rcvbuf < in_rcvbuf_sz) {
+            _MSG_INFO("The receive buffer of the UDP server for port {} was limited to {} "
+                    "bytes by the system (net.core.rmem_max on Linux)", in_port, rcvbuf);
+        }
+    }
+
+#ifdef SO_RXQ_OVFL
+    int ovfl = 1;
+    if (setsockopt(server_fd, SOL_SOCKET, SO_RXQ_OVFL, &ovfl, sizeof(ovfl)) < 0) {
+        _MSG_DEBUG("Unable to enable dropped packet counts on the UDP server for port {}: {}",
+                in_port, kis_strerror_r(errno));
+    }
+#endif
+
     memset(&servaddr, 0, sizeof(servaddr)); 
     servaddr.sin_family = AF_INET;
     servaddr.sin_port = htons(in_port);
 
+    if (inet_pton(AF_INET, in_bindaddress.c_str(), &(servaddr.sin_addr.s_addr)) == 0) 
+        servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
+
     if (::bind(server_fd, (struct sockaddr *) &servaddr, sizeof(servaddr)) < 0) {
         _MSG_ERROR("Unable to configure UDP server for port {}, unable to bind socket: {}",
                 in_port, kis_strerror_r(errno));
         close(server_fd);
+        server_fd = -1;
         return -1;
     }
-    
-    if (inet_pton(AF_INET, in_bindaddress.c_str(), &(servaddr.sin_addr.s_addr)) == 0) 
-        servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
 
     fcntl(server_fd, F_SETFL, fcntl(server_fd, F_GETFL, 0) | O_NONBLOCK);
 
@@ -167,108 +231,189 @@ int udp_dgram_server::pollable_merge_set(int in_max_fd, fd_set *out_rset, fd_set
     return maxfd;
 }
 
+int udp_dgram_server::receive_batch() {
+#ifdef MSG_WAITFORONE
+    for (unsigned int i = 0; i < batch_sz; i++) {
+        slot_msg[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        slot_msg[i].msg_hdr.msg_controllen = slot_control_sz;
+        slot_msg[i].msg_hdr.msg_flags = 0;
+    }
+
+    int r = recvmmsg(server_fd, slot_msg.data(), batch_sz, MSG_DONTWAIT, nullptr);
+
+    if (r < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            return -1;
+
+        return 0;
+    }
+
+    for (int i = 0; i < r; i++) {
+        slot_addr_len[i] = slot_msg[i].msg_hdr.msg_namelen;
+        slot_len[i] = slot_msg[i].msg_len;
+
+#ifdef SO_RXQ_OVFL
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&slot_msg[i].msg_hdr); cmsg != nullptr;
+                cmsg = CMSG_NXTHDR(&slot_msg[i].msg_hdr, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+                uint32_t ovfl;
+                memcpy(&ovfl, CMSG_DATA(cmsg), sizeof(uint32_t));
+
+                // The count wraps
+                socket_drops += (uint32_t) (ovfl - last_ovfl);
+                last_ovfl = ovfl;
+            }
+        }
+#endif
+    }
+
+    return r;
+#else
+    unsigned int n;
+
+    for (n = 0; n < batch_sz; n++) {
+        slot_addr_len[n] = sizeof(struct sockaddr_in);
+
+        slot_len[n] = recvfrom(server_fd, &slot_data[n * max_packet], max_packet, MSG_DONTWAIT,
+                (struct sockaddr *) &slot_addr[n], &slot_addr_len[n]);
+
+        if (slot_len[n] < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return -1;
+
+            break;
+        }
+    }
+
+    return n;
+#endif
+}
+
 int udp_dgram_server::pollable_poll(fd_set& in_rset, fd_set& in_wset) {
     local_locker l(&udp_mutex, "udp_dgram_server::pollable_poll");
 
     if (server_fd < 0)
         return -1;
 
-    struct sockaddr_in cliaddr;
-    socklen_t addr_len;
-    ssize_t r_len;
-
     if (FD_ISSET(server_fd, &in_rset)) {
         while (1) {
-            memset(&cliaddr, 0, sizeof(cliaddr));
+            auto drops = socket_drops;
 
-            addr_len = sizeof(cliaddr);
+            auto r = receive_batch();
 
-            r_len = recvfrom(server_fd, packet, max_packet,  MSG_DONTWAIT, 
-                    (struct sockaddr *) &cliaddr, &addr_len); 
-
-            if (r_len < 0) {
-                if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                    for (auto c : client_map)
+            if (r < 0) {
+                for (auto c : client_map) {
+                    if (c.second->bufferpair != nullptr)
                         c.second->bufferpair->error("UDP server socket error {} (errno {})",
                                 kis_strerror_r(errno), errno);
-                    shutdown();
-                    return -1;
                 }
+                shutdown();
+                return -1;
+            }
+
+            for (int i = 0; i < r; i++) 
+                handle_datagram(slot_addr[i], slot_addr_len[i], &slot_data[i * max_packet],
+                        slot_len[i]);
+
+            if ((r > 0 || socket_drops != drops) && batch_cb != nullptr)
+                batch_cb(socket_drops);
 
+            // A short batch means we've drained the socket
+            if (r < (int) batch_sz)
                 break;
-            }
 
-            // We could have a zero-length dgram, i guess?  We don't do anything with it
-            // if we get it tho.
-            if (r_len > 0) {
-                auto cli_csum = adler32_checksum(&cliaddr, addr_len);
-                std::shared_ptr<client> client_rec;
-
-                auto client_key = client_map.find(cli_csum);
-                if (client_key == client_map.end()) {
-                    bool pass = true;
-
-                    if (ipfilter_vec.size() > 0) {
-                        pass = false;
-
-                        for (auto ipi : ipfilter_vec) {
-                            if ((cliaddr.sin_addr.s_addr & ipi.mask.s_addr) ==
-                                    (ipi.network.s_addr & ipi.mask.s_addr)) {
-                                pass = true;
-                                break;
-                            }
-                        }
-                    }
+            // The callbacks may have shut us down
+            if (server_fd < 0)
+                return -1;
+        }
+    }
 
-                    // Typically we silently drop packets which don't pass the IP filter
-                    // or we'd get absolutely flooded with bogus messages
+    return 0;
+}
 
-                    if (pass && connection_cb != nullptr) {
-                        auto cli_bufferpair = 
-                            connection_cb((const struct sockaddr_storage *) &cliaddr, 
-                                    addr_len, cli_csum);
+void udp_dgram_server::handle_datagram(const struct sockaddr_in& cliaddr, socklen_t addr_len,
+        const char *data, ssize_t r_len) {
+    // We could have a zero-length dgram, i guess?  We don't do anything with it
+    // if we get it tho.
+    if (r_len <= 0)
+        return;
 
-                        if (cli_bufferpair != nullptr) {
-                            client_rec = std::make_shared<client>();
-                            client_rec->bufferpair = cli_bufferpair;
-                            client_rec->addr.sin_addr.s_addr = cliaddr.sin_addr.s_addr;
+    auto cli_csum = adler32_checksum(&cliaddr, addr_len);
+    std::shared_ptr<client> client_rec;
 
-                            client_map[cli_csum] = client_rec;
-                        }
-                    }
-                } else {
-                    client_rec = client_key->second;
-                }
+    auto client_key = client_map.find(cli_csum);
+    if (client_key == client_map.end()) {
+        bool pass = true;
 
-                if (client_rec != nullptr) {
-                    client_rec->last_time = time(0);
-
-                    try {
-                        // Write the dgram length as a raw ssize_t, then the datagram itself.
-                        auto r = client_rec->bufferpair->write_rbuf(&r_len, sizeof(ssize_t));
-                        if (r != sizeof(ssize_t))
-                            throw std::runtime_error(fmt::format("UDP server unable to write packet "
-                                        "length header to UDP source buffer {}", 
-                                        inet_ntoa(client_rec->addr.sin_addr)));
-
-                        r = client_rec->bufferpair->write_rbuf(packet, r_len);
-                        if (r != r_len)
-                            throw std::runtime_error(fmt::format("UDP server unable to write packet "
-                                        "data to UDP source buffer {}",
-                                        inet_ntoa(client_rec->addr.sin_addr)));
-                    } catch (const std::exception& e) {
-                        // Any error constitutes a removal of that record, it will be recreated
-                        // next packet but the buffer needs to be purged since it's now in an
-                        // unknown state.
-                        client_map.erase(client_map.find(cli_csum));
-                        client_rec->bufferpair->throw_error(std::current_exception());
-                    }
+        if (ipfilter_vec.size() > 0) {
+            pass = false;
+
+            for (auto ipi : ipfilter_vec) {
+                if ((cliaddr.sin_addr.s_addr & ipi.mask.s_addr) ==
+                        (ipi.network.s_addr & ipi.mask.s_addr)) {
+                    pass = true;
+                    break;
                 }
             }
         }
+
+        // Typically we silently drop packets which don't pass the IP filter
+        // or we'd get absolutely flooded with bogus messages
+
+        if (pass && connection_cb != nullptr) {
+            auto cli_bufferpair = 
+                connection_cb((const struct sockaddr_storage *) &cliaddr, 
+                        addr_len, cli_csum);
+
+            if (cli_bufferpair != nullptr) {
+                client_rec = std::make_shared<client>();
+                client_rec->bufferpair = cli_bufferpair;
+                client_rec->addr.sin_addr.s_addr = cliaddr.sin_addr.s_addr;
+
+                client_map[cli_csum] = client_rec;
+            }
+        } else if (pass && datagram_cb != nullptr) {
+            client_rec = std::make_shared<client>();
+            client_rec->addr.sin_addr.s_addr = cliaddr.sin_addr.s_addr;
+
+            client_map[cli_csum] = client_rec;
+        }
+    } else {
+        client_rec = client_key->second;
     }
 
-    return 0;
+    if (client_rec == nullptr)
+        return;
+
+    client_rec->last_time = time(0);
+
+    if (client_rec->bufferpair == nullptr) {
+        if (datagram_cb != nullptr)
+            datagram_cb(cli_csum, &cliaddr, data, r_len);
+
+        return;
+    }
+
+    try {
+        // Write the dgram length as a raw ssize_t, then the datagram itself.
+        auto r = client_rec->bufferpair->write_rbuf(&r_len, sizeof(ssize_t));
+        if (r != sizeof(ssize_t))
+            throw std::runtime_error(fmt::format("UDP server unable to write packet "
+                        "length header to UDP source buffer {}", 
+                        inet_ntoa(client_rec->addr.sin_addr)));
+
+        r = client_rec->bufferpair->write_rbuf(data, r_len);
+        if (r != r_len)
+            throw std::runtime_error(fmt::format("UDP server unable to write packet "
+                        "data to UDP source buffer {}",
+                        inet_ntoa(client_rec->addr.sin_addr)));
+    } catch (const std::exception& e) {
+        // Any error constitutes a removal of that record, it will be recreated
+        // next packet but the buffer needs to be purged since it's now in an
+        // unknown state.
+        client_map.erase(client_map.find(cli_csum));
+        client_rec->bufferpair->throw_error(std::current_exception());
+    }
 }
 
 void udp_dgram_server::shutdown() {
@@ -277,7 +422,11 @@ void udp_dgram_server::shutdown() {
     if (server_fd >= 0)
         close(server_fd);
 
-    for (auto c : client_map)
-        c.second->bufferpair->close("UDP server shutting down");
+    server_fd = -1;
+
+    for (auto c : client_map) {
+        if (c.second->bufferpair != nullptr)
+            c.second->bufferpair->close("UDP server shutting down");
+    }
 }
 
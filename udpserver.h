@@ -32,6 +32,7 @@
 #include <unistd.h>
 
 #include <chrono>
+#include <vector>
 
 #include "buffer_handler.h"
 #include "buffer_pair.h"
@@ -55,7 +56,13 @@
 // new data is seen.
 //
 // Each packet is written to the UDP read buffer with the length of the packet as a ssize_t
-// prefix.
+// prefix.  Alternately, with a datagram callback, accepted datagrams are handed directly
+// to the callback from the receive buffer, without a per-client buffer.
+//
+// Datagrams are received in batches of up to [batch] with recvmmsg where it's available,
+// into a fixed set of receive slots which are re-used for every batch.  Datagrams the
+// kernel dropped because the socket buffer was full are counted where the system
+// reports them (SO_RXQ_OVFL on Linux).
 //
 // A UDP streaming listener may be required for future implementations of other protocols.
 //
@@ -71,12 +78,28 @@ public:
     udp_dgram_server();
     virtual ~udp_dgram_server();
 
+    // A receive buffer size of 0 leaves the system default
     virtual int configure_server(short int in_port, const std::string& in_bindaddress, 
             const std::vector<std::string>& in_filtervec, std::chrono::seconds in_timeout,
-            size_t in_max_packet, size_t in_wbuf_sz);
+            size_t in_max_packet, size_t in_wbuf_sz, size_t in_rcvbuf_sz = 0,
+            unsigned int in_batch = 1);
 
     void set_new_connection_cb(std::function<std::shared_ptr<buffer_pair> (const struct sockaddr_storage *, size_t, uint32_t)>);
     void set_timeout_connection_cb(std::function<void (uint32_t, std::shared_ptr<buffer_pair>)> cb);
+
+    // Datagrams from accepted clients which have no buffer, by client key; the data is
+    // only valid for the duration of the callback
+    void set_datagram_cb(std::function<void (uint32_t, const struct sockaddr_in *, const char *, size_t)> cb);
+
+    // Called after each batch of datagrams, with the total dropped by the kernel since the
+    // server was configured; datagram callbacks can queue their work until the batch is
+    // complete
+    void set_batch_cb(std::function<void (uint64_t)> cb);
+
+    uint64_t get_socket_drops() {
+        local_locker l(&udp_mutex, "udp_dgram_server::get_socket_drops");
+        return socket_drops;
+    }
     
     virtual void shutdown();
 
@@ -90,7 +113,31 @@ protected:
     std::chrono::seconds timeout;
 
     size_t max_packet;
-    char *packet;
+
+    // Receive slots, max_packet bytes each, re-used for every batch
+    unsigned int batch_sz;
+    std::vector<char> slot_data;
+    std::vector<struct sockaddr_in> slot_addr;
+    std::vector<socklen_t> slot_addr_len;
+    std::vector<ssize_t> slot_len;
+#ifdef MSG_WAITFORONE
+    std::vector<struct mmsghdr> slot_msg;
+    std::vector<struct iovec> slot_iov;
+    std::vector<char> slot_control;
+    size_t slot_control_sz;
+#endif
+
+    // Datagrams dropped by the kernel; the system reports a running count which we
+    // track the changes in
+    uint64_t socket_drops;
+    uint32_t last_ovfl;
+
+    // Receive a batch into the slots; returns the number of datagrams, 0 if there
+    // was nothing to read, or -1 on error
+    int receive_batch();
+
+    void handle_datagram(const struct sockaddr_in& cliaddr, socklen_t addr_len,
+            const char *data, ssize_t len);
 
     struct client {
         struct sockaddr_in addr;
@@ -106,6 +153,8 @@ protected:
 
     std::function<std::shared_ptr<buffer_pair> (const struct sockaddr_storage *, size_t, uint32_t)> connection_cb;
     std::function<void (uint32_t, std::shared_ptr<buffer_pair>)> timeout_cb;
+    std::function<void (uint32_t, const struct sockaddr_in *, const char *, size_t)> datagram_cb;
+    std::function<void (uint64_t)> batch_cb;
 
     std::shared_ptr<time_tracker> timetracker;
     int timeout_id;